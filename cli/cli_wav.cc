@@ -0,0 +1,351 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <iostream>
+
+#include "cli_wav.h"
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+// The size of the header written by wav_create (RIFF, fmt, fact, and data chunk headers).
+#define WAV_HEADER_BYTES 58
+
+// WAV files are little endian.
+static void put_u16(unsigned char *p, uint32_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t get_u16(const unsigned char *p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Writes the header for w->frames frames at the start of the file.
+static int wav_write_header(cli_wav_t *w)
+{
+  unsigned char h[WAV_HEADER_BYTES];
+  uint32_t block_align = (uint32_t) (w->channels * 4);
+  uint32_t data_bytes = (uint32_t) (w->frames * block_align);
+
+  memcpy(&h[0], "RIFF", 4);
+  put_u32(&h[4], WAV_HEADER_BYTES - 8 + data_bytes);
+  memcpy(&h[8], "WAVE", 4);
+
+  memcpy(&h[12], "fmt ", 4);
+  put_u32(&h[16], 18);
+  put_u16(&h[20], WAV_FORMAT_FLOAT);
+  put_u16(&h[22], (uint32_t) w->channels);
+  put_u32(&h[24], (uint32_t) w->fs);
+  put_u32(&h[28], (uint32_t) w->fs * block_align);
+  put_u16(&h[32], block_align);
+  put_u16(&h[34], 32);
+  put_u16(&h[36], 0); // No extension.
+
+  // Non-PCM files should have a fact chunk with the number of frames.
+  memcpy(&h[38], "fact", 4);
+  put_u32(&h[42], 4);
+  put_u32(&h[46], (uint32_t) w->frames);
+
+  memcpy(&h[50], "data", 4);
+  put_u32(&h[54], data_bytes);
+
+  if (fseek(w->fp, 0, SEEK_SET) || fwrite(h, 1, WAV_HEADER_BYTES, w->fp) != WAV_HEADER_BYTES) {
+    return -1;
+  }
+
+  return fseek(w->fp, 0, SEEK_END);
+}
+
+/***
+ *
+ * wav_create
+ *
+ * Creates a 32-bit float WAV file with channels (interleaved) channels.
+ *
+ ***/
+
+cli_wav_t* wav_create(const char *path, size_t channels, double fs)
+{
+  cli_wav_t *w = new cli_wav_t;
+
+  w->writing = true;
+  w->channels = channels;
+  w->fs = fs;
+  w->format = WAV_FORMAT_FLOAT;
+  w->bits = 32;
+  w->frames = 0;
+  w->frames_read = 0;
+  w->data_pos = WAV_HEADER_BYTES;
+
+  if ((w->fp = fopen(path, "wb")) == nullptr) {
+    std::cerr << "Failed to create the file: '" << path << "'!" << std::endl;
+    delete w;
+    return nullptr;
+  }
+
+  if (wav_write_header(w)) {
+    std::cerr << "Failed to write the WAV header of: '" << path << "'!" << std::endl;
+    fclose(w->fp);
+    delete w;
+    return nullptr;
+  }
+
+  return w;
+}
+
+/***
+ *
+ * wav_write
+ *
+ * Appends frames interleaved frames. Returns -1 if the write fails or if
+ * the file would exceed the 4 GB limit of the WAV format.
+ *
+ ***/
+
+int wav_write(cli_wav_t *w, const float *buffer, size_t frames)
+{
+  uint64_t data_bytes = (uint64_t) (w->frames + frames) * w->channels * 4;
+
+  if (data_bytes > (uint64_t) UINT32_MAX - WAV_HEADER_BYTES) {
+    std::cerr << "WAV files are limited to 4 GB!" << std::endl;
+    return -1;
+  }
+
+  if (fwrite(buffer, w->channels * sizeof(float), frames, w->fp) != frames) {
+    std::cerr << "Failed to write to the WAV file!" << std::endl;
+    return -1;
+  }
+
+  w->frames += frames;
+
+  return 0;
+}
+
+/***
+ *
+ * wav_max_frames
+ *
+ * The largest number of frames a (32-bit float) file with channels
+ * channels can hold within the 4 GB limit of the WAV format.
+ *
+ ***/
+
+size_t wav_max_frames(size_t channels)
+{
+  return (size_t) (((uint64_t) UINT32_MAX - WAV_HEADER_BYTES) / (channels * 4));
+}
+
+/***
+ *
+ * wav_flush
+ *
+ * Updates the header with the frames written so far and flushes the file,
+ * so that the file is valid up to this point if the program is killed.
+ *
+ ***/
+
+int wav_flush(cli_wav_t *w)
+{
+  if (wav_write_header(w)) {
+    return -1;
+  }
+
+  return fflush(w->fp);
+}
+
+/***
+ *
+ * wav_open
+ *
+ * Opens a WAV file for reading.
+ *
+ ***/
+
+cli_wav_t* wav_open(const char *path)
+{
+  unsigned char h[40];
+
+  cli_wav_t *w = new cli_wav_t;
+
+  w->writing = false;
+  w->format = 0;
+  w->frames = 0;
+  w->frames_read = 0;
+  w->data_pos = 0;
+
+  if ((w->fp = fopen(path, "rb")) == nullptr) {
+    std::cerr << "Failed to open the file: '" << path << "'!" << std::endl;
+    delete w;
+    return nullptr;
+  }
+
+  if (fread(h, 1, 12, w->fp) != 12 || memcmp(&h[0], "RIFF", 4) || memcmp(&h[8], "WAVE", 4)) {
+    std::cerr << "'" << path << "' is not a WAV file!" << std::endl;
+    wav_close(w);
+    return nullptr;
+  }
+
+  // Walk the chunks until the data chunk (the fmt chunk comes before it).
+  while (fread(h, 1, 8, w->fp) == 8) {
+
+    uint32_t size = get_u32(&h[4]);
+
+    if (!memcmp(&h[0], "fmt ", 4)) {
+
+      if (size < 16 || fread(h, 1, size < 40 ? size : 40, w->fp) != (size < 40 ? size : 40)) {
+        break;
+      }
+
+      w->format = get_u16(&h[0]);
+      w->channels = get_u16(&h[2]);
+      w->fs = get_u32(&h[4]);
+      w->bits = get_u16(&h[14]);
+
+      // The sub-format GUID starts with the format code.
+      if (w->format == WAV_FORMAT_EXTENSIBLE && size >= 26) {
+        w->format = get_u16(&h[24]);
+      }
+
+      if (size > 40 && fseek(w->fp, size - 40, SEEK_CUR)) {
+        break;
+      }
+
+    } else if (!memcmp(&h[0], "data", 4)) {
+
+      w->data_pos = ftell(w->fp);
+      break;
+
+    } else if (fseek(w->fp, size + (size & 1), SEEK_CUR)) { // Chunks are word aligned.
+      break;
+    }
+  }
+
+  bool supported = (w->format == WAV_FORMAT_PCM && (w->bits == 16 || w->bits == 24 || w->bits == 32)) ||
+    (w->format == WAV_FORMAT_FLOAT && w->bits == 32);
+
+  if (w->data_pos == 0 || !supported || w->channels == 0) {
+    std::cerr << "'" << path << "' is not a 16, 24, or 32-bit PCM or a 32-bit float WAV file!" << std::endl;
+    wav_close(w);
+    return nullptr;
+  }
+
+  w->frames = get_u32(&h[4]) / (w->channels * w->bits / 8);
+
+  return w;
+}
+
+/***
+ *
+ * wav_read
+ *
+ * Reads up to max_frames frames, converted to float and interleaved, and
+ * returns the number of frames read (0 at the end of the file).
+ *
+ ***/
+
+size_t wav_read(cli_wav_t *w, float *buffer, size_t max_frames)
+{
+  size_t bytes = w->bits / 8;
+  size_t frames = w->frames - w->frames_read;
+
+  if (frames > max_frames) {
+    frames = max_frames;
+  }
+
+  size_t n = frames * w->channels;
+
+  // Read into the end of the buffer and convert in place from the start.
+  unsigned char *raw = (unsigned char*) buffer + n * (sizeof(float) - bytes);
+  frames = fread(raw, bytes * w->channels, frames, w->fp);
+  n = frames * w->channels;
+
+  if (w->format == WAV_FORMAT_PCM) {
+    for (size_t k=0; k<n; k++) {
+      const unsigned char *p = &raw[k*bytes];
+      int32_t x;
+      switch (bytes) {
+      case 2:
+        x = (int32_t) (get_u16(p) << 16);
+        break;
+      case 3:
+        x = (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24);
+        break;
+      default:
+        x = (int32_t) get_u32(p);
+      }
+      buffer[k] = (float) x * (1.0f / 2147483648.0f);
+    }
+  }
+
+  w->frames_read += frames;
+
+  return frames;
+}
+
+/***
+ *
+ * wav_close
+ *
+ * Closes the file, updating the header of files that are written.
+ *
+ ***/
+
+int wav_close(cli_wav_t *w)
+{
+  int err = 0;
+
+  if (!w) {
+    return 0;
+  }
+
+  if (w->writing) {
+    err = wav_write_header(w);
+  }
+
+  if (fclose(w->fp)) {
+    err = -1;
+  }
+
+  delete w;
+
+  return err;
+}
@@ -0,0 +1,54 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __CLI_WAV_H__
+#define __CLI_WAV_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+//
+// Minimal WAV file I/O for the command line tools. Files are written as 32-bit float and
+// 16, 24, or 32-bit PCM or 32-bit float files can be read. Samples are interleaved.
+//
+
+typedef struct {
+  FILE *fp;
+  bool writing;
+  size_t channels;
+  double fs;
+  int format;             // 1 = PCM, 3 = IEEE float.
+  size_t bits;            // Bits per sample.
+  size_t frames;          // Frames written, or frames in the file when reading.
+  size_t frames_read;
+  long data_pos;          // Offset of the data chunk payload.
+} cli_wav_t;
+
+cli_wav_t* wav_create(const char *path, size_t channels, double fs);
+int wav_write(cli_wav_t *w, const float *buffer, size_t frames);
+size_t wav_max_frames(size_t channels);
+int wav_flush(cli_wav_t *w);
+cli_wav_t* wav_open(const char *path);
+size_t wav_read(cli_wav_t *w, float *buffer, size_t max_frames);
+int wav_close(cli_wav_t *w);
+
+#endif
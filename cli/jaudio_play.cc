@@ -0,0 +1,209 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include "jaudio.h"
+#include "cli_wav.h"
+
+/********************************************************************************************
+ *
+ * jaudio-play
+ *
+ * Headless player: streams a WAV file from disk to JACK ports through the play queue, so
+ * that files of any length are played gaplessly with a bounded amount of memory.
+ *
+ *********************************************************************************************/
+
+static volatile bool play_stop = false;
+
+static void play_sighandler(int signum)
+{
+  play_stop = true;
+}
+
+static void usage(void)
+{
+  std::cout << "Usage: jaudio-play [options] file.wav [port ...]\n"
+            << "\n"
+            << "Plays a WAV file to the JACK input ports (default system:playback_1, system:playback_2, ...).\n"
+            << "Ports may be patterns: 'system:playback_*', 'system:playback_[1-8]' or '/regex/'.\n"
+            << "\n"
+            << "  -b N        Number of buffers in the play queue (default 4).\n"
+            << "  -c SECONDS  Length of each buffer (default 0.25).\n"
+            << "  -n NAME     The JACK client name (default jaudio-play).\n"
+            << "  -h          Show this help.\n";
+}
+
+int main(int argc, char *argv[])
+{
+  std::string client_name = "jaudio-play";
+  size_t num_buffers = 4;
+  double buffer_length = 0.25;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:c:n:h")) != -1) {
+    switch (opt) {
+    case 'b':
+      num_buffers = (size_t) atoi(optarg);
+      break;
+    case 'c':
+      buffer_length = atof(optarg);
+      break;
+    case 'n':
+      client_name = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind >= argc || num_buffers < 2 || buffer_length <= 0.0) {
+    usage();
+    return 1;
+  }
+
+  cli_wav_t *wav = wav_open(argv[optind]);
+  if (!wav) {
+    return 1;
+  }
+
+  size_t channels = wav->channels;
+
+  // One port per channel (port patterns are expanded).
+  std::vector<std::string> ports;
+  if (argc - optind - 1 == 0) {
+    for (size_t n=0; n<channels; n++) {
+      ports.push_back("system:playback_" + std::to_string(n+1));
+    }
+  } else {
+    for (int n=optind+1; n<argc; n++) {
+      ports.push_back(argv[n]);
+    }
+  }
+
+  std::vector<const char*> names;
+  for (const std::string &port : ports) {
+    names.push_back(port.c_str());
+  }
+
+  // One short-lived client expands the port patterns and reads the sample rate
+  // before the queue's client is opened.
+  jack_client_t *client = ports_open_client(client_name.c_str());
+  if (!client) {
+    wav_close(wav);
+    return 1;
+  }
+
+  jaudio_port_list_t port_list;
+  int resolve_err = port_list_resolve(&port_list, names.data(), names.size(), JackPortIsInput, client);
+  jack_nframes_t fs = jack_get_sample_rate(client);
+  jack_client_close(client);
+
+  if (resolve_err < 0) {
+    wav_close(wav);
+    return 1;
+  }
+
+  if (port_list.num != channels) {
+    std::cerr << "The number of ports must match the " << channels << " channels of the file!" << std::endl;
+    wav_close(wav);
+    return 1;
+  }
+
+  if (fs != (jack_nframes_t) wav->fs) {
+    std::cerr << "Warning: the file is sampled at " << wav->fs << " Hz but is played at the "
+              << fs << " Hz of the JACK server!" << std::endl;
+  }
+
+  size_t chunk_frames = (size_t) (buffer_length * wav->fs);
+  if (chunk_frames == 0) {
+    chunk_frames = 1;
+  }
+
+  std::vector<float> frames_buffer(chunk_frames * channels);
+  std::vector<float> play_buffer(chunk_frames * channels);
+
+  jaudio_queue_t *q = queue_open(channels, port_list.names.data(), client_name.c_str(), num_buffers);
+  if (!q) {
+    wav_close(wav);
+    return 1;
+  }
+
+  signal(SIGINT, play_sighandler);
+  signal(SIGTERM, play_sighandler);
+
+  int err = 0;
+  size_t frames;
+
+  while (!play_stop && (frames = wav_read(wav, frames_buffer.data(), chunk_frames)) > 0) {
+
+    // The queue takes frames x channels (column major) matrices.
+    for (size_t c=0; c<channels; c++) {
+      for (size_t k=0; k<frames; k++) {
+        play_buffer[c*frames + k] = frames_buffer[k*channels + c];
+      }
+    }
+
+    // Wait while the queue is full.
+    while (!play_stop && (err = queue_enqueue(q, play_buffer.data(), FLOAT_AUDIO, frames)) == 1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    if (err < 0) {
+      std::cerr << "The playback stopped!" << std::endl;
+      break;
+    }
+  }
+
+  // Play the rest of the queue.
+  while (!play_stop && !queue_finish(q)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+  size_t played = queue_frames_played(q);
+  size_t underruns = queue_underruns(q);
+
+  queue_close(q);
+  wav_close(wav);
+
+  std::cout << "Played " << played << " frames";
+  if (underruns > 0) {
+    std::cout << " (" << underruns << " underruns)";
+  }
+  std::cout << "." << std::endl;
+
+  return err < 0 ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include "jaudio.h"
+#include "cli_wav.h"
+
+/********************************************************************************************
+ *
+ * jaudio-rec
+ *
+ * Headless recorder: captures JACK ports to 32-bit float WAV files with the capture stream
+ * engine, for a given time or until it is interrupted. Long recordings can be split into
+ * files of a fixed length, and are always continued in a new file before a file reaches
+ * the 4 GB limit of the WAV format.
+ *
+ *********************************************************************************************/
+
+static volatile bool rec_stop = false;
+
+static void rec_sighandler(int signum)
+{
+  rec_stop = true;
+}
+
+static void usage(void)
+{
+  std::cout << "Usage: jaudio-rec [options] port ...\n"
+            << "\n"
+            << "Records the JACK output ports (e.g., system:capture_1) to a 32-bit float WAV file.\n"
+            << "Ports may be patterns: 'system:capture_*', 'system:capture_[1-64]' or '/regex/'.\n"
+            << "\n"
+            << "  -o FILE     The output file (default jaudio-rec.wav).\n"
+            << "  -d SECONDS  Recording time (default 0 = until CTRL-C or SIGTERM).\n"
+            << "  -s SECONDS  Start a new file every SECONDS seconds (FILE-0001.wav, FILE-0002.wav, ...).\n"
+            << "              Without -s the recording continues in FILE-0002.wav, ... at the 4 GB WAV limit.\n"
+            << "  -b SECONDS  Length of the capture ring buffer (default 4).\n"
+            << "  -n NAME     The JACK client name (default jaudio-rec).\n"
+            << "  -h          Show this help.\n";
+}
+
+// The name of file number index (starting at 1) of a split recording.
+static std::string segment_name(const std::string &file_name, size_t index)
+{
+  std::string base = file_name;
+  char suffix[32];
+
+  if (base.size() > 4 && base.compare(base.size() - 4, 4, ".wav") == 0) {
+    base.resize(base.size() - 4);
+  }
+
+  snprintf(suffix, sizeof(suffix), "-%04d.wav", (int) index);
+
+  return base + suffix;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string file_name = "jaudio-rec.wav";
+  std::string client_name = "jaudio-rec";
+  double duration = 0.0, split = 0.0, ring_length = 4.0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:d:s:b:n:h")) != -1) {
+    switch (opt) {
+    case 'o':
+      file_name = optarg;
+      break;
+    case 'd':
+      duration = atof(optarg);
+      break;
+    case 's':
+      split = atof(optarg);
+      break;
+    case 'b':
+      ring_length = atof(optarg);
+      break;
+    case 'n':
+      client_name = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (argc - optind == 0 || duration < 0.0 || split < 0.0 || ring_length <= 0.0) {
+    usage();
+    return 1;
+  }
+
+  // One short-lived client expands the port patterns (e.g., 'system:capture_*') and
+  // reads the sample rate before the stream's client is opened.
+  jack_client_t *client = ports_open_client(client_name.c_str());
+  if (!client) {
+    return 1;
+  }
+
+  jaudio_port_list_t ports;
+  int resolve_err = port_list_resolve(&ports, &argv[optind], argc - optind, JackPortIsOutput, client);
+  jack_nframes_t fs = jack_get_sample_rate(client);
+  jack_client_close(client);
+
+  if (resolve_err < 0) {
+    return 1;
+  }
+
+  size_t channels = ports.num;
+
+  size_t duration_frames = (size_t) (duration * fs + 0.5);  // 0 = no limit.
+  size_t split_frames = (size_t) (split * fs + 0.5);        // 0 = one file (up to the WAV limit).
+
+  // The length of each file (a file never exceeds the 4 GB limit of the WAV format).
+  size_t file_frames = wav_max_frames(channels);
+  if (split_frames > 0 && split_frames < file_frames) {
+    file_frames = split_frames;
+  }
+
+  // Read about 100 ms at a time.
+  size_t chunk_frames = fs / 10;
+  std::vector<float> buffer(chunk_frames * channels);
+
+  size_t segment = 1;
+  std::string name = split_frames ? segment_name(file_name, segment) : file_name;
+  cli_wav_t *wav = wav_create(name.c_str(), channels, fs);
+  if (!wav) {
+    return 1;
+  }
+
+  jaudio_stream_t *s = stream_open(channels, ports.names.data(), client_name.c_str(),
+                                   (size_t) (ring_length * fs));
+  if (!s) {
+    wav_close(wav);
+    return 1;
+  }
+
+  signal(SIGINT, rec_sighandler);
+  signal(SIGTERM, rec_sighandler);
+
+  size_t frames_written = 0, frames_in_file = 0, dropped = 0;
+  int err = 0;
+
+  std::cout << "Recording " << channels << " channels at " << fs << " Hz to " << name << std::endl;
+
+  while (!err && (duration_frames == 0 || frames_written < duration_frames)) {
+
+    size_t frames = stream_read(s, buffer.data(), chunk_frames);
+
+    if (frames == 0) {
+
+      // Drain the ring buffer before stopping.
+      if (rec_stop || !stream_is_running(s)) {
+        break;
+      }
+
+      // Keep the file valid in case the program is killed.
+      wav_flush(wav);
+
+      if (stream_frames_dropped(s) != dropped) {
+        dropped = stream_frames_dropped(s);
+        std::cerr << "Warning: " << dropped << " frames dropped (the disk is too slow)!" << std::endl;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      continue;
+    }
+
+    if (duration_frames > 0 && frames > duration_frames - frames_written) {
+      frames = duration_frames - frames_written;
+    }
+
+    // Write the frames, starting new files at the split points (or at the WAV limit).
+    size_t m = 0;
+    while (m < frames) {
+
+      if (frames_in_file == file_frames) {
+
+        err = wav_close(wav);
+        name = segment_name(file_name, ++segment);
+        if (err || (wav = wav_create(name.c_str(), channels, fs)) == nullptr) {
+          wav = nullptr;
+          err = -1;
+          break;
+        }
+        frames_in_file = 0;
+        std::cout << "Recording to " << name << std::endl;
+      }
+
+      size_t len = frames - m;
+      if (len > file_frames - frames_in_file) {
+        len = file_frames - frames_in_file;
+      }
+
+      if ((err = wav_write(wav, &buffer[m*channels], len))) {
+        break;
+      }
+
+      m += len;
+      frames_in_file += len;
+      frames_written += len;
+    }
+  }
+
+  if (!stream_is_running(s)) {
+    std::cerr << "The JACK server was shut down!" << std::endl;
+    err = -1;
+  }
+
+  dropped = stream_frames_dropped(s);
+  size_t lost = stream_frames_lost(s);
+  stream_close(s);
+
+  if (wav_close(wav)) {
+    err = -1;
+  }
+
+  std::cout << "Recorded " << frames_written << " frames";
+  if (dropped > 0) {
+    std::cout << " (" << dropped << " frames were dropped)";
+  }
+  if (lost > 0) {
+    std::cout << " (" << lost << " frames were lost in xruns and filled with silence)";
+  }
+  std::cout << "." << std::endl;
+
+  return err ? 1 : 0;
+}
@@ -24,9 +24,393 @@
 
 #define FLOAT_AUDIO 0
 #define DOUBLE_AUDIO 1
+#define GENERATOR_AUDIO 2 // The play buffer is a jaudio_generator_t.
+#define RESAMPLED_AUDIO 3 // The play buffer is a jaudio_resampler_t.
+#define CONVOLVED_AUDIO 4 // The play buffer is a jaudio_convolver_t.
+#define EVENT_AUDIO 5     // The play buffer is a jaudio_events_t.
 
+#include <stdint.h>
+#include <iostream>
+#include <complex>
+#include <vector>
 #include <jack/jack.h>
 
+//
+// Port selection (glob/regex patterns, bulk validation and connection)
+//
+
+typedef struct {
+  std::vector<char> buffer;   // The names, NUL terminated, back to back.
+  std::vector<char*> names;   // The num names (pointers into buffer).
+  size_t num;
+} jaudio_port_list_t;
+
+bool ports_is_pattern(const char *name);
+bool ports_has_patterns(const char * const *names, size_t num_names);
+jack_client_t* ports_open_client(const char *client_name);
+int port_list_resolve(jaudio_port_list_t *list, const char * const *names, size_t num_names,
+                      unsigned long flags, jack_client_t *client);
+int ports_connect(jack_client_t *client, jack_port_t **ports, char **port_names, size_t num_ports,
+                  bool capture);
+
+//
+// Stimulus generators
+//
+
+#define JAUDIO_GEN_TONES 0     // Sine or multi-tone.
+#define JAUDIO_GEN_LIN_SWEEP 1 // Linear sweep (chirp).
+#define JAUDIO_GEN_EXP_SWEEP 2 // Exponential (log) sweep.
+#define JAUDIO_GEN_MLS 3       // Maximum length sequence.
+#define JAUDIO_GEN_NOISE 4     // Seeded white noise (independent per channel).
+
+#define JAUDIO_GEN_MAX_TONES 64
+#define JAUDIO_GEN_MAX_MLS_ORDER 24
+
+typedef struct {
+  int type;
+  double amplitude;
+
+  // Tones.
+  size_t num_tones;
+  double tone_freqs_hz[JAUDIO_GEN_MAX_TONES];
+  double tone_amps[JAUDIO_GEN_MAX_TONES];   // Relative to amplitude.
+  double tone_phases[JAUDIO_GEN_MAX_TONES]; // [rad]
+
+  // Sweeps.
+  double f1_hz;
+  double f2_hz;
+  size_t sweep_frames;
+
+  // MLS.
+  int mls_order;
+
+  // Noise.
+  uint64_t seed;
+  bool gaussian;
+
+  // Bursts (burst_on_frames = 0 means continuous).
+  size_t burst_on_frames;
+  size_t burst_off_frames;
+
+  // Set by generator_setup.
+  double fs;
+  size_t channels;
+  uint32_t mls_state;
+  uint64_t *noise_state;
+} jaudio_generator_t;
+
+int generator_setup(jaudio_generator_t *gen, double fs, size_t channels);
+void generator_free(jaudio_generator_t *gen);
+void generator_render(jaudio_generator_t *gen, jack_default_audio_sample_t **out,
+                      size_t pos, size_t offset, size_t nframes);
+
+//
+// Sparse event-list playback
+//
+
+typedef struct {
+  size_t start;      // Start frame on the timeline.
+  size_t channel;    // Output channel (port).
+  size_t waveform;   // Index of the waveform to play.
+  float gain;
+} jaudio_event_t;
+
+typedef struct jaudio_events jaudio_events_t;
+
+jaudio_events_t* events_create(const float * const *waveforms, const size_t *waveform_frames, size_t num_waveforms,
+                               const jaudio_event_t *events, size_t num_events, size_t channels, size_t frames);
+size_t events_get_frames(const jaudio_events_t *ev);
+void events_render(jaudio_events_t *ev, jack_default_audio_sample_t **out,
+                   size_t pos, size_t offset, size_t nframes);
+void events_destroy(jaudio_events_t *ev);
+
+//
+// Loop points
+//
+
+#define JAUDIO_LOOP_FOREVER 0 // Play the loop until stopped.
+
+typedef struct {
+  size_t frames;   // The length of the play data.
+  size_t start;    // First frame of the loop.
+  size_t end;      // One past the last frame of the loop.
+  size_t repeats;  // Number of times the loop is played (or JAUDIO_LOOP_FOREVER).
+} jaudio_loop_t;
+
+int loop_setup(jaudio_loop_t *lp, size_t frames, size_t start, size_t end, size_t repeats);
+size_t loop_get_frames(const jaudio_loop_t *lp);
+size_t loop_position(const jaudio_loop_t *lp, size_t t, size_t *run);
+
+//
+// Shared-memory live tap
+//
+
+#define JAUDIO_TAP_MAGIC 0x5041544a   // "JTAP" (little endian).
+#define JAUDIO_TAP_VERSION 2
+#define JAUDIO_TAP_NAME_SIZE 64       // Bytes per (NUL terminated) channel name.
+
+// The header of the shared-memory object. It is followed by channels channel names of
+// JAUDIO_TAP_NAME_SIZE bytes and, at data_offset, by channels rings of ring_frames floats.
+typedef struct {
+  volatile uint32_t magic;            // JAUDIO_TAP_MAGIC when the header is initialized.
+  uint32_t version;
+  uint32_t channels;
+  uint32_t sample_rate;
+  uint64_t ring_frames;               // Frames per channel in the ring.
+  uint64_t data_offset;               // Byte offset of the first channel ring.
+  volatile uint64_t write_count;      // Total frames written (frame n is at n % ring_frames).
+  volatile uint64_t frame_time;       // JACK frame time of the first frame of the latest period.
+  volatile uint32_t active;           // 0 when the capture has ended.
+  uint32_t max_period;                // The most frames being written ahead of write_count.
+} jaudio_tap_header_t;
+
+typedef struct jaudio_tap jaudio_tap_t;
+
+jaudio_tap_t* tap_create(const char *name, size_t channels, size_t ring_frames, size_t max_period_frames,
+                         double fs, const char * const *channel_names);
+void tap_write(jaudio_tap_t *tap, jack_default_audio_sample_t **in, size_t nframes, jack_nframes_t frame_time);
+void tap_destroy(jaudio_tap_t *tap);
+
+//
+// Level metering
+//
+
+#define JAUDIO_METER_CLIP_LEVEL 1.0f // Default clip level (0 dBFS).
+
+typedef struct {
+  float peak;          // Max |x| since the start.
+  float rms;           // RMS since the start.
+  float period_peak;   // Max |x| in the latest JACK period.
+  float period_rms;    // RMS of the latest JACK period.
+  size_t clips;        // Number of samples with |x| >= the clip level.
+  size_t frames;       // Number of metered frames.
+} jaudio_meter_stats_t;
+
+typedef struct jaudio_meter jaudio_meter_t;
+
+jaudio_meter_t* meter_create(size_t channels, float clip_level);
+void meter_destroy(jaudio_meter_t *meter);
+void meter_update(jaudio_meter_t *meter, size_t channel, const float *x, size_t nframes);
+void meter_publish(jaudio_meter_t *meter);
+void meter_snapshot(const jaudio_meter_t *meter, jaudio_meter_stats_t *stats);
+
+//
+// Multi-channel trigger detection (per-channel levels, any/all/K-of-N votes)
+//
+
+typedef struct jaudio_trigger jaudio_trigger_t;
+
+jaudio_trigger_t* trigger_create(size_t ports, const size_t *channels, const double *levels,
+                                 size_t num_channels, size_t window_frames, size_t votes);
+void trigger_destroy(jaudio_trigger_t *trig);
+void trigger_update(jaudio_trigger_t *trig, size_t port, const float *x, size_t nframes);
+void trigger_skip(jaudio_trigger_t *trig, size_t nframes);
+bool trigger_check(jaudio_trigger_t *trig, size_t nframes);
+size_t trigger_get_envelopes(const jaudio_trigger_t *trig, float *envelopes);
+
+//
+// Streaming STFT (spectrogram) analysis
+//
+
+#define JAUDIO_WIN_HANN 0
+#define JAUDIO_WIN_HAMMING 1
+#define JAUDIO_WIN_RECT 2
+#define JAUDIO_WIN_CUSTOM 3
+
+typedef struct {
+  size_t window_frames;        // Window (FFT) length, a power of two.
+  size_t hop_frames;           // Frames between consecutive windows.
+  int window_type;             // JAUDIO_WIN_HANN, JAUDIO_WIN_HAMMING, JAUDIO_WIN_RECT, or JAUDIO_WIN_CUSTOM.
+  const float *window_coeffs;  // The window_frames coefficients of a custom window.
+  size_t num_bands;            // Sum the power in bands (0 = return all window_frames/2+1 bins).
+  const double *band_edges_hz; // The num_bands+1 band edges.
+  bool db;                     // Return the power in dB.
+} jaudio_stft_config_t;
+
+typedef struct jaudio_stft jaudio_stft_t;
+
+size_t stft_num_features(const jaudio_stft_config_t *cfg);
+size_t stft_num_frames(const jaudio_stft_config_t *cfg, size_t frames);
+jaudio_stft_t* stft_create(const jaudio_stft_config_t *cfg, size_t channels, double fs,
+                           size_t frames, float *features);
+void stft_write(jaudio_stft_t *stft, jack_default_audio_sample_t **in, size_t nframes);
+void stft_finish(jaudio_stft_t *stft);
+bool stft_done(const jaudio_stft_t *stft);
+size_t stft_overruns(const jaudio_stft_t *stft);
+size_t stft_frames_dropped(const jaudio_stft_t *stft);
+void stft_destroy(jaudio_stft_t *stft);
+
+//
+// Decimation (anti-alias filtering and downsampling of captured channels)
+//
+
+typedef struct jaudio_decimation jaudio_decimation_t;
+
+size_t decimation_output_frames(size_t frames, size_t factor);
+size_t decimation_buffer_frames(size_t frames, const size_t *factors, size_t channels);
+jaudio_decimation_t* decimation_create(const size_t *factors, size_t channels, size_t frames);
+void decimation_process(jaudio_decimation_t *d, size_t channel,
+                        const float *in, size_t nframes, float *buffer);
+void decimation_finish(jaudio_decimation_t *d, float *buffer);
+void decimation_destroy(jaudio_decimation_t *d);
+
+//
+// Delay-and-sum beamforming
+//
+
+typedef struct {
+  size_t num_beams;
+  const double *delays;        // channels x num_beams (column major) delays [frames], >= 0.
+  const double *weights;       // channels x num_beams weights (nullptr = 1/channels).
+  size_t num_threads;          // Worker threads (the beams are split into this many groups).
+} jaudio_beamform_config_t;
+
+typedef struct jaudio_beamformer jaudio_beamformer_t;
+
+jaudio_beamformer_t* beamform_create(const jaudio_beamform_config_t *cfg, size_t channels,
+                                     size_t frames, float *beams);
+void beamform_write(jaudio_beamformer_t *bf, jack_default_audio_sample_t **in, size_t nframes);
+void beamform_finish(jaudio_beamformer_t *bf);
+bool beamform_done(const jaudio_beamformer_t *bf);
+size_t beamform_overruns(const jaudio_beamformer_t *bf);
+size_t beamform_frames_dropped(const jaudio_beamformer_t *bf);
+void beamform_destroy(jaudio_beamformer_t *bf);
+
+//
+// Routing and gain matrices (sources -> play ports, record ports -> channels)
+//
+
+typedef struct jaudio_router jaudio_router_t;
+
+jaudio_router_t* router_create(const double *gains, size_t outputs, size_t inputs, size_t max_frames);
+size_t router_outputs(const jaudio_router_t *rt);
+size_t router_inputs(const jaudio_router_t *rt);
+jack_default_audio_sample_t** router_mix(jaudio_router_t *rt, jack_default_audio_sample_t **in, size_t nframes);
+void router_mix_play(const jaudio_router_t *rt, const float *buffer, size_t frames, size_t pos,
+                     jack_default_audio_sample_t **out, size_t offset, size_t nframes);
+void router_mix_play(const jaudio_router_t *rt, const double *buffer, size_t frames, size_t pos,
+                     jack_default_audio_sample_t **out, size_t offset, size_t nframes);
+void router_destroy(jaudio_router_t *rt);
+
+//
+// Play data convolution (uniformly partitioned overlap-save)
+//
+
+typedef struct jaudio_convolver jaudio_convolver_t;
+
+size_t convolver_output_frames(size_t frames, size_t taps);
+jaudio_convolver_t* convolver_create(const void *buffer, int format, size_t frames, size_t in_channels,
+                                     const double *h, size_t taps, size_t out_channels, bool mimo);
+size_t convolver_get_frames(const jaudio_convolver_t *cv);
+size_t convolver_read(jaudio_convolver_t *cv, jack_default_audio_sample_t **out,
+                      size_t offset, size_t nframes);
+size_t convolver_underruns(const jaudio_convolver_t *cv);
+void convolver_destroy(jaudio_convolver_t *cv);
+
+//
+// Playback sample-rate conversion
+//
+
+typedef struct jaudio_resampler jaudio_resampler_t;
+
+size_t resampler_output_frames(size_t frames, double fs_in, double fs_out);
+jaudio_resampler_t* resampler_create(const void *buffer, int format, size_t frames, size_t channels,
+                                     double fs_in, double fs_out);
+size_t resampler_get_frames(const jaudio_resampler_t *rs);
+double resampler_get_output_rate(const jaudio_resampler_t *rs);
+size_t resampler_read(jaudio_resampler_t *rs, jack_default_audio_sample_t **out,
+                      size_t offset, size_t nframes);
+size_t resampler_underruns(const jaudio_resampler_t *rs);
+void resampler_destroy(jaudio_resampler_t *rs);
+
+//
+// Buffer-size and sample-rate changes
+//
+
+// The largest JACK period the engines preallocate their per-period buffers for.
+#define JAUDIO_MAX_PERIOD_FRAMES 8192
+
+// The number of change points logged per run.
+#define JAUDIO_MAX_PERIOD_CHANGES 64
+
+typedef struct {
+  size_t frame;                 // The recorded frame where the change took effect.
+  jack_nframes_t buffer_size;   // The period size [frames] from frame on.
+  jack_nframes_t sample_rate;   // The sample rate [Hz] from frame on.
+} jaudio_period_change_t;
+
+typedef struct jaudio_change_log jaudio_change_log_t;
+
+size_t jaudio_max_period_frames(jack_client_t *client);
+jaudio_change_log_t* change_log_create(jack_client_t *client, size_t max_frames);
+int change_log_set_buffer_size(jaudio_change_log_t *log, jack_nframes_t nframes);
+void change_log_set_sample_rate(jaudio_change_log_t *log, jack_nframes_t fs);
+void change_log_update(jaudio_change_log_t *log, size_t frame, jack_nframes_t nframes);
+size_t change_log_get(const jaudio_change_log_t *log, jaudio_period_change_t *changes);
+void change_log_destroy(jaudio_change_log_t *log);
+
+//
+// Xrun detection (lost cycles are filled so that the recordings stay time-true)
+//
+
+// The number of gaps logged per run.
+#define JAUDIO_MAX_XRUNS 256
+
+typedef struct {
+  size_t frame;           // The recorded frame where the gap starts.
+  size_t lost_frames;     // The number of frames JACK never delivered.
+} jaudio_xrun_t;
+
+typedef struct jaudio_xrun_log jaudio_xrun_log_t;
+
+jaudio_xrun_log_t* xrun_log_create(void);
+void xrun_log_notify(jaudio_xrun_log_t *log);
+size_t xrun_log_lost_frames(jaudio_xrun_log_t *log, jack_nframes_t frame_time, jack_nframes_t nframes,
+                            bool freewheeling);
+void xrun_log_add(jaudio_xrun_log_t *log, size_t frame, size_t lost_frames);
+size_t xrun_log_get(const jaudio_xrun_log_t *log, jaudio_xrun_t *xruns);
+size_t xrun_log_reported(const jaudio_xrun_log_t *log);
+void xrun_log_report(const jaudio_xrun_log_t *log);
+void xrun_log_destroy(jaudio_xrun_log_t *log);
+
+//
+// Setup-phase profiling (client open, port registration, activation, connection, teardown)
+//
+
+typedef enum {
+  JAUDIO_PHASE_INIT = 0,        // All of X_init (including the phases below).
+  JAUDIO_PHASE_OPEN,            // jack_client_open.
+  JAUDIO_PHASE_REGISTER,        // Port registration.
+  JAUDIO_PHASE_ACTIVATE,        // jack_activate.
+  JAUDIO_PHASE_CONNECT,         // jack_connect (one per port).
+  JAUDIO_PHASE_FIRST_PERIOD,    // From jack_activate to the first played or recorded frame.
+  JAUDIO_PHASE_WAIT,            // Waiting for the job to finish.
+  JAUDIO_PHASE_CLOSE,           // All of X_close.
+  JAUDIO_NUM_PHASES
+} jaudio_phase_t;
+
+typedef struct {
+  double seconds[JAUDIO_NUM_PHASES];    // The time spent in each phase [s].
+  size_t count[JAUDIO_NUM_PHASES];      // The number of times each phase was timed.
+  size_t calls;                         // The number of profiled calls.
+} jaudio_profile_t;
+
+void profile_enable(bool enable);
+bool profile_is_enabled(void);
+void profile_begin_call(void);
+double profile_now(void);
+void profile_add(jaudio_phase_t phase, double start);
+void profile_get(jaudio_profile_t *call, jaudio_profile_t *total);
+const char* profile_phase_name(jaudio_phase_t phase);
+
+// Adds the time until the end of the scope to phase (for functions with several returns).
+typedef struct jaudio_profile_scope {
+  jaudio_phase_t phase;
+  double start;
+  jaudio_profile_scope(jaudio_phase_t p) : phase(p), start(profile_now()) {}
+  ~jaudio_profile_scope() { profile_add(phase, start); }
+} jaudio_profile_scope_t;
+
 // Play
 
 bool play_is_running(void);
@@ -36,10 +420,47 @@ void play_clear_running_flag(void);
 int play_finished(void);
 int play_process_f(jack_nframes_t nframes, void *arg);
 int play_process_d(jack_nframes_t nframes, void *arg);
+int play_process_g(jack_nframes_t nframes, void *arg);
+int play_process_r(jack_nframes_t nframes, void *arg);
+int play_process_e(jack_nframes_t nframes, void *arg);
+int play_process_mf(jack_nframes_t nframes, void *arg);
+int play_process_md(jack_nframes_t nframes, void *arg);
+bool play_is_freewheeling(void);
+void play_set_routing(const double *gains, size_t sources);
+void play_set_loop(size_t start, size_t end, size_t repeats);
 int play_init(void* buffer, size_t frames, size_t channels,
-              char **port_names, const char *client_name, int format);
+              char **port_names, const char *client_name, int format,
+              bool freewheel = false);
 int play_close(void);
 
+// Play queue
+
+typedef struct jaudio_queue jaudio_queue_t;
+
+jaudio_queue_t* queue_open(size_t channels, char **port_names, const char *client_name, size_t max_buffers);
+int queue_enqueue(jaudio_queue_t *q, const void *buffer, int format, size_t frames);
+size_t queue_channels(const jaudio_queue_t *q);
+size_t queue_pending_frames(const jaudio_queue_t *q);
+size_t queue_frames_played(const jaudio_queue_t *q);
+size_t queue_underruns(const jaudio_queue_t *q);
+bool queue_is_running(const jaudio_queue_t *q);
+bool queue_finish(jaudio_queue_t *q);
+void queue_close(jaudio_queue_t *q);
+
+// Capture stream
+
+typedef struct jaudio_stream jaudio_stream_t;
+
+jaudio_stream_t* stream_open(size_t channels, char **port_names, const char *client_name, size_t ring_frames = 0);
+size_t stream_read(jaudio_stream_t *s, float *buffer, size_t max_frames);
+size_t stream_channels(const jaudio_stream_t *s);
+jack_nframes_t stream_sample_rate(const jaudio_stream_t *s);
+size_t stream_frames_captured(const jaudio_stream_t *s);
+size_t stream_frames_dropped(const jaudio_stream_t *s);
+size_t stream_frames_lost(const jaudio_stream_t *s);
+bool stream_is_running(const jaudio_stream_t *s);
+void stream_close(jaudio_stream_t *s);
+
 // Record
 
 bool got_a_trigger(void);
@@ -47,14 +468,34 @@ bool record_is_running(void);
 void record_set_running_flag(void);
 void record_clear_running_flag(void);
 
+bool record_is_freewheeling(void);
 bool record_finished(void);
+void record_set_meter(bool enable, float clip_level = JAUDIO_METER_CLIP_LEVEL);
+int record_get_meter(jaudio_meter_stats_t *stats);
+void record_set_stft(const jaudio_stft_config_t *cfg);
+void record_set_decimation(const size_t *factors);
+void record_set_beamform(const jaudio_beamform_config_t *cfg, float *beams = nullptr);
+size_t record_get_beamform_overruns(void);
+size_t record_get_beamform_frames_dropped(void);
+void record_set_routing(const double *gains, size_t channels);
+void record_set_tap(const char *name, size_t ring_frames = 0);
+size_t record_get_stft_overruns(void);
+size_t record_get_stft_frames_dropped(void);
+size_t record_get_period_changes(jaudio_period_change_t *changes);
+void record_set_xrun_fill(bool fill);
+size_t record_get_xruns(jaudio_xrun_t *xruns);
+jack_nframes_t record_get_sample_rate(void);
 int record_init(void* buffer, size_t frames, size_t channels,
-                char **port_names, const char *client_name);
+                char **port_names, const char *client_name,
+                bool freewheel = false);
 int record_close(void);
 
 bool t_record_finished(void);
 int t_record_process_f(jack_nframes_t nframes, void *arg);
 int t_record_process_d(jack_nframes_t nframes, void *arg);
+void t_record_set_trigger(const size_t *channels, const double *levels, size_t num_channels,
+                          size_t votes);
+size_t t_record_get_trigger_envelopes(float *envelopes);
 int t_record_init(void* buffer, size_t frames, size_t channels,
                   char **port_names, const char *client_name,
                   double trigger_level,
@@ -78,20 +519,122 @@ void playrec_jack_shutdown(void *arg);
 
 int playrec_process_f(jack_nframes_t nframes, void *arg);
 int playrec_process_d(jack_nframes_t nframes, void *arg);
+int playrec_process_g(jack_nframes_t nframes, void *arg);
+int playrec_process_r(jack_nframes_t nframes, void *arg);
+int playrec_process_c(jack_nframes_t nframes, void *arg);
+int playrec_process_e(jack_nframes_t nframes, void *arg);
 
+bool playrec_is_freewheeling(void);
 bool playrec_finished(void);
+size_t playrec_get_frames_recorded(void);
+jack_nframes_t playrec_get_sample_rate(void);
+void playrec_set_averaging(size_t num_averages, bool compute_variance);
+int playrec_get_average(float *average, float *variance);
+void playrec_set_meter(bool enable, float clip_level = JAUDIO_METER_CLIP_LEVEL);
+int playrec_get_meter(jaudio_meter_stats_t *stats);
+size_t playrec_get_period_changes(jaudio_period_change_t *changes);
+void playrec_set_xrun_fill(bool fill);
+size_t playrec_get_xruns(jaudio_xrun_t *xruns);
+void playrec_set_decimation(const size_t *factors);
+void playrec_set_play_routing(const double *gains, size_t sources);
+void playrec_set_record_routing(const double *gains, size_t channels);
+void playrec_set_monitor(const double *gains, bool gated = true);
+void playrec_set_loop(size_t start, size_t end, size_t repeats);
 int playrec_init(void* play_buffer, int play_format,
                  size_t play_channels, char **play_port_names,
                  void* record_buffer, size_t record_channels, char **record_port_names,
                  size_t frames,
                  const char *client_name,
-                 size_t num_skip_buffers = 0);
+                 size_t num_skip_buffers = 0,
+                 bool freewheel = false);
 
 int playrec_close(size_t play_channels,
                   char **play_port_names,
                   size_t record_channels,
                   char **record_port_names);
 
+//
+// Sequenced play and record jobs (back-to-back in one JACK session)
+//
+
+typedef struct {
+  void *play_buffer;           // A frames x play_channels (column major) stimulus matrix.
+  int play_format;             // FLOAT_AUDIO or DOUBLE_AUDIO.
+  size_t frames;               // The stimulus length.
+  size_t play_channels;
+  size_t *play_ports;          // Indices into the session's play ports (one per stimulus column).
+  float *record_buffer;        // A (frames*repetitions) x record_channels matrix.
+  size_t record_channels;
+  size_t *record_ports;        // Indices into the session's record ports.
+  size_t repetitions;          // Number of times the stimulus is played.
+  size_t gap_frames;           // Frames of silence after the job.
+  size_t start_frame;          // Set by sequence_init: where the job starts on the timeline.
+} jaudio_seq_job_t;
+
+bool sequence_is_running(void);
+void sequence_set_running_flag(void);
+void sequence_clear_running_flag(void);
+
+int sequence_process(jack_nframes_t nframes, void *arg);
+
+bool sequence_finished(void);
+size_t sequence_current_job(void);
+size_t sequence_get_period_changes(jaudio_period_change_t *changes);
+int sequence_init(jaudio_seq_job_t *jobs, size_t num_jobs,
+                  size_t play_channels, char **play_port_names,
+                  size_t record_channels, char **record_port_names,
+                  const char *client_name,
+                  size_t num_skip_buffers = 0,
+                  bool freewheel = false);
+int sequence_close(void);
+
+//
+// FFT (radix-2)
+//
+
+typedef struct {
+  size_t n;                         // Transform length (a power of two).
+  size_t *bitrev;                   // Bit reversal permutation.
+  std::complex<double> *twiddles;   // exp(-j*2*pi*k/n), k = 0..n/2.
+} jaudio_fft_plan_t;
+
+size_t fft_next_pow2(size_t n);
+jaudio_fft_plan_t* fft_create_plan(size_t n);
+void fft_destroy_plan(jaudio_fft_plan_t *plan);
+void fft_execute(const jaudio_fft_plan_t *plan, std::complex<double> *x, bool inverse);
+
+//
+// Swept-sine impulse response measurement
+//
+
+typedef struct {
+  double f1_hz;                     // Sweep start frequency.
+  double f2_hz;                     // Sweep stop frequency.
+  size_t sweep_frames;              // Sweep length.
+  double amplitude;
+  double fs;                        // Sample rate.
+  size_t ir_frames;                 // Length of the extracted responses.
+  size_t num_harmonics;             // Highest harmonic order to extract (1 = linear only).
+  size_t record_frames;             // Set by ir_prepare.
+  size_t fft_frames;                // Set by ir_prepare.
+  jaudio_fft_plan_t *plan;          // Set by ir_prepare.
+  std::complex<double> *inv_spectrum; // Set by ir_prepare: spectrum of the inverse filter.
+  double *inv_head;                 // Set by ir_prepare: the first ir_frames taps of the inverse filter.
+  size_t tail_fft_frames;           // Set by ir_prepare (0 if the tail is convolved directly).
+  jaudio_fft_plan_t *tail_plan;     // Set by ir_prepare.
+  std::complex<double> *tail_spectrum; // Set by ir_prepare: spectrum of the taps the tail is convolved with.
+} jaudio_ir_t;
+
+void ir_sweep_generator(const jaudio_ir_t *ir, jaudio_generator_t *gen);
+int ir_prepare(jaudio_ir_t *ir, size_t record_frames);
+int ir_deconvolve(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                  double *h, double *hd, size_t num_threads);
+int ir_deconvolve_sweep(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                        double *h, double *hd, size_t num_threads);
+int ir_deconvolve_tail(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                       double *h, size_t num_threads);
+void ir_free(jaudio_ir_t *ir);
+
 static void print_jack_status(jack_status_t status)
 {
 
@@ -144,6 +687,49 @@ static void print_jack_status(jack_status_t status)
   }
 };
 
+/***
+ *
+ * jaudio_port_is_physical
+ *
+ * True if the named port belongs to a sound card (hardware) backend.
+ * Such ports are not serviced when the server is freewheeling.
+ *
+ ***/
+
+static inline bool jaudio_port_is_physical(jack_client_t *client, const char *port_name)
+{
+  jack_port_t *port = jack_port_by_name(client, port_name);
+
+  return (port != nullptr) && (jack_port_flags(port) & JackPortIsPhysical);
+}
+
+/***
+ *
+ * jaudio_get_server_sample_rate
+ *
+ * The sample rate of the JACK server, using a short-lived client, or 0
+ * if the server can't be reached. Used to size buffers before the
+ * engine clients are opened.
+ *
+ ***/
+
+static inline jack_nframes_t jaudio_get_server_sample_rate(const char *client_name)
+{
+  jack_status_t status;
+  jack_client_t *client = jack_client_open(client_name, JackNullOption, &status);
+
+  if (client == nullptr) {
+    print_jack_status(status);
+    std::cerr << "Failed to open JACK client: '" << client_name << "'!" << std::endl;
+    return 0;
+  }
+
+  jack_nframes_t fs = jack_get_sample_rate(client);
+  jack_client_close(client);
+
+  return fs;
+}
+
 void jerror(const char *desc);
 void jack_shutdown(void *arg);
 int srate(jack_nframes_t nframes, void *arg);
@@ -0,0 +1,51 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include "oct_changes.h"
+
+/***
+ *
+ * oct_period_changes
+ *
+ * Converts the buffer-size and sample-rate change points to an Octave
+ * struct with one column per change (frames are 1-based rows).
+ *
+ ***/
+
+octave_scalar_map oct_period_changes(const jaudio_period_change_t *changes, size_t num_changes)
+{
+  octave_scalar_map info;
+
+  Matrix frame(1, num_changes), buffer_size(1, num_changes), sample_rate(1, num_changes);
+
+  for (size_t n=0; n<num_changes; n++) {
+    frame(0, n) = (double) changes[n].frame + 1.0;
+    buffer_size(0, n) = (double) changes[n].buffer_size;
+    sample_rate(0, n) = (double) changes[n].sample_rate;
+  }
+
+  info.assign("frame", frame);
+  info.assign("buffer_size", buffer_size);
+  info.assign("sample_rate", sample_rate);
+
+  return info;
+}
@@ -0,0 +1,38 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_CHANGES_H__
+#define __OCT_CHANGES_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of info.period_changes (shared by the gateway help texts).
+#define OCT_CHANGES_HELP "\
+The field period_changes is set if the JACK period size or sample rate changed during the capture.\n\
+Its fields frame, buffer_size, and sample_rate (row vectors with one element per change) give the\n\
+recorded frame from which the new values apply.\n"
+
+octave_scalar_map oct_period_changes(const jaudio_period_change_t *changes, size_t num_changes);
+
+#endif
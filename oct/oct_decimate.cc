@@ -0,0 +1,113 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <math.h>
+
+#include <iostream>
+
+#include "oct_decimate.h"
+
+/***
+ *
+ * oct_get_decimation
+ *
+ * Parses a scalar (all channels) or per-channel vector of decimation factors.
+ *
+ ***/
+
+void oct_get_decimation(const octave_value &arg, size_t channels, std::vector<size_t> &factors)
+{
+  const Matrix d = arg.matrix_value();
+
+  if (d.numel() != 1 && (size_t) d.numel() != channels) {
+    error("The decimation must be a scalar or have one factor per capture channel!");
+  }
+
+  factors.resize(channels);
+  for (size_t n=0; n<channels; n++) {
+
+    double factor = d.data()[(d.numel() == 1) ? 0 : n];
+    if (factor < 1 || factor != round(factor)) {
+      error("The decimation factors must be integers >= 1!");
+    }
+
+    factors[n] = (size_t) factor;
+  }
+}
+
+bool oct_decimation_is_uniform(const std::vector<size_t> &factors)
+{
+  for (size_t n=1; n<factors.size(); n++) {
+    if (factors[n] != factors[0]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/***
+ *
+ * oct_decimation_buffer
+ *
+ * Allocates the record buffer. With equal factors the decimated channels,
+ * stored after each other, form a (frames/factor) x channels matrix.
+ *
+ ***/
+
+FloatMatrix oct_decimation_buffer(size_t frames, const std::vector<size_t> &factors)
+{
+  size_t channels = factors.size();
+
+  if (oct_decimation_is_uniform(factors) && channels > 0) {
+    return FloatMatrix((octave_idx_type) decimation_output_frames(frames, factors[0]),
+                       (octave_idx_type) channels);
+  }
+
+  return FloatMatrix((octave_idx_type) decimation_buffer_frames(frames, factors.data(), channels), 1);
+}
+
+// The output arg: the buffer matrix or, with different factors, a cell array of columns.
+octave_value oct_decimation_output(const FloatMatrix &Y, size_t frames, const std::vector<size_t> &factors)
+{
+  if (oct_decimation_is_uniform(factors)) {
+    return octave_value(Y);
+  }
+
+  Cell C(1, (octave_idx_type) factors.size());
+  const float *y = Y.data();
+
+  for (size_t n=0; n<factors.size(); n++) {
+
+    size_t len = decimation_output_frames(frames, factors[n]);
+    FloatMatrix col((octave_idx_type) len, 1);
+    float *dest = (float*) col.data();
+
+    for (size_t m=0; m<len; m++) {
+      dest[m] = y[m];
+    }
+
+    C(n) = col;
+    y += len;
+  }
+
+  return octave_value(C);
+}
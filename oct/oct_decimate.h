@@ -0,0 +1,44 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#ifndef __OCT_DECIMATE_H__
+#define __OCT_DECIMATE_H__
+
+#include <vector>
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the decimation option (shared by the gateway help texts).
+#define OCT_DECIMATE_HELP "\
+@item decimate\n\
+A decimation factor, or a vector with one factor per capture channel. The captured data is\n\
+anti-alias filtered and downsampled in the JACK callback. Y is a (frames/factor) x channels\n\
+matrix if all channels use the same factor and otherwise a cell array with one column per\n\
+channel. Defaults to 1 (no decimation).\n"
+
+void oct_get_decimation(const octave_value &arg, size_t channels, std::vector<size_t> &factors);
+bool oct_decimation_is_uniform(const std::vector<size_t> &factors);
+FloatMatrix oct_decimation_buffer(size_t frames, const std::vector<size_t> &factors);
+octave_value oct_decimation_output(const FloatMatrix &Y, size_t frames, const std::vector<size_t> &factors);
+
+#endif
@@ -0,0 +1,114 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <cmath>
+#include <vector>
+
+#include "oct_events.h"
+
+// An event list is a struct with an events field (a generator struct has a type field).
+bool oct_is_event_list(const octave_value &arg)
+{
+  return arg.isstruct() && arg.scalar_map_value().isfield("events");
+}
+
+/***
+ *
+ * oct_get_events
+ *
+ * Parses an event-list struct (see OCT_EVENTS_HELP) and creates the
+ * event player for channels ports. The caller destroys it.
+ *
+ ***/
+
+jaudio_events_t* oct_get_events(const octave_scalar_map &s, size_t channels)
+{
+  if (!s.isfield("waveforms") || !s.getfield("waveforms").iscell()) {
+    error("The event list must have a waveforms field with a cell array of waveforms!");
+  }
+
+  const Cell W = s.getfield("waveforms").cell_value();
+  size_t num_waveforms = (size_t) W.numel();
+
+  std::vector<FloatMatrix> waveforms(num_waveforms);
+  std::vector<const float*> wave_data(num_waveforms);
+  std::vector<size_t> wave_frames(num_waveforms);
+
+  for (size_t w=0; w<num_waveforms; w++) {
+    waveforms[w] = W(w).float_matrix_value();
+    if (waveforms[w].rows() != 1 && waveforms[w].cols() != 1) {
+      error("The event waveforms must be vectors!");
+    }
+    wave_data[w] = waveforms[w].data();
+    wave_frames[w] = (size_t) waveforms[w].numel();
+  }
+
+  const Matrix E = s.getfield("events").matrix_value();
+  if (E.numel() > 0 && E.cols() != 3 && E.cols() != 4) {
+    error("The events must be an events x 3 or events x 4 matrix ([start channel waveform gain])!");
+  }
+
+  size_t num_events = (E.numel() > 0) ? (size_t) E.rows() : 0;
+  std::vector<jaudio_event_t> events(num_events);
+
+  const double *col = E.data();
+  for (size_t e=0; e<num_events; e++) {
+
+    double start = col[e];
+    double channel = col[e + num_events];
+    double waveform = col[e + 2*num_events];
+
+    if (start < 0 || start != std::round(start)) {
+      error("The event start frames must be integers >= 0!");
+    }
+
+    if (channel < 1 || channel > (double) channels || channel != std::round(channel)) {
+      error("The event channels must be port numbers (1 to %d)!", (int) channels);
+    }
+
+    if (waveform < 1 || waveform > (double) num_waveforms || waveform != std::round(waveform)) {
+      error("The event waveforms must be waveform numbers (1 to %d)!", (int) num_waveforms);
+    }
+
+    events[e].start = (size_t) start;
+    events[e].channel = (size_t) channel - 1;
+    events[e].waveform = (size_t) waveform - 1;
+    events[e].gain = (E.cols() == 4) ? (float) col[e + 3*num_events] : 1.0f;
+  }
+
+  size_t frames = 0;
+  if (s.isfield("frames")) {
+    double f = s.getfield("frames").double_value();
+    if (f < 1) {
+      error("The event list frames must be >= 1!");
+    }
+    frames = (size_t) f;
+  }
+
+  jaudio_events_t *ev = events_create(wave_data.data(), wave_frames.data(), num_waveforms,
+                                      events.data(), num_events, channels, frames);
+  if (!ev) {
+    error("Failed to create the event list!");
+  }
+
+  return ev;
+}
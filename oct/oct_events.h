@@ -0,0 +1,46 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_EVENTS_H__
+#define __OCT_EVENTS_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the event-list struct (shared by the gateway help texts).
+#define OCT_EVENTS_HELP "\
+@table @code\n\
+@item waveforms\n\
+A cell array with the (short) waveforms, as vectors, that the events play.\n\
+@item events\n\
+An events x 3 or events x 4 matrix with one [start channel waveform gain] row per event: the start\n\
+frame (0 is the first frame), the port number, the waveform number, and the gain (default 1).\n\
+Events may overlap. Only the sounding events are rendered in the JACK callback.\n\
+@item frames\n\
+The length of the timeline. Defaults to the end of the last event.\n\
+@end table\n"
+
+bool oct_is_event_list(const octave_value &arg);
+jaudio_events_t* oct_get_events(const octave_scalar_map &s, size_t channels);
+
+#endif
@@ -0,0 +1,177 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <string>
+
+#include "oct_generator.h"
+
+// Returns a scalar struct field or the default value if the field is missing or empty.
+static double get_scalar(const octave_scalar_map &g, const char *name, double default_value)
+{
+  if (g.isfield(name) && !g.getfield(name).isempty()) {
+    return g.getfield(name).double_value();
+  }
+
+  return default_value;
+}
+
+/***
+ *
+ * oct_get_generator
+ *
+ * Converts an Octave generator description struct to a jaudio_generator_t.
+ *
+ ***/
+
+void oct_get_generator(const octave_scalar_map &g, jaudio_generator_t *gen, size_t *frames)
+{
+  memset(gen, 0x0, sizeof(jaudio_generator_t));
+
+  if (!g.isfield("type") || !g.getfield("type").is_string()) {
+    error("The generator struct must have a 'type' string field!");
+  }
+
+  std::string type = g.getfield("type").string_value();
+
+  if (type == "sine" || type == "tones") {
+    gen->type = JAUDIO_GEN_TONES;
+  } else if (type == "linsweep" || type == "chirp") {
+    gen->type = JAUDIO_GEN_LIN_SWEEP;
+  } else if (type == "expsweep" || type == "logsweep") {
+    gen->type = JAUDIO_GEN_EXP_SWEEP;
+  } else if (type == "mls") {
+    gen->type = JAUDIO_GEN_MLS;
+  } else if (type == "noise") {
+    gen->type = JAUDIO_GEN_NOISE;
+  } else {
+    error("Unknown generator type '%s'!", type.c_str());
+  }
+
+  double n_frames = get_scalar(g, "frames", -1.0);
+  if (n_frames < 0) {
+    error("The generator struct must have a 'frames' field >= 0!");
+  }
+  *frames = (size_t) n_frames;
+
+  gen->amplitude = get_scalar(g, "amplitude", 0.5);
+
+  //
+  // Bursts.
+  //
+
+  if (g.isfield("burst") && !g.getfield("burst").isempty()) {
+
+    const Matrix burst = g.getfield("burst").matrix_value();
+    if (burst.numel() != 2 || burst.data()[0] < 1 || burst.data()[1] < 0) {
+      error("The generator burst field must be [on_frames off_frames] with on_frames >= 1!");
+    }
+
+    gen->burst_on_frames = (size_t) burst.data()[0];
+    gen->burst_off_frames = (size_t) burst.data()[1];
+  }
+
+  //
+  // Tones.
+  //
+
+  if (gen->type == JAUDIO_GEN_TONES) {
+
+    if (!g.isfield("freq")) {
+      error("A 'sine' generator requires the 'freq' field!");
+    }
+
+    const Matrix freq = g.getfield("freq").matrix_value();
+    if (freq.numel() < 1 || freq.numel() > JAUDIO_GEN_MAX_TONES) {
+      error("The number of tones must be >= 1 and <= %d!", JAUDIO_GEN_MAX_TONES);
+    }
+    gen->num_tones = (size_t) freq.numel();
+
+    Matrix amp, phase;
+    if (g.isfield("amp")) {
+      amp = g.getfield("amp").matrix_value();
+      if ((size_t) amp.numel() != gen->num_tones) {
+        error("The 'amp' and 'freq' fields must have the same length!");
+      }
+    }
+
+    if (g.isfield("phase")) {
+      phase = g.getfield("phase").matrix_value();
+      if ((size_t) phase.numel() != gen->num_tones) {
+        error("The 'phase' and 'freq' fields must have the same length!");
+      }
+    }
+
+    for (size_t k=0; k<gen->num_tones; k++) {
+      gen->tone_freqs_hz[k] = freq.data()[k];
+      gen->tone_amps[k] = (amp.numel() > 0) ? amp.data()[k] : 1.0;
+      gen->tone_phases[k] = (phase.numel() > 0) ? phase.data()[k] : 0.0;
+    }
+  }
+
+  //
+  // Sweeps.
+  //
+
+  if (gen->type == JAUDIO_GEN_LIN_SWEEP || gen->type == JAUDIO_GEN_EXP_SWEEP) {
+
+    if (!g.isfield("f1") || !g.isfield("f2")) {
+      error("A sweep generator requires the 'f1' and 'f2' fields!");
+    }
+
+    gen->f1_hz = g.getfield("f1").double_value();
+    gen->f2_hz = g.getfield("f2").double_value();
+
+    double default_len = (gen->burst_on_frames > 0) ? (double) gen->burst_on_frames : (double) *frames;
+    gen->sweep_frames = (size_t) get_scalar(g, "sweep_frames", default_len);
+  }
+
+  //
+  // MLS.
+  //
+
+  if (gen->type == JAUDIO_GEN_MLS) {
+    gen->mls_order = (int) get_scalar(g, "order", 16);
+  }
+
+  //
+  // Noise.
+  //
+
+  if (gen->type == JAUDIO_GEN_NOISE) {
+
+    gen->seed = (uint64_t) get_scalar(g, "seed", 0.0);
+
+    if (g.isfield("distribution")) {
+
+      std::string dist = g.getfield("distribution").string_value();
+
+      if (dist == "gaussian" || dist == "normal") {
+        gen->gaussian = true;
+      } else if (dist != "uniform") {
+        error("Unknown noise distribution '%s'!", dist.c_str());
+      }
+    }
+  }
+}
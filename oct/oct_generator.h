@@ -0,0 +1,52 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#ifndef __OCT_GENERATOR_H__
+#define __OCT_GENERATOR_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the generator struct (shared by the gateway help texts).
+#define OCT_GENERATOR_HELP "\
+@table @code\n\
+@item type\n\
+'sine' (one or more tones), 'linsweep', 'expsweep', 'mls', or 'noise'.\n\
+@item frames\n\
+The number of frames to play.\n\
+@item amplitude\n\
+The peak amplitude. Defaults to 0.5.\n\
+@item freq, amp, phase\n\
+Tone frequencies [Hz], relative amplitudes (default 1), and phases [rad] (default 0) for 'sine'.\n\
+@item f1, f2, sweep_frames\n\
+Start and stop frequencies [Hz] and sweep length (defaults to the burst length or frames) for the sweeps.\n\
+@item order\n\
+The MLS order (2 to 24).\n\
+@item seed, distribution\n\
+The noise seed (default 0) and 'uniform' (default) or 'gaussian' noise. Each channel gets independent noise.\n\
+@item burst\n\
+[on_frames off_frames] to play the stimulus as bursts followed by silence. Each burst starts over.\n\
+@end table\n"
+
+void oct_get_generator(const octave_scalar_map &g, jaudio_generator_t *gen, size_t *frames);
+
+#endif
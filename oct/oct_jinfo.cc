@@ -19,121 +19,133 @@
  *
  ***/
 
-// This code is based on: http://dis-dot-dat.net/index.cgi?item=jacktuts/starting/
-
 #include <string.h>
 #include <stdlib.h>
-#include <math.h>
-#include <pthread.h>
-#include <signal.h>
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <octave/oct.h>
 
-//#include "jaudio.h"
 #include <jack/jack.h>
 
-//
-// Macros.
-//
-
-#ifdef CLAMP
-#undef CLAMP
-#endif
-#define CLAMP(x, low, high)  (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
-
-#define mxGetM(N)   args(N).matrix_value().rows()
-#define mxGetN(N)   args(N).matrix_value().cols()
-#define mxIsChar(N) args(N).is_string()
-
-//
-// Globals.
-//
-
-jack_port_t *input_port;
-jack_port_t *output_port;
-
 //
 // Function prototypes.
 //
 
-void sighandler(int signum);
-void sighandler(int signum);
-void sig_abrt_handler(int signum);
-void sig_keyint_handler(int signum);
+static void print_jack_status(jack_status_t status);
+static octave_map get_port_info(jack_client_t *client, const char **port_names, size_t num_ports);
+static void print_ports(const char *title, const octave_map &ports, size_t first, size_t last);
+
+static void print_jack_status(jack_status_t status)
+{
+  std::cerr << "JACK status: " << status << std::endl;
+}
 
 /***
  *
- * Signal handlers.
+ * get_port_info
+ *
+ * A num_ports x 1 struct array describing the named ports. Only queries
+ * the server, so it works without an active client.
  *
  ***/
 
-void sighandler(int signum) {
-  //printf("Caught signal SIGTERM.\n");
-  //clear_running_flag();
-}
-
-void sig_abrt_handler(int signum) {
-  //printf("Caught signal SIGABRT.\n");
-}
-
-void sig_keyint_handler(int signum) {
-  //printf("Caught signal SIGINT.\n");
-}
-
-//
-// Jack callback functions.
-//
-
-int process_jinfo (jack_nframes_t nframes, void *arg)
+static octave_map get_port_info(jack_client_t *client, const char **port_names, size_t num_ports)
 {
-  jack_default_audio_sample_t *out =
-    (jack_default_audio_sample_t *)
-    jack_port_get_buffer (output_port, nframes);
-
-  /*
-  jack_default_audio_sample_t *in =
-    (jack_default_audio_sample_t *)
-    jack_port_get_buffer (input_port, nframes);
-
-  // Just copy input to output.
-  memcpy (out, in, sizeof (jack_default_audio_sample_t) * nframes);
-  */
+  dim_vector dims((octave_idx_type) num_ports, 1);
+  Cell names(dims), types(dims), directions(dims), physical(dims), terminal(dims), flags(dims);
+  Cell capture_latency(dims), playback_latency(dims), connections(dims);
+
+  for (size_t n=0; n<num_ports; n++) {
+
+    jack_port_t *port = jack_port_by_name(client, port_names[n]);
+    int port_flags = port ? jack_port_flags(port) : 0;
+
+    names(n) = octave_value(std::string(port_names[n]));
+    types(n) = octave_value(std::string(port ? jack_port_type(port) : ""));
+    directions(n) = octave_value(std::string((port_flags & JackPortIsInput) ? "input" : "output"));
+    physical(n) = octave_value((bool) (port_flags & JackPortIsPhysical));
+    terminal(n) = octave_value((bool) (port_flags & JackPortIsTerminal));
+    flags(n) = octave_value((double) port_flags);
+
+    // [min max] latencies in frames.
+    Matrix c_lat(1, 2, 0.0), p_lat(1, 2, 0.0);
+    if (port) {
+      jack_latency_range_t range;
+      double *c = (double*) c_lat.data();
+      double *p = (double*) p_lat.data();
+
+      jack_port_get_latency_range(port, JackCaptureLatency, &range);
+      c[0] = (double) range.min;
+      c[1] = (double) range.max;
+
+      jack_port_get_latency_range(port, JackPlaybackLatency, &range);
+      p[0] = (double) range.min;
+      p[1] = (double) range.max;
+    }
+    capture_latency(n) = octave_value(c_lat);
+    playback_latency(n) = octave_value(p_lat);
+
+    // The connected ports (a column cell array of names).
+    const char **conns = port ? jack_port_get_all_connections(client, port) : nullptr;
+    size_t num_conns = 0;
+    while (conns && conns[num_conns]) {
+      num_conns++;
+    }
 
-  // Just fill with silence.
-  bzero(out, sizeof (jack_default_audio_sample_t) * nframes);
+    Cell C((octave_idx_type) num_conns, 1);
+    for (size_t k=0; k<num_conns; k++) {
+      C(k) = octave_value(std::string(conns[k]));
+    }
+    connections(n) = octave_value(C);
 
-  return 0;
-}
+    if (conns) {
+      jack_free(conns);
+    }
+  }
 
-// This is called whenever the sample rate changes.
-int srate(jack_nframes_t nframes, void *arg)
-{
-  printf("The sample rate is now %lu/sec.\n", (long unsigned int) nframes);
-  return 0;
+  octave_map ports(dims);
+  ports.assign("name", names);
+  ports.assign("type", types);
+  ports.assign("direction", directions);
+  ports.assign("physical", physical);
+  ports.assign("terminal", terminal);
+  ports.assign("flags", flags);
+  ports.assign("capture_latency", capture_latency);
+  ports.assign("playback_latency", playback_latency);
+  ports.assign("connections", connections);
+
+  return ports;
 }
 
-void jerror(const char *desc)
+// Prints ports first to last-1 of a get_port_info struct array.
+static void print_ports(const char *title, const octave_map &ports, size_t first, size_t last)
 {
-  std::cerr << "JACK error: '" << desc << "'" << std::endl;
-  return;
-}
+  const Cell names = ports.contents("name");
+  const Cell physical = ports.contents("physical");
+  const Cell connections = ports.contents("connections");
 
+  octave_stdout << "|------------------------------------------------------\n";
+  octave_stdout << "|         " << title << "\n";
+  octave_stdout << "|------------------------------------------------------\n";
 
-void jack_shutdown(void *arg)
-{
-  //clear_running_flag(); // Stop if JACK shuts down..
-  return;
-}
+  for (size_t n=first; n<last; n++) {
 
-void print_jack_status(jack_status_t status)
-{
+    octave_stdout << "|        " << names(n).string_value();
+    if (physical(n).bool_value()) {
+      octave_stdout << " [physical]";
+    }
+    octave_stdout << std::endl;
 
-  std::cerr << "JACK status: " << status << std::endl;
+    const Cell C = connections(n).cell_value();
+    for (octave_idx_type k=0; k<C.numel(); k++) {
+      octave_stdout << "|            <-> " << C(k).string_value() << std::endl;
+    }
+  }
 }
 
-
 /***
  *
  * Octave (oct) gateway function for JINFO.
@@ -142,18 +154,39 @@ void print_jack_status(jack_status_t status)
 
 DEFUN_DLD (jinfo, args, nlhs,
            "-*- texinfo -*-\n\
-@deftypefn {Loadable Function} {}  [Fs_hz, buffer_size] = jinfo()\n\
+@deftypefn {Loadable Function} {}  [Fs_hz, buffer_size, info] = jinfo(opts)\n\
+\n\
+JINFO Prints the input and output ports of the (low-latency) JACK audio\n\
+engine and their connections.\n\
 \n\
-JINFO Prints the input and output ports connected to the\n\
- (low-latency) JACK audio engine.\n\
+The server is only queried: no ports are registered, the client is never\n\
+activated, and a server that is not running is not started, so jinfo doesn't\n\
+disturb the running graph and is cheap enough to call often from scripts.\n\
 \n\
-Output argument:\n\
+Input argument:\n\
+\n\
+@table @samp\n\
+@item opts\n\
+An optional struct with options:\n\
+@table @samp\n\
+@item quiet\n\
+Don't print the port list (default false).\n\
+@end table\n\
+@end table\n\
+\n\
+Output arguments:\n\
 \n\
 @table @samp\n\
 @item Fs_hz\n\
 The JACK server sampling frequency in Hz (optional).\n\
 @item buffer_size\n\
 The JACK server buffer size in frames (optional).\n\
+@item info\n\
+A struct with the fields sample_rate, buffer_size, cpu_load [%], realtime, and\n\
+ports (optional). ports is a struct array with one element per port and the\n\
+fields name, type, direction ('input' or 'output' as seen from the port's\n\
+client), physical, terminal, flags, capture_latency and playback_latency\n\
+([min max] frames), and connections (a cell array of the connected ports).\n\
 @end table\n\
 \n\
 @copyright{} 2023 Fredrik Lingvall.\n\
@@ -162,35 +195,40 @@ The JACK server buffer size in frames (optional).\n\
 {
   jack_client_t *client;
   const char **ports_i = nullptr, **ports_o = nullptr;
-  jack_port_t  *port = nullptr;
-  int  n = 0, port_flags = 0;
-  jack_nframes_t sample_rate = 0;
-  jack_nframes_t buffer_size = 0;
+  size_t num_ports_i = 0, num_ports_o = 0;
+  bool quiet = false;
   octave_value_list oct_retval; // Octave return (output) parameters
 
   int nrhs = args.length ();
 
   // Check for proper inputs arguments.
 
-  if (nrhs > 0) {
-    error("jinfo don't have any input argument!");
+  if (nrhs > 1) {
+    error("jinfo takes at most one input argument!");
   }
 
-  if (nlhs > 2) {
-    error("Too many output args for jinfo!");
+  if (nrhs == 1) {
+
+    if (!args(0).isstruct()) {
+      error("The options argument must be a struct!");
+    }
+
+    const octave_scalar_map opts = args(0).scalar_map_value();
+
+    if (opts.isfield("quiet")) {
+      quiet = opts.getfield("quiet").bool_value();
+    }
   }
 
-  //
-  // List all devices if no input arg is given.
-  //
+  if (nlhs > 3) {
+    error("Too many output args for jinfo!");
+  }
 
-  // Try to become a client of the JACK server.
+  // Only talk to a running server (don't start one just to query it).
   const char *client_name = "octave:jinfo";
-  const char *server_name = NULL;
-  jack_options_t options = JackNullOption;
   jack_status_t status;
 
-  client = jack_client_open (client_name, options, &status, server_name);
+  client = jack_client_open (client_name, JackNoStartServer, &status);
   if (client == NULL) {
     print_jack_status(status);
     error("jack server not running?\n");
@@ -198,203 +236,74 @@ The JACK server buffer size in frames (optional).\n\
     return oct_retval;
   }
 
-  if (status & JackServerStarted) {
-    fprintf (stderr, "JACK server started\n");
-  }
-
-  if (status & JackNameNotUnique) {
-    client_name = jack_get_client_name(client);
-    fprintf (stderr, "unique name `%s' assigned\n", client_name);
-  }
-
-  // Tell the JACK server to call `process()' whenever
-  // there is work to be done.
-  jack_set_process_callback (client, process_jinfo, 0);
-
-  // Tell the JACK server to call `jack_shutdown()' if
-  // it ever shuts down, either entirely, or if it
-  // just decides to stop calling us.
-  jack_on_shutdown (client, jack_shutdown, 0);
-
-  // Tell the JACK server to call error() whenever it
-  // experiences an error.  Notice that this callback is
-  // global to this process, not specific to each client.
-  //
-  // This is set here so that it can catch errors in the
-  // connection process.
-  //jack_set_error_function (jerror);
-
-  // Tell the JACK server to call `srate()' whenever
-  // the sample rate of the system changes.
-  //jack_set_sample_rate_callback (client, srate, 0);
-
-  octave_stdout << "|------------------------------------------------------\n";
+  jack_nframes_t sample_rate = jack_get_sample_rate(client);
+  jack_nframes_t buffer_size = jack_get_buffer_size(client);
+  float cpu_load = jack_cpu_load(client);
 
-  // Display the current sample rate. Once the client is activated
-  // (see below), you should rely on your own sample rate
-  // callback (see above) for this value.
-  sample_rate = jack_get_sample_rate(client);
-  octave_stdout << "|\n| JACK engine sample rate: " << sample_rate << " [Hz]" << std::endl;
+  // Input (playback) and output (capture) ports. This client has no ports
+  // of its own so all ports belong to other clients.
+  ports_i = jack_get_ports(client, NULL, NULL, JackPortIsInput);
+  ports_o = jack_get_ports(client, NULL, NULL, JackPortIsOutput);
 
-  buffer_size = jack_get_buffer_size (client);
-  octave_stdout << "|\n| JACK engine buffer size: " << buffer_size << " [frames]" << std::endl;
-
-  // Display the current JACK load.
-  octave_stdout << "|\n| Current JACK engine CPU load: " << jack_cpu_load(client) << " [%]\n|" << std::endl;
-
-  //
-  // Create input and output ports.
-  //
-
-  input_port = jack_port_register(client, "input",
-                                  JACK_DEFAULT_AUDIO_TYPE,
-                                  JackPortIsInput, 0);
-
-  output_port = jack_port_register(client, "output",
-                                   JACK_DEFAULT_AUDIO_TYPE,
-                                   JackPortIsOutput, 0);
-
-  if ((input_port == NULL) || (output_port == NULL)) {
-    std::cerr << "No more JACK ports available!" << std::endl;
-    return oct_retval;
+  while (ports_i && ports_i[num_ports_i]) {
+    num_ports_i++;
   }
 
-  // Tell the JACK server that we are ready to roll.
-  // This segfaults of some reason?
-  if (int err = jack_activate(client)) {
-
-    std::cerr << "Activate err: " << err << std::endl;
-
-    jack_client_close(client);
-
-    // Bail out
-    error("Cannot activate jack client");
+  while (ports_o && ports_o[num_ports_o]) {
+    num_ports_o++;
   }
 
-  // Connect the ports. Note: you can't do this before
-  // the client is activated, because we can't allow
-  // connections to be made to clients that aren't
-  // running.
+  // The input ports followed by the output ports.
+  std::vector<const char*> port_names;
+  port_names.insert(port_names.end(), ports_i, ports_i + num_ports_i);
+  port_names.insert(port_names.end(), ports_o, ports_o + num_ports_o);
 
-  // Connect output port -> input (playback) port
+  octave_map ports = get_port_info(client, port_names.data(), port_names.size());
 
-  if ((ports_o = jack_get_ports(client, NULL, NULL,
-                                JackPortIsOutput)) == NULL) {
+  if (!quiet) {
 
-    // Close connection and bail out.
-    jack_client_close (client);
-    error("Cannot find any output ports\n");
-  }
+    octave_stdout << "|------------------------------------------------------\n";
+    octave_stdout << "|\n| JACK engine sample rate: " << sample_rate << " [Hz]" << std::endl;
+    octave_stdout << "|\n| JACK engine buffer size: " << buffer_size << " [frames]" << std::endl;
+    octave_stdout << "|\n| Current JACK engine CPU load: " << cpu_load << " [%]\n|" << std::endl;
 
-  // Connect to first output (capture) port.
-  if (jack_connect(client, ports_o[0], jack_port_name (input_port))) {
+    print_ports("Input ports:", ports, 0, num_ports_i);
+    print_ports("Output ports:", ports, num_ports_i, num_ports_i + num_ports_o);
 
-    // Close connection and bail out.
-    jack_client_close (client);
-    error("Cannot connect output ports\n");
+    octave_stdout << "|------------------------------------------------------\n";
   }
 
-  //
-  // Connect output (capture) port -> input port
-  //
-
-  if ((ports_i = jack_get_ports(client, NULL, NULL,
-                                JackPortIsInput)) == NULL) {
-
-    // Disconnect outputs, close, and bail out
-    jack_disconnect(client, ports_o[0], jack_port_name (input_port));
-    jack_client_close (client);
-
-    error("Cannot find any input ports\n");
-  }
-
-  // Connect to first input (playback) port.
-  if (int err = jack_connect(client, jack_port_name(output_port), ports_i[0])) {
-
-    std::cout << err << std::endl;
-
-    // Disconnect outputs, close, and bail out
-    jack_disconnect(client, ports_o[0], jack_port_name (input_port));
-    jack_client_close (client);
-
-    error("Cannot connect input ports\n");
-
-    return oct_retval;
-  }
-
-  octave_stdout << "|------------------------------------------------------\n";
-  octave_stdout << "|         Input ports:                                 \n";
-  octave_stdout << "|------------------------------------------------------\n";
-  n = 0;
-  while(ports_i[n] != NULL) {
-
-    port = jack_port_by_name(client, ports_i[n]);
-    port_flags = jack_port_flags(port);
-
-    if (strcmp("octave:jinfo:input", ports_i[n]) != 0) { // Don't print the jinfo input.
-      if (port_flags & JackPortIsPhysical)
-        octave_stdout << "|        " << ports_i[n] << " [physical]\n";
-      else
-        octave_stdout << "|        " << ports_i[n] << std::endl;
-    }
-    n++;
-  }
-
-  octave_stdout << "|------------------------------------------------------\n";
-  octave_stdout << "|         Output ports:                                \n";
-  octave_stdout << "|------------------------------------------------------\n";
-  n = 0;
-  while(ports_o[n] != NULL) {
-
-    port = jack_port_by_name(client, ports_o[n]);
-    port_flags = jack_port_flags(port);
-
-    if (strcmp("octave:jinfo:output",ports_o[n]) != 0) { // Don't print the jinfo output.
-      if (port_flags & JackPortIsPhysical)
-        octave_stdout << "|        " << ports_o[n] << " [physical]\n";
-      else
-        octave_stdout << "|        " << ports_o[n] << std::endl;
-    }
-    n++;
-  }
-  octave_stdout << "|------------------------------------------------------\n";
-
   // Return sample rate if we have at least one output arg.
   if (nlhs >= 1) {
-    Matrix fs_mat(1,1);
-    double* fs_ptr = (double*) fs_mat.data();
-    fs_ptr[0] = (double) sample_rate;
-    oct_retval.append(fs_mat);
+    oct_retval.append((double) sample_rate);
   }
 
   // Return buffer size if we have two output args.
-  if (nlhs == 2) {
-    Matrix bs_mat(1,1);
-    double* bs_ptr = (double*) bs_mat.data();
-    bs_ptr[0] = (double) buffer_size;
-    oct_retval.append(bs_mat);
+  if (nlhs >= 2) {
+    oct_retval.append((double) buffer_size);
   }
 
+  if (nlhs == 3) {
 
-  // Disconnect ports
-
-  if (jack_disconnect(client, jack_port_name (output_port), ports_i[0])) {
-    error("Cannot disconnect output port!\n");
-  }
+    octave_scalar_map info;
+    info.assign("sample_rate", (double) sample_rate);
+    info.assign("buffer_size", (double) buffer_size);
+    info.assign("cpu_load", (double) cpu_load);
+    info.assign("realtime", (bool) jack_is_realtime(client));
+    info.assign("ports", ports);
 
-  if (jack_disconnect(client, ports_o[0], jack_port_name (input_port))) {
-    error("Cannot connect input port!\n");
+    oct_retval.append(info);
   }
 
-  // Close the client.
+  // Close the client (it was never activated).
   jack_client_close (client);
 
-  // Clenaup
+  // Cleanup
   if (ports_i) {
-    free (ports_i);
+    jack_free (ports_i);
   }
   if (ports_o) {
-    free (ports_o);
+    jack_free (ports_o);
   }
 
   return oct_retval;
@@ -0,0 +1,434 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <signal.h>
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+#include "oct_ports.h"
+#include "oct_profile.h"
+
+//
+// Function prototypes.
+//
+
+void sighandler(int signum);
+void sig_abrt_handler(int signum);
+void sig_keyint_handler(int signum);
+
+/***
+ *
+ * Signal handlers.
+ *
+ ***/
+
+void sighandler(int signum) {
+  //printf("Caught signal SIGTERM.\n");
+  playrec_clear_running_flag();
+}
+
+void sig_abrt_handler(int signum) {
+  //printf("Caught signal SIGABRT.\n");
+}
+
+void sig_keyint_handler(int signum) {
+  //printf("Caught signal SIGINT.\n");
+}
+
+/***
+ *
+ * Octave (oct) gateway function for JMEASURE_IR.
+ *
+ ***/
+
+DEFUN_DLD (jmeasure_ir, args, nlhs,
+           "-*- texinfo -*-\n\
+@deftypefn {Loadable Function} {} [h,hd,Y,info] = jmeasure_ir(pars,jack_inputs,jack_ouputs,num_skip_buffers,opts);\n\
+\n\
+JMEASURE_IR Measures impulse responses using an exponential (log) sweep. The sweep is synthesized\n\
+in the JACK callback and played on the jack ports given by jack_inputs while the responses are\n\
+recorded from the jack ports given by jack_ouputs. The recordings are deconvolved with the\n\
+inverse filter of the sweep, using an FFT that runs on several threads (one or more channels per\n\
+thread). The spectrum of the inverse filter is computed while the sweep is playing, and the\n\
+sweep part of the recordings is deconvolved while the tail is recorded. A measurement that is\n\
+interrupted (CTRL-C) raises an error.\n\
+\n\
+Input parameters:\n\
+\n\
+@table @samp\n\
+@item pars\n\
+A struct with the measurement parameters:\n\
+\n\
+@table @code\n\
+@item sweep_frames\n\
+The length of the sweep in frames (required).\n\
+@item f1\n\
+The start frequency of the sweep [Hz]. Defaults to 20 Hz.\n\
+@item f2\n\
+The stop frequency of the sweep [Hz]. Defaults to 20 kHz.\n\
+@item amplitude\n\
+The sweep amplitude. Defaults to 0.5.\n\
+@item ir_frames\n\
+The length of the returned impulse responses. Defaults to 4096.\n\
+@item tail_frames\n\
+The number of frames to record after the sweep has ended. Defaults to ir_frames.\n\
+@item harmonics\n\
+The highest harmonic distortion order to extract (1 = linear response only). Defaults to 1.\n\
+@end table\n\
+@item jack_inputs\n\
+A char matrix with the JACK client input port names, for example, ['system:playback_1'; 'system:playback_2'], etc.\n\
+@item jack_ouputs\n\
+A char matrix with the JACK client output port names, for example, ['system:capture_1'; 'system:capture_2'], etc.\n\
+" OCT_PORTS_HELP "\
+@item num_skip_buffers\n\
+The number of JACK periods (buffers) to skip before saving audio data (optional).\n\
+@item opts\n\
+An optional struct with measurement options:\n\
+\n\
+@table @code\n\
+@item freewheel\n\
+If true, put the JACK server in freewheel mode during the measurement (see jplayrec).\n\
+Defaults to false.\n\
+@item threads\n\
+The number of deconvolution threads. Defaults to the number of CPU cores.\n\
+" OCT_PROFILE_HELP "\
+@end table\n\
+@end table\n\
+\n\
+Output argument:\n\
+\n\
+@table @samp\n\
+@item h\n\
+An ir_frames x channels matrix with the linear impulse responses.\n\
+@item hd\n\
+An ir_frames x channels x (harmonics-1) array with the harmonic distortion responses of order\n\
+2 to harmonics. A response is zero padded if it is longer than the spacing to the next lower order.\n\
+@item Y\n\
+The raw (sweep_frames+tail_frames) x channels single precision recording.\n\
+@item info\n\
+A struct with additional information about the measurement (optional). If profiling is enabled\n\
+the field profile holds the phase times.\n\
+@end table\n\
+\n\
+@copyright{} 2023 Fredrik Lingvall.\n\
+@seealso {jplayrec, jinfo, @indicateurl{http://jackaudio.org}}\n\
+@end deftypefn")
+{
+  sighandler_t old_handler, old_handler_abrt, old_handler_keyint;
+  jaudio_port_list_t rec_port_list, play_port_list;
+  char **port_names_in = nullptr, **port_names_out = nullptr;
+  size_t play_channels = 0, rec_channels = 0;
+  bool freewheel = false;
+  bool use_profile = false;
+  size_t num_threads = std::thread::hardware_concurrency();
+  size_t tail_frames = 0;
+  jaudio_ir_t ir;
+  jaudio_generator_t gen;
+
+  octave_value_list oct_retval; // Octave return (output) parameters
+
+  int nrhs = args.length ();
+
+  // Check for proper inputs arguments.
+
+  if ( (nrhs < 3) || (nrhs > 5) ) {
+    error("jmeasure_ir requires 3 to 5 input arguments!");
+  }
+
+  if (nlhs > 4) {
+    error("Too many output args for jmeasure_ir!");
+  }
+
+  //
+  // Input arg 1 : The measurement parameters.
+  //
+
+  if (!args(0).isstruct()) {
+    error("1st arg must be a struct!");
+  }
+
+  const octave_scalar_map pars = args(0).scalar_map_value();
+
+  memset(&ir, 0x0, sizeof(jaudio_ir_t));
+  ir.f1_hz = 20.0;
+  ir.f2_hz = 20000.0;
+  ir.amplitude = 0.5;
+  ir.ir_frames = 4096;
+  ir.num_harmonics = 1;
+
+  if (!pars.isfield("sweep_frames") || pars.getfield("sweep_frames").double_value() < 1) {
+    error("pars.sweep_frames must be given and > 0!");
+  }
+  ir.sweep_frames = (size_t) pars.getfield("sweep_frames").double_value();
+
+  if (pars.isfield("f1")) {
+    ir.f1_hz = pars.getfield("f1").double_value();
+  }
+
+  if (pars.isfield("f2")) {
+    ir.f2_hz = pars.getfield("f2").double_value();
+  }
+
+  if (ir.f1_hz <= 0.0 || ir.f2_hz <= ir.f1_hz) {
+    error("The sweep frequencies must fulfill 0 < f1 < f2!");
+  }
+
+  if (pars.isfield("amplitude")) {
+    ir.amplitude = pars.getfield("amplitude").double_value();
+  }
+
+  if (pars.isfield("ir_frames")) {
+    if (pars.getfield("ir_frames").double_value() < 1) {
+      error("pars.ir_frames must be > 0!");
+    }
+    ir.ir_frames = (size_t) pars.getfield("ir_frames").double_value();
+  }
+
+  tail_frames = ir.ir_frames;
+  if (pars.isfield("tail_frames")) {
+    if (pars.getfield("tail_frames").double_value() < 0) {
+      error("pars.tail_frames must be >= 0!");
+    }
+    tail_frames = (size_t) pars.getfield("tail_frames").double_value();
+  }
+
+  if (pars.isfield("harmonics")) {
+    if (pars.getfield("harmonics").double_value() < 1) {
+      error("pars.harmonics must be >= 1!");
+    }
+    ir.num_harmonics = (size_t) pars.getfield("harmonics").double_value();
+  }
+
+  size_t frames = ir.sweep_frames + tail_frames;
+
+  //
+  // Input arg 2 and 3 : The jack (writable client) input and (readable client) output audio ports.
+  //
+
+  if ( !args(1).is_sq_string() ) {
+    error("2nd arg must be a string matrix !");
+  }
+
+  if ( !args(2).is_sq_string() ) {
+    error("3rd arg must be a string matrix !");
+  }
+
+  //
+  // Input arg 4 : Number of JACK periods to skip on record
+  //
+
+  size_t num_skip_buffers = 0;
+  if ( nrhs >= 4 && !args(3).isempty()) {
+    // Must ba a scalar
+    const Matrix tmp3 = args(3).matrix_value();
+    if (tmp3.rows() * tmp3.cols() != 1 ) {
+      error("4:th arg must be a scalar !");
+    }
+
+    num_skip_buffers = (size_t) tmp3.data()[0];
+  }
+
+  //
+  // Input arg 5 : Measurement options (optional).
+  //
+
+  if (nrhs == 5) {
+
+    if (!args(4).isstruct()) {
+      error("5:th arg must be a struct!");
+    }
+
+    const octave_scalar_map opts = args(4).scalar_map_value();
+
+    if (opts.isfield("freewheel")) {
+      freewheel = opts.getfield("freewheel").bool_value();
+    }
+
+    if (opts.isfield("profile")) {
+      use_profile = opts.getfield("profile").bool_value();
+    }
+
+    if (opts.isfield("threads")) {
+      if (opts.getfield("threads").double_value() < 1) {
+        error("opts.threads must be >= 1!");
+      }
+      num_threads = (size_t) opts.getfield("threads").double_value();
+    }
+  }
+
+  oct_get_port_names(args(1), JackPortIsOutput, &rec_port_list, "record ports");
+  oct_get_port_names(args(2), JackPortIsInput, &play_port_list, "playback ports");
+
+  rec_channels = rec_port_list.num;
+  port_names_in = rec_port_list.names.data();
+  play_channels = play_port_list.num;
+  port_names_out = play_port_list.names.data();
+
+  //
+  // Register signal handlers.
+  //
+
+  if ((old_handler = signal(SIGTERM, &sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if ((old_handler_abrt = signal(SIGABRT, &sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if ((old_handler_keyint = signal(SIGINT, &sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  // Allocate memory for the raw recording.
+  FloatMatrix Ymat( (octave_idx_type) frames, rec_channels);
+  float *Y = (float*) Ymat.data();
+
+  // Set status to running (CTRL-C will clear the flag and stop play/capture).
+  playrec_set_running_flag();
+
+  // The sweep (followed by silence during the tail) is synthesized in the JACK callback.
+  ir_sweep_generator(&ir, &gen);
+
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
+  if (playrec_init(&gen, GENERATOR_AUDIO,
+                   play_channels, port_names_out,
+                   Y, rec_channels, port_names_in,
+                   frames,
+                   "octave:jmeasure_ir",
+                   num_skip_buffers,
+                   freewheel) < 0) {
+    signal(SIGTERM, old_handler);
+    signal(SIGABRT, old_handler_abrt);
+    signal(SIGINT, old_handler_keyint);
+    error("jmeasure_ir init failed!");
+  }
+
+  // Compute the inverse filter while the sweep is playing.
+  ir.fs = (double) playrec_get_sample_rate();
+  int prepare_err = ir_prepare(&ir, frames);
+
+  Matrix Hmat( (octave_idx_type) ir.ir_frames, rec_channels);
+  double *H = (double*) Hmat.data();
+
+  dim_vector dims((octave_idx_type) ir.ir_frames, rec_channels,
+                  (octave_idx_type) (ir.num_harmonics - 1));
+  NDArray HDmat(dims);
+  double *HD = (ir.num_harmonics > 1) ? (double*) HDmat.data() : nullptr;
+
+  // Wait for both playback and record to finish, and deconvolve the sweep
+  // part of the recordings as soon as it has been recorded.
+  std::thread sweep_worker;
+  bool sweep_started = false;
+  double t_wait = profile_now();
+  while( !playrec_finished() && playrec_is_running() ) {
+
+    if (prepare_err == 0 && !sweep_started && playrec_get_frames_recorded() >= ir.sweep_frames) {
+      sweep_worker = std::thread(ir_deconvolve_sweep, &ir, Y, rec_channels, H, HD, num_threads);
+      sweep_started = true;
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+  }
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+  bool interrupted = !playrec_is_running();
+
+  if (sweep_worker.joinable()) {
+    sweep_worker.join();
+  }
+
+  // Close all jack ports and the client.
+  playrec_close(play_channels, port_names_out,
+                rec_channels, port_names_in);
+
+  //
+  // Restore old signal handlers.
+  //
+
+  if (signal(SIGTERM, old_handler) == SIG_ERR) {
+    error("Couldn't register old signal handler.\n");
+  }
+
+  if (signal(SIGABRT,  old_handler_abrt) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if (signal(SIGINT, old_handler_keyint) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if (interrupted) {
+    ir_free(&ir);
+    error("CTRL-C pressed - measurement interrupted!\n"); // Bail out.
+  }
+
+  if (prepare_err < 0) {
+    error("jmeasure_ir: failed to compute the inverse filter!");
+  }
+
+  //
+  // Deconvolve what is left: the sweep part (if the recording ended before we
+  // got to it) and the tail.
+  //
+
+  if (!sweep_started) {
+    ir_deconvolve_sweep(&ir, Y, rec_channels, H, HD, num_threads);
+  }
+
+  ir_deconvolve_tail(&ir, Y, rec_channels, H, num_threads);
+
+  ir_free(&ir);
+
+  oct_retval.append(Hmat);
+
+  if (nlhs >= 2) {
+    oct_retval.append(HDmat);
+  }
+
+  if (nlhs >= 3) {
+    oct_retval.append(Ymat);
+  }
+
+  if (nlhs == 4) {
+
+    octave_scalar_map info;
+
+    if (use_profile) {
+      info.assign("profile", oct_profile_info());
+    }
+
+    oct_retval.append(info);
+  }
+
+  return oct_retval;
+}
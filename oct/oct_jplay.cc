@@ -33,6 +33,12 @@
 #include <octave/oct.h>
 
 #include "jaudio.h"
+#include "oct_generator.h"
+#include "oct_route.h"
+#include "oct_events.h"
+#include "oct_loop.h"
+#include "oct_ports.h"
+#include "oct_profile.h"
 
 //
 // Macros.
@@ -89,7 +95,7 @@ void sig_keyint_handler(int signum) {
 
 DEFUN_DLD (jplay, args, nlhs,
            "-*- texinfo -*-\n\
-@deftypefn {Loadable Function} {} jplay(A,jack_inputs).\n\
+@deftypefn {Loadable Function} {} info = jplay(A,jack_inputs,opts).\n\
 \n\
 JPLAY Plays audio data from the input matrix A using the (low-latency) audio server JACK.\n\
 \n\
@@ -97,10 +103,44 @@ Input parameters:\n\
 \n\
 @table @samp\n\
 @item A\n\
-A frames x number of playback channels matrix.\n\
+A frames x number of playback channels matrix, or a generator struct describing a stimulus that is\n\
+synthesized in the JACK callback (played on all ports). The generator struct fields are:\n\
+\n\
+" OCT_GENERATOR_HELP "\
+\n\
+A can also be a sparse event-list struct, where short waveforms are placed at given frames\n\
+on given ports. The event-list struct fields are:\n\
+\n\
+" OCT_EVENTS_HELP "\
 \n\
 @item jack_inputs\n\
 A char matrix with the JACK client input port names, for example, ['system:playback_1'; 'system:playback_2'], etc.\n\
+" OCT_PORTS_HELP "\
+\n\
+@item opts\n\
+An optional struct with playback options:\n\
+\n\
+@table @code\n\
+@item fs\n\
+The sample rate of A [Hz]. If it differs from the JACK sample rate the data is converted\n\
+to the JACK rate, in chunks ahead of the JACK callback, by a windowed-sinc polyphase resampler.\n\
+Defaults to the JACK sample rate (no conversion).\n\
+@item freewheel\n\
+If true, put the JACK server in freewheel mode while playing so that the data is processed\n\
+as fast as the CPU allows. Only useful for software-only JACK graphs since hardware ports are\n\
+not serviced in freewheel mode. Defaults to false.\n\
+" OCT_PLAY_ROUTE_HELP "\
+" OCT_LOOP_HELP "\
+" OCT_PROFILE_HELP "\
+@end table\n\
+@end table\n\
+\n\
+Output argument:\n\
+\n\
+@table @samp\n\
+@item info\n\
+A struct with additional information about the playback (optional). If profiling is enabled\n\
+the field profile holds the phase times.\n\
 @end table\n\
 \n\
 @copyright{} 2009-2023 Fredrik Lingvall.\n\
@@ -109,11 +149,21 @@ A char matrix with the JACK client input port names, for example, ['system:playb
 {
   double *dA = nullptr;
   float  *fA = nullptr;
-  octave_idx_type n = 0, frames = 0;
+  octave_idx_type frames = 0;
   sighandler_t old_handler, old_handler_abrt, old_handler_keyint;
-  char **port_names = nullptr;
+  jaudio_port_list_t port_list;
   octave_idx_type channels = 0;
   int format = FLOAT_AUDIO;
+  bool freewheel = false;
+  double fs_data = 0.0;
+  jaudio_generator_t gen;
+  jaudio_resampler_t *resampler = nullptr;
+  Matrix play_route;
+  bool use_route = false;
+  jaudio_events_t *events = nullptr;
+  bool looped = false;
+  size_t loop_start = 0, loop_end = 0, loop_repeats = 1;
+  bool use_profile = false;
 
   octave_value_list oct_retval; // Octave return (output) parameters
 
@@ -121,13 +171,13 @@ A char matrix with the JACK client input port names, for example, ['system:playb
 
   // Check for proper inputs arguments.
 
-  if (nrhs != 2) {
-    error("jplay requires 2 input arguments!");
+  if ( (nrhs < 2) || (nrhs > 3) ) {
+    error("jplay requires 2 or 3 input arguments!");
     return oct_retval;
   }
 
-  if (nlhs > 0) {
-    error("jplay don't have output arguments!");
+  if (nlhs > 1) {
+    error("jplay has at most one output argument!");
     return oct_retval;
   }
 
@@ -160,6 +210,21 @@ A char matrix with the JACK client input port names, for example, ['system:playb
     return oct_retval;
   }
 
+  // Stimulus generator.
+  if (args(0).isstruct() && !oct_is_event_list(args(0))) {
+
+    format = GENERATOR_AUDIO;
+
+    size_t gen_frames = 0;
+    oct_get_generator(args(0).scalar_map_value(), &gen, &gen_frames);
+    frames = (octave_idx_type) gen_frames;
+  }
+
+  // Event list (parsed below when the number of ports is known).
+  if (oct_is_event_list(args(0))) {
+    format = EVENT_AUDIO;
+  }
+
   if (channels < 0) {
     error("The number of channels (columns in arg 1) must > 0!");
     return oct_retval;
@@ -169,38 +234,136 @@ A char matrix with the JACK client input port names, for example, ['system:playb
   // Input arg 2 : The jack (writable client) input audio ports.
   //
 
-  if ( !args(1).is_sq_string() ) {
-    error("2rd arg must be a string matrix !");
-    return oct_retval;
+  oct_get_port_names(args(1), JackPortIsInput, &port_list, "playback ports");
+
+  // The ports we play on (checked against the channels below since
+  // the channels can be routed to a different number of ports).
+  octave_idx_type ports = port_list.num;
+  char **port_names = port_list.names.data();
+
+  // All ports play the generated signal or the events.
+  if (format == GENERATOR_AUDIO || format == EVENT_AUDIO) {
+    channels = ports;
   }
 
-  charMatrix ch = args(1).char_matrix_value();
+  //
+  // Input arg 3 : Playback options (optional).
+  //
+
+  if (nrhs == 3) {
+
+    if (!args(2).isstruct()) {
+      error("3rd arg must be a struct!");
+      return oct_retval;
+    }
+
+    const octave_scalar_map opts = args(2).scalar_map_value();
+
+    if (opts.isfield("freewheel")) {
+      freewheel = opts.getfield("freewheel").bool_value();
+    }
+
+    if (opts.isfield("profile")) {
+      use_profile = opts.getfield("profile").bool_value();
+    }
+
+    if (opts.isfield("fs")) {
+      fs_data = opts.getfield("fs").double_value();
 
-  if ( ch.rows() != channels ) {
+      if (fs_data <= 0.0) {
+        error("opts.fs must be > 0!");
+        return oct_retval;
+      }
+
+      if (format == GENERATOR_AUDIO || format == EVENT_AUDIO) {
+        error("opts.fs can only be used with matrix play data!");
+        return oct_retval;
+      }
+    }
+
+    if (opts.isfield("play_route")) {
+
+      if (format == GENERATOR_AUDIO || format == EVENT_AUDIO || fs_data > 0.0) {
+        error("opts.play_route can only be used with (non-resampled) matrix play data!");
+        return oct_retval;
+      }
+
+      play_route = oct_get_route(opts.getfield("play_route"), channels, "play_route");
+      use_route = true;
+
+      if (play_route.rows() != ports) {
+        error("opts.play_route must have one row per jack client input port!");
+        return oct_retval;
+      }
+    }
+
+    looped = oct_get_loop(opts, &loop_start, &loop_end, &loop_repeats);
+
+    if (looped && (format == GENERATOR_AUDIO || fs_data > 0.0)) {
+      error("opts.loop and opts.repeat can only be used with (non-resampled) matrix or event-list play data!");
+      return oct_retval;
+    }
+  }
+
+  if ( !use_route && ports != channels ) {
     error("The number of channels to play don't match the specified number of jack client input ports!");
     return oct_retval;
   }
 
-  //std::string strin = args(1).string_value();
-  //octave_stdout << strin << std::endl;
-  //buflen = strin.length();
-  octave_idx_type buflen = ch.cols();
-  port_names = (char**) malloc(channels * sizeof(char*));
-  for (n=0; n<channels; n++) {
+  // Mix the channels (columns of A) to the ports in the JACK callback.
+  play_set_routing(use_route ? play_route.data() : nullptr, (size_t) channels);
+
+  // Only the waveforms of the event list are stored.
+  if (format == EVENT_AUDIO) {
+    events = oct_get_events(args(0).scalar_map_value(), (size_t) ports);
+    frames = (octave_idx_type) events_get_frames(events);
+  }
+
+  // Loop points (the data is only stored once).
+  if (looped) {
+
+    jaudio_loop_t loop;
+    if (loop_setup(&loop, (size_t) frames, loop_start, (loop_end > 0) ? loop_end : (size_t) frames, loop_repeats) < 0) {
+      events_destroy(events);
+      error("opts.loop must be within the rows of A!");
+      return oct_retval;
+    }
+
+    if (loop_repeats == JAUDIO_LOOP_FOREVER) {
+      octave_stdout << "Looping until CTRL-C is pressed..." << std::endl;
+    }
+  }
+
+  play_set_loop(loop_start, loop_end, loop_repeats);
+
+  //
+  // Resample the play data if it isn't at the JACK sample rate.
+  //
+
+  const FloatMatrix fA_data = (format == FLOAT_AUDIO) ? args(0).float_matrix_value() : FloatMatrix();
+  const Matrix dA_data = (format == DOUBLE_AUDIO) ? args(0).matrix_value() : Matrix();
+
+  if (fs_data > 0.0) {
 
-    port_names[n] = (char*) malloc(buflen*sizeof(char)+1);
+    double fs_jack = (double) jaudio_get_server_sample_rate("octave:jplay_fs");
+    if (fs_jack <= 0.0) {
+      error("Failed to get the JACK sample rate!");
+      return oct_retval;
+    }
 
-    std::string strin = ch.row_as_string(n);
+    if (fs_data != fs_jack) {
 
-    for (int k=0; k<=buflen; k++ )
-      if (strin[k] != ' ')  // Cut off the string if its a whitespace char.
-        port_names[n][k] = strin[k];
-      else {
-        port_names[n][k] = '\0';
-        break;
+      const void *data = (format == FLOAT_AUDIO) ? (const void*) fA_data.data() : (const void*) dA_data.data();
+
+      resampler = resampler_create(data, format, frames, channels, fs_data, fs_jack);
+      if (!resampler) {
+        error("Failed to create the resampler!");
+        return oct_retval;
       }
 
-    port_names[0][buflen] = '\0';
+      format = RESAMPLED_AUDIO;
+      frames = (octave_idx_type) resampler_get_frames(resampler);
+    }
   }
 
   //
@@ -222,6 +385,9 @@ A char matrix with the JACK client input port names, for example, ['system:playb
   // Set status to running (CTRL-C will clear the flag and stop playback).
   play_set_running_flag();
 
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
   //
   // Init and connect to the output ports.
   //
@@ -230,17 +396,19 @@ A char matrix with the JACK client input port names, for example, ['system:playb
 
     octave_stdout << "Playing single precision data...";
 
-    const FloatMatrix tmp0 = args(0).float_matrix_value();
-    fA = (float*) tmp0.data();
+    fA = (float*) fA_data.data();
 
-    if (play_init(fA, frames, channels, port_names, "octave:jplay", FLOAT_AUDIO) < 0) {
+    if (play_init(fA, frames, ports, port_names, "octave:jplay", FLOAT_AUDIO, freewheel) < 0) {
       return oct_retval;
     }
 
-    // Wait until we have played all data.
+    // Wait until we have played all data (poll often when freewheeling
+    // since the data then is consumed much faster than in real-time).
+    double t_wait = profile_now();
     while(!play_finished() && play_is_running() ) {
-      std::this_thread::sleep_for (std::chrono::milliseconds(50));
+      std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
     }
+    profile_add(JAUDIO_PHASE_WAIT, t_wait);
 
     play_close();
     octave_stdout << "done!" << std::endl;
@@ -250,34 +418,110 @@ A char matrix with the JACK client input port names, for example, ['system:playb
 
     octave_stdout << "Playing double precision data...";
 
-    const Matrix tmp0 = args(0).matrix_value();
-    dA = (double*) tmp0.data();
+    dA = (double*) dA_data.data();
 
-    if (play_init(dA, frames, channels, port_names, "octave:jplay", DOUBLE_AUDIO) < 0) {
+    if (play_init(dA, frames, ports, port_names, "octave:jplay", DOUBLE_AUDIO, freewheel) < 0) {
       return oct_retval;
     }
 
     // Wait until we have played all data.
+    double t_wait = profile_now();
     while(!play_finished() && play_is_running() ) {
-      std::this_thread::sleep_for (std::chrono::milliseconds(50));
+      std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
     }
+    profile_add(JAUDIO_PHASE_WAIT, t_wait);
 
     play_close();
 
     octave_stdout << "done!" << std::endl;
   }
 
-  //
-  // Cleanup.
-  //
+  if (format == GENERATOR_AUDIO) {
+
+    octave_stdout << "Playing generated data...";
+
+    if (play_init(&gen, frames, channels, port_names, "octave:jplay", GENERATOR_AUDIO, freewheel) < 0) {
+      return oct_retval;
+    }
+
+    // Wait until we have played all data.
+    double t_wait = profile_now();
+    while(!play_finished() && play_is_running() ) {
+      std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+    }
+    profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+    play_close();
 
-  for ( n=0; n<channels; n++ ) {
-    if (port_names[n])
-      free(port_names[n]);
+    octave_stdout << "done!" << std::endl;
   }
 
-  if (port_names)
-    free(port_names);
+  if (format == RESAMPLED_AUDIO) {
+
+    octave_stdout << "Playing resampled data (" << fs_data << " -> "
+                  << resampler_get_output_rate(resampler) << " Hz)...";
+
+    if (play_init(resampler, frames, channels, port_names, "octave:jplay", RESAMPLED_AUDIO, freewheel) < 0) {
+      resampler_destroy(resampler);
+      return oct_retval;
+    }
+
+    // Wait until we have played all data.
+    double t_wait = profile_now();
+    while(!play_finished() && play_is_running() ) {
+      std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+    }
+    profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+    play_close();
+
+    octave_stdout << "done!" << std::endl;
+
+    if (resampler_underruns(resampler) > 0) {
+      octave_stdout << "Warning: the resampler could not keep up with JACK ("
+                    << resampler_underruns(resampler) << " underruns)!" << std::endl;
+    }
+
+    resampler_destroy(resampler);
+  }
+
+  if (format == EVENT_AUDIO) {
+
+    octave_stdout << "Playing event list...";
+
+    if (play_init(events, frames, channels, port_names, "octave:jplay", EVENT_AUDIO, freewheel) < 0) {
+      events_destroy(events);
+      return oct_retval;
+    }
+
+    // Wait until we have played all data.
+    double t_wait = profile_now();
+    while(!play_finished() && play_is_running() ) {
+      std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+    }
+    profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+    play_close();
+
+    octave_stdout << "done!" << std::endl;
+
+    events_destroy(events);
+  }
+
+  if (nlhs == 1) {
+
+    octave_scalar_map info;
+
+    if (use_profile) {
+      info.assign("profile", oct_profile_info());
+    }
+
+    oct_retval.append(info);
+  }
+
+  //
+  // Cleanup.
+  //
 
   //
   // Restore old signal handlers.
@@ -295,7 +539,8 @@ A char matrix with the JACK client input port names, for example, ['system:playb
     error("Couldn't register signal handler.\n");
   }
 
-  if (!play_is_running())
+  // CTRL-C is the normal way to stop an endless loop.
+  if (!play_is_running() && !(looped && loop_repeats == JAUDIO_LOOP_FOREVER))
     error("CTRL-C pressed - playback interrupted!\n"); // Bail out.
 
   return oct_retval;
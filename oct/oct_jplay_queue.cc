@@ -0,0 +1,382 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <map>
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+#include "oct_ports.h"
+#include "oct_profile.h"
+
+// The play queue functions share the queues so they are in one oct-file (jplay_open.oct)
+// and the other functions are autoloaded from it.
+
+// PKG_ADD: autoload ("jplay_enqueue", fullfile (fileparts (mfilename ("fullpath")), "jplay_open.oct"));
+// PKG_ADD: autoload ("jplay_close", fullfile (fileparts (mfilename ("fullpath")), "jplay_open.oct"));
+
+//
+// Globals.
+//
+
+// The open queues (by handle).
+static std::map<int, jaudio_queue_t*> queues;
+static int next_handle = 1;
+
+static volatile bool queue_interrupted = false;
+
+//
+// Function prototypes.
+//
+
+void queue_sighandler(int signum);
+static jaudio_queue_t* get_queue(const octave_value &arg);
+
+/***
+ *
+ * Signal handlers.
+ *
+ ***/
+
+void queue_sighandler(int signum) {
+  queue_interrupted = true;
+}
+
+// Look up the queue of a handle.
+static jaudio_queue_t* get_queue(const octave_value &arg)
+{
+  int h = (int) arg.double_value();
+
+  auto it = queues.find(h);
+  if (it == queues.end()) {
+    error("Invalid play queue handle!");
+  }
+
+  return it->second;
+}
+
+/***
+ *
+ * Octave (oct) gateway function for JPLAY_OPEN.
+ *
+ ***/
+
+DEFUN_DLD (jplay_open, args, nlhs,
+           "-*- texinfo -*-\n\
+@deftypefn {Loadable Function} {} h = jplay_open(jack_inputs,opts).\n\
+\n\
+JPLAY_OPEN Opens a play queue, a JACK client that stays open and plays the buffers enqueued\n\
+with jplay_enqueue back to back, without gaps, while Octave prepares the next buffers. This\n\
+gives continuous playback of arbitrarily long (generated) material using bounded memory.\n\
+Close the queue with jplay_close.\n\
+\n\
+Input parameters:\n\
+\n\
+@table @samp\n\
+@item jack_inputs\n\
+A char matrix with the JACK client input port names, for example, ['system:playback_1'; 'system:playback_2'], etc.\n\
+" OCT_PORTS_HELP "\
+@item opts\n\
+An optional struct with the fields:\n\
+\n\
+@table @code\n\
+@item buffers\n\
+The maximum number of enqueued buffers that are held by the queue (jplay_enqueue waits for\n\
+a buffer to be played when the queue is full). Defaults to 4.\n\
+" OCT_PROFILE_HELP "\
+The profile is returned by jplay_close. Profiling is shared by all queues: the call times are\n\
+those since the last jplay_open and wait is the time jplay_close waits for the queue to drain.\n\
+@end table\n\
+@end table\n\
+\n\
+Output argument:\n\
+\n\
+@table @samp\n\
+@item h\n\
+The play queue handle.\n\
+@end table\n\
+\n\
+Example:\n\
+\n\
+@example\n\
+h = jplay_open(['system:playback_1'; 'system:playback_2']);\n\
+for n=1:100\n\
+  jplay_enqueue(h, randn(48000, 2, 'single') * 0.1);\n\
+end\n\
+info = jplay_close(h);\n\
+@end example\n\
+\n\
+@copyright{} 2023 Fredrik Lingvall.\n\
+@seealso {jplay_enqueue, jplay_close, jplay, @indicateurl{http://jackaudio.org}}\n\
+@end deftypefn")
+{
+  size_t max_buffers = 4;
+  bool use_profile = false;
+
+  octave_value_list oct_retval; // Octave return (output) parameters
+
+  int nrhs = args.length ();
+
+  if ( (nrhs < 1) || (nrhs > 2) ) {
+    error("jplay_open requires 1 or 2 input arguments!");
+  }
+
+  if (nlhs > 1) {
+    error("Too many output args for jplay_open!");
+  }
+
+  //
+  // Input arg 1 : The jack (writable client) input audio ports.
+  //
+
+  jaudio_port_list_t port_list;
+  oct_get_port_names(args(0), JackPortIsInput, &port_list, "playback ports");
+
+  //
+  // Input arg 2 : Queue options (optional).
+  //
+
+  if (nrhs == 2) {
+
+    if (!args(1).isstruct()) {
+      error("2nd arg must be a struct!");
+    }
+
+    const octave_scalar_map opts = args(1).scalar_map_value();
+
+    if (opts.isfield("buffers")) {
+      double buffers = opts.getfield("buffers").double_value();
+      if (buffers < 1.0) {
+        error("opts.buffers must be >= 1!");
+      }
+      max_buffers = (size_t) buffers;
+    }
+
+    if (opts.isfield("profile")) {
+      use_profile = opts.getfield("profile").bool_value();
+    }
+  }
+
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
+  // Each queue is a client of its own.
+  std::string client_name = "octave:jplay_queue_" + std::to_string(next_handle);
+
+  jaudio_queue_t *q = queue_open(port_list.num, port_list.names.data(), client_name.c_str(), max_buffers);
+
+  if (!q) {
+    error("Failed to open the play queue!");
+  }
+
+  int h = next_handle++;
+  queues[h] = q;
+
+  oct_retval.append(octave_value((double) h));
+
+  return oct_retval;
+}
+
+/***
+ *
+ * Octave (oct) gateway function for JPLAY_ENQUEUE.
+ *
+ ***/
+
+DEFUN_DLD (jplay_enqueue, args, nlhs,
+           "-*- texinfo -*-\n\
+@deftypefn {Loadable Function} {} jplay_enqueue(h,A).\n\
+\n\
+JPLAY_ENQUEUE Appends the frames x channels (ports) matrix A to the play queue h. The data is\n\
+copied so A can be reused. If the queue is full the function waits until a buffer has been played.\n\
+A is played directly after the previously enqueued buffer; if it is enqueued too late the gap is\n\
+filled with silence and counted as an underrun (see jplay_close).\n\
+\n\
+@copyright{} 2023 Fredrik Lingvall.\n\
+@seealso {jplay_open, jplay_close, @indicateurl{http://jackaudio.org}}\n\
+@end deftypefn")
+{
+  sighandler_t old_handler, old_handler_keyint;
+
+  octave_value_list oct_retval; // Octave return (output) parameters
+
+  int nrhs = args.length ();
+
+  if (nrhs != 2) {
+    error("jplay_enqueue requires 2 input arguments!");
+  }
+
+  if (nlhs > 0) {
+    error("jplay_enqueue don't have output arguments!");
+  }
+
+  jaudio_queue_t *q = get_queue(args(0));
+
+  if (!args(1).is_single_type() && !args(1).is_double_type()) {
+    error("2nd arg must be a single or double precision matrix!");
+  }
+
+  // Keep the matrix alive while it is copied.
+  const FloatMatrix fA = args(1).is_single_type() ? args(1).float_matrix_value() : FloatMatrix();
+  const Matrix dA = args(1).is_double_type() ? args(1).matrix_value() : Matrix();
+
+  int format = args(1).is_single_type() ? FLOAT_AUDIO : DOUBLE_AUDIO;
+  const void *data = (format == FLOAT_AUDIO) ? (const void*) fA.data() : (const void*) dA.data();
+  size_t frames = (size_t) ((format == FLOAT_AUDIO) ? fA.rows() : dA.rows());
+  size_t cols = (size_t) ((format == FLOAT_AUDIO) ? fA.cols() : dA.cols());
+
+  if (frames > 0 && cols != queue_channels(q)) {
+    error("The number of columns of A must match the number of ports of the play queue!");
+  }
+
+  // CTRL-C stops the wait for a free slot.
+  queue_interrupted = false;
+
+  if ((old_handler = signal(SIGTERM, &queue_sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if ((old_handler_keyint = signal(SIGINT, &queue_sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  int err;
+  while ((err = queue_enqueue(q, data, format, frames)) == 1 && !queue_interrupted) {
+    std::this_thread::sleep_for (std::chrono::milliseconds(5));
+  }
+
+  if (signal(SIGTERM, old_handler) == SIG_ERR) {
+    error("Couldn't register old signal handler.\n");
+  }
+
+  if (signal(SIGINT, old_handler_keyint) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if (err < 0) {
+    error("Failed to enqueue the play data (is the JACK server running)!");
+  }
+
+  if (err == 1) {
+    error("CTRL-C pressed - the play data was not enqueued!\n");
+  }
+
+  return oct_retval;
+}
+
+/***
+ *
+ * Octave (oct) gateway function for JPLAY_CLOSE.
+ *
+ ***/
+
+DEFUN_DLD (jplay_close, args, nlhs,
+           "-*- texinfo -*-\n\
+@deftypefn {Loadable Function} {} info = jplay_close(h,drain).\n\
+\n\
+JPLAY_CLOSE Closes the play queue h. If drain is true (the default) the function first waits until\n\
+all enqueued data has been played, otherwise the playback is stopped at once.\n\
+\n\
+Output argument:\n\
+\n\
+@table @samp\n\
+@item info\n\
+A struct with the fields frames (the number of frames played) and underruns (the number of JACK\n\
+periods where the queue ran dry before it was closed). If profiling was enabled in jplay_open the\n\
+field profile holds the phase times.\n\
+@end table\n\
+\n\
+@copyright{} 2023 Fredrik Lingvall.\n\
+@seealso {jplay_open, jplay_enqueue, @indicateurl{http://jackaudio.org}}\n\
+@end deftypefn")
+{
+  sighandler_t old_handler, old_handler_keyint;
+  bool drain = true;
+
+  octave_value_list oct_retval; // Octave return (output) parameters
+
+  int nrhs = args.length ();
+
+  if ( (nrhs < 1) || (nrhs > 2) ) {
+    error("jplay_close requires 1 or 2 input arguments!");
+  }
+
+  if (nlhs > 1) {
+    error("Too many output args for jplay_close!");
+  }
+
+  jaudio_queue_t *q = get_queue(args(0));
+
+  if (nrhs == 2) {
+    drain = args(1).bool_value();
+  }
+
+  // CTRL-C stops the playback.
+  queue_interrupted = false;
+
+  if ((old_handler = signal(SIGTERM, &queue_sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if ((old_handler_keyint = signal(SIGINT, &queue_sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  // Wait until we have played all data.
+  double t_wait = profile_now();
+  while (!queue_finish(q) && drain && !queue_interrupted) {
+    std::this_thread::sleep_for (std::chrono::milliseconds(50));
+  }
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+  if (signal(SIGTERM, old_handler) == SIG_ERR) {
+    error("Couldn't register old signal handler.\n");
+  }
+
+  if (signal(SIGINT, old_handler_keyint) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  octave_scalar_map info;
+  info.assign("frames", (double) queue_frames_played(q));
+  info.assign("underruns", (double) queue_underruns(q));
+
+  queues.erase((int) args(0).double_value());
+  queue_close(q);
+
+  // The profile is added last since it includes the teardown.
+  if (profile_is_enabled()) {
+    info.assign("profile", oct_profile_info());
+  }
+
+  if (nlhs == 1) {
+    oct_retval.append(info);
+  }
+
+  return oct_retval;
+}
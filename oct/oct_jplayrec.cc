@@ -28,10 +28,22 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <vector>
+#include <algorithm>
 
 #include <octave/oct.h>
 
 #include "jaudio.h"
+#include "oct_generator.h"
+#include "oct_meter.h"
+#include "oct_decimate.h"
+#include "oct_route.h"
+#include "oct_events.h"
+#include "oct_loop.h"
+#include "oct_ports.h"
+#include "oct_changes.h"
+#include "oct_xruns.h"
+#include "oct_profile.h"
 
 //
 // Macros.
@@ -83,7 +95,7 @@ void sig_keyint_handler(int signum) {
 
 DEFUN_DLD (jplayrec, args, nlhs,
            "-*- texinfo -*-\n\
-@deftypefn {Loadable Function} {} Y = jplayrec(A,jack_inputs,jack_ouputs,num_skip_buffers);\n\
+@deftypefn {Loadable Function} {} [Y,info] = jplayrec(A,jack_inputs,jack_ouputs,num_skip_buffers,opts);\n\
 \n\
 JPLAYREC Plays audio data from the input matrix A, on the jack ports given by jack_inputs and \n\
 records audio data, from the jack ports given by jack_ouputs, to the output matrix Y using the \n\
@@ -93,20 +105,82 @@ Input parameters:\n\
 \n\
 @table @samp\n\
 @item A\n\
-A frames x number of playback channels (jack ports) matrix.\n\
+A frames x number of playback channels (jack ports) matrix, or a generator struct describing a stimulus\n\
+that is synthesized in the JACK callback (played on all playback ports). The generator struct fields are:\n\
+\n\
+" OCT_GENERATOR_HELP "\
+\n\
+A can also be a sparse event-list struct, where short waveforms are placed at given frames\n\
+on given playback ports. The event-list struct fields are:\n\
+\n\
+" OCT_EVENTS_HELP "\
 @item jack_inputs\n\
 A char matrix with the JACK client input port names, for example, ['system:playback_1'; 'system:playback_2'], etc.\n\
 @item jack_ouputs\n\
 A char matrix with the JACK client output port names, for example, ['system:capture_1'; 'system:capture_2'], etc.\n\
+" OCT_PORTS_HELP "\
 @item num_skip_buffers\n\
 The number of JACK periods (buffers) to skip before saving audio data (optional).\n\
+@item opts\n\
+An optional struct with play and record options:\n\
+\n\
+@table @code\n\
+@item fs\n\
+The sample rate of A [Hz]. If it differs from the JACK sample rate the data is converted\n\
+to the JACK rate, in chunks ahead of the JACK callback, by a windowed-sinc polyphase resampler,\n\
+and Y is recorded at the JACK rate. Can't be combined with averaging. Defaults to the JACK\n\
+sample rate (no conversion).\n\
+@item filter\n\
+FIR filters applied to A while playing, either a taps x 1 vector (used for all channels), a\n\
+taps x channels matrix (one filter per channel), or a taps x output ports x channels array (MIMO)\n\
+where each output port plays the sum of all channels of A filtered by filter(:,port,channel).\n\
+The filtering is a uniformly partitioned FFT (overlap-save) convolution computed in blocks ahead\n\
+of the JACK callback, and frames + taps - 1 frames are played and recorded. Can't be combined\n\
+with generators, resampling, or averaging.\n\
+" OCT_PLAY_ROUTE_HELP "\
+" OCT_RECORD_ROUTE_HELP "\
+" OCT_LOOP_HELP "\
+Y then holds the looped (longer) stimulus.\n\
+@item monitor\n\
+A play ports x capture ports gain matrix for direct monitoring. The capture ports are mixed into\n\
+the play ports, on top of the play data, in the same JACK cycle (no extra client or latency).\n\
+@item monitor_gate\n\
+If true, the monitor is muted except while recording (after the skipped periods). Otherwise\n\
+it is open for the whole job. Defaults to true.\n\
+@item freewheel\n\
+If true, put the JACK server in freewheel mode during the play and record job so that the data\n\
+is processed as fast as the CPU allows. Only useful for software-only JACK graphs since hardware\n\
+ports are not serviced in freewheel mode. Defaults to false.\n\
+" OCT_XRUN_FILL_HELP "\
+With xrun_fill the lost frames are also skipped in A so that play and record stay aligned.\n\
+" OCT_PROFILE_HELP "\
+@item averages\n\
+Play A this many times back-to-back and return the (coherent) average of the recorded repetitions\n\
+instead of the raw recording. The repetitions are accumulated in double precision inside the\n\
+JACK callback so memory use does not depend on the number of averages. Defaults to 1 (no averaging).\n\
+@item variance\n\
+If true (and averages > 1), also compute the per-sample variance over the repetitions which is\n\
+returned in info.variance. Defaults to false.\n\
+" OCT_METER_HELP "\
+" OCT_DECIMATE_HELP "\
+Decimation can't be combined with averaging.\n\
+@end table\n\
 @end table\n\
 \n\
 Output argument:\n\
 \n\
 @table @samp\n\
 @item Y\n\
-A frames x channels single precision matrix containing the recorded audio data.\n\
+A frames x channels single precision matrix containing the recorded (or averaged) audio data.\n\
+@item info\n\
+A struct with additional information about the recording (optional). The field averages holds\n\
+the number of averaged repetitions and, if requested, the field variance the per-sample variance.\n\
+If metering is enabled the field meter holds the per-channel peak, rms, clips, peak_dbfs, and\n\
+rms_dbfs values of the raw (non-averaged) recording. If A was resampled the field fs holds the\n\
+JACK sample rate and the field underruns the number of periods where the resampler could not keep up.\n\
+If A was filtered the field underruns holds the number of periods where the convolver could not keep up.\n\
+" OCT_CHANGES_HELP "\
+" OCT_XRUNS_HELP "\
 @end table\n\
 \n\
 @copyright{} 2011,2023 Fredrik Lingvall.\n\
@@ -118,10 +192,34 @@ A frames x channels single precision matrix containing the recorded audio data.\
   float  *Y = nullptr;
   size_t frames = 0;
   sighandler_t old_handler, old_handler_abrt, old_handler_keyint;
+  jaudio_port_list_t rec_port_list, play_port_list;
   char **port_names_in = nullptr, **port_names_out = nullptr;
-  size_t buflen;
-  size_t play_channels = 0, rec_channels = 0;
+  size_t play_channels = 0, rec_channels = 0, rec_ports = 0;
   int format = FLOAT_AUDIO;
+  bool freewheel = false;
+  bool xrun_fill = true;
+  bool use_profile = false;
+  size_t num_averages = 1;
+  bool compute_variance = false;
+  bool use_meter = false, meter_display = false;
+  float clip_level = JAUDIO_METER_CLIP_LEVEL;
+  bool use_decimation = false;
+  std::vector<size_t> decimation;
+  double fs_data = 0.0;
+  jaudio_generator_t gen;
+  jaudio_resampler_t *resampler = nullptr;
+  std::vector<double> filter;
+  size_t filter_taps = 0;
+  bool filter_mimo = false;
+  jaudio_convolver_t *convolver = nullptr;
+  jaudio_events_t *events = nullptr;
+  bool looped = false;
+  size_t loop_start = 0, loop_end = 0, loop_repeats = 1;
+  Matrix play_route, record_route;
+  bool use_play_route = false, use_record_route = false;
+  size_t play_sources = 0;
+  Matrix monitor;
+  bool use_monitor = false, monitor_gate = true;
 
   octave_value_list oct_retval; // Octave return (output) parameters
 
@@ -129,11 +227,11 @@ A frames x channels single precision matrix containing the recorded audio data.\
 
   // Check for proper inputs arguments.
 
-  if ( (nrhs < 3) || (nrhs > 4) ) {
-    error("jplayrec requires 3 or 4 input arguments!");
+  if ( (nrhs < 3) || (nrhs > 5) ) {
+    error("jplayrec requires 3 to 5 input arguments!");
   }
 
-  if (nlhs > 1) {
+  if (nlhs > 2) {
     error("Too many output args for jplayrec!");
   }
 
@@ -165,6 +263,19 @@ A frames x channels single precision matrix containing the recorded audio data.\
     fA = (float*) tmp0.data();
   }
 
+  // Stimulus generator.
+  if (args(0).isstruct() && !oct_is_event_list(args(0))) {
+
+    format = GENERATOR_AUDIO;
+
+    oct_get_generator(args(0).scalar_map_value(), &gen, &frames);
+  }
+
+  // Event list (parsed below when the number of playback ports is known).
+  if (oct_is_event_list(args(0))) {
+    format = EVENT_AUDIO;
+  }
+
   if (frames < 0) {
     error("The number of audio frames (rows in arg 1) must > 0!");
     return oct_retval;
@@ -179,83 +290,288 @@ A frames x channels single precision matrix containing the recorded audio data.\
   // Input arg 2 : The jack (writable client) input audio ports.
   //
 
-  if ( !args(1).is_sq_string() ) {
-    error("2rd arg must be a string matrix !");
-    return oct_retval;
+  oct_get_port_names(args(1), JackPortIsOutput, &rec_port_list, "record ports");
+
+  // The ports we record from (one channel per port unless the ports are routed).
+  rec_ports = rec_port_list.num;
+  rec_channels = rec_ports;
+  port_names_in = rec_port_list.names.data();
+
+  //
+  // Input arg 3 : The jack (readable client) ouput audio ports.
+  //
+
+  oct_get_port_names(args(2), JackPortIsInput, &play_port_list, "playback ports");
+
+  // The ports we play on (checked against the play channels below since a
+  // MIMO filter can map the channels of A to a different number of ports).
+  size_t play_ports = play_port_list.num;
+  port_names_out = play_port_list.names.data();
+
+  // All playback ports play the generated signal or the events.
+  if (format == GENERATOR_AUDIO || format == EVENT_AUDIO) {
+    play_channels = play_ports;
   }
 
-  charMatrix ch_in = args(1).char_matrix_value();
+  //
+  // Input arg 4 : Number of JACK periods to skip on record
+  //
 
-  if ( size_t(ch_in.rows()) != play_channels ) {
-    error("The number of channels to play don't match the specified number of jack client input ports!");
+  size_t num_skip_buffers = 0;
+  if ( nrhs >= 4 && !args(3).isempty()) {
+    // Must ba a scalar
+    const Matrix tmp3 = args(3).matrix_value();
+    if (tmp3.rows() * tmp3.cols() != 1 ) {
+      error("4:th arg must be a scalar !");
+    }
+
+    num_skip_buffers = (size_t) tmp3.data()[0];
+  } else {
+    num_skip_buffers = 0;
   }
 
-  buflen = (size_t) ch_in.cols();
-  port_names_in = (char**) malloc(play_channels * sizeof(char*));
-  for ( size_t n=0; n<play_channels; n++ ) {
+  //
+  // Input arg 5 : Play and record options (optional).
+  //
+
+  if (nrhs == 5) {
+
+    if (!args(4).isstruct()) {
+      error("5:th arg must be a struct!");
+    }
+
+    const octave_scalar_map opts = args(4).scalar_map_value();
+
+    // Parsed first since the other record options are per (routed) channel.
+    if (opts.isfield("record_route")) {
+      record_route = oct_get_route(opts.getfield("record_route"), rec_ports, "record_route");
+      rec_channels = record_route.rows();
+      use_record_route = true;
+    }
+
+    if (opts.isfield("freewheel")) {
+      freewheel = opts.getfield("freewheel").bool_value();
+    }
+
+    if (opts.isfield("xrun_fill")) {
+      xrun_fill = opts.getfield("xrun_fill").bool_value();
+    }
+
+    if (opts.isfield("profile")) {
+      use_profile = opts.getfield("profile").bool_value();
+    }
+
+    if (opts.isfield("averages")) {
+      double averages = opts.getfield("averages").double_value();
+      if (averages < 1) {
+        error("opts.averages must be >= 1!");
+      }
+      num_averages = (size_t) averages;
+    }
+
+    if (opts.isfield("variance")) {
+      compute_variance = opts.getfield("variance").bool_value();
+    }
+
+    if (opts.isfield("meter")) {
+      use_meter = opts.getfield("meter").bool_value();
+    }
+
+    if (opts.isfield("clip_level")) {
+      clip_level = (float) opts.getfield("clip_level").double_value();
+    }
+
+    if (opts.isfield("meter_display")) {
+      meter_display = opts.getfield("meter_display").bool_value();
+      use_meter = use_meter || meter_display;
+    }
+
+    if (opts.isfield("decimate")) {
+      oct_get_decimation(opts.getfield("decimate"), rec_channels, decimation);
+      use_decimation = true;
+    }
+
+    if (use_decimation && num_averages > 1) {
+      error("Decimation can't be combined with averaging!");
+    }
+
+    if (opts.isfield("fs")) {
+      fs_data = opts.getfield("fs").double_value();
+
+      if (fs_data <= 0.0) {
+        error("opts.fs must be > 0!");
+      }
+
+      if (format == GENERATOR_AUDIO || format == EVENT_AUDIO) {
+        error("opts.fs can only be used with matrix play data!");
+      }
+
+      if (num_averages > 1) {
+        error("Resampling can't be combined with averaging!");
+      }
+    }
+
+    if (opts.isfield("filter")) {
+
+      if (format == GENERATOR_AUDIO || format == EVENT_AUDIO) {
+        error("opts.filter can only be used with matrix play data!");
+      }
+
+      if (fs_data > 0.0) {
+        error("Filtering can't be combined with resampling!");
+      }
+
+      if (num_averages > 1) {
+        error("Filtering can't be combined with averaging!");
+      }
 
-    port_names_in[n] = (char*) malloc(buflen*sizeof(char)+1);
+      const NDArray H = opts.getfield("filter").array_value();
+      const dim_vector dv = H.dims();
 
-    std::string strin = ch_in.row_as_string(n);
+      filter_taps = (size_t) dv(0);
+      if (filter_taps < 1) {
+        error("opts.filter must have at least one tap!");
+      }
+
+      if (dv.ndims() > 2 && dv(2) > 1) {
+
+        // A taps x ports x channels MIMO filter matrix.
+        if ((size_t) dv(1) != play_ports || (size_t) dv(2) != play_channels) {
+          error("A MIMO opts.filter must be a taps x output ports x channels (columns in A) array!");
+        }
+
+        filter_mimo = true;
+        filter.assign(H.data(), H.data() + H.numel());
+
+      } else {
+
+        // One filter for all channels or one filter per channel.
+        size_t num_filters = (size_t) dv(1);
+        if (num_filters != 1 && num_filters != play_channels) {
+          error("opts.filter must have one column or one column per channel!");
+        }
+
+        filter.resize(filter_taps * play_channels);
+        for (size_t n=0; n<play_channels; n++) {
+          const double *h = H.data() + (num_filters == 1 ? 0 : n * filter_taps);
+          std::copy(h, h + filter_taps, &filter[n * filter_taps]);
+        }
+      }
+    }
+
+    if (opts.isfield("play_route")) {
+
+      if (format == GENERATOR_AUDIO || format == EVENT_AUDIO || fs_data > 0.0 || filter_taps > 0) {
+        error("opts.play_route can only be used with (non-resampled, non-filtered) matrix play data!");
+      }
+
+      play_route = oct_get_route(opts.getfield("play_route"), play_channels, "play_route");
+      use_play_route = true;
 
-    for (size_t k=0; k<=buflen; k++ )
-      if (strin[k] != ' ')  // Cut off the string if its a whitespace char.
-        port_names_in[n][k] = strin[k];
-      else {
-        port_names_in[n][k] = '\0';
-        break;
+      if ((size_t) play_route.rows() != play_ports) {
+        error("opts.play_route must have one row per jack client input port!");
       }
+    }
+
+    if (opts.isfield("monitor")) {
 
-    port_names_in[0][buflen] = '\0';
+      monitor = oct_get_route(opts.getfield("monitor"), rec_ports, "monitor");
+      use_monitor = true;
+
+      if ((size_t) monitor.rows() != play_ports) {
+        error("opts.monitor must have one row per jack client input port!");
+      }
+    }
+
+    if (opts.isfield("monitor_gate")) {
+      monitor_gate = opts.getfield("monitor_gate").bool_value();
+    }
+
+    looped = oct_get_loop(opts, &loop_start, &loop_end, &loop_repeats);
+
+    if (looped && (format == GENERATOR_AUDIO || fs_data > 0.0 || filter_taps > 0)) {
+      error("opts.loop and opts.repeat can only be used with (non-resampled, non-filtered) matrix or event-list play data!");
+    }
+
+    if (looped && loop_repeats == JAUDIO_LOOP_FOREVER) {
+      error("opts.repeat must be finite (Y holds the whole recording)!");
+    }
   }
 
-  //
-  // Input arg 3 : The jack (readable client) ouput audio ports.
-  //
+  if (!filter_mimo && !use_play_route && play_ports != play_channels) {
+    error("The number of channels to play don't match the specified number of jack client input ports!");
+  }
 
-  if ( !args(2).is_sq_string() ) {
-    error("2rd arg must be a string matrix !");
-    return oct_retval;
+  // The sources (columns of A) are mixed to the ports in the JACK callback.
+  play_sources = play_channels;
+  if (use_play_route) {
+    play_channels = play_ports;
+  }
+
+  // Only the waveforms of the event list are stored.
+  if (format == EVENT_AUDIO) {
+    events = oct_get_events(args(0).scalar_map_value(), play_ports);
+    frames = events_get_frames(events);
   }
 
-  charMatrix ch_out = args(2).char_matrix_value();
+  // The recorded frames (the play data with the loops).
+  size_t rec_frames = frames;
+  if (looped) {
+
+    jaudio_loop_t loop;
+    if (loop_setup(&loop, frames, loop_start, (loop_end > 0) ? loop_end : frames, loop_repeats) < 0) {
+      events_destroy(events);
+      error("opts.loop must be within the rows of A!");
+    }
+
+    rec_frames = loop_get_frames(&loop);
+  }
+
+  //
+  // Resample the play data if it isn't at the JACK sample rate.
+  //
 
-  rec_channels = ch_out.rows();
+  double fs_jack = 0.0;
+  if (fs_data > 0.0) {
 
-  buflen = ch_out.cols();
-  port_names_out = (char**) malloc(rec_channels * sizeof(char*));
-  for ( size_t n=0; n<rec_channels; n++ ) {
+    fs_jack = (double) jaudio_get_server_sample_rate("octave:jplayrec_fs");
+    if (fs_jack <= 0.0) {
+      error("Failed to get the JACK sample rate!");
+    }
 
-    port_names_out[n] = (char*) malloc(buflen*sizeof(char)+1);
+    if (fs_data != fs_jack) {
 
-    std::string strin = ch_out.row_as_string(n);
+      const void *data = (format == FLOAT_AUDIO) ? (const void*) fA : (const void*) dA;
 
-    for (size_t k=0; k<=buflen; k++ )
-      if (strin[k] != ' ')  // Cut off the string if its a whitespace char.
-        port_names_out[n][k] = strin[k];
-      else {
-        port_names_out[n][k] = '\0';
-        break;
+      resampler = resampler_create(data, format, frames, play_channels, fs_data, fs_jack);
+      if (!resampler) {
+        error("Failed to create the resampler!");
       }
 
-    port_names_out[0][buflen] = '\0';
+      // Play and record the resampled length.
+      format = RESAMPLED_AUDIO;
+      frames = resampler_get_frames(resampler);
+    }
   }
 
   //
-  // Input arg 4 : Number of JACK periods to skip on record
+  // Filter the play data (in blocks ahead of the JACK callback).
   //
 
-  size_t num_skip_buffers = 0;
-  if ( nrhs ==  4) {
-    // Must ba a scalar
-    const Matrix tmp3 = args(3).matrix_value();
-    if (tmp3.rows() * tmp3.cols() != 1 ) {
-      error("4:th arg must be a scalar !");
+  if (filter_taps > 0) {
+
+    const void *data = (format == FLOAT_AUDIO) ? (const void*) fA : (const void*) dA;
+
+    convolver = convolver_create(data, format, frames, play_channels,
+                                 filter.data(), filter_taps, play_ports, filter_mimo);
+    if (!convolver) {
+      error("Failed to create the convolver!");
     }
 
-    num_skip_buffers = (size_t) tmp3.data()[0];
-  } else {
-    num_skip_buffers = 0;
+    // Play and record the full convolution length (frames + taps - 1).
+    format = CONVOLVED_AUDIO;
+    frames = convolver_get_frames(convolver);
+    play_channels = play_ports;
   }
 
   //
@@ -275,12 +591,45 @@ A frames x channels single precision matrix containing the recorded audio data.\
   }
 
   // Allocate memory for the output arg.
-  FloatMatrix Ymat( (octave_idx_type) frames, rec_channels);
+  FloatMatrix Ymat;
+  if (use_decimation) {
+    // The decimated channels are stored after each other.
+    Ymat = oct_decimation_buffer(rec_frames, decimation);
+  } else {
+    Ymat = FloatMatrix( (octave_idx_type) rec_frames, rec_channels);
+  }
   Y = (float*) Ymat.data();
 
   // Set status to running (CTRL-C will clear the flag and stop play/capture).
   playrec_set_running_flag();
 
+  // Synchronous averaging (a no-op for a single repetition).
+  compute_variance = compute_variance && (num_averages > 1);
+  playrec_set_averaging(num_averages, compute_variance);
+
+  // Per-channel level metering in the JACK callback.
+  playrec_set_meter(use_meter, clip_level);
+  std::vector<jaudio_meter_stats_t> meter_stats(rec_channels);
+
+  // Anti-alias filtering and downsampling.
+  playrec_set_decimation(use_decimation ? decimation.data() : nullptr);
+
+  // Routing (gain) matrices.
+  playrec_set_play_routing(use_play_route ? play_route.data() : nullptr, play_sources);
+  playrec_set_record_routing(use_record_route ? record_route.data() : nullptr, rec_channels);
+
+  // Direct (input to output) monitoring.
+  playrec_set_monitor(use_monitor ? monitor.data() : nullptr, monitor_gate);
+
+  // Loop points (the play data is only stored once).
+  playrec_set_loop(loop_start, loop_end, loop_repeats);
+
+  // Skip the frames lost in xruns in the play data and record zeros (or continue).
+  playrec_set_xrun_fill(xrun_fill);
+
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
   if (format == DOUBLE_AUDIO) {
 
     const Matrix tmp0 = args(0).matrix_value();
@@ -289,10 +638,70 @@ A frames x channels single precision matrix containing the recorded audio data.\
     // Init playback and connect to the jack input ports.
     if (playrec_init(dA, DOUBLE_AUDIO,
                      play_channels, port_names_out,
-                     Y, rec_channels, port_names_in,
+                     Y, rec_ports, port_names_in,
+                     frames,
+                     "octave:jplayrec",
+                     num_skip_buffers,
+                     freewheel) < 0) {
+      error("jplayrec init failed!");
+    }
+  }
+
+  if (format == GENERATOR_AUDIO) {
+
+    // Init generated playback and record and connect to the jack ports.
+    if (playrec_init(&gen, GENERATOR_AUDIO,
+                     play_channels, port_names_out,
+                     Y, rec_ports, port_names_in,
                      frames,
                      "octave:jplayrec",
-                     num_skip_buffers) < 0) {
+                     num_skip_buffers,
+                     freewheel) < 0) {
+      error("jplayrec init failed!");
+    }
+  }
+
+  if (format == RESAMPLED_AUDIO) {
+
+    // Init resampled playback and record and connect to the jack ports.
+    if (playrec_init(resampler, RESAMPLED_AUDIO,
+                     play_channels, port_names_out,
+                     Y, rec_ports, port_names_in,
+                     frames,
+                     "octave:jplayrec",
+                     num_skip_buffers,
+                     freewheel) < 0) {
+      resampler_destroy(resampler);
+      error("jplayrec init failed!");
+    }
+  }
+
+  if (format == CONVOLVED_AUDIO) {
+
+    // Init filtered playback and record and connect to the jack ports.
+    if (playrec_init(convolver, CONVOLVED_AUDIO,
+                     play_channels, port_names_out,
+                     Y, rec_ports, port_names_in,
+                     frames,
+                     "octave:jplayrec",
+                     num_skip_buffers,
+                     freewheel) < 0) {
+      convolver_destroy(convolver);
+      error("jplayrec init failed!");
+    }
+  }
+
+  if (format == EVENT_AUDIO) {
+
+    // Init event-list playback and record and connect to the jack ports.
+    if (playrec_init(events, EVENT_AUDIO,
+                     play_channels, port_names_out,
+                     Y, rec_ports, port_names_in,
+                     frames,
+                     "octave:jplayrec",
+                     num_skip_buffers,
+                     freewheel) < 0) {
+      events_destroy(events);
       error("jplayrec init failed!");
     }
   }
@@ -306,26 +715,108 @@ A frames x channels single precision matrix containing the recorded audio data.\
 
     if (playrec_init(fA, FLOAT_AUDIO,
                      play_channels, port_names_out,
-                     Y, rec_channels, port_names_in,
+                     Y, rec_ports, port_names_in,
                      frames,
                      "octave:jplayrec",
-                     num_skip_buffers) < 0) {
+                     num_skip_buffers,
+                     freewheel) < 0) {
 
       error("jplayrec init failed!");
     }
   }
 
-  // Wait for both playback and record to finish.
+  // Wait for both playback and record to finish (poll often when
+  // freewheeling since the job then runs faster than real-time).
+  size_t polls = 0;
+  double t_wait = profile_now();
   while( !playrec_finished() && playrec_is_running() ) {
-    std::this_thread::sleep_for (std::chrono::milliseconds(50));
+    std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+
+    if (meter_display && !freewheel && (++polls % 4) == 0) {
+      playrec_get_meter(meter_stats.data());
+      oct_meter_print(meter_stats.data(), rec_channels);
+    }
+  }
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+  if (meter_display) {
+    std::cout << std::endl;
+  }
+
+  // Read the final meter statistics before the meter is freed.
+  if (use_meter) {
+    playrec_get_meter(meter_stats.data());
+  }
+
+  // Likewise the buffer-size and sample-rate change points.
+  std::vector<jaudio_period_change_t> period_changes(JAUDIO_MAX_PERIOD_CHANGES);
+  size_t num_period_changes = playrec_get_period_changes(period_changes.data());
+
+  std::vector<jaudio_xrun_t> xruns(JAUDIO_MAX_XRUNS);
+  size_t num_xruns = playrec_get_xruns(xruns.data());
+
+  // Compute the average (and variance) before the sum buffers are freed.
+  FloatMatrix Vmat;
+  if (num_averages > 1) {
+
+    if (compute_variance) {
+      Vmat = FloatMatrix( (octave_idx_type) rec_frames, rec_channels);
+    }
+
+    playrec_get_average(Y, compute_variance ? (float*) Vmat.data() : nullptr);
   }
 
   // Close all jack ports and the client.
   playrec_close(play_channels, port_names_out,
-                rec_channels, port_names_in);
+                rec_ports, port_names_in);
 
   // Append the output data.
-  oct_retval.append(Ymat);
+  if (use_decimation) {
+    oct_retval.append(oct_decimation_output(Ymat, rec_frames, decimation));
+  } else {
+    oct_retval.append(Ymat);
+  }
+
+  if (nlhs == 2) {
+
+    octave_scalar_map info;
+
+    info.assign("averages", (double) num_averages);
+    if (compute_variance) {
+      info.assign("variance", Vmat);
+    }
+
+    if (use_meter) {
+      info.assign("meter", oct_meter_info(meter_stats.data(), rec_channels));
+    }
+
+    if (resampler) {
+      info.assign("fs", fs_jack);
+      info.assign("underruns", (double) resampler_underruns(resampler));
+    }
+
+    if (convolver) {
+      info.assign("underruns", (double) convolver_underruns(convolver));
+    }
+
+    if (num_period_changes > 0) {
+      info.assign("period_changes", oct_period_changes(period_changes.data(), num_period_changes));
+    }
+
+    if (num_xruns > 0) {
+      info.assign("xruns", oct_xruns(xruns.data(), num_xruns));
+    }
+
+    if (use_profile) {
+      info.assign("profile", oct_profile_info());
+    }
+
+    oct_retval.append(info);
+  }
+
+  resampler_destroy(resampler);
+  convolver_destroy(convolver);
+  events_destroy(events);
 
   //
   // Restore old signal handlers.
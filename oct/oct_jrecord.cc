@@ -28,10 +28,19 @@
 
 #include <iostream>
 #include <thread>
+#include <vector>
+#include <string>
 
 #include <octave/oct.h>
 
 #include "jaudio.h"
+#include "oct_meter.h"
+#include "oct_decimate.h"
+#include "oct_route.h"
+#include "oct_ports.h"
+#include "oct_changes.h"
+#include "oct_xruns.h"
+#include "oct_profile.h"
 
 //
 // Macros.
@@ -83,7 +92,7 @@ void sig_keyint_handler(int signum) {
 
 DEFUN_DLD (jrecord, args, nlhs,
            "-*- texinfo -*-\n\
-@deftypefn {Loadable Function} {} Y = jrecord(frames, jack_inputs).\n\
+@deftypefn {Loadable Function} {} [Y,info] = jrecord(frames, jack_inputs, opts).\n\
 \n\
 JRECORD Records audio data to the output matrix Y using the (low-latency) audio server JACK.\n\
 \n\
@@ -95,13 +104,60 @@ A scalar that specifies the number of frames to record/channel.\n\
 \n\
 @item jack_ouputs\n\
 A char matrix with the JACK client input port names, for example, ['system:capture_1'; 'system:capture_2'], etc.\n\
+" OCT_PORTS_HELP "\
+\n\
+@item opts\n\
+An optional struct with capture options:\n\
+\n\
+@table @code\n\
+@item freewheel\n\
+If true, put the JACK server in freewheel mode while recording so that the data is processed\n\
+as fast as the CPU allows. Only useful for software-only JACK graphs since hardware ports are\n\
+not serviced in freewheel mode. Defaults to false.\n\
+" OCT_XRUN_FILL_HELP "\
+" OCT_PROFILE_HELP "\
+" OCT_RECORD_ROUTE_HELP "\
+" OCT_METER_HELP "\
+" OCT_DECIMATE_HELP "\
+@item stft\n\
+A struct that selects spectrogram capture: the captured periods are analyzed by a short-time\n\
+Fourier transform in a worker thread, while recording, and only the power spectra are returned.\n\
+The fields are nfft (the window length, a power of two, default 1024), hop (the number of frames\n\
+between windows, default nfft/2), window ('hann' (default), 'hamming', 'rect', or a vector with\n\
+nfft coefficients), bands (an optional vector of band edges [Hz] to sum the power in bands),\n\
+and db (if true return the power in dB, default false).\n\
+@item beamform\n\
+A struct that selects delay-and-sum beamforming: a worker thread, fed from the JACK callback,\n\
+computes the beams while recording. The fields are delays (a channels x beams matrix with the\n\
+per-channel delays [frames], which may be fractional, for each beam), weights (a channels x beams\n\
+matrix, default 1/channels), threads (the number of worker threads, default 1), and raw (if true\n\
+also return the raw channels, default false). Y is then a frames x beams matrix, or, with raw\n\
+set, the raw recording with the beams in info.beams. Can't be combined with stft or decimate.\n\
+@item tap\n\
+The name of a POSIX shared-memory object, for example '/jrecord', where the recorded channels\n\
+are published, period by period, while recording. Other local processes can then read the live\n\
+capture from the object (see jaudio_tap_header_t in jaudio.h for the layout) without opening\n\
+JACK clients of their own. The object is removed when jrecord returns.\n\
+@item tap_frames\n\
+The length of the shared-memory ring [frames per channel]. Defaults to one second.\n\
+@end table\n\
 @end table\n\
 \n\
 Output argument:\n\
 \n\
 @table @samp\n\
 @item Y\n\
-A frames x channels single precision matrix containing the recorded audio data.\n\
+A frames x channels single precision matrix containing the recorded audio data or, in spectrogram\n\
+mode, a (nfft/2+1 or number of bands) x spectral frames x channels array with the power spectra.\n\
+@item info\n\
+A struct with additional information about the recording (optional). If metering is enabled\n\
+the field meter holds the per-channel peak, rms, clips, peak_dbfs, and rms_dbfs values. In\n\
+spectrogram mode the fields freqs (bin frequencies or band edges [Hz]), times (window center\n\
+times [s]), overruns (the number of periods with frames dropped since the analysis could not keep up),\n\
+and dropped_frames (the number of dropped frames, which are analyzed as zeros) are set.\n\
+When beamforming the fields overruns and dropped_frames are set likewise, and the field beams if raw is set.\n\
+" OCT_CHANGES_HELP "\
+" OCT_XRUNS_HELP "\
 @end table\n\
 \n\
 @copyright{} 2011-2023 Fredrik Lingvall.\n\
@@ -109,11 +165,28 @@ A frames x channels single precision matrix containing the recorded audio data.\
 @end deftypefn")
 {
   float *Y;
-  octave_idx_type n, frames;
+  octave_idx_type frames;
   sighandler_t old_handler, old_handler_abrt, old_handler_keyint;
-  char **port_names;
-  octave_idx_type buflen;
-  octave_idx_type channels;
+  jaudio_port_list_t port_list;
+  octave_idx_type channels, ports;
+  bool freewheel = false;
+  bool xrun_fill = true;
+  bool use_profile = false;
+  bool use_meter = false, meter_display = false;
+  float clip_level = JAUDIO_METER_CLIP_LEVEL;
+  bool use_stft = false;
+  jaudio_stft_config_t stft_cfg;
+  std::vector<float> stft_window;
+  std::vector<double> stft_bands;
+  bool use_decimation = false;
+  std::vector<size_t> decimation;
+  bool use_beamform = false, beamform_raw = false;
+  jaudio_beamform_config_t beamform_cfg;
+  Matrix beamform_delays, beamform_weights;
+  Matrix record_route;
+  bool use_route = false;
+  std::string tap_name;
+  size_t tap_frames = 0;
 
   octave_value_list oct_retval; // Octave return (output) parameters
 
@@ -121,12 +194,12 @@ A frames x channels single precision matrix containing the recorded audio data.\
 
   // Check for proper inputs arguments.
 
-  if (nrhs != 2) {
-    error("jrecord requires 2 input arguments!");
+  if ( (nrhs < 2) || (nrhs > 3) ) {
+    error("jrecord requires 2 or 3 input arguments!");
     return oct_retval;
   }
 
-  if (nlhs > 1) {
+  if (nlhs > 2) {
     error("Too many output args for jrecord!");
     return oct_retval;
   }
@@ -152,32 +225,245 @@ A frames x channels single precision matrix containing the recorded audio data.\
   // Input arg 2 : The jack (readable client) ouput audio ports.
   //
 
-  if ( !args(1).is_sq_string() ) {
-    error("2rd arg must be a string matrix !");
-    return oct_retval;
-  }
+  oct_get_port_names(args(1), JackPortIsOutput, &port_list, "record ports");
+
+  // One channel per port unless the ports are routed.
+  ports = port_list.num;
+  channels = ports;
+
+  //
+  // Input arg 3 : Capture options (optional).
+  //
+
+  if (nrhs == 3) {
+
+    if (!args(2).isstruct()) {
+      error("3rd arg must be a struct!");
+      return oct_retval;
+    }
+
+    const octave_scalar_map opts = args(2).scalar_map_value();
+
+    // Parsed first since the other options are per (routed) channel.
+    if (opts.isfield("record_route")) {
+      record_route = oct_get_route(opts.getfield("record_route"), ports, "record_route");
+      channels = record_route.rows();
+      use_route = true;
+    }
+
+    if (opts.isfield("freewheel")) {
+      freewheel = opts.getfield("freewheel").bool_value();
+    }
+
+    if (opts.isfield("xrun_fill")) {
+      xrun_fill = opts.getfield("xrun_fill").bool_value();
+    }
+
+    if (opts.isfield("profile")) {
+      use_profile = opts.getfield("profile").bool_value();
+    }
+
+    if (opts.isfield("meter")) {
+      use_meter = opts.getfield("meter").bool_value();
+    }
+
+    if (opts.isfield("clip_level")) {
+      clip_level = (float) opts.getfield("clip_level").double_value();
+    }
+
+    if (opts.isfield("meter_display")) {
+      meter_display = opts.getfield("meter_display").bool_value();
+      use_meter = use_meter || meter_display;
+    }
+
+    if (opts.isfield("decimate")) {
+      oct_get_decimation(opts.getfield("decimate"), channels, decimation);
+      use_decimation = true;
+    }
+
+    if (opts.isfield("stft")) {
 
-  charMatrix ch = args(1).char_matrix_value();
+      if (!opts.getfield("stft").isstruct()) {
+        error("opts.stft must be a struct!");
+        return oct_retval;
+      }
+
+      const octave_scalar_map stft = opts.getfield("stft").scalar_map_value();
+
+      use_stft = true;
+      memset(&stft_cfg, 0x0, sizeof(jaudio_stft_config_t));
+      stft_cfg.window_frames = 1024;
+      stft_cfg.window_type = JAUDIO_WIN_HANN;
+
+      if (stft.isfield("nfft")) {
+        stft_cfg.window_frames = (size_t) stft.getfield("nfft").double_value();
+      }
+
+      if (stft_cfg.window_frames < 2 || (stft_cfg.window_frames & (stft_cfg.window_frames-1)) != 0) {
+        error("opts.stft.nfft must be a power of two!");
+        return oct_retval;
+      }
+
+      stft_cfg.hop_frames = stft_cfg.window_frames / 2;
+      if (stft.isfield("hop")) {
+        if (stft.getfield("hop").double_value() < 1) {
+          error("opts.stft.hop must be >= 1!");
+          return oct_retval;
+        }
+        stft_cfg.hop_frames = (size_t) stft.getfield("hop").double_value();
+      }
+
+      if (stft.isfield("window")) {
+
+        const octave_value win = stft.getfield("window");
+
+        if (win.is_string()) {
+
+          std::string type = win.string_value();
+          if (type == "hann" || type == "hanning") {
+            stft_cfg.window_type = JAUDIO_WIN_HANN;
+          } else if (type == "hamming") {
+            stft_cfg.window_type = JAUDIO_WIN_HAMMING;
+          } else if (type == "rect" || type == "boxcar") {
+            stft_cfg.window_type = JAUDIO_WIN_RECT;
+          } else {
+            error("Unknown opts.stft.window type '%s'!", type.c_str());
+            return oct_retval;
+          }
+
+        } else {
+
+          const Matrix w = win.matrix_value();
+          if ((size_t) w.numel() != stft_cfg.window_frames) {
+            error("opts.stft.window must have nfft coefficients!");
+            return oct_retval;
+          }
 
-  channels = ch.rows();
+          stft_window.resize(stft_cfg.window_frames);
+          for (size_t k=0; k<stft_cfg.window_frames; k++) {
+            stft_window[k] = (float) w.data()[k];
+          }
 
-  buflen = ch.cols();
-  port_names = (char**) malloc(channels * sizeof(char*));
-  for ( n=0; n<channels; n++ ) {
+          stft_cfg.window_type = JAUDIO_WIN_CUSTOM;
+          stft_cfg.window_coeffs = stft_window.data();
+        }
+      }
+
+      if (stft.isfield("bands") && !stft.getfield("bands").isempty()) {
+
+        const Matrix b = stft.getfield("bands").matrix_value();
+        if (b.numel() < 2) {
+          error("opts.stft.bands must have at least two band edges!");
+          return oct_retval;
+        }
+
+        stft_bands.assign(b.data(), b.data() + b.numel());
+        for (size_t k=1; k<stft_bands.size(); k++) {
+          if (stft_bands[k] <= stft_bands[k-1]) {
+            error("The opts.stft.bands edges must be increasing!");
+            return oct_retval;
+          }
+        }
 
-    port_names[n] = (char*) malloc(buflen*sizeof(char)+1);
+        stft_cfg.num_bands = stft_bands.size() - 1;
+        stft_cfg.band_edges_hz = stft_bands.data();
+      }
+
+      if (stft.isfield("db")) {
+        stft_cfg.db = stft.getfield("db").bool_value();
+      }
+    }
 
-    std::string strin = ch.row_as_string(n);
+    if (opts.isfield("tap")) {
 
-    for (int k=0; k<=buflen; k++ )
-      if (strin[k] != ' ')  // Cut off the string if its a whitespace char.
-        port_names[n][k] = strin[k];
-      else {
-        port_names[n][k] = '\0';
-        break;
+      if (!opts.getfield("tap").is_string()) {
+        error("opts.tap must be a string!");
+        return oct_retval;
       }
 
-    port_names[0][buflen] = '\0';
+      tap_name = opts.getfield("tap").string_value();
+
+      // POSIX shared-memory object names start with a slash.
+      if (tap_name.empty() || tap_name[0] != '/') {
+        tap_name = "/" + tap_name;
+      }
+    }
+
+    if (opts.isfield("tap_frames")) {
+      double tf = opts.getfield("tap_frames").double_value();
+      if (tf < 1.0) {
+        error("opts.tap_frames must be >= 1!");
+        return oct_retval;
+      }
+      tap_frames = (size_t) tf;
+    }
+
+    if (opts.isfield("beamform")) {
+
+      if (!opts.getfield("beamform").isstruct()) {
+        error("opts.beamform must be a struct!");
+        return oct_retval;
+      }
+
+      const octave_scalar_map bf = opts.getfield("beamform").scalar_map_value();
+
+      if (!bf.isfield("delays")) {
+        error("opts.beamform.delays is required!");
+        return oct_retval;
+      }
+
+      beamform_delays = bf.getfield("delays").matrix_value();
+      if (beamform_delays.rows() != channels || beamform_delays.cols() < 1) {
+        error("opts.beamform.delays must be a channels x beams matrix!");
+        return oct_retval;
+      }
+
+      for (octave_idx_type k=0; k<beamform_delays.numel(); k++) {
+        if (beamform_delays.data()[k] < 0.0) {
+          error("The opts.beamform.delays must be >= 0!");
+          return oct_retval;
+        }
+      }
+
+      use_beamform = true;
+      memset(&beamform_cfg, 0x0, sizeof(jaudio_beamform_config_t));
+      beamform_cfg.num_beams = (size_t) beamform_delays.cols();
+      beamform_cfg.delays = beamform_delays.data();
+      beamform_cfg.num_threads = 1;
+
+      if (bf.isfield("weights")) {
+        beamform_weights = bf.getfield("weights").matrix_value();
+        if (beamform_weights.rows() != beamform_delays.rows() ||
+            beamform_weights.cols() != beamform_delays.cols()) {
+          error("opts.beamform.weights must have the same size as opts.beamform.delays!");
+          return oct_retval;
+        }
+        beamform_cfg.weights = beamform_weights.data();
+      }
+
+      if (bf.isfield("threads")) {
+        double threads = bf.getfield("threads").double_value();
+        if (threads < 1) {
+          error("opts.beamform.threads must be >= 1!");
+          return oct_retval;
+        }
+        beamform_cfg.num_threads = (size_t) threads;
+      }
+
+      if (bf.isfield("raw")) {
+        beamform_raw = bf.getfield("raw").bool_value();
+      }
+    }
+  }
+
+  if (use_stft && use_decimation) {
+    error("Decimation can't be combined with spectrogram capture!");
+    return oct_retval;
+  }
+
+  if (use_beamform && (use_stft || use_decimation)) {
+    error("Beamforming can't be combined with spectrogram capture or decimation!");
+    return oct_retval;
   }
 
   //
@@ -200,25 +486,164 @@ A frames x channels single precision matrix containing the recorded audio data.\
   // Allocate memory for the output arg.
   //
 
-  FloatMatrix Ymat(frames, channels);
-  Y = (float*) Ymat.data();
+  FloatMatrix Ymat;
+  FloatNDArray Smat;
+  FloatMatrix Bmat;
+
+  if (use_stft) {
+    // Only the spectral frames are stored.
+    dim_vector dims((octave_idx_type) stft_num_features(&stft_cfg),
+                    (octave_idx_type) stft_num_frames(&stft_cfg, frames), channels);
+    Smat = FloatNDArray(dims, 0.0f);
+    Y = (float*) Smat.data();
+  } else if (use_decimation) {
+    // The decimated channels are stored after each other.
+    Ymat = oct_decimation_buffer(frames, decimation);
+    Y = (float*) Ymat.data();
+  } else if (use_beamform && !beamform_raw) {
+    // Only the beams are stored.
+    Ymat = FloatMatrix(frames, (octave_idx_type) beamform_cfg.num_beams);
+    Y = (float*) Ymat.data();
+  } else {
+    Ymat = FloatMatrix(frames, channels);
+    Y = (float*) Ymat.data();
+  }
 
   // Set status to running (CTRL-C will clear the flag and stop capture).
   record_set_running_flag();
 
+  // Per-channel level metering in the JACK callback.
+  record_set_meter(use_meter, clip_level);
+  std::vector<jaudio_meter_stats_t> meter_stats(channels);
+
+  // Mix the ports to the recorded channels.
+  record_set_routing(use_route ? record_route.data() : nullptr, (size_t) channels);
+
+  // Spectrogram capture.
+  record_set_stft(use_stft ? &stft_cfg : nullptr);
+
+  // Anti-alias filtering and downsampling.
+  record_set_decimation(use_decimation ? decimation.data() : nullptr);
+
+  // Delay-and-sum beamforming (into a separate buffer when the raw channels are kept).
+  if (use_beamform && beamform_raw) {
+    Bmat = FloatMatrix(frames, (octave_idx_type) beamform_cfg.num_beams);
+  }
+  record_set_beamform(use_beamform ? &beamform_cfg : nullptr,
+                      beamform_raw ? (float*) Bmat.data() : nullptr);
+
+  // Live tap for other local processes.
+  record_set_tap(tap_name.empty() ? nullptr : tap_name.c_str(), tap_frames);
+
+  // Record zeros for the frames lost in xruns (or skip them).
+  record_set_xrun_fill(xrun_fill);
+
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
   // Init and connect to the output ports.
-  if (record_init(Y, frames, channels, port_names, "octave:jrecord") < 0) {
+  if (record_init(Y, frames, ports, port_list.names.data(), "octave:jrecord", freewheel) < 0) {
     return oct_retval;
   }
 
-  // Wait until we have recorded all data.
+  // Wait until we have recorded all data (poll often when freewheeling
+  // since the data then is produced much faster than in real-time).
+  size_t polls = 0;
+  double t_wait = profile_now();
   while(!record_finished() && record_is_running() ) {
-    std::this_thread::sleep_for (std::chrono::milliseconds(50));
+    std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+
+    if (meter_display && !freewheel && (++polls % 4) == 0) {
+      record_get_meter(meter_stats.data());
+      oct_meter_print(meter_stats.data(), channels);
+    }
+  }
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+  if (meter_display) {
+    std::cout << std::endl;
+  }
+
+  // Read the final meter statistics before the meter is freed.
+  if (use_meter) {
+    record_get_meter(meter_stats.data());
   }
 
+  double fs = (double) record_get_sample_rate();
+  size_t stft_overruns = record_get_stft_overruns();
+  size_t stft_dropped = record_get_stft_frames_dropped();
+  size_t beamform_overruns = record_get_beamform_overruns();
+  size_t beamform_dropped = record_get_beamform_frames_dropped();
+
+  std::vector<jaudio_period_change_t> period_changes(JAUDIO_MAX_PERIOD_CHANGES);
+  size_t num_period_changes = record_get_period_changes(period_changes.data());
+
+  std::vector<jaudio_xrun_t> xruns(JAUDIO_MAX_XRUNS);
+  size_t num_xruns = record_get_xruns(xruns.data());
+
   if (record_is_running()) {
     // Append the output matrix.
-    oct_retval.append(Ymat);
+    if (use_stft) {
+      oct_retval.append(Smat);
+    } else if (use_decimation) {
+      oct_retval.append(oct_decimation_output(Ymat, frames, decimation));
+    } else {
+      oct_retval.append(Ymat);
+    }
+
+    if (nlhs == 2) {
+
+      octave_scalar_map info;
+
+      if (use_meter) {
+        info.assign("meter", oct_meter_info(meter_stats.data(), channels));
+      }
+
+      if (use_stft) {
+
+        Matrix freqs;
+        if (stft_cfg.num_bands > 0) {
+          freqs = Matrix(stft_bands.size(), 1);
+          for (size_t k=0; k<stft_bands.size(); k++) {
+            freqs(k) = stft_bands[k];
+          }
+        } else {
+          freqs = Matrix(stft_cfg.window_frames/2 + 1, 1);
+          for (size_t k=0; k<=stft_cfg.window_frames/2; k++) {
+            freqs(k) = (double) k * fs / (double) stft_cfg.window_frames;
+          }
+        }
+
+        size_t num_frames = stft_num_frames(&stft_cfg, frames);
+        Matrix times(1, num_frames);
+        for (size_t k=0; k<num_frames; k++) {
+          times(k) = ((double) (k*stft_cfg.hop_frames) + 0.5 * (double) stft_cfg.window_frames) / fs;
+        }
+
+        info.assign("freqs", freqs);
+        info.assign("times", times);
+        info.assign("overruns", (double) stft_overruns);
+        info.assign("dropped_frames", (double) stft_dropped);
+      }
+
+      if (use_beamform) {
+        if (beamform_raw) {
+          info.assign("beams", Bmat);
+        }
+        info.assign("overruns", (double) beamform_overruns);
+        info.assign("dropped_frames", (double) beamform_dropped);
+      }
+
+      if (num_period_changes > 0) {
+        info.assign("period_changes", oct_period_changes(period_changes.data(), num_period_changes));
+      }
+
+      if (num_xruns > 0) {
+        info.assign("xruns", oct_xruns(xruns.data(), num_xruns));
+      }
+
+      oct_retval.append(info);
+    }
   }
 
   //
@@ -227,14 +652,11 @@ A frames x channels single precision matrix containing the recorded audio data.\
 
   record_close();
 
-  for ( n=0; n<channels; n++ ) {
-    if (port_names[n]) {
-      free(port_names[n]);
-    }
-  }
-
-  if (port_names) {
-    free(port_names);
+  // The profile is added last since it includes the teardown.
+  if (use_profile && oct_retval.length() == 2) {
+    octave_scalar_map info = oct_retval(1).scalar_map_value();
+    info.assign("profile", oct_profile_info());
+    oct_retval(1) = info;
   }
 
   //
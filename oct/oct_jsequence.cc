@@ -0,0 +1,433 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <signal.h>
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+#include "oct_ports.h"
+#include "oct_profile.h"
+#include "oct_changes.h"
+
+//
+// Function prototypes.
+//
+
+void sighandler(int signum);
+std::vector<size_t> get_port_indices(const octave_scalar_map &job, const char *name,
+                                     size_t num_ports, size_t job_no);
+
+/***
+ *
+ * Signal handlers.
+ *
+ ***/
+
+void sighandler(int signum) {
+  //printf("Caught signal SIGTERM.\n");
+  sequence_clear_running_flag();
+}
+
+/***
+ *
+ * Port index helper.
+ *
+ ***/
+
+// Read a (one based) port index vector from a job struct and convert it to zero based indices.
+std::vector<size_t> get_port_indices(const octave_scalar_map &job, const char *name,
+                                     size_t num_ports, size_t job_no)
+{
+  std::vector<size_t> indices;
+
+  if (job.isfield(name) && !job.getfield(name).isempty()) {
+
+    const Matrix idx = job.getfield(name).matrix_value();
+
+    for (octave_idx_type n=0; n<idx.numel(); n++) {
+
+      double i = idx.data()[n];
+      if (i < 1 || i > (double) num_ports) {
+        error("Job %d: the %s indices must be >= 1 and <= %d!", (int) job_no, name, (int) num_ports);
+      }
+
+      indices.push_back((size_t) i - 1);
+    }
+  }
+
+  return indices;
+}
+
+/***
+ *
+ * Octave (oct) gateway function for JSEQUENCE.
+ *
+ ***/
+
+DEFUN_DLD (jsequence, args, nlhs,
+           "-*- texinfo -*-\n\
+@deftypefn {Loadable Function} {} [Y,info] = jsequence(jobs,jack_outputs,jack_inputs,num_skip_buffers,opts);\n\
+\n\
+JSEQUENCE Plays and records a list of jobs back-to-back, without gaps between the jobs (unless\n\
+requested), using one JACK client session. Compared to calling jplayrec in a loop there is no\n\
+per job client setup and the timing between the jobs is exact to the frame.\n\
+\n\
+Input parameters:\n\
+\n\
+@table @samp\n\
+@item jobs\n\
+A struct array, or a cell array of stimulus matrices, describing the jobs. Each job struct has the fields:\n\
+\n\
+@table @code\n\
+@item A\n\
+A frames x channels stimulus matrix (single or double precision).\n\
+@item ref\n\
+Index of an earlier job whose stimulus is reused (instead of A). Optional.\n\
+@item play_ch\n\
+Indices into jack_inputs of the ports the stimulus columns are played on. Defaults to 1:columns(A).\n\
+@item rec_ch\n\
+Indices into jack_outputs of the ports to record. Defaults to all ports.\n\
+@item reps\n\
+The number of times the stimulus is repeated. Defaults to 1.\n\
+@item gap\n\
+The number of frames of silence after the job. Defaults to 0.\n\
+@end table\n\
+@item jack_outputs\n\
+A char matrix with the JACK client output port names to record from, for example, ['system:capture_1'; 'system:capture_2'], etc.\n\
+@item jack_inputs\n\
+A char matrix with the JACK client input port names to play on, for example, ['system:playback_1'; 'system:playback_2'], etc.\n\
+" OCT_PORTS_HELP "\
+@item num_skip_buffers\n\
+The number of JACK periods (buffers) the recording lags the playback (optional).\n\
+@item opts\n\
+An optional struct with the fields freewheel and profile (see jplayrec).\n\
+@end table\n\
+\n\
+Output arguments:\n\
+\n\
+@table @samp\n\
+@item Y\n\
+A cell array with one (frames*reps) x numel(rec_ch) single precision matrix per job.\n\
+@item info\n\
+A struct with additional information about the sequence (optional). If profiling is enabled\n\
+the field profile holds the phase times.\n\
+" OCT_CHANGES_HELP "\
+@end table\n\
+\n\
+@copyright{} 2023 Fredrik Lingvall.\n\
+@seealso {jinfo, jplay, jrecord, jplayrec, @indicateurl{http://jackaudio.org}}\n\
+@end deftypefn")
+{
+  sighandler_t old_handler, old_handler_abrt, old_handler_keyint;
+  size_t play_channels = 0, rec_channels = 0;
+  bool freewheel = false;
+  bool use_profile = false;
+
+  octave_value_list oct_retval; // Octave return (output) parameters
+
+  int nrhs = args.length ();
+
+  // Check for proper inputs arguments.
+
+  if ( (nrhs < 3) || (nrhs > 5) ) {
+    error("jsequence requires 3 to 5 input arguments!");
+  }
+
+  if (nlhs > 2) {
+    error("Too many output args for jsequence!");
+  }
+
+  //
+  // Input arg 2 : The jack (readable client) output audio ports.
+  //
+
+  jaudio_port_list_t rec_port_list;
+  oct_get_port_names(args(1), JackPortIsOutput, &rec_port_list, "record ports");
+  rec_channels = rec_port_list.num;
+
+  //
+  // Input arg 3 : The jack (writable client) input audio ports.
+  //
+
+  jaudio_port_list_t play_port_list;
+  oct_get_port_names(args(2), JackPortIsInput, &play_port_list, "playback ports");
+  play_channels = play_port_list.num;
+
+  //
+  // Input arg 4 : Number of JACK periods to skip on record
+  //
+
+  size_t num_skip_buffers = 0;
+  if ( nrhs >= 4 && !args(3).isempty()) {
+    const Matrix tmp3 = args(3).matrix_value();
+    if (tmp3.rows() * tmp3.cols() != 1 ) {
+      error("4:th arg must be a scalar !");
+    }
+
+    num_skip_buffers = (size_t) tmp3.data()[0];
+  }
+
+  //
+  // Input arg 5 : Options (optional).
+  //
+
+  if (nrhs == 5) {
+
+    if (!args(4).isstruct()) {
+      error("5:th arg must be a struct!");
+    }
+
+    const octave_scalar_map opts = args(4).scalar_map_value();
+
+    if (opts.isfield("freewheel")) {
+      freewheel = opts.getfield("freewheel").bool_value();
+    }
+
+    if (opts.isfield("profile")) {
+      use_profile = opts.getfield("profile").bool_value();
+    }
+  }
+
+  //
+  // Input arg 1 : The job list.
+  //
+
+  std::vector<octave_scalar_map> job_structs;
+
+  if (args(0).iscell()) {
+
+    const Cell c = args(0).cell_value();
+    for (octave_idx_type k=0; k<c.numel(); k++) {
+      octave_scalar_map job;
+      job.assign("A", c(k));
+      job_structs.push_back(job);
+    }
+
+  } else if (args(0).isstruct()) {
+
+    const octave_map m = args(0).map_value();
+    for (octave_idx_type k=0; k<m.numel(); k++) {
+      job_structs.push_back(m.checkelem(k));
+    }
+
+  } else {
+    error("1st arg must be a struct array or a cell array!");
+  }
+
+  size_t num_jobs = job_structs.size();
+  if (num_jobs < 1) {
+    error("The job list is empty!");
+  }
+
+  std::vector<jaudio_seq_job_t> jobs(num_jobs);
+  std::vector<std::vector<size_t>> play_ports(num_jobs), record_ports(num_jobs);
+  std::vector<octave_value> stimuli(num_jobs);
+  std::vector<Matrix> dstimuli(num_jobs);        // The converted stimuli (alive during the session).
+  std::vector<FloatMatrix> fstimuli(num_jobs);
+  std::vector<FloatMatrix> Ymats(num_jobs);
+
+  for (size_t k=0; k<num_jobs; k++) {
+
+    const octave_scalar_map &job = job_structs[k];
+    jaudio_seq_job_t *j = &jobs[k];
+
+    // The stimulus or a reference to an earlier job's stimulus.
+    if (job.isfield("ref") && !job.getfield("ref").isempty()) {
+
+      size_t ref = (size_t) job.getfield("ref").double_value();
+      if (ref < 1 || ref > k) {
+        error("Job %d: ref must point to an earlier job!", (int) k+1);
+      }
+
+      stimuli[k] = stimuli[ref-1];
+
+    } else if (job.isfield("A")) {
+      stimuli[k] = job.getfield("A");
+    } else {
+      error("Job %d: no stimulus (field A or ref) given!", (int) k+1);
+    }
+
+    if (stimuli[k].is_double_type()) {
+      j->play_format = DOUBLE_AUDIO;
+      dstimuli[k] = stimuli[k].matrix_value();
+      j->play_buffer = (void*) dstimuli[k].data();
+    } else if (stimuli[k].is_single_type()) {
+      j->play_format = FLOAT_AUDIO;
+      fstimuli[k] = stimuli[k].float_matrix_value();
+      j->play_buffer = (void*) fstimuli[k].data();
+    } else {
+      error("Job %d: the stimulus must be a single or double precision matrix!", (int) k+1);
+    }
+
+    j->frames = (size_t) stimuli[k].rows();
+    size_t stim_channels = (size_t) stimuli[k].columns();
+
+    // Play port indices.
+    play_ports[k] = get_port_indices(job, "play_ch", play_channels, k+1);
+    if (play_ports[k].empty()) {
+      for (size_t c=0; c<stim_channels && c<play_channels; c++) {
+        play_ports[k].push_back(c);
+      }
+    }
+
+    if (play_ports[k].size() != stim_channels) {
+      error("Job %d: the number of play ports don't match the number of stimulus columns!", (int) k+1);
+    }
+
+    // Record port indices.
+    record_ports[k] = get_port_indices(job, "rec_ch", rec_channels, k+1);
+    if (record_ports[k].empty()) {
+      for (size_t c=0; c<rec_channels; c++) {
+        record_ports[k].push_back(c);
+      }
+    }
+
+    j->play_channels = play_ports[k].size();
+    j->play_ports = play_ports[k].data();
+    j->record_channels = record_ports[k].size();
+    j->record_ports = record_ports[k].data();
+
+    j->repetitions = 1;
+    if (job.isfield("reps") && !job.getfield("reps").isempty()) {
+      double reps = job.getfield("reps").double_value();
+      if (reps < 0) {
+        error("Job %d: reps must be >= 0!", (int) k+1);
+      }
+      j->repetitions = (size_t) reps;
+    }
+
+    j->gap_frames = 0;
+    if (job.isfield("gap") && !job.getfield("gap").isempty()) {
+      double gap = job.getfield("gap").double_value();
+      if (gap < 0) {
+        error("Job %d: gap must be >= 0!", (int) k+1);
+      }
+      j->gap_frames = (size_t) gap;
+    }
+
+    // Allocate memory for the job's recording.
+    Ymats[k] = FloatMatrix((octave_idx_type) (j->frames*j->repetitions),
+                           (octave_idx_type) j->record_channels);
+    j->record_buffer = (float*) Ymats[k].data();
+  }
+
+  //
+  // Register signal handlers.
+  //
+
+  if ((old_handler = signal(SIGTERM, &sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if ((old_handler_abrt = signal(SIGABRT, &sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if ((old_handler_keyint = signal(SIGINT, &sighandler)) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  // Set status to running (CTRL-C will clear the flag and stop the sequence).
+  sequence_set_running_flag();
+
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
+  if (sequence_init(jobs.data(), num_jobs,
+                    play_channels, play_port_list.names.data(),
+                    rec_channels, rec_port_list.names.data(),
+                    "octave:jsequence",
+                    num_skip_buffers,
+                    freewheel) < 0) {
+    signal(SIGTERM, old_handler);
+    signal(SIGABRT, old_handler_abrt);
+    signal(SIGINT, old_handler_keyint);
+    error("jsequence init failed!");
+  }
+
+  // Wait until all jobs have been played and recorded.
+  double t_wait = profile_now();
+  while( !sequence_finished() && sequence_is_running() ) {
+    std::this_thread::sleep_for (std::chrono::milliseconds(freewheel ? 1 : 50));
+  }
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+  // The buffer-size and sample-rate change points (read before the client closes).
+  std::vector<jaudio_period_change_t> period_changes(JAUDIO_MAX_PERIOD_CHANGES);
+  size_t num_period_changes = sequence_get_period_changes(period_changes.data());
+
+  // Close all jack ports and the client.
+  sequence_close();
+
+  // Return the recordings as a cell array.
+  Cell Y(1, (octave_idx_type) num_jobs);
+  for (size_t k=0; k<num_jobs; k++) {
+    Y(k) = Ymats[k];
+  }
+  oct_retval.append(Y);
+
+  if (nlhs == 2) {
+
+    octave_scalar_map info;
+
+    if (use_profile) {
+      info.assign("profile", oct_profile_info());
+    }
+
+    if (num_period_changes > 0) {
+      info.assign("period_changes", oct_period_changes(period_changes.data(), num_period_changes));
+    }
+
+    oct_retval.append(info);
+  }
+
+  //
+  // Restore old signal handlers.
+  //
+
+  if (signal(SIGTERM, old_handler) == SIG_ERR) {
+    error("Couldn't register old signal handler.\n");
+  }
+
+  if (signal(SIGABRT,  old_handler_abrt) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if (signal(SIGINT, old_handler_keyint) == SIG_ERR) {
+    error("Couldn't register signal handler.\n");
+  }
+
+  if (!sequence_is_running()) {
+    error("CTRL-C pressed - sequence interrupted!\n"); // Bail out.
+  }
+
+  return oct_retval;
+}
@@ -37,6 +37,7 @@
 #include <octave/oct.h>
 
 #include <iostream>
+#include <vector>
 using namespace std;
 
 #include <octave/defun-dld.h>
@@ -47,6 +48,8 @@ using namespace std;
 #include <octave/variables.h>
 
 #include "jaudio.h"
+#include "oct_ports.h"
+#include "oct_profile.h"
 
 #define TRUE 1
 #define FALSE 0
@@ -106,7 +109,7 @@ void sig_keyint_handler(int signum) {
 
 DEFUN_DLD (jtrecord, args, nlhs,
            "-*- texinfo -*-\n\
-@deftypefn {Loadable Function} {} Y = jtrecord(trigger_pars,frames,jack_ouputs).\n\
+@deftypefn {Loadable Function} {} [Y,info] = jtrecord(trigger_pars,frames,jack_ouputs,opts).\n\
 \n\
 JTRECORD Records audio data to the output matrix Y using the (low-latency) audio server JACK.\n\
 \n\
@@ -139,9 +142,37 @@ A scalar that specifies the number of frames to record/channel.\n\
 \n\
 @item jack_ouputs\n\
 A char matrix with the JACK client output port names, for example, ['system:capture_1'; 'system:capture_2'], etc.\n\
+" OCT_PORTS_HELP "\
 @end table\n\
+@item opts\n\
+An optional struct with record options (or, for backward compatibility, the indicator file name):\n\
+\n\
+@table @code\n\
 @item indicator_file\n\
-An optional file name (text string) which, when specified, jtrecord writes a 1 to when a trigger occurs.\n\
+A file name (text string) which, when specified, jtrecord writes a 1 to when a trigger occurs.\n\
+@item trigger_channels\n\
+A vector with the trigger channels (1 to channels). Each channel has its own envelope (the mean\n\
+absolute value over the last trigger_frames frames) which are all updated in one pass per JACK period.\n\
+Defaults to trigger_ch.\n\
+@item trigger_levels\n\
+The trigger level of each trigger channel (>= 0 and <= 1.0), or one level for all of them.\n\
+Defaults to trigger_level.\n\
+@item trigger_rule\n\
+'any' (a single channel above its level triggers the capture), 'all' (all channels must be above\n\
+their levels), or the number of channels that must be above their levels. Defaults to 'any'.\n\
+" OCT_PROFILE_HELP "\
+@end table\n\
+@end table\n\
+\n\
+Output arguments:\n\
+\n\
+@table @samp\n\
+@item Y\n\
+A frames x channels single precision matrix with the recorded audio data.\n\
+@item info\n\
+A struct with additional information about the recording (optional). The field trigger_envelopes\n\
+holds the envelope of each trigger channel when the capture was triggered. If profiling is enabled\n\
+the field profile holds the phase times.\n\
 @end table\n\
 \n\
 @copyright{} 2011,2012 Fredrik Lingvall.\n\
@@ -152,13 +183,18 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
   int err,verbose = 0;
   octave_idx_type n, frames;
   sighandler_t old_handler, old_handler_abrt, old_handler_keyint;
-  char **port_names;
+  jaudio_port_list_t port_list;
   octave_idx_type buflen;
   octave_idx_type channels;
   double trigger_level;
   octave_idx_type trigger_ch, trigger_frames, post_trigger_frames;
   char indicator_file[100];
   int write_to_i_file = FALSE;
+  bool use_profile = false;
+  std::vector<size_t> trig_channels;
+  std::vector<double> trig_levels;
+  size_t trig_votes = 1;
+  bool trig_all = false;
 
   octave_value_list oct_retval; // Octave return (output) parameters
 
@@ -171,7 +207,7 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
     return oct_retval;
   }
 
-  if (nlhs > 1) {
+  if (nlhs > 2) {
     error("Too many output args for jtrecord!");
     return oct_retval;
   }
@@ -197,48 +233,112 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
   // Input arg 3 : The jack (readable client) ouput audio ports.
   //
 
-  if ( !args(2).is_sq_string() ) {
-    error("3rd arg must be a string matrix !");
-    return oct_retval;
-  }
+  oct_get_port_names(args(2), JackPortIsOutput, &port_list, "record ports");
 
-  charMatrix ch = args(2).char_matrix_value();
+  channels = port_list.num;
 
-  channels = ch.rows();
+  if (nrhs == 4) {
 
-  buflen = ch.cols();
-  port_names = (char**) malloc(channels * sizeof(char*));
-  for ( n=0; n<channels; n++ ) {
+    std::string strin;
 
-    port_names[n] = (char*) malloc(buflen*sizeof(char)+1);
+    if (args(3).isstruct()) {
 
-    std::string strin = ch.row_as_string(n);
+      const octave_scalar_map opts = args(3).scalar_map_value();
 
-    for (int k=0; k<=buflen; k++ )
-      if (strin[k] != ' ')  // Cut off the string if its a whitespace char.
-        port_names[n][k] = strin[k];
-      else {
-        port_names[n][k] = '\0';
-        break;
+      if (opts.isfield("indicator_file")) {
+        strin = opts.getfield("indicator_file").string_value();
+        write_to_i_file = TRUE;
       }
 
-    port_names[0][buflen] = '\0';
-  }
+      if (opts.isfield("profile")) {
+        use_profile = opts.getfield("profile").bool_value();
+      }
 
-  if (nrhs == 4) {
+      if (opts.isfield("trigger_channels")) {
 
-    if (!mxIsChar(3)) {
-      error("Argument 4 must be a string");
-      return oct_retval;
+        const Matrix ch = opts.getfield("trigger_channels").matrix_value();
+
+        for (octave_idx_type k=0; k<ch.numel(); k++) {
+
+          if (ch(k) < 1 || ch(k) > channels) {
+            error("opts.trigger_channels must be >= 1 and <= %d!", (int) channels);
+            return oct_retval;
+          }
+
+          trig_channels.push_back((size_t) ch(k) - 1);
+        }
+
+        if (trig_channels.empty()) {
+          error("opts.trigger_channels must have at least one channel!");
+          return oct_retval;
+        }
+      }
+
+      if (opts.isfield("trigger_levels")) {
+
+        const Matrix lev = opts.getfield("trigger_levels").matrix_value();
+
+        for (octave_idx_type k=0; k<lev.numel(); k++) {
+
+          if (lev(k) < 0.0 || lev(k) > 1.0) {
+            error("opts.trigger_levels must be >= 0 and <= 1.0!");
+            return oct_retval;
+          }
+
+          trig_levels.push_back(lev(k));
+        }
+      }
+
+      if (opts.isfield("trigger_rule")) {
+
+        const octave_value rule = opts.getfield("trigger_rule");
+
+        if (rule.is_string()) {
+
+          std::string type = rule.string_value();
+
+          if (type == "all") {
+            trig_all = true;
+          } else if (type != "any") {
+            error("opts.trigger_rule must be 'any', 'all', or a number of channels!");
+            return oct_retval;
+          }
+
+        } else {
+
+          if (rule.double_value() < 1) {
+            error("opts.trigger_rule must be >= 1!");
+            return oct_retval;
+          }
+
+          trig_votes = (size_t) rule.double_value();
+        }
+      }
+
+    } else {
+
+      if (!mxIsChar(3)) {
+        error("Argument 4 must be a string or a struct");
+        return oct_retval;
+      }
+
+      strin = args(3).string_value();
+      write_to_i_file = TRUE;
     }
 
-    std::string strin = args(3).string_value();
-    buflen = strin.length();
-    for ( n=0; n<=buflen; n++ ) {
-      indicator_file[n] = strin[n];
+    if (write_to_i_file) {
+
+      buflen = strin.length();
+      if (buflen >= (octave_idx_type) sizeof(indicator_file)) {
+        error("The indicator file name is too long!");
+        return oct_retval;
+      }
+
+      for ( n=0; n<=buflen; n++ ) {
+        indicator_file[n] = strin[n];
+      }
+      indicator_file[buflen] = '\0';
     }
-    indicator_file[buflen] = '\0';
-    write_to_i_file = TRUE;
   }
 
 
@@ -307,6 +407,41 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
   } else
     post_trigger_frames = 0; // Default to save immediately.
 
+  //
+  // The multi-channel trigger (opts.trigger_channels/levels/rule).
+  //
+
+  if (!trig_channels.empty() || !trig_levels.empty() || trig_all || trig_votes > 1) {
+
+    if (trig_channels.empty()) {
+      trig_channels.push_back((size_t) trigger_ch);
+    }
+
+    if (trig_levels.empty()) {
+      trig_levels.push_back(trigger_level);
+    }
+
+    // One level for all channels.
+    if (trig_levels.size() == 1) {
+      trig_levels.resize(trig_channels.size(), trig_levels[0]);
+    }
+
+    if (trig_levels.size() != trig_channels.size()) {
+      error("opts.trigger_levels must have one level per trigger channel (or a single level)!");
+      return oct_retval;
+    }
+
+    if (trig_all) {
+      trig_votes = trig_channels.size();
+    }
+
+    if (trig_votes > trig_channels.size()) {
+      error("opts.trigger_rule can't be larger than the number of trigger channels (%d)!",
+            (int) trig_channels.size());
+      return oct_retval;
+    }
+  }
+
 
   //
   // Register signal handlers.
@@ -334,8 +469,15 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
   // Set status to running (CTRL-C will clear the flag and stop capture).
   record_set_running_flag();
 
+  // Time the setup and teardown phases.
+  oct_profile_begin(use_profile);
+
+  if (!trig_channels.empty()) {
+    t_record_set_trigger(trig_channels.data(), trig_levels.data(), trig_channels.size(), trig_votes);
+  }
+
   // Init and connect to the output ports.
-  if (t_record_init(Y, frames, channels, port_names, "octave:jtrecord",
+  if (t_record_init(Y, frames, channels, port_list.names.data(), "octave:jtrecord",
                     trigger_level,
                     trigger_ch,
                     trigger_frames,
@@ -343,6 +485,7 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
     return oct_retval;
 
   // Wait until we have recorded all data.
+  double t_wait = profile_now();
   while(!t_record_finished() && record_is_running() ) {
     sleep(1); // Note: This will give delay of 1 sec but it takes some time
               // to save data so we will always loose some data if we, for
@@ -360,6 +503,7 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
     }
 
   }
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
 
 
   if (record_is_running()) { // Only do this if we have not pressed CTRL-C.
@@ -393,6 +537,10 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
     oct_retval.append(Ymat);
   }
 
+  // Read the trigger envelopes before the trigger is freed.
+  std::vector<float> trig_envelopes(trig_channels.empty() ? 1 : trig_channels.size());
+  size_t num_envelopes = t_record_get_trigger_envelopes(trig_envelopes.data());
+
   //
   // Cleanup.
   //
@@ -400,13 +548,23 @@ An optional file name (text string) which, when specified, jtrecord writes a 1 t
   // Close the JACK connections and cleanup.
   t_record_close();
 
-  for ( n=0; n<channels; n++ ) {
-    if (port_names[n])
-      free(port_names[n]);
-  }
+  // The profile is added last since it includes the teardown.
+  if (nlhs == 2 && oct_retval.length() == 1) {
 
-  if (port_names)
-    free(port_names);
+    octave_scalar_map info;
+
+    Matrix envelopes(1, (octave_idx_type) num_envelopes);
+    for (size_t k=0; k<num_envelopes; k++) {
+      envelopes(k) = trig_envelopes[k];
+    }
+    info.assign("trigger_envelopes", envelopes);
+
+    if (use_profile) {
+      info.assign("profile", oct_profile_info());
+    }
+
+    oct_retval.append(info);
+  }
 
   //
   // Restore old signal handlers.
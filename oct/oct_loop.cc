@@ -0,0 +1,81 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <cmath>
+
+#include "oct_loop.h"
+
+/***
+ *
+ * oct_get_loop
+ *
+ * Parses the opts.loop and opts.repeat options to the (0-based, end
+ * exclusive) loop points. end = 0 is the end of the play data. Returns
+ * false if the play data isn't looped.
+ *
+ ***/
+
+bool oct_get_loop(const octave_scalar_map &opts, size_t *start, size_t *end, size_t *repeats)
+{
+  *start = 0;
+  *end = 0;
+  *repeats = 1;
+
+  if (!opts.isfield("loop") && !opts.isfield("repeat")) {
+    return false;
+  }
+
+  if (opts.isfield("loop")) {
+
+    const Matrix L = opts.getfield("loop").matrix_value();
+
+    if (L.numel() != 2) {
+      error("opts.loop must be a [first last] vector!");
+    }
+
+    double first = L.data()[0];
+    double last = L.data()[1];
+
+    if (first < 1.0 || last < first || first != std::floor(first) || last != std::floor(last)) {
+      error("opts.loop must be [first last] row numbers with 1 <= first <= last!");
+    }
+
+    *start = (size_t) first - 1;
+    *end = (size_t) last;
+    *repeats = JAUDIO_LOOP_FOREVER;
+  }
+
+  if (opts.isfield("repeat")) {
+
+    double repeat = opts.getfield("repeat").double_value();
+
+    if (std::isinf(repeat) && repeat > 0.0) {
+      *repeats = JAUDIO_LOOP_FOREVER;
+    } else if (repeat >= 1.0 && repeat == std::floor(repeat)) {
+      *repeats = (size_t) repeat;
+    } else {
+      error("opts.repeat must be an integer >= 1 (or Inf)!");
+    }
+  }
+
+  return true;
+}
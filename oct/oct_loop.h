@@ -0,0 +1,41 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_LOOP_H__
+#define __OCT_LOOP_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the loop options (shared by the gateway help texts).
+#define OCT_LOOP_HELP "\
+@item loop\n\
+[first last] rows of A that are played opts.repeat times, jumping back sample-exactly at the end\n\
+of the loop, before the rest of A is played. Only one copy of A is stored. Defaults to all rows.\n\
+@item repeat\n\
+The number of times the loop is played. Inf (jplay only) plays the loop until CTRL-C is pressed.\n\
+Defaults to Inf if opts.loop is given and 1 otherwise.\n"
+
+bool oct_get_loop(const octave_scalar_map &opts, size_t *start, size_t *end, size_t *repeats);
+
+#endif
@@ -0,0 +1,88 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <stdio.h>
+#include <math.h>
+
+#include <iostream>
+
+#include "oct_meter.h"
+
+// Level in dBFS (with a floor at -120 dB).
+static double to_dbfs(double x)
+{
+  return (x > 1e-6) ? 20.0 * log10(x) : -120.0;
+}
+
+/***
+ *
+ * oct_meter_info
+ *
+ * Converts the meter statistics to an Octave struct with one
+ * column per channel.
+ *
+ ***/
+
+octave_scalar_map oct_meter_info(const jaudio_meter_stats_t *stats, size_t channels)
+{
+  octave_scalar_map meter;
+
+  Matrix peak(1, channels), rms(1, channels), clips(1, channels);
+  Matrix peak_dbfs(1, channels), rms_dbfs(1, channels);
+
+  for (size_t n=0; n<channels; n++) {
+    peak(0, n) = stats[n].peak;
+    rms(0, n) = stats[n].rms;
+    clips(0, n) = (double) stats[n].clips;
+    peak_dbfs(0, n) = to_dbfs(stats[n].peak);
+    rms_dbfs(0, n) = to_dbfs(stats[n].rms);
+  }
+
+  meter.assign("peak", peak);
+  meter.assign("rms", rms);
+  meter.assign("clips", clips);
+  meter.assign("peak_dbfs", peak_dbfs);
+  meter.assign("rms_dbfs", rms_dbfs);
+
+  return meter;
+}
+
+/***
+ *
+ * oct_meter_print
+ *
+ * Prints a one line level display (peak level of the latest period
+ * per channel) which is overwritten by the next call.
+ *
+ ***/
+
+void oct_meter_print(const jaudio_meter_stats_t *stats, size_t channels)
+{
+  char level[32];
+
+  std::cout << "\r";
+  for (size_t n=0; n<channels; n++) {
+    snprintf(level, sizeof(level), " %2d:%7.1f dB%s", (int) n+1,
+             to_dbfs(stats[n].period_peak), (stats[n].clips > 0) ? " CLIP" : "     ");
+    std::cout << level;
+  }
+  std::cout << std::flush;
+}
@@ -0,0 +1,43 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#ifndef __OCT_METER_H__
+#define __OCT_METER_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the metering options (shared by the gateway help texts).
+#define OCT_METER_HELP "\
+@item meter\n\
+If true, meter the recorded data in the JACK callback and return the per-channel peak, RMS,\n\
+and clip count in info.meter. Defaults to false.\n\
+@item clip_level\n\
+Samples with a magnitude >= clip_level are counted as clipped. Defaults to 1.0 (0 dBFS).\n\
+@item meter_display\n\
+If true, continuously print the peak level of the latest period (in dBFS) for all channels\n\
+while recording. Implies meter. Defaults to false.\n"
+
+octave_scalar_map oct_meter_info(const jaudio_meter_stats_t *stats, size_t channels);
+void oct_meter_print(const jaudio_meter_stats_t *stats, size_t channels);
+
+#endif
@@ -0,0 +1,91 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <string>
+#include <vector>
+
+#include "oct_ports.h"
+
+/***
+ *
+ * oct_get_port_names
+ *
+ * Parses a char matrix or cellstr of port names and patterns and resolves
+ * them to the list of ports (see port_list_resolve). flags selects the
+ * ports the patterns are matched against: JackPortIsOutput for capture
+ * sources and JackPortIsInput for playback targets.
+ *
+ ***/
+
+void oct_get_port_names(const octave_value &arg, unsigned long flags, jaudio_port_list_t *list,
+                        const char *what)
+{
+  std::vector<std::string> names;
+
+  if (arg.is_string()) {
+
+    const charMatrix ch = arg.char_matrix_value();
+
+    // Only the padding is removed since port names may contain spaces.
+    for (octave_idx_type n=0; n<ch.rows(); n++) {
+      names.push_back(ch.row_as_string(n, true));
+    }
+
+  } else if (arg.iscellstr()) {
+
+    const string_vector sv = arg.string_vector_value();
+
+    for (octave_idx_type n=0; n<sv.numel(); n++) {
+      names.push_back(sv(n));
+    }
+
+  } else {
+    error("The %s must be a char matrix or a cell array of strings!", what);
+  }
+
+  if (names.empty()) {
+    error("At least one %s must be given!", what);
+  }
+
+  std::vector<const char*> name_ptrs;
+  for (const std::string &name : names) {
+    name_ptrs.push_back(name.c_str());
+  }
+
+  // The output buffers are sized from the number of ports before the engine's client is
+  // opened, so patterns are listed with a short-lived client (only opened if needed).
+  jack_client_t *client = nullptr;
+  if (ports_has_patterns(name_ptrs.data(), name_ptrs.size()) &&
+      (client = ports_open_client("octave:ports")) == nullptr) {
+    error("Failed to resolve the %s!", what);
+  }
+
+  int err = port_list_resolve(list, name_ptrs.data(), name_ptrs.size(), flags, client);
+
+  if (client) {
+    jack_client_close(client);
+  }
+
+  if (err < 0) {
+    error("Failed to resolve the %s!", what);
+  }
+}
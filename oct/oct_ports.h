@@ -0,0 +1,40 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_PORTS_H__
+#define __OCT_PORTS_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the port patterns (shared by the gateway help texts).
+#define OCT_PORTS_HELP "\
+Port names may be given as a char matrix (one name per row) or a cell array of strings, and\n\
+may be patterns that are expanded to all matching ports in natural order: globs such as\n\
+'system:capture_*', decimal ranges such as 'system:capture_[1-64]', or (whole name) regular\n\
+expressions between slashes such as '/system:capture_(1|3)/'.\n"
+
+void oct_get_port_names(const octave_value &arg, unsigned long flags, jaudio_port_list_t *list,
+                        const char *what);
+
+#endif
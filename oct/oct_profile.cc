@@ -0,0 +1,76 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include "oct_profile.h"
+
+/***
+ *
+ * oct_profile_begin
+ *
+ * Enables (or disables) profiling for the call. Must be called before
+ * any JACK client is opened.
+ *
+ ***/
+
+void oct_profile_begin(bool enable)
+{
+  profile_enable(enable);
+  profile_begin_call();
+}
+
+static octave_scalar_map oct_profile_phases(const jaudio_profile_t *profile)
+{
+  octave_scalar_map phases;
+
+  for (int n=0; n<JAUDIO_NUM_PHASES; n++) {
+    phases.assign(profile_phase_name((jaudio_phase_t) n), profile->seconds[n]);
+  }
+
+  phases.assign("connects", (double) profile->count[JAUDIO_PHASE_CONNECT]);
+
+  return phases;
+}
+
+/***
+ *
+ * oct_profile_info
+ *
+ * Returns the phase times of the last call and the totals over all
+ * profiled calls (in this module) as an Octave struct.
+ *
+ ***/
+
+octave_scalar_map oct_profile_info(void)
+{
+  jaudio_profile_t call, total;
+  profile_get(&call, &total);
+
+  octave_scalar_map info;
+
+  info.assign("call", oct_profile_phases(&call));
+
+  octave_scalar_map totals = oct_profile_phases(&total);
+  totals.assign("calls", (double) total.calls);
+  info.assign("total", totals);
+
+  return info;
+}
@@ -0,0 +1,44 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_PROFILE_H__
+#define __OCT_PROFILE_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the profile option (shared by the gateway help texts).
+#define OCT_PROFILE_HELP "\
+@item profile\n\
+If true, time the phases outside the audio transfer and return them in info.profile. Its fields\n\
+call and total hold the times [s] of this call and the sums over all profiled calls since the\n\
+function was loaded: init (all of the setup), open (jack_client_open), register (the port\n\
+registration), activate (jack_activate), connect (all jack_connect calls), first_period (from\n\
+activation to the first played or recorded frame, including the skipped periods), wait (the\n\
+completion poll), and close (the teardown). The field connects is the number of jack_connect\n\
+calls and total.calls the number of profiled calls. Defaults to false.\n"
+
+void oct_profile_begin(bool enable);
+octave_scalar_map oct_profile_info(void);
+
+#endif
@@ -0,0 +1,54 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <cmath>
+
+#include "oct_route.h"
+
+/***
+ *
+ * oct_get_route
+ *
+ * Parses an outputs x inputs gain (routing) matrix.
+ *
+ ***/
+
+Matrix oct_get_route(const octave_value &arg, size_t inputs, const char *name)
+{
+  if (!arg.isnumeric() || !arg.isreal()) {
+    error("opts.%s must be a real matrix!", name);
+  }
+
+  const Matrix gains = arg.matrix_value();
+
+  if (gains.rows() < 1 || (size_t) gains.cols() != inputs) {
+    error("opts.%s must have %d columns (one per input)!", name, (int) inputs);
+  }
+
+  for (octave_idx_type k=0; k<gains.numel(); k++) {
+    if (!std::isfinite(gains.data()[k])) {
+      error("The opts.%s gains must be finite!", name);
+    }
+  }
+
+  return gains;
+}
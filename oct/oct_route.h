@@ -0,0 +1,45 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_ROUTE_H__
+#define __OCT_ROUTE_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo descriptions of the routing options (shared by the gateway help texts).
+#define OCT_PLAY_ROUTE_HELP "\
+@item play_route\n\
+A ports x columns of A gain (routing) matrix. Port p plays the sum of the columns of A scaled\n\
+by play_route(p,:), mixed in the JACK callback, so a stimulus can be fed to many ports with\n\
+different gains without copying it. Only for matrix play data. Defaults to one column per port.\n"
+
+#define OCT_RECORD_ROUTE_HELP "\
+@item record_route\n\
+A channels x capture ports gain (routing) matrix. Recorded channel c is the sum of the capture\n\
+ports scaled by record_route(c,:), mixed in the JACK callback before any other processing, so\n\
+Y has one channel per row of record_route. Defaults to one channel per port.\n"
+
+Matrix oct_get_route(const octave_value &arg, size_t inputs, const char *name);
+
+#endif
@@ -0,0 +1,44 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include "oct_xruns.h"
+
+/***
+ *
+ * oct_xruns
+ *
+ * Converts the logged gaps to a num_xruns x 2 matrix with the (1-based)
+ * recorded frame and the number of lost frames of each gap.
+ *
+ ***/
+
+Matrix oct_xruns(const jaudio_xrun_t *xruns, size_t num_xruns)
+{
+  Matrix X(num_xruns, 2);
+
+  for (size_t n=0; n<num_xruns; n++) {
+    X(n, 0) = (double) xruns[n].frame + 1.0;
+    X(n, 1) = (double) xruns[n].lost_frames;
+  }
+
+  return X;
+}
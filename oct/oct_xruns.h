@@ -0,0 +1,44 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#ifndef __OCT_XRUNS_H__
+#define __OCT_XRUNS_H__
+
+#include <octave/oct.h>
+
+#include "jaudio.h"
+
+// Texinfo description of the xrun_fill option (shared by the gateway help texts).
+#define OCT_XRUN_FILL_HELP "\
+@item xrun_fill\n\
+If true, the frames lost when JACK misses a deadline (an xrun) are recorded as zeros so that the\n\
+sample indices stay time-true. If false the gaps are skipped (and only reported in info.xruns).\n\
+Defaults to true.\n"
+
+// Texinfo description of info.xruns.
+#define OCT_XRUNS_HELP "\
+The field xruns is set if frames were lost in xruns during the capture. It is a matrix with one\n\
+row, [frame lost_frames], per gap where frame is the recorded frame the gap starts at.\n"
+
+Matrix oct_xruns(const jaudio_xrun_t *xruns, size_t num_xruns);
+
+#endif
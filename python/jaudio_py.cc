@@ -0,0 +1,745 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Python bindings
+ *
+ * jaudio.play, jaudio.record, and jaudio.playrec run the play, record, and duplex engines
+ * on NumPy arrays (or any other object with the buffer protocol). The arrays are used in
+ * place: the engines read the play data from, and record into, the array memory, which
+ * must be Fortran (column major) ordered frames x channels float32 (or float64 for play
+ * data) arrays, i.e., the same layout as the Octave matrices. Recorded arrays are
+ * allocated with numpy.zeros unless an out array is given.
+ *
+ * The GIL is released while the engines run so that other Python threads can work on
+ * earlier results. A KeyboardInterrupt in the main thread stops the job. jaudio.profile
+ * enables setup-phase profiling of the jobs and returns the phase times. The profile is
+ * shared by the engines, so profiled jobs are run one at a time.
+ *
+ *********************************************************************************************/
+
+// The engines are single instance; a second job on a busy engine is refused (checked
+// while holding the GIL).
+static bool play_busy = false;
+static bool record_busy = false;
+static bool playrec_busy = false;
+
+// The profile is process-wide, so a profiled job is refused while another job is running.
+static bool profile_conflict(void)
+{
+  if (profile_is_enabled() && (play_busy || record_busy || playrec_busy)) {
+    PyErr_SetString(PyExc_RuntimeError, "profiled jobs can't run concurrently");
+    return true;
+  }
+
+  return false;
+}
+
+//
+// Helpers.
+//
+
+// Frees a port name list from get_port_names.
+static void free_port_names(char **port_names, size_t ports)
+{
+  if (port_names) {
+    for (size_t n=0; n<ports; n++) {
+      free(port_names[n]);
+    }
+    free(port_names);
+  }
+}
+
+// A port name or pattern, or a sequence of them, as a malloc'ed list of the matching ports
+// (flags is JackPortIsOutput for record and JackPortIsInput for play ports). Returns nullptr
+// (with an exception set) on errors.
+static char** get_port_names(PyObject *obj, unsigned long flags, size_t *ports, const char *what)
+{
+  PyObject *seq;
+
+  if (PyUnicode_Check(obj)) {
+    seq = PyTuple_Pack(1, obj);
+  } else {
+    seq = PySequence_Fast(obj, "");
+  }
+
+  if (!seq) {
+    PyErr_Format(PyExc_TypeError, "%s must be a port name or a sequence of port names", what);
+    return nullptr;
+  }
+
+  size_t num_names = (size_t) PySequence_Fast_GET_SIZE(seq);
+
+  if (num_names == 0) {
+    PyErr_Format(PyExc_ValueError, "%s must contain at least one port name", what);
+    Py_DECREF(seq);
+    return nullptr;
+  }
+
+  std::vector<const char*> names(num_names);
+
+  for (size_t n=0; n<num_names; n++) {
+
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, n);
+    names[n] = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : nullptr;
+
+    if (!names[n]) {
+      PyErr_Format(PyExc_TypeError, "%s must be a port name or a sequence of port names", what);
+      Py_DECREF(seq);
+      return nullptr;
+    }
+  }
+
+  // The arrays are sized from the number of ports before the engine's client is opened,
+  // so patterns are listed with a short-lived client (only opened if needed).
+  jack_client_t *client = nullptr;
+  if (ports_has_patterns(names.data(), num_names) &&
+      (client = ports_open_client("python:ports")) == nullptr) {
+    PyErr_Format(PyExc_RuntimeError, "failed to open a JACK client to resolve the %s", what);
+    Py_DECREF(seq);
+    return nullptr;
+  }
+
+  jaudio_port_list_t list;
+  int err = port_list_resolve(&list, names.data(), num_names, flags, client);
+
+  if (client) {
+    jack_client_close(client);
+  }
+
+  Py_DECREF(seq);
+
+  if (err < 0) {
+    PyErr_Format(PyExc_ValueError, "failed to resolve the %s", what);
+    return nullptr;
+  }
+
+  *ports = list.num;
+  char **port_names = (char**) calloc(*ports, sizeof(char*));
+
+  for (size_t n=0; n<*ports; n++) {
+    port_names[n] = strdup(list.names[n]);
+  }
+
+  return port_names;
+}
+
+// The struct module format character of a buffer ('f', 'd', ...), ignoring native byte
+// order and size prefixes.
+static char buffer_type(const Py_buffer *view)
+{
+  const char *fmt = view->format ? view->format : "B";
+
+  if (*fmt == '@' || *fmt == '=' || *fmt == '<') {
+    fmt++;
+  }
+
+  return (fmt[0] != '\0' && fmt[1] == '\0') ? fmt[0] : '\0';
+}
+
+// The frames and channels of a 1-D (one channel) or 2-D (frames x channels) buffer.
+static bool buffer_dims(const Py_buffer *view, size_t *frames, size_t *channels, const char *what)
+{
+  if (view->ndim == 1) {
+    *frames = (size_t) view->shape[0];
+    *channels = 1;
+  } else if (view->ndim == 2) {
+    *frames = (size_t) view->shape[0];
+    *channels = (size_t) view->shape[1];
+  } else {
+    PyErr_Format(PyExc_ValueError, "%s must be a frames x channels array", what);
+    return false;
+  }
+
+  if (*frames == 0 || *channels == 0) {
+    PyErr_Format(PyExc_ValueError, "%s must not be empty", what);
+    return false;
+  }
+
+  return true;
+}
+
+// Gets a Fortran ordered float32 or float64 (if allow_double) buffer.
+static bool get_audio_buffer(PyObject *obj, Py_buffer *view, bool writable, bool allow_double,
+                             const char *what)
+{
+  int flags = PyBUF_F_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+
+  if (PyObject_GetBuffer(obj, view, flags) < 0) {
+    PyErr_Clear();
+    PyErr_Format(PyExc_TypeError, "%s must be a %sFortran ordered (column major) float32%s array",
+                 what, writable ? "writable " : "", allow_double ? " or float64" : "");
+    return false;
+  }
+
+  char type = buffer_type(view);
+
+  if (!(type == 'f' || (allow_double && type == 'd'))) {
+    PyErr_Format(PyExc_TypeError, "%s must be a float32%s array", what, allow_double ? " or float64" : "");
+    PyBuffer_Release(view);
+    return false;
+  }
+
+  return true;
+}
+
+// Allocates a zeroed frames x channels Fortran ordered float32 NumPy array.
+static PyObject* new_record_array(size_t frames, size_t channels)
+{
+  PyObject *numpy = PyImport_ImportModule("numpy");
+
+  if (!numpy) {
+    return nullptr;
+  }
+
+  PyObject *zeros = PyObject_GetAttrString(numpy, "zeros");
+  Py_DECREF(numpy);
+
+  if (!zeros) {
+    return nullptr;
+  }
+
+  PyObject *args = Py_BuildValue("((nn))", (Py_ssize_t) frames, (Py_ssize_t) channels);
+  PyObject *kwargs = Py_BuildValue("{s:s,s:s}", "dtype", "float32", "order", "F");
+  PyObject *Y = nullptr;
+
+  if (args && kwargs) {
+    Y = PyObject_Call(zeros, args, kwargs);
+  }
+
+  Py_XDECREF(kwargs);
+  Py_XDECREF(args);
+  Py_DECREF(zeros);
+
+  return Y;
+}
+
+/***
+ *
+ * wait_for_job
+ *
+ * Waits, without the GIL, until finished() returns true or the job stops.
+ * Returns false if a KeyboardInterrupt (or another signal handler
+ * exception) is pending; the job is then stopped with stop().
+ *
+ ***/
+
+static bool wait_for_job(bool (*finished)(void), bool (*is_running)(void), void (*stop)(void), bool freewheel)
+{
+  double t_wait = profile_now();
+
+  while (!finished() && is_running()) {
+
+    Py_BEGIN_ALLOW_THREADS
+    std::this_thread::sleep_for(std::chrono::milliseconds(freewheel ? 1 : 50));
+    Py_END_ALLOW_THREADS
+
+    if (PyErr_CheckSignals() < 0) {
+      stop();
+      profile_add(JAUDIO_PHASE_WAIT, t_wait);
+      return false;
+    }
+  }
+
+  profile_add(JAUDIO_PHASE_WAIT, t_wait);
+
+  return true;
+}
+
+// record_finished and play_finished have different return types.
+static bool play_done(void)
+{
+  return play_finished() != 0;
+}
+
+//
+// jaudio.play
+//
+
+PyDoc_STRVAR(py_play_doc,
+"play(A, ports, client_name='python:jplay', freewheel=False)\n"
+"\n"
+"Plays the frames x channels array A (Fortran ordered float32 or float64) to the JACK\n"
+"input ports, one column per port. A is played in place (without a copy).");
+
+static PyObject* py_play(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  static const char *kwlist[] = {"A", "ports", "client_name", "freewheel", nullptr};
+  PyObject *A_obj, *ports_obj;
+  const char *client_name = "python:jplay";
+  int freewheel = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|sp", (char**) kwlist,
+                                   &A_obj, &ports_obj, &client_name, &freewheel)) {
+    return nullptr;
+  }
+
+  if (play_busy) {
+    PyErr_SetString(PyExc_RuntimeError, "the play engine is busy");
+    return nullptr;
+  }
+
+  if (profile_conflict()) {
+    return nullptr;
+  }
+
+  Py_buffer A;
+  size_t frames, channels, ports;
+
+  if (!get_audio_buffer(A_obj, &A, false, true, "A")) {
+    return nullptr;
+  }
+
+  if (!buffer_dims(&A, &frames, &channels, "A")) {
+    PyBuffer_Release(&A);
+    return nullptr;
+  }
+
+  char **port_names = get_port_names(ports_obj, JackPortIsInput, &ports, "ports");
+  if (!port_names) {
+    PyBuffer_Release(&A);
+    return nullptr;
+  }
+
+  if (ports != channels) {
+    PyErr_SetString(PyExc_ValueError, "the number of ports must match the number of columns of A");
+    free_port_names(port_names, ports);
+    PyBuffer_Release(&A);
+    return nullptr;
+  }
+
+  int format = (buffer_type(&A) == 'd') ? DOUBLE_AUDIO : FLOAT_AUDIO;
+  int err;
+
+  play_busy = true;
+  play_set_running_flag();
+  profile_begin_call();
+
+  Py_BEGIN_ALLOW_THREADS
+  err = play_init(A.buf, frames, channels, port_names, client_name, format, freewheel != 0);
+  Py_END_ALLOW_THREADS
+
+  // A failed init has already released the client.
+  bool completed = false;
+  if (err >= 0) {
+    completed = wait_for_job(play_done, play_is_running, play_clear_running_flag, freewheel != 0);
+
+    Py_BEGIN_ALLOW_THREADS
+    play_close();
+    Py_END_ALLOW_THREADS
+  }
+
+  play_busy = false;
+  free_port_names(port_names, ports);
+  PyBuffer_Release(&A);
+
+  if (err < 0) {
+    PyErr_SetString(PyExc_RuntimeError, "play init failed");
+    return nullptr;
+  }
+
+  if (!completed) {
+    return nullptr; // The KeyboardInterrupt.
+  }
+
+  Py_RETURN_NONE;
+}
+
+//
+// jaudio.record
+//
+
+PyDoc_STRVAR(py_record_doc,
+"record(frames, ports, out=None, client_name='python:jrecord', freewheel=False) -> Y\n"
+"\n"
+"Records frames frames from the JACK output ports. Y is a frames x ports float32 NumPy\n"
+"array (Fortran ordered). If out, a writable Fortran ordered float32 array, is given the\n"
+"data is recorded into it and it is returned as Y; frames may then be None.");
+
+static PyObject* py_record(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  static const char *kwlist[] = {"frames", "ports", "out", "client_name", "freewheel", nullptr};
+  PyObject *frames_obj, *ports_obj, *out_obj = Py_None;
+  const char *client_name = "python:jrecord";
+  int freewheel = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Osp", (char**) kwlist,
+                                   &frames_obj, &ports_obj, &out_obj, &client_name, &freewheel)) {
+    return nullptr;
+  }
+
+  if (record_busy) {
+    PyErr_SetString(PyExc_RuntimeError, "the record engine is busy");
+    return nullptr;
+  }
+
+  if (profile_conflict()) {
+    return nullptr;
+  }
+
+  size_t frames = 0, ports, channels;
+
+  if (frames_obj != Py_None) {
+    frames = PyLong_AsSize_t(frames_obj);
+    if (PyErr_Occurred()) {
+      return nullptr;
+    }
+  }
+
+  char **port_names = get_port_names(ports_obj, JackPortIsOutput, &ports, "ports");
+  if (!port_names) {
+    return nullptr;
+  }
+
+  PyObject *Y;
+  if (out_obj == Py_None) {
+
+    if (frames == 0) {
+      PyErr_SetString(PyExc_ValueError, "frames must be > 0");
+      free_port_names(port_names, ports);
+      return nullptr;
+    }
+
+    Y = new_record_array(frames, ports);
+
+  } else {
+    Py_INCREF(out_obj);
+    Y = out_obj;
+  }
+
+  if (!Y) {
+    free_port_names(port_names, ports);
+    return nullptr;
+  }
+
+  Py_buffer view;
+  size_t out_frames;
+
+  if (!get_audio_buffer(Y, &view, true, false, "out")) {
+    free_port_names(port_names, ports);
+    Py_DECREF(Y);
+    return nullptr;
+  }
+
+  if (!buffer_dims(&view, &out_frames, &channels, "out") ||
+      channels != ports || (frames > 0 && out_frames != frames)) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "out must be a frames x ports array");
+    }
+    PyBuffer_Release(&view);
+    free_port_names(port_names, ports);
+    Py_DECREF(Y);
+    return nullptr;
+  }
+
+  int err;
+
+  record_busy = true;
+  record_set_running_flag();
+  profile_begin_call();
+
+  Py_BEGIN_ALLOW_THREADS
+  err = record_init(view.buf, out_frames, ports, port_names, client_name, freewheel != 0);
+  Py_END_ALLOW_THREADS
+
+  // A failed init has already released the client.
+  bool completed = false;
+  if (err >= 0) {
+    completed = wait_for_job(record_finished, record_is_running, record_clear_running_flag, freewheel != 0);
+
+    Py_BEGIN_ALLOW_THREADS
+    record_close();
+    Py_END_ALLOW_THREADS
+  }
+
+  record_busy = false;
+  free_port_names(port_names, ports);
+  PyBuffer_Release(&view);
+
+  if (err < 0 || !completed) {
+    if (err < 0) {
+      PyErr_SetString(PyExc_RuntimeError, "record init failed");
+    }
+    Py_DECREF(Y);
+    return nullptr;
+  }
+
+  return Y;
+}
+
+//
+// jaudio.playrec
+//
+
+PyDoc_STRVAR(py_playrec_doc,
+"playrec(A, play_ports, record_ports, out=None, skip=0, client_name='python:jplayrec',\n"
+"        freewheel=False) -> Y\n"
+"\n"
+"Plays the frames x channels array A (Fortran ordered float32 or float64) to the JACK input\n"
+"play_ports while recording the same number of frames from the output record_ports, skipping\n"
+"the first skip JACK periods. Y is a frames x record_ports float32 NumPy array (Fortran\n"
+"ordered), or out if given.");
+
+static PyObject* py_playrec(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  static const char *kwlist[] = {"A", "play_ports", "record_ports", "out", "skip",
+                                 "client_name", "freewheel", nullptr};
+  PyObject *A_obj, *play_ports_obj, *record_ports_obj, *out_obj = Py_None;
+  Py_ssize_t skip = 0;
+  const char *client_name = "python:jplayrec";
+  int freewheel = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|Onsp", (char**) kwlist,
+                                   &A_obj, &play_ports_obj, &record_ports_obj, &out_obj,
+                                   &skip, &client_name, &freewheel)) {
+    return nullptr;
+  }
+
+  if (playrec_busy) {
+    PyErr_SetString(PyExc_RuntimeError, "the playrec engine is busy");
+    return nullptr;
+  }
+
+  if (profile_conflict()) {
+    return nullptr;
+  }
+
+  if (skip < 0) {
+    PyErr_SetString(PyExc_ValueError, "skip must be >= 0");
+    return nullptr;
+  }
+
+  Py_buffer A, view;
+  size_t frames, channels, play_ports = 0, record_ports = 0, out_frames, out_channels;
+  char **play_port_names = nullptr, **record_port_names = nullptr;
+  PyObject *Y = nullptr;
+
+  if (!get_audio_buffer(A_obj, &A, false, true, "A")) {
+    return nullptr;
+  }
+
+  if (!buffer_dims(&A, &frames, &channels, "A") ||
+      (play_port_names = get_port_names(play_ports_obj, JackPortIsInput, &play_ports, "play_ports")) == nullptr ||
+      (record_port_names = get_port_names(record_ports_obj, JackPortIsOutput, &record_ports, "record_ports")) == nullptr) {
+    free_port_names(play_port_names, play_ports);
+    PyBuffer_Release(&A);
+    return nullptr;
+  }
+
+  if (play_ports != channels) {
+    PyErr_SetString(PyExc_ValueError, "the number of play ports must match the number of columns of A");
+  } else if (out_obj == Py_None) {
+    Y = new_record_array(frames, record_ports);
+  } else {
+    Py_INCREF(out_obj);
+    Y = out_obj;
+  }
+
+  if (Y && get_audio_buffer(Y, &view, true, false, "out")) {
+
+    if (!buffer_dims(&view, &out_frames, &out_channels, "out") ||
+        out_frames != frames || out_channels != record_ports) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError, "out must be a frames x record_ports array");
+      }
+      PyBuffer_Release(&view);
+      Py_CLEAR(Y);
+    }
+
+  } else {
+    Py_CLEAR(Y);
+  }
+
+  if (!Y) {
+    free_port_names(play_port_names, play_ports);
+    free_port_names(record_port_names, record_ports);
+    PyBuffer_Release(&A);
+    return nullptr;
+  }
+
+  int format = (buffer_type(&A) == 'd') ? DOUBLE_AUDIO : FLOAT_AUDIO;
+  int err;
+
+  playrec_busy = true;
+  playrec_set_running_flag();
+  profile_begin_call();
+
+  Py_BEGIN_ALLOW_THREADS
+  err = playrec_init(A.buf, format, play_ports, play_port_names,
+                     view.buf, record_ports, record_port_names,
+                     frames, client_name, (size_t) skip, freewheel != 0);
+  Py_END_ALLOW_THREADS
+
+  // A failed init has already released the client.
+  bool completed = false;
+  if (err >= 0) {
+    completed = wait_for_job(playrec_finished, playrec_is_running, playrec_clear_running_flag, freewheel != 0);
+
+    Py_BEGIN_ALLOW_THREADS
+    playrec_close(play_ports, play_port_names, record_ports, record_port_names);
+    Py_END_ALLOW_THREADS
+  }
+
+  playrec_busy = false;
+  free_port_names(play_port_names, play_ports);
+  free_port_names(record_port_names, record_ports);
+  PyBuffer_Release(&view);
+  PyBuffer_Release(&A);
+
+  if (err < 0 || !completed) {
+    if (err < 0) {
+      PyErr_SetString(PyExc_RuntimeError, "playrec init failed");
+    }
+    Py_DECREF(Y);
+    return nullptr;
+  }
+
+  return Y;
+}
+
+//
+// jaudio.profile
+//
+
+// A dict with the phase times [s] and the number of jack_connect calls.
+static PyObject* profile_phases(const jaudio_profile_t *profile)
+{
+  PyObject *phases = PyDict_New();
+  if (!phases) {
+    return nullptr;
+  }
+
+  for (int n=0; n<=JAUDIO_NUM_PHASES; n++) {
+
+    PyObject *value = (n < JAUDIO_NUM_PHASES) ?
+      PyFloat_FromDouble(profile->seconds[n]) :
+      PyLong_FromSize_t(profile->count[JAUDIO_PHASE_CONNECT]);
+
+    const char *name = (n < JAUDIO_NUM_PHASES) ? profile_phase_name((jaudio_phase_t) n) : "connects";
+
+    if (!value || PyDict_SetItemString(phases, name, value) < 0) {
+      Py_XDECREF(value);
+      Py_DECREF(phases);
+      return nullptr;
+    }
+
+    Py_DECREF(value);
+  }
+
+  return phases;
+}
+
+PyDoc_STRVAR(py_profile_doc,
+"profile(enable=None) -> dict\n"
+"\n"
+"Enables (or disables) setup-phase profiling of the following jobs if enable is given, and\n"
+"returns the profile as a dict with the dicts call (the last job) and total (all profiled\n"
+"jobs). They hold the times [s] of the phases init, open, register, activate, connect,\n"
+"first_period, wait, and close, and the number of jack_connect calls (connects). The\n"
+"total dict also holds the number of profiled jobs (calls). The profile is shared by all\n"
+"engines, so it can't be read or changed while a job is running, and profiled jobs must\n"
+"run one at a time.");
+
+static PyObject* py_profile(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  static const char *kwlist[] = {"enable", nullptr};
+  PyObject *enable_obj = Py_None;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", (char**) kwlist, &enable_obj)) {
+    return nullptr;
+  }
+
+  // The jobs update the profile (without locking) so it can't be read or changed while one is running.
+  if (play_busy || record_busy || playrec_busy) {
+    PyErr_SetString(PyExc_RuntimeError, "the profile can't be used while a job is running");
+    return nullptr;
+  }
+
+  if (enable_obj != Py_None) {
+
+    int enable = PyObject_IsTrue(enable_obj);
+    if (enable < 0) {
+      return nullptr;
+    }
+
+    profile_enable(enable != 0);
+  }
+
+  jaudio_profile_t call, total;
+  profile_get(&call, &total);
+
+  PyObject *call_dict = profile_phases(&call);
+  PyObject *total_dict = profile_phases(&total);
+  PyObject *calls = PyLong_FromSize_t(total.calls);
+  PyObject *profile = PyDict_New();
+
+  if (!call_dict || !total_dict || !calls || !profile ||
+      PyDict_SetItemString(total_dict, "calls", calls) < 0 ||
+      PyDict_SetItemString(profile, "call", call_dict) < 0 ||
+      PyDict_SetItemString(profile, "total", total_dict) < 0) {
+    Py_XDECREF(profile);
+    profile = nullptr;
+  }
+
+  Py_XDECREF(calls);
+  Py_XDECREF(call_dict);
+  Py_XDECREF(total_dict);
+
+  return profile;
+}
+
+//
+// The module.
+//
+
+static PyMethodDef jaudio_methods[] = {
+  {"play", (PyCFunction) (void(*)(void)) py_play, METH_VARARGS | METH_KEYWORDS, py_play_doc},
+  {"record", (PyCFunction) (void(*)(void)) py_record, METH_VARARGS | METH_KEYWORDS, py_record_doc},
+  {"playrec", (PyCFunction) (void(*)(void)) py_playrec, METH_VARARGS | METH_KEYWORDS, py_playrec_doc},
+  {"profile", (PyCFunction) (void(*)(void)) py_profile, METH_VARARGS | METH_KEYWORDS, py_profile_doc},
+  {nullptr, nullptr, 0, nullptr}
+};
+
+static struct PyModuleDef jaudio_module = {
+  PyModuleDef_HEAD_INIT,
+  "jaudio",
+  "Play and record audio with the JACK audio connection kit.",
+  -1,
+  jaudio_methods
+};
+
+PyMODINIT_FUNC PyInit_jaudio(void)
+{
+  return PyModule_Create(&jaudio_module);
+}
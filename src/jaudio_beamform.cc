@@ -0,0 +1,510 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include <jack/ringbuffer.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Delay-and-sum beamforming
+ *
+ * Beam m is the weighted sum of all channels, each delayed by a (fractional) number
+ * of frames:
+ *
+ *   y_m[n] = sum_c w[c,m] x_c[n - d[c,m]].
+ *
+ * The fractional delays use third order (four tap) Lagrange interpolation. The
+ * interpolator needs one frame of look-ahead, so all delays are increased by one
+ * frame internally and the first output frame is dropped, which keeps the beams
+ * aligned with the input. As in the STFT the JACK callback only queues the
+ * captured periods in a ring buffer and a worker thread computes the beams, in
+ * blocks. With more than one thread the beams are split into groups and the worker
+ * hands each block to helper threads (one per group but the first), which are
+ * started with the beamformer and wait for the blocks. As in the STFT, frames that
+ * don't fit in the ring buffer are dropped and beamformed as zeros, so the beams
+ * stay time-true and every output frame is written.
+ *
+ *********************************************************************************************/
+
+#define BEAMFORM_SCRATCH_FRAMES 256  // Interleaving chunk size in the JACK callback.
+#define BEAMFORM_BLOCK_FRAMES 1024   // Frames processed per worker iteration.
+#define BEAMFORM_TAPS 4              // Lagrange interpolator length.
+
+struct jaudio_beamformer {
+  size_t channels;
+  size_t num_beams;
+  size_t frames;              // Output frames per beam.
+  float *beams;               // frames x num_beams output.
+  size_t num_threads;
+
+  size_t *delay_int;          // channels x num_beams integer delays (including the look-ahead frame).
+  float *coeffs;              // channels x num_beams x BEAMFORM_TAPS weighted interpolator taps.
+  size_t history;             // History frames needed by the longest delay.
+
+  jack_ringbuffer_t *ring;    // Interleaved samples (JACK thread -> worker).
+  float *scratch;             // Interleaving buffer used by the JACK callback.
+  std::atomic<size_t> overruns;
+  std::atomic<size_t> gap_frames;     // Dropped frames not yet replaced by zeros.
+  std::atomic<size_t> frames_dropped; // Total dropped frames.
+
+  std::thread worker;
+  std::atomic<bool> finishing;
+  std::atomic<bool> done;
+
+  // The helper threads and the block they work on (set by the worker).
+  size_t groups;              // The number of beam groups (the worker computes group 0).
+  std::vector<std::thread> helpers;
+  std::mutex lock;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  size_t generation;          // Incremented for each block.
+  size_t pending;             // Helpers that haven't finished the current block.
+  bool quit;
+  float **block_hist;
+  size_t block_len;
+  ptrdiff_t block_out_pos;
+  float *acc;                 // groups x BEAMFORM_BLOCK_FRAMES accumulators.
+};
+
+/***
+ *
+ * Computes the beams [m0,m1) for len new frames. hist[c] holds history + len
+ * frames where the new frames start at history. Beam m is accumulated into
+ * acc (len frames) and then written, from output frame out_pos, to the beam buffer.
+ * The first input frame ever (out_pos = -1) is the look-ahead and is dropped.
+ *
+ ***/
+
+static void beamform_block(const jaudio_beamformer_t *bf, float **hist, size_t len,
+                           ptrdiff_t out_pos, size_t m0, size_t m1, float *acc)
+{
+  for (size_t m=m0; m<m1; m++) {
+
+    memset(acc, 0x0, len * sizeof(float));
+
+    for (size_t c=0; c<bf->channels; c++) {
+
+      size_t idx = m*bf->channels + c;
+      const float *h = &bf->coeffs[idx * BEAMFORM_TAPS];
+
+      // x[k] is the input frame k - delay_int + 1 (the interpolator spans x[k-3]..x[k]).
+      const float *x = &hist[c][bf->history - bf->delay_int[idx] + 1];
+      const float h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3];
+
+      for (size_t k=0; k<len; k++) {
+        acc[k] += h0 * x[k] + h1 * x[k-1] + h2 * x[k-2] + h3 * x[k-3];
+      }
+    }
+
+    float *y = &bf->beams[m * bf->frames];
+    for (size_t k=0; k<len; k++) {
+      ptrdiff_t n = out_pos + (ptrdiff_t) k;
+      if (n >= 0 && (size_t) n < bf->frames) {
+        y[n] = acc[k];
+      }
+    }
+  }
+}
+
+/***
+ *
+ * A helper thread: computes beam group g of each block the worker
+ * hands out until the beamformer is destroyed.
+ *
+ ***/
+
+static void beamform_helper(jaudio_beamformer_t *bf, size_t g)
+{
+  size_t m0 = g * bf->num_beams / bf->groups;
+  size_t m1 = (g+1) * bf->num_beams / bf->groups;
+  size_t seen = 0;
+
+  while (true) {
+
+    {
+      std::unique_lock<std::mutex> l(bf->lock);
+      bf->start_cv.wait(l, [&] { return bf->quit || bf->generation != seen; });
+      if (bf->quit) {
+        return;
+      }
+      seen = bf->generation;
+    }
+
+    beamform_block(bf, bf->block_hist, bf->block_len, bf->block_out_pos, m0, m1,
+                   &bf->acc[g * BEAMFORM_BLOCK_FRAMES]);
+
+    std::lock_guard<std::mutex> l(bf->lock);
+    if (--bf->pending == 0) {
+      bf->done_cv.notify_one();
+    }
+  }
+}
+
+/***
+ *
+ * The worker thread: de-interleaves the ring buffer data into a per-channel
+ * history and computes the beams block by block.
+ *
+ ***/
+
+static void beamform_worker(jaudio_beamformer_t *bf)
+{
+  size_t frame_bytes = bf->channels * sizeof(float);
+  size_t H = bf->history;
+
+  float **hist = (float**) calloc(bf->channels, sizeof(float*));
+  float *chunk = (float*) malloc(BEAMFORM_BLOCK_FRAMES * frame_bytes);
+
+  bool ok = (hist && chunk);
+  for (size_t c=0; ok && c<bf->channels; c++) {
+    hist[c] = (float*) calloc(H + BEAMFORM_BLOCK_FRAMES, sizeof(float));
+    ok = (hist[c] != nullptr);
+  }
+
+  if (!ok) {
+    std::cerr << "Beamformer worker memory allocation failed!" << std::endl;
+  }
+
+  ptrdiff_t out_pos = -1; // Output frame of the next input frame (the look-ahead frame is dropped).
+  bool flushed = false;
+
+  while (ok && out_pos < (ptrdiff_t) bf->frames) {
+
+    size_t available = jack_ringbuffer_read_space(bf->ring) / frame_bytes;
+    size_t len = 0;
+
+    if (available > 0) {
+
+      len = (available < BEAMFORM_BLOCK_FRAMES) ? available : BEAMFORM_BLOCK_FRAMES;
+      jack_ringbuffer_read(bf->ring, (char*) chunk, len * frame_bytes);
+
+      for (size_t c=0; c<bf->channels; c++) {
+        float *h = &hist[c][H];
+        for (size_t k=0; k<len; k++) {
+          h[k] = chunk[k*bf->channels + c];
+        }
+      }
+
+    } else if (bf->finishing && bf->gap_frames > 0) {
+
+      // Frames dropped at the end of the capture were never replaced (no more writes).
+      len = (bf->gap_frames < BEAMFORM_BLOCK_FRAMES) ? bf->gap_frames.load() : BEAMFORM_BLOCK_FRAMES;
+      for (size_t c=0; c<bf->channels; c++) {
+        memset(&hist[c][H], 0x0, len * sizeof(float));
+      }
+      bf->gap_frames -= len;
+
+    } else if (bf->finishing && !flushed) {
+
+      // Push one zero frame through to get the last (look-ahead delayed) output frame.
+      len = 1;
+      flushed = true;
+      for (size_t c=0; c<bf->channels; c++) {
+        hist[c][H] = 0.0f;
+      }
+
+    } else if (bf->finishing) {
+      break; // The capture ended early so we will not reach the end.
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    // Hand the block to the helpers, compute the first group of beams, and
+    // wait for the other groups.
+    if (bf->groups > 1) {
+      std::lock_guard<std::mutex> l(bf->lock);
+      bf->block_hist = hist;
+      bf->block_len = len;
+      bf->block_out_pos = out_pos;
+      bf->pending = bf->groups - 1;
+      bf->generation++;
+    }
+    bf->start_cv.notify_all();
+
+    beamform_block(bf, hist, len, out_pos, 0, bf->num_beams / bf->groups, bf->acc);
+
+    if (bf->groups > 1) {
+      std::unique_lock<std::mutex> l(bf->lock);
+      bf->done_cv.wait(l, [&] { return bf->pending == 0; });
+    }
+
+    out_pos += (ptrdiff_t) len;
+
+    // Keep the last H frames as history for the next block.
+    for (size_t c=0; c<bf->channels; c++) {
+      memmove(hist[c], &hist[c][len], H * sizeof(float));
+    }
+  }
+
+  bf->done = true;
+
+  if (hist) {
+    for (size_t c=0; c<bf->channels; c++) {
+      free(hist[c]);
+    }
+    free(hist);
+  }
+  free(chunk);
+}
+
+/***
+ *
+ * beamform_create
+ *
+ * Creates a beamformer for frames long captures with the given number of
+ * channels and starts the worker (and helper) threads. The beams are written to the
+ * frames x num_beams (column major) buffer beams.
+ *
+ ***/
+
+jaudio_beamformer_t* beamform_create(const jaudio_beamform_config_t *cfg, size_t channels,
+                                     size_t frames, float *beams)
+{
+  if (cfg->num_beams == 0) {
+    std::cerr << "The number of beams must be > 0!" << std::endl;
+    return nullptr;
+  }
+
+  size_t num = channels * cfg->num_beams;
+  double max_delay = 0.0;
+
+  for (size_t k=0; k<num; k++) {
+
+    if (cfg->delays[k] < 0.0) {
+      std::cerr << "The beamformer delays must be >= 0!" << std::endl;
+      return nullptr;
+    }
+
+    if (cfg->delays[k] > max_delay) {
+      max_delay = cfg->delays[k];
+    }
+  }
+
+  jaudio_beamformer_t *bf = new jaudio_beamformer_t;
+
+  bf->channels = channels;
+  bf->num_beams = cfg->num_beams;
+  bf->frames = frames;
+  bf->beams = beams;
+  bf->num_threads = (cfg->num_threads > 0) ? cfg->num_threads : 1;
+  bf->overruns = 0;
+  bf->gap_frames = 0;
+  bf->frames_dropped = 0;
+  bf->finishing = false;
+  bf->done = false;
+
+  // One group of beams per thread (but not more groups than beams).
+  bf->groups = (bf->num_threads < bf->num_beams) ? bf->num_threads : bf->num_beams;
+  bf->generation = 0;
+  bf->pending = 0;
+  bf->quit = false;
+  bf->block_hist = nullptr;
+  bf->block_len = 0;
+  bf->block_out_pos = 0;
+
+  // The interpolator spans three frames behind the (look-ahead) integer delay.
+  bf->history = (size_t) floor(max_delay) + BEAMFORM_TAPS;
+
+  bf->delay_int = (size_t*) malloc(num * sizeof(size_t));
+  bf->coeffs = (float*) malloc(num * BEAMFORM_TAPS * sizeof(float));
+  bf->scratch = (float*) malloc(BEAMFORM_SCRATCH_FRAMES * channels * sizeof(float));
+  bf->acc = (float*) malloc(bf->groups * BEAMFORM_BLOCK_FRAMES * sizeof(float));
+
+  // Room for (at least) eight blocks of data.
+  bf->ring = jack_ringbuffer_create(8 * BEAMFORM_BLOCK_FRAMES * channels * sizeof(float));
+
+  if (!bf->delay_int || !bf->coeffs || !bf->scratch || !bf->acc || !bf->ring) {
+    std::cerr << "Beamformer memory allocation failed!" << std::endl;
+    beamform_destroy(bf);
+    return nullptr;
+  }
+
+  // Keep the ring buffer in RAM since it is written from the JACK thread.
+  jack_ringbuffer_mlock(bf->ring);
+
+  // The weighted Lagrange taps for x[n-D], x[n-D-1], x[n-D-2], and x[n-D-3]
+  // where D is the integer and f the fractional part of the delay plus one.
+  for (size_t m=0; m<bf->num_beams; m++) {
+    for (size_t c=0; c<channels; c++) {
+
+      size_t idx = m*channels + c;
+      double d = cfg->delays[c + m*channels];
+      double D = floor(d);
+      double f = d - D;
+      double w = cfg->weights ? cfg->weights[c + m*channels] : 1.0 / (double) channels;
+
+      bf->delay_int[idx] = (size_t) D + 1; // Including the look-ahead frame.
+
+      float *h = &bf->coeffs[idx * BEAMFORM_TAPS];
+      h[0] = (float) (w * -f * (f - 1.0) * (f - 2.0) / 6.0);
+      h[1] = (float) (w * (f + 1.0) * (f - 1.0) * (f - 2.0) / 2.0);
+      h[2] = (float) (w * -(f + 1.0) * f * (f - 2.0) / 2.0);
+      h[3] = (float) (w * (f + 1.0) * f * (f - 1.0) / 6.0);
+    }
+  }
+
+  for (size_t g=1; g<bf->groups; g++) {
+    bf->helpers.push_back(std::thread(beamform_helper, bf, g));
+  }
+
+  bf->worker = std::thread(beamform_worker, bf);
+
+  return bf;
+}
+
+/***
+ *
+ * beamform_write
+ *
+ * Queues nframes frames from the per-channel buffers in for beamforming.
+ * Called from the JACK callback.
+ *
+ ***/
+
+void beamform_write(jaudio_beamformer_t *bf, jack_default_audio_sample_t **in, size_t nframes)
+{
+  size_t frame_bytes = bf->channels * sizeof(float);
+  size_t m = 0;
+
+  // The worker owns the remaining gap after beamform_finish.
+  if (bf->finishing) {
+    return;
+  }
+
+  // First replace the frames dropped in earlier periods with zeros.
+  while (bf->gap_frames > 0) {
+
+    size_t len = (bf->gap_frames < BEAMFORM_SCRATCH_FRAMES) ? bf->gap_frames.load() : BEAMFORM_SCRATCH_FRAMES;
+
+    if (jack_ringbuffer_write_space(bf->ring) < len * frame_bytes) {
+      break;
+    }
+
+    memset(bf->scratch, 0x0, len * frame_bytes);
+    jack_ringbuffer_write(bf->ring, (const char*) bf->scratch, len * frame_bytes);
+    bf->gap_frames -= len;
+  }
+
+  while (m < nframes) {
+
+    size_t len = nframes - m;
+    if (len > BEAMFORM_SCRATCH_FRAMES) {
+      len = BEAMFORM_SCRATCH_FRAMES;
+    }
+
+    // The worker can't keep up - drop the rest of the period (and zero it later).
+    if (bf->gap_frames > 0 || jack_ringbuffer_write_space(bf->ring) < len * frame_bytes) {
+      bf->overruns++;
+      bf->gap_frames += nframes - m;
+      bf->frames_dropped += nframes - m;
+      return;
+    }
+
+    for (size_t c=0; c<bf->channels; c++) {
+      const float *x = &in[c][m];
+      for (size_t k=0; k<len; k++) {
+        bf->scratch[k*bf->channels + c] = x[k];
+      }
+    }
+
+    jack_ringbuffer_write(bf->ring, (const char*) bf->scratch, len * frame_bytes);
+
+    m += len;
+  }
+}
+
+/***
+ *
+ * beamform_finish
+ *
+ * Tells the worker that no more data will be written. The worker
+ * processes the queued data and then exits.
+ *
+ ***/
+
+void beamform_finish(jaudio_beamformer_t *bf)
+{
+  bf->finishing = true;
+}
+
+// True when all beam frames have been computed.
+bool beamform_done(const jaudio_beamformer_t *bf)
+{
+  return bf->done;
+}
+
+size_t beamform_overruns(const jaudio_beamformer_t *bf)
+{
+  return bf->overruns;
+}
+
+// The number of frames that were dropped (and beamformed as zeros).
+size_t beamform_frames_dropped(const jaudio_beamformer_t *bf)
+{
+  return bf->frames_dropped;
+}
+
+void beamform_destroy(jaudio_beamformer_t *bf)
+{
+  if (!bf) {
+    return;
+  }
+
+  if (bf->worker.joinable()) {
+    bf->finishing = true;
+    bf->worker.join();
+  }
+
+  {
+    std::lock_guard<std::mutex> l(bf->lock);
+    bf->quit = true;
+  }
+  bf->start_cv.notify_all();
+
+  for (auto &t : bf->helpers) {
+    t.join();
+  }
+
+  if (bf->ring) {
+    jack_ringbuffer_free(bf->ring);
+  }
+
+  free(bf->delay_int);
+  free(bf->coeffs);
+  free(bf->scratch);
+  free(bf->acc);
+
+  delete bf;
+}
@@ -0,0 +1,184 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <atomic>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Buffer-size and Sample-rate Changes
+ *
+ * The JACK server may change the period size (and, with some backends, the sample rate)
+ * while a client is running. The engines preallocate their per-period scratch buffers for
+ * JAUDIO_MAX_PERIOD_FRAMES frames so that nothing needs to be reallocated when that
+ * happens, and log where in the recording (or playback) each change took effect.
+ *
+ * The JACK callbacks only store the new values. The process callback compares them with
+ * the last logged ones at the start of each period and appends a change point to a fixed
+ * (preallocated) log, so the log has a single writer and is only read after the run.
+ *
+ *********************************************************************************************/
+
+struct jaudio_change_log {
+  size_t max_frames;                            // The period size the scratch buffers hold.
+  jack_nframes_t buffer_size;                   // The current (last logged) values.
+  jack_nframes_t sample_rate;
+  std::atomic<jack_nframes_t> new_sample_rate;  // Set by the sample-rate callback.
+
+  jaudio_period_change_t changes[JAUDIO_MAX_PERIOD_CHANGES];
+  std::atomic<size_t> num_changes;
+  size_t dropped;
+};
+
+/***
+ *
+ * jaudio_max_period_frames
+ *
+ * The number of frames to preallocate per-period buffers for: the
+ * largest period size supported at runtime, or the current period
+ * size if that is larger.
+ *
+ ***/
+
+size_t jaudio_max_period_frames(jack_client_t *client)
+{
+  size_t buffer_size = (size_t) jack_get_buffer_size(client);
+
+  return (buffer_size > JAUDIO_MAX_PERIOD_FRAMES) ? buffer_size : JAUDIO_MAX_PERIOD_FRAMES;
+}
+
+/***
+ *
+ * change_log_create
+ *
+ * Allocates a change log starting at the client's current period size
+ * and sample rate, for an engine whose per-period buffers hold
+ * max_frames frames.
+ *
+ ***/
+
+jaudio_change_log_t* change_log_create(jack_client_t *client, size_t max_frames)
+{
+  jaudio_change_log_t *log = new jaudio_change_log_t;
+
+  log->max_frames = max_frames;
+  log->buffer_size = jack_get_buffer_size(client);
+  log->sample_rate = jack_get_sample_rate(client);
+  log->new_sample_rate.store(log->sample_rate);
+  log->num_changes.store(0);
+  log->dropped = 0;
+
+  return log;
+}
+
+void change_log_destroy(jaudio_change_log_t *log)
+{
+  delete log;
+}
+
+/***
+ *
+ * change_log_set_buffer_size
+ *
+ * Called from the buffer-size callback. Returns -1 if the new period
+ * doesn't fit in the engine's preallocated buffers.
+ *
+ ***/
+
+int change_log_set_buffer_size(jaudio_change_log_t *log, jack_nframes_t nframes)
+{
+  if ((size_t) nframes > log->max_frames) {
+    std::cerr << "The JACK period (" << nframes << " frames) is larger than the preallocated "
+              << log->max_frames << " frames!" << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+// Called from the sample-rate callback.
+void change_log_set_sample_rate(jaudio_change_log_t *log, jack_nframes_t fs)
+{
+  log->new_sample_rate.store(fs);
+}
+
+/***
+ *
+ * change_log_update
+ *
+ * Called by the process callback at the start of each period. Logs a
+ * change point at frame if the period size or the sample rate differs
+ * from the last period. Never allocates.
+ *
+ ***/
+
+void change_log_update(jaudio_change_log_t *log, size_t frame, jack_nframes_t nframes)
+{
+  jack_nframes_t fs = log->new_sample_rate.load();
+
+  if (nframes == log->buffer_size && fs == log->sample_rate) {
+    return;
+  }
+
+  log->buffer_size = nframes;
+  log->sample_rate = fs;
+
+  size_t n = log->num_changes.load(std::memory_order_relaxed);
+
+  if (n == JAUDIO_MAX_PERIOD_CHANGES) {
+    log->dropped++;
+    return;
+  }
+
+  log->changes[n].frame = frame;
+  log->changes[n].buffer_size = nframes;
+  log->changes[n].sample_rate = fs;
+
+  log->num_changes.store(n + 1, std::memory_order_release);
+}
+
+/***
+ *
+ * change_log_get
+ *
+ * Copies the logged change points to changes (which must have room for
+ * JAUDIO_MAX_PERIOD_CHANGES entries) and returns their number.
+ *
+ ***/
+
+size_t change_log_get(const jaudio_change_log_t *log, jaudio_period_change_t *changes)
+{
+  size_t n = log->num_changes.load(std::memory_order_acquire);
+
+  memcpy(changes, log->changes, n * sizeof(jaudio_period_change_t));
+
+  if (log->dropped > 0) {
+    std::cerr << "Warning: " << log->dropped << " buffer-size/sample-rate changes were not logged!" << std::endl;
+  }
+
+  return n;
+}
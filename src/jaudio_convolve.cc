@@ -0,0 +1,394 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <complex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <jack/ringbuffer.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Play data convolution
+ *
+ * The play data is filtered by a uniformly partitioned overlap-save convolution:
+ * the filters are split into partitions of CONVOLVE_BLOCK_FRAMES taps whose spectra
+ * are multiplied with a frequency-domain delay line of the input block spectra.
+ * Since the play data is known in advance a worker thread computes the output
+ * blocks ahead of the JACK callback into a lock-free ring buffer (as for the
+ * resampler), so the filtered play data is aligned with the unfiltered and no
+ * filtered copy of the play matrix is stored.
+ *
+ *********************************************************************************************/
+
+#define CONVOLVE_BLOCK_FRAMES 1024    // Partition length (the FFT length is twice this).
+#define CONVOLVE_SCRATCH_FRAMES 256   // De-interleaving chunk size in the JACK callback.
+
+typedef std::complex<double> cplx;
+
+struct jaudio_convolver {
+  const void *buffer;         // The frames x in_channels (column major) play data.
+  int format;                 // FLOAT_AUDIO or DOUBLE_AUDIO.
+  size_t frames;
+  size_t in_channels;
+  size_t out_channels;
+  bool mimo;                  // Full out x in filter matrix (otherwise one filter per channel).
+
+  size_t partitions;
+  size_t num_filters;         // out_channels x in_channels (MIMO) or channels.
+  jaudio_fft_plan_t *plan;    // 2 * CONVOLVE_BLOCK_FRAMES long transforms.
+  cplx *H;                    // num_filters x partitions filter spectra.
+  cplx *X;                    // in_channels x partitions input spectra (frequency-domain delay line).
+  size_t fdl_pos;             // The newest input spectrum in the delay line.
+  cplx *acc;                  // Output spectrum accumulator.
+  float *last_block;          // in_channels x CONVOLVE_BLOCK_FRAMES previous input block.
+
+  size_t out_frames;          // frames + taps - 1.
+  size_t blocks_done;         // Input blocks processed (worker only).
+  size_t produced;            // Output frames converted so far (worker only).
+  float *chunk;               // Interleaved worker output.
+
+  jack_ringbuffer_t *ring;    // Interleaved filtered frames (worker -> JACK thread).
+  float *scratch;             // De-interleaving buffer used by the JACK callback.
+  size_t consumed;            // Frames read by the JACK callback.
+  std::atomic<size_t> underruns;
+
+  std::thread worker;
+  std::atomic<bool> stopping;
+};
+
+// The number of output frames (the full convolution including the filter tail).
+size_t convolver_output_frames(size_t frames, size_t taps)
+{
+  return (taps > 0) ? frames + taps - 1 : frames;
+}
+
+// Sample k of input channel c (zero outside the play data).
+static double convolver_input(const jaudio_convolver_t *cv, size_t c, size_t k)
+{
+  if (k >= cv->frames) {
+    return 0.0;
+  }
+
+  if (cv->format == DOUBLE_AUDIO) {
+    return ((const double*) cv->buffer)[c * cv->frames + k];
+  }
+
+  return (double) ((const float*) cv->buffer)[c * cv->frames + k];
+}
+
+// Filter the next input block and write CONVOLVE_BLOCK_FRAMES interleaved output frames to the chunk.
+static void convolver_block(jaudio_convolver_t *cv)
+{
+  size_t B = CONVOLVE_BLOCK_FRAMES;
+  size_t N = 2*B;
+  size_t P = cv->partitions;
+  size_t start = cv->blocks_done * B;
+
+  cv->fdl_pos = (cv->fdl_pos + 1) % P;
+
+  // Transform [previous block, current block] of each input channel.
+  for (size_t i=0; i<cv->in_channels; i++) {
+
+    cplx *x = &cv->X[(i*P + cv->fdl_pos) * N];
+    float *last = &cv->last_block[i*B];
+
+    for (size_t k=0; k<B; k++) {
+      x[k] = cplx(last[k], 0.0);
+      double v = convolver_input(cv, i, start + k);
+      x[B + k] = cplx(v, 0.0);
+      last[k] = (float) v;
+    }
+
+    fft_execute(cv->plan, x, false);
+  }
+
+  for (size_t o=0; o<cv->out_channels; o++) {
+
+    memset((void*) cv->acc, 0x0, N * sizeof(cplx));
+
+    size_t i0 = cv->mimo ? 0 : o;
+    size_t i1 = cv->mimo ? cv->in_channels : o + 1;
+
+    for (size_t i=i0; i<i1; i++) {
+
+      size_t f = cv->mimo ? i*cv->out_channels + o : o;
+
+      for (size_t p=0; p<P; p++) {
+
+        const cplx *h = &cv->H[(f*P + p) * N];
+        const cplx *x = &cv->X[(i*P + (cv->fdl_pos + P - p) % P) * N];
+
+        for (size_t k=0; k<N; k++) {
+          cv->acc[k] += h[k] * x[k];
+        }
+      }
+    }
+
+    fft_execute(cv->plan, cv->acc, true);
+
+    // Overlap-save: the last B samples are the valid (non-aliased) output.
+    for (size_t k=0; k<B; k++) {
+      cv->chunk[k*cv->out_channels + o] = (float) cv->acc[B + k].real();
+    }
+  }
+
+  cv->blocks_done++;
+}
+
+// Fill the ring buffer as far as possible. Returns false when all frames are filtered.
+static bool convolver_fill(jaudio_convolver_t *cv)
+{
+  size_t frame_bytes = cv->out_channels * sizeof(float);
+
+  while (cv->produced < cv->out_frames) {
+
+    size_t space = jack_ringbuffer_write_space(cv->ring) / frame_bytes;
+    if (space < CONVOLVE_BLOCK_FRAMES) {
+      return true; // Full - wait for the JACK callback to consume some data.
+    }
+
+    convolver_block(cv);
+
+    size_t len = cv->out_frames - cv->produced;
+    if (len > CONVOLVE_BLOCK_FRAMES) {
+      len = CONVOLVE_BLOCK_FRAMES;
+    }
+
+    jack_ringbuffer_write(cv->ring, (const char*) cv->chunk, len * frame_bytes);
+    cv->produced += len;
+  }
+
+  return false;
+}
+
+static void convolver_worker(jaudio_convolver_t *cv)
+{
+  while (!cv->stopping && convolver_fill(cv)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+/***
+ *
+ * convolver_create
+ *
+ * Creates a convolver that filters the frames x in_channels matrix buffer
+ * (FLOAT_AUDIO or DOUBLE_AUDIO). The taps long filters h are either one per
+ * channel (taps x in_channels, out_channels = in_channels) or, if mimo is
+ * true, a full taps x out_channels x in_channels filter matrix where output o
+ * is the sum of all inputs filtered by h(:,o,i). The ring buffer is filled
+ * before the function returns and a worker thread then keeps it filled. The
+ * buffer must outlive the convolver.
+ *
+ ***/
+
+jaudio_convolver_t* convolver_create(const void *buffer, int format, size_t frames, size_t in_channels,
+                                     const double *h, size_t taps, size_t out_channels, bool mimo)
+{
+  if (format != FLOAT_AUDIO && format != DOUBLE_AUDIO) {
+    std::cerr << "Only matrix play data can be filtered!" << std::endl;
+    return nullptr;
+  }
+
+  if (taps == 0) {
+    std::cerr << "The filters must have at least one tap!" << std::endl;
+    return nullptr;
+  }
+
+  if (!mimo && out_channels != in_channels) {
+    std::cerr << "The number of filters must match the number of channels!" << std::endl;
+    return nullptr;
+  }
+
+  size_t B = CONVOLVE_BLOCK_FRAMES;
+  size_t N = 2*B;
+
+  jaudio_convolver_t *cv = new jaudio_convolver_t;
+
+  cv->buffer = buffer;
+  cv->format = format;
+  cv->frames = frames;
+  cv->in_channels = in_channels;
+  cv->out_channels = out_channels;
+  cv->mimo = mimo;
+  cv->partitions = (taps + B - 1) / B;
+  cv->num_filters = mimo ? out_channels * in_channels : in_channels;
+  cv->fdl_pos = 0;
+  cv->out_frames = convolver_output_frames(frames, taps);
+  cv->blocks_done = 0;
+  cv->produced = 0;
+  cv->consumed = 0;
+  cv->underruns = 0;
+  cv->stopping = false;
+
+  size_t P = cv->partitions;
+
+  cv->plan = fft_create_plan(N);
+  cv->H = (cplx*) calloc(cv->num_filters * P * N, sizeof(cplx));
+  cv->X = (cplx*) calloc(in_channels * P * N, sizeof(cplx));
+  cv->acc = (cplx*) malloc(N * sizeof(cplx));
+  cv->last_block = (float*) calloc(in_channels * B, sizeof(float));
+  cv->chunk = (float*) malloc(B * out_channels * sizeof(float));
+  cv->scratch = (float*) malloc(CONVOLVE_SCRATCH_FRAMES * out_channels * sizeof(float));
+
+  // Room for (at least) eight blocks of filtered data.
+  cv->ring = jack_ringbuffer_create(8 * B * out_channels * sizeof(float));
+
+  if (!cv->plan || !cv->H || !cv->X || !cv->acc || !cv->last_block ||
+      !cv->chunk || !cv->scratch || !cv->ring) {
+    std::cerr << "Convolver memory allocation failed!" << std::endl;
+    convolver_destroy(cv);
+    return nullptr;
+  }
+
+  // Keep the ring buffer in RAM since it is read from the JACK thread.
+  jack_ringbuffer_mlock(cv->ring);
+
+  // The spectra of the zero-padded filter partitions.
+  for (size_t f=0; f<cv->num_filters; f++) {
+
+    const double *hf = &h[f * taps];
+
+    for (size_t p=0; p<P; p++) {
+
+      cplx *Hp = &cv->H[(f*P + p) * N];
+      for (size_t k=0; k<B && p*B + k < taps; k++) {
+        Hp[k] = cplx(hf[p*B + k], 0.0);
+      }
+
+      fft_execute(cv->plan, Hp, false);
+    }
+  }
+
+  // Fill the ring buffer before the JACK callback starts reading.
+  if (convolver_fill(cv)) {
+    cv->worker = std::thread(convolver_worker, cv);
+  }
+
+  return cv;
+}
+
+size_t convolver_get_frames(const jaudio_convolver_t *cv)
+{
+  return cv->out_frames;
+}
+
+/***
+ *
+ * convolver_read
+ *
+ * Writes the next nframes filtered frames to the per-channel buffers
+ * out, starting at offset. If the worker has fallen behind the missing
+ * frames are set to zero and counted as an underrun. Called from the
+ * JACK callback.
+ *
+ ***/
+
+size_t convolver_read(jaudio_convolver_t *cv, jack_default_audio_sample_t **out,
+                      size_t offset, size_t nframes)
+{
+  size_t frame_bytes = cv->out_channels * sizeof(float);
+  size_t m = 0;
+
+  while (m < nframes) {
+
+    size_t len = nframes - m;
+    if (len > CONVOLVE_SCRATCH_FRAMES) {
+      len = CONVOLVE_SCRATCH_FRAMES;
+    }
+
+    size_t available = jack_ringbuffer_read_space(cv->ring) / frame_bytes;
+    if (len > available) {
+      len = available;
+    }
+
+    if (len == 0) {
+      break;
+    }
+
+    jack_ringbuffer_read(cv->ring, (char*) cv->scratch, len * frame_bytes);
+
+    for (size_t c=0; c<cv->out_channels; c++) {
+      jack_default_audio_sample_t *y = &out[c][offset + m];
+      for (size_t k=0; k<len; k++) {
+        y[k] = cv->scratch[k*cv->out_channels + c];
+      }
+    }
+
+    m += len;
+  }
+
+  if (m < nframes) {
+
+    for (size_t c=0; c<cv->out_channels; c++) {
+      memset(&out[c][offset + m], 0x0, (nframes - m) * sizeof(jack_default_audio_sample_t));
+    }
+
+    // Running out of data before the end means that the worker can't keep up.
+    if (cv->consumed + m < cv->out_frames) {
+      cv->underruns++;
+    }
+  }
+
+  cv->consumed += m;
+
+  return m;
+}
+
+size_t convolver_underruns(const jaudio_convolver_t *cv)
+{
+  return cv->underruns;
+}
+
+void convolver_destroy(jaudio_convolver_t *cv)
+{
+  if (!cv) {
+    return;
+  }
+
+  if (cv->worker.joinable()) {
+    cv->stopping = true;
+    cv->worker.join();
+  }
+
+  if (cv->ring) {
+    jack_ringbuffer_free(cv->ring);
+  }
+
+  fft_destroy_plan(cv->plan);
+  free(cv->H);
+  free(cv->X);
+  free(cv->acc);
+  free(cv->last_block);
+  free(cv->chunk);
+  free(cv->scratch);
+
+  delete cv;
+}
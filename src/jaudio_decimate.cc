@@ -0,0 +1,319 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Decimation
+ *
+ * Each decimated channel is filtered by a Kaiser windowed-sinc anti-alias filter
+ * which is only evaluated at the retained (every factor:th) input frames, that is,
+ * the polyphase form of a decimator. The cost is DECIMATE_TAPS_PER_FACTOR
+ * multiply-adds per input frame, independent of the factor, so the filtering is
+ * done directly in the JACK callback. The (linear phase) filter delay is removed so
+ * that the decimated data is aligned with the input.
+ *
+ *********************************************************************************************/
+
+#define DECIMATE_TAPS_PER_FACTOR 32  // Filter length / decimation factor.
+#define DECIMATE_KAISER_BETA 8.0     // About 80 dB stopband attenuation.
+#define DECIMATE_PASSBAND 0.9        // Cutoff relative to the output Nyquist frequency.
+
+typedef struct {
+  size_t factor;
+  size_t taps;
+  float *h;          // Time-reversed filter coefficients.
+  float *delay;      // Delay line (stored twice to avoid wrapping in the dot product).
+  size_t pos;        // Delay line write position.
+  size_t phase;      // Input frames until the next output frame.
+  size_t skip;       // Output frames left to discard (the filter delay).
+} decimator_t;
+
+struct jaudio_decimation {
+  size_t channels;
+  decimator_t *dec;  // One decimator per channel.
+  size_t *offsets;   // Where each channel starts in the record buffer.
+  size_t *written;   // Number of output frames written per channel.
+  size_t *lengths;   // Output frames per channel.
+};
+
+// Zeroth order modified Bessel function of the first kind.
+static double bessel_i0(double x)
+{
+  double sum = 1.0, term = 1.0;
+
+  for (int k=1; k<50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < 1e-12 * sum) {
+      break;
+    }
+  }
+
+  return sum;
+}
+
+static int decimator_setup(decimator_t *d, size_t factor)
+{
+  d->factor = factor;
+  d->pos = 0;
+  d->phase = 0;
+  d->skip = DECIMATE_TAPS_PER_FACTOR / 2; // The group delay in output frames.
+  d->h = nullptr;
+  d->delay = nullptr;
+
+  if (factor <= 1) {
+    d->taps = 0;
+    return 0;
+  }
+
+  d->taps = DECIMATE_TAPS_PER_FACTOR * factor + 1;
+  d->h = (float*) malloc(d->taps * sizeof(float));
+  d->delay = (float*) calloc(2 * d->taps, sizeof(float));
+
+  if (!d->h || !d->delay) {
+    std::cerr << "Decimation filter memory allocation failed!" << std::endl;
+    return -1;
+  }
+
+  // Lowpass with unity DC gain and the cutoff just below the output Nyquist frequency.
+  double fc = DECIMATE_PASSBAND * 0.5 / (double) factor; // Normalized to the input rate.
+  double center = 0.5 * (double) (d->taps - 1);
+  double i0_beta = bessel_i0(DECIMATE_KAISER_BETA);
+  double sum = 0.0;
+
+  for (size_t k=0; k<d->taps; k++) {
+
+    double t = (double) k - center;
+    double sinc = (t == 0.0) ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+    double r = t / center;
+    double w = bessel_i0(DECIMATE_KAISER_BETA * sqrt(1.0 - r*r)) / i0_beta;
+
+    d->h[d->taps - 1 - k] = (float) (sinc * w);
+    sum += sinc * w;
+  }
+
+  for (size_t k=0; k<d->taps; k++) {
+    d->h[k] = (float) (d->h[k] / sum);
+  }
+
+  return 0;
+}
+
+static void decimator_free(decimator_t *d)
+{
+  free(d->h);
+  free(d->delay);
+  d->h = nullptr;
+  d->delay = nullptr;
+}
+
+// Filter and decimate nframes frames (zeros if in is null). At most max_out
+// frames are written. Returns the number of output frames.
+static size_t decimator_process(decimator_t *d, const float *in, size_t nframes,
+                                float *out, size_t max_out)
+{
+  size_t taps = d->taps;
+  size_t n_out = 0;
+
+  for (size_t m=0; m<nframes; m++) {
+
+    float x_in = in ? in[m] : 0.0f;
+    d->delay[d->pos] = x_in;
+    d->delay[d->pos + taps] = x_in;
+    d->pos = (d->pos + 1 == taps) ? 0 : d->pos + 1;
+
+    if (d->phase == 0) {
+
+      // The last taps input frames, oldest first, are delay[pos .. pos+taps-1].
+      const float *x = &d->delay[d->pos];
+      const float *h = d->h;
+      float acc = 0.0f;
+      for (size_t k=0; k<taps; k++) {
+        acc += h[k] * x[k];
+      }
+
+      if (d->skip > 0) {
+        d->skip--;
+      } else if (n_out < max_out) {
+        out[n_out++] = acc;
+      }
+      d->phase = d->factor;
+    }
+
+    d->phase--;
+  }
+
+  return n_out;
+}
+
+/***
+ *
+ * decimation_output_frames
+ *
+ * The number of output frames when frames input frames are decimated
+ * by factor (the first input frame is always retained).
+ *
+ ***/
+
+size_t decimation_output_frames(size_t frames, size_t factor)
+{
+  if (factor <= 1) {
+    return frames;
+  }
+
+  return (frames + factor - 1) / factor;
+}
+
+// The size of a record buffer holding all decimated channels after each other.
+size_t decimation_buffer_frames(size_t frames, const size_t *factors, size_t channels)
+{
+  size_t total = 0;
+
+  for (size_t n=0; n<channels; n++) {
+    total += decimation_output_frames(frames, factors[n]);
+  }
+
+  return total;
+}
+
+/***
+ *
+ * decimation_create
+ *
+ * Creates the decimators for frames long captures where channel n
+ * is decimated by factors[n] (1 = no decimation).
+ *
+ ***/
+
+jaudio_decimation_t* decimation_create(const size_t *factors, size_t channels, size_t frames)
+{
+  jaudio_decimation_t *d = (jaudio_decimation_t*) calloc(1, sizeof(jaudio_decimation_t));
+  if (!d) {
+    return nullptr;
+  }
+
+  d->channels = channels;
+  d->dec = (decimator_t*) calloc(channels, sizeof(decimator_t));
+  d->offsets = (size_t*) calloc(channels, sizeof(size_t));
+  d->written = (size_t*) calloc(channels, sizeof(size_t));
+  d->lengths = (size_t*) calloc(channels, sizeof(size_t));
+
+  if (!d->dec || !d->offsets || !d->written || !d->lengths) {
+    std::cerr << "Decimation memory allocation failed!" << std::endl;
+    decimation_destroy(d);
+    return nullptr;
+  }
+
+  size_t offset = 0;
+  for (size_t n=0; n<channels; n++) {
+
+    if (decimator_setup(&d->dec[n], factors[n]) < 0) {
+      decimation_destroy(d);
+      return nullptr;
+    }
+
+    d->offsets[n] = offset;
+    d->lengths[n] = decimation_output_frames(frames, factors[n]);
+    offset += d->lengths[n];
+  }
+
+  return d;
+}
+
+void decimation_destroy(jaudio_decimation_t *d)
+{
+  if (!d) {
+    return;
+  }
+
+  if (d->dec) {
+    for (size_t n=0; n<d->channels; n++) {
+      decimator_free(&d->dec[n]);
+    }
+  }
+
+  free(d->dec);
+  free(d->offsets);
+  free(d->written);
+  free(d->lengths);
+  free(d);
+}
+
+/***
+ *
+ * decimation_process
+ *
+ * Decimates nframes frames of a channel and appends the result to the
+ * channel's part of the record buffer. Called from the JACK callback.
+ *
+ ***/
+
+void decimation_process(jaudio_decimation_t *d, size_t channel,
+                        const float *in, size_t nframes, float *buffer)
+{
+  decimator_t *dec = &d->dec[channel];
+  float *out = &buffer[d->offsets[channel] + d->written[channel]];
+  size_t max_out = d->lengths[channel] - d->written[channel];
+
+  if (dec->factor <= 1) {
+    if (nframes > max_out) {
+      nframes = max_out;
+    }
+    memcpy(out, in, nframes * sizeof(float));
+    d->written[channel] += nframes;
+    return;
+  }
+
+  d->written[channel] += decimator_process(dec, in, nframes, out, max_out);
+}
+
+/***
+ *
+ * decimation_finish
+ *
+ * Flushes the filters with zeros to produce the output frames that are
+ * held back by the filter delay. Called once after the last period.
+ *
+ ***/
+
+void decimation_finish(jaudio_decimation_t *d, float *buffer)
+{
+  for (size_t n=0; n<d->channels; n++) {
+
+    decimator_t *dec = &d->dec[n];
+    if (dec->factor <= 1) {
+      continue;
+    }
+
+    float *out = &buffer[d->offsets[n] + d->written[n]];
+    size_t max_out = d->lengths[n] - d->written[n];
+
+    d->written[n] += decimator_process(dec, nullptr, (dec->taps - 1) / 2 + dec->factor, out, max_out);
+  }
+}
@@ -0,0 +1,215 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <algorithm>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Sparse Event-List Playback
+ *
+ * A stimulus that is mostly silence (bursts, pings, test plans with long pauses) is
+ * described by a list of events, each placing a (short) waveform on a channel at a
+ * start frame with a gain. Only the waveforms are stored, so the memory use depends
+ * on the burst content and not on the timeline length. The events are sorted by start
+ * frame and the renderer keeps a cursor to the next event and a list of the active
+ * (sounding) events, so a period only touches the events that overlap it and silent
+ * periods are just a memset.
+ *
+ *********************************************************************************************/
+
+struct jaudio_events {
+  size_t frames;              // The timeline length.
+  size_t channels;
+  size_t num_events;
+  jaudio_event_t *events;     // Sorted by start frame.
+  float *pool;                // All waveforms after each other.
+  size_t *wave_offset;        // Per waveform offset into pool.
+  size_t *wave_frames;        // Per waveform length.
+
+  // Render state (only touched by the JACK thread).
+  size_t next;                // The next event to start.
+  size_t *active;             // Indices of the sounding events.
+  size_t num_active;
+  size_t expected_pos;        // Where the next period is expected to start.
+};
+
+/***
+ *
+ * events_create
+ *
+ * Creates an event player from num_waveforms waveforms (waveforms[w] with
+ * waveform_frames[w] frames, copied) and num_events events for channels
+ * output channels. The timeline is frames long, or, if frames is 0, ends
+ * when the last event ends.
+ *
+ ***/
+
+jaudio_events_t* events_create(const float * const *waveforms, const size_t *waveform_frames, size_t num_waveforms,
+                               const jaudio_event_t *events, size_t num_events, size_t channels, size_t frames)
+{
+  for (size_t e=0; e<num_events; e++) {
+
+    if (events[e].channel >= channels) {
+      std::cerr << "Event " << e+1 << " is on channel " << events[e].channel+1
+                << " but there are only " << channels << " channels!" << std::endl;
+      return nullptr;
+    }
+
+    if (events[e].waveform >= num_waveforms) {
+      std::cerr << "Event " << e+1 << " refers to waveform " << events[e].waveform+1
+                << " but there are only " << num_waveforms << " waveforms!" << std::endl;
+      return nullptr;
+    }
+  }
+
+  jaudio_events_t *ev = new jaudio_events_t;
+
+  ev->channels = channels;
+  ev->num_events = num_events;
+
+  size_t pool_frames = 0;
+  for (size_t w=0; w<num_waveforms; w++) {
+    pool_frames += waveform_frames[w];
+  }
+
+  ev->events = (jaudio_event_t*) malloc((num_events + 1) * sizeof(jaudio_event_t));
+  ev->pool = (float*) malloc((pool_frames + 1) * sizeof(float));
+  ev->wave_offset = (size_t*) malloc((num_waveforms + 1) * sizeof(size_t));
+  ev->wave_frames = (size_t*) malloc((num_waveforms + 1) * sizeof(size_t));
+  ev->active = (size_t*) malloc((num_events + 1) * sizeof(size_t));
+
+  if (!ev->events || !ev->pool || !ev->wave_offset || !ev->wave_frames || !ev->active) {
+    std::cerr << "Event list memory allocation failed!" << std::endl;
+    events_destroy(ev);
+    return nullptr;
+  }
+
+  size_t offset = 0;
+  for (size_t w=0; w<num_waveforms; w++) {
+    memcpy(&ev->pool[offset], waveforms[w], waveform_frames[w] * sizeof(float));
+    ev->wave_offset[w] = offset;
+    ev->wave_frames[w] = waveform_frames[w];
+    offset += waveform_frames[w];
+  }
+
+  // Sort by start frame (stable so that simultaneous events keep their order).
+  std::copy(events, events + num_events, ev->events);
+  std::stable_sort(ev->events, ev->events + num_events,
+                   [](const jaudio_event_t &a, const jaudio_event_t &b) { return a.start < b.start; });
+
+  ev->frames = frames;
+  if (frames == 0) {
+    for (size_t e=0; e<num_events; e++) {
+      size_t end = ev->events[e].start + ev->wave_frames[ev->events[e].waveform];
+      ev->frames = std::max(ev->frames, end);
+    }
+  }
+
+  ev->next = 0;
+  ev->num_active = 0;
+  ev->expected_pos = 0;
+
+  return ev;
+}
+
+size_t events_get_frames(const jaudio_events_t *ev)
+{
+  return ev->frames;
+}
+
+void events_destroy(jaudio_events_t *ev)
+{
+  if (ev) {
+    free(ev->events);
+    free(ev->pool);
+    free(ev->wave_offset);
+    free(ev->wave_frames);
+    free(ev->active);
+    delete ev;
+  }
+}
+
+/***
+ *
+ * events_render
+ *
+ * Renders nframes frames, starting at frame pos of the timeline, into
+ * out[c][offset .. offset+nframes-1] for all channels. Periods are normally
+ * rendered in order; if pos jumps (for example when the stimulus is repeated)
+ * the render state is rebuilt from the start of the event list.
+ *
+ ***/
+
+void events_render(jaudio_events_t *ev, jack_default_audio_sample_t **out,
+                   size_t pos, size_t offset, size_t nframes)
+{
+  for (size_t c=0; c<ev->channels; c++) {
+    memset(&out[c][offset], 0x0, nframes * sizeof(jack_default_audio_sample_t));
+  }
+
+  if (pos != ev->expected_pos) {
+    ev->next = 0;
+    ev->num_active = 0;
+  }
+  ev->expected_pos = pos + nframes;
+
+  size_t end = pos + nframes;
+
+  // Activate the events that start in this period (or, after a jump, earlier).
+  while (ev->next < ev->num_events && ev->events[ev->next].start < end) {
+    ev->active[ev->num_active++] = ev->next++;
+  }
+
+  size_t n = 0;
+  for (size_t a=0; a<ev->num_active; a++) {
+
+    const jaudio_event_t *e = &ev->events[ev->active[a]];
+    size_t e_end = e->start + ev->wave_frames[e->waveform];
+
+    if (e_end <= pos) {
+      continue; // Already done (only after a jump).
+    }
+
+    // The overlap between the event and the period.
+    size_t k0 = (e->start > pos) ? e->start - pos : 0;
+    size_t k1 = (e_end < end) ? e_end - pos : nframes;
+
+    const float *x = &ev->pool[ev->wave_offset[e->waveform] + (pos + k0 - e->start)];
+    jack_default_audio_sample_t *y = &out[e->channel][offset];
+    float g = e->gain;
+
+    for (size_t k=k0; k<k1; k++) {
+      y[k] += g * x[k - k0];
+    }
+
+    // Keep the events that continue in the next period.
+    if (e_end > end) {
+      ev->active[n++] = ev->active[a];
+    }
+  }
+  ev->num_active = n;
+}
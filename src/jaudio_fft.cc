@@ -0,0 +1,172 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <complex>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * FFT
+ *
+ * A plain iterative radix-2 FFT. A plan holds the bit reversal permutation and
+ * the twiddle factors so that fft_execute does no memory allocation and can be
+ * used from the JACK thread. A plan is read-only once created and can hence be
+ * shared by several threads.
+ *
+ *********************************************************************************************/
+
+/***
+ *
+ * fft_next_pow2
+ *
+ * The smallest power of two >= n.
+ *
+ ***/
+
+size_t fft_next_pow2(size_t n)
+{
+  size_t m = 1;
+  while (m < n) {
+    m <<= 1;
+  }
+
+  return m;
+}
+
+/***
+ *
+ * fft_create_plan
+ *
+ * Creates a plan for n-point transforms (n must be a power of two).
+ *
+ ***/
+
+jaudio_fft_plan_t* fft_create_plan(size_t n)
+{
+  if (n < 1 || (n & (n-1)) != 0) {
+    std::cerr << "The FFT length must be a power of two!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_fft_plan_t *plan = (jaudio_fft_plan_t*) malloc(sizeof(jaudio_fft_plan_t));
+  if (!plan) {
+    return nullptr;
+  }
+
+  plan->n = n;
+  plan->bitrev = (size_t*) malloc(n * sizeof(size_t));
+  plan->twiddles = (std::complex<double>*) malloc((n/2 + 1) * sizeof(std::complex<double>));
+
+  if (!plan->bitrev || !plan->twiddles) {
+    std::cerr << "FFT plan memory allocation failed!" << std::endl;
+    fft_destroy_plan(plan);
+    return nullptr;
+  }
+
+  size_t bits = 0;
+  while (((size_t) 1 << bits) < n) {
+    bits++;
+  }
+
+  for (size_t k=0; k<n; k++) {
+    size_t r = 0;
+    for (size_t b=0; b<bits; b++) {
+      if (k & ((size_t) 1 << b)) {
+        r |= (size_t) 1 << (bits - 1 - b);
+      }
+    }
+    plan->bitrev[k] = r;
+  }
+
+  // Forward transform twiddles exp(-j*2*pi*k/n).
+  for (size_t k=0; k<=n/2; k++) {
+    double phi = -2.0 * M_PI * (double) k / (double) n;
+    plan->twiddles[k] = std::complex<double>(cos(phi), sin(phi));
+  }
+
+  return plan;
+}
+
+void fft_destroy_plan(jaudio_fft_plan_t *plan)
+{
+  if (plan) {
+    free(plan->bitrev);
+    free(plan->twiddles);
+    free(plan);
+  }
+}
+
+/***
+ *
+ * fft_execute
+ *
+ * In-place complex transform. The inverse transform is scaled by 1/n.
+ *
+ ***/
+
+void fft_execute(const jaudio_fft_plan_t *plan, std::complex<double> *x, bool inverse)
+{
+  size_t n = plan->n;
+
+  // Bit reversal permutation.
+  for (size_t k=0; k<n; k++) {
+    size_t r = plan->bitrev[k];
+    if (r > k) {
+      std::swap(x[k], x[r]);
+    }
+  }
+
+  // Butterflies.
+  for (size_t len=2; len<=n; len<<=1) {
+
+    size_t half = len >> 1;
+    size_t step = n / len;
+
+    for (size_t i=0; i<n; i+=len) {
+      for (size_t k=0; k<half; k++) {
+
+        std::complex<double> w = plan->twiddles[k*step];
+        if (inverse) {
+          w = std::conj(w);
+        }
+
+        std::complex<double> u = x[i+k];
+        std::complex<double> v = x[i+k+half] * w;
+
+        x[i+k] = u + v;
+        x[i+k+half] = u - v;
+      }
+    }
+  }
+
+  if (inverse) {
+    double scale = 1.0 / (double) n;
+    for (size_t k=0; k<n; k++) {
+      x[k] *= scale;
+    }
+  }
+}
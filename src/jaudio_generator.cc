@@ -0,0 +1,331 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <cstring>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Stimulus Generators
+ *
+ * The generators synthesize the stimulus period by period, directly into the JACK
+ * output buffers, so that no frames x channels input matrix is needed. The output is
+ * a function of the frame position in the stimulus. The stateful generators (MLS and
+ * noise) restart when rendering starts over at position 0, so a looped stimulus is
+ * identical in every repetition.
+ *
+ *********************************************************************************************/
+
+// Galois LFSR feedback masks for maximum length sequences of order 2 to 24.
+static const uint32_t mls_masks[JAUDIO_GEN_MAX_MLS_ORDER+1] = {
+  0x0, 0x0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240, 0x500, 0xE08,
+  0x1C80, 0x3802, 0x6000, 0xD008, 0x12000, 0x20400, 0x72000, 0x90000,
+  0x140000, 0x300000, 0x420000, 0xE10000
+};
+
+// splitmix64 is used to derive independent per channel noise seeds.
+static inline uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// xorshift64* returning a uniform number in [0,1).
+static inline double noise_uniform(uint64_t *s)
+{
+  uint64_t x = *s;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *s = x;
+
+  return (double) ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Restart the stateful generators.
+static void generator_reset(jaudio_generator_t *gen)
+{
+  gen->mls_state = 1;
+
+  uint64_t seed = gen->seed;
+  for (size_t c=0; c<gen->channels; c++) {
+    gen->noise_state[c] = splitmix64(&seed) | 1; // xorshift state must be non-zero.
+  }
+}
+
+/***
+ *
+ * generator_setup
+ *
+ * Computes the sample rate dependent parameters and allocates the per
+ * channel state. Must be called (from a non real-time thread) before
+ * generator_render.
+ *
+ ***/
+
+int generator_setup(jaudio_generator_t *gen, double fs, size_t channels)
+{
+  gen->fs = fs;
+  gen->channels = channels;
+
+  if (gen->type == JAUDIO_GEN_MLS) {
+    if (gen->mls_order < 2 || gen->mls_order > JAUDIO_GEN_MAX_MLS_ORDER) {
+      std::cerr << "The MLS order must be >= 2 and <= " << JAUDIO_GEN_MAX_MLS_ORDER << "!" << std::endl;
+      return -1;
+    }
+  }
+
+  if (gen->type == JAUDIO_GEN_LIN_SWEEP || gen->type == JAUDIO_GEN_EXP_SWEEP) {
+
+    if (gen->sweep_frames == 0) {
+      std::cerr << "The sweep length must be > 0!" << std::endl;
+      return -1;
+    }
+
+    if (gen->type == JAUDIO_GEN_EXP_SWEEP && (gen->f1_hz <= 0.0 || gen->f2_hz <= 0.0 || gen->f1_hz == gen->f2_hz)) {
+      std::cerr << "An exponential sweep requires 0 < f1 != f2!" << std::endl;
+      return -1;
+    }
+  }
+
+  gen->noise_state = (uint64_t*) malloc(channels * sizeof(uint64_t));
+  if (!gen->noise_state) {
+    std::cerr << "Generator memory allocation failed!" << std::endl;
+    return -1;
+  }
+
+  generator_reset(gen);
+
+  return 0;
+}
+
+void generator_free(jaudio_generator_t *gen)
+{
+  if (gen->noise_state) {
+    free(gen->noise_state);
+    gen->noise_state = nullptr;
+  }
+}
+
+/***
+ *
+ * Waveforms for the (burst local) frame span [l0, l0+len).
+ *
+ ***/
+
+// Sum of sinusoids. Each tone uses a rotating phasor which is re-anchored
+// from the exact phase at the start of every span to avoid drift.
+static void render_tones(const jaudio_generator_t *gen, float *out, size_t l0, size_t len)
+{
+  std::memset(out, 0x0, len * sizeof(float));
+
+  for (size_t k=0; k<gen->num_tones; k++) {
+
+    double w = 2.0 * M_PI * gen->tone_freqs_hz[k] / gen->fs;
+    double theta = fmod(w * (double) l0, 2.0 * M_PI) + gen->tone_phases[k];
+    double a = gen->amplitude * gen->tone_amps[k];
+
+    double c = cos(theta), s = sin(theta);
+    double cw = cos(w), sw = sin(w);
+
+    for (size_t m=0; m<len; m++) {
+      out[m] += (float) (a * s);
+
+      double c_next = c*cw - s*sw;
+      s = s*cw + c*sw;
+      c = c_next;
+    }
+  }
+}
+
+static void render_sweep(const jaudio_generator_t *gen, float *out, size_t l0, size_t len)
+{
+  double T = (double) gen->sweep_frames / gen->fs;
+  double f1 = gen->f1_hz, f2 = gen->f2_hz;
+
+  for (size_t m=0; m<len; m++) {
+
+    size_t l = l0 + m;
+    if (l >= gen->sweep_frames) {
+      out[m] = 0.0f; // The sweep has ended.
+      continue;
+    }
+
+    double t = (double) l / gen->fs;
+    double phase;
+
+    if (gen->type == JAUDIO_GEN_LIN_SWEEP) {
+      phase = 2.0 * M_PI * (f1*t + 0.5*(f2 - f1)*t*t/T);
+    } else {
+      double L = T / log(f2/f1);
+      phase = 2.0 * M_PI * f1 * L * (exp(t/L) - 1.0);
+    }
+
+    out[m] = (float) (gen->amplitude * sin(phase));
+  }
+}
+
+static void render_mls(jaudio_generator_t *gen, float *out, size_t len)
+{
+  uint32_t state = gen->mls_state;
+  uint32_t mask = mls_masks[gen->mls_order];
+  float a = (float) gen->amplitude;
+
+  for (size_t m=0; m<len; m++) {
+    uint32_t lsb = state & 1u;
+    out[m] = lsb ? a : -a;
+    state = (state >> 1) ^ ((0u - lsb) & mask);
+  }
+
+  gen->mls_state = state;
+}
+
+static void render_noise(jaudio_generator_t *gen, size_t channel, float *out, size_t len)
+{
+  uint64_t *s = &gen->noise_state[channel];
+
+  if (gen->gaussian) {
+
+    // Box-Muller (two samples per pair of uniform numbers).
+    size_t m = 0;
+    while (m < len) {
+      double u1 = noise_uniform(s);
+      double u2 = noise_uniform(s);
+      double r = gen->amplitude * sqrt(-2.0 * log(1.0 - u1));
+
+      out[m++] = (float) (r * cos(2.0 * M_PI * u2));
+      if (m < len) {
+        out[m++] = (float) (r * sin(2.0 * M_PI * u2));
+      }
+    }
+
+  } else {
+
+    for (size_t m=0; m<len; m++) {
+      out[m] = (float) (gen->amplitude * (2.0 * noise_uniform(s) - 1.0));
+    }
+  }
+}
+
+/***
+ *
+ * generator_render
+ *
+ * Renders nframes frames, starting at frame pos of the stimulus, into
+ * out[c][offset .. offset+nframes-1] for all channels.
+ *
+ ***/
+
+void generator_render(jaudio_generator_t *gen, jack_default_audio_sample_t **out,
+                      size_t pos, size_t offset, size_t nframes)
+{
+  if (pos == 0) {
+    generator_reset(gen);
+  }
+
+  size_t cycle = gen->burst_on_frames + gen->burst_off_frames;
+  bool deterministic = (gen->type != JAUDIO_GEN_NOISE);
+
+  size_t m = 0;
+  while (m < nframes) {
+
+    // Split the span at the burst boundaries.
+    size_t p = pos + m;
+    size_t l0 = p;
+    size_t len = nframes - m;
+    bool on = true;
+
+    if (gen->burst_on_frames > 0) {
+
+      size_t in_cycle = p % cycle;
+
+      if (in_cycle < gen->burst_on_frames) {
+        l0 = in_cycle;
+        if (len > gen->burst_on_frames - in_cycle) {
+          len = gen->burst_on_frames - in_cycle;
+        }
+
+        // Every burst starts over from the beginning.
+        if (in_cycle == 0) {
+          gen->mls_state = 1;
+        }
+
+      } else {
+        on = false;
+        if (len > cycle - in_cycle) {
+          len = cycle - in_cycle;
+        }
+      }
+    }
+
+    if (!on) {
+
+      for (size_t c=0; c<gen->channels; c++) {
+        std::memset(&out[c][offset+m], 0x0, len * sizeof(jack_default_audio_sample_t));
+      }
+
+    } else if (deterministic) {
+
+      // Render to the first port and copy to the others.
+      float *dest = &out[0][offset+m];
+
+      switch (gen->type) {
+
+      case JAUDIO_GEN_TONES:
+        render_tones(gen, dest, l0, len);
+        break;
+
+      case JAUDIO_GEN_LIN_SWEEP:
+      case JAUDIO_GEN_EXP_SWEEP:
+        render_sweep(gen, dest, l0, len);
+        break;
+
+      case JAUDIO_GEN_MLS:
+        render_mls(gen, dest, len);
+        break;
+
+      default:
+        std::memset(dest, 0x0, len * sizeof(float));
+      }
+
+      for (size_t c=1; c<gen->channels; c++) {
+        std::memcpy(&out[c][offset+m], dest, len * sizeof(jack_default_audio_sample_t));
+      }
+
+    } else {
+
+      // Independent noise on each channel.
+      for (size_t c=0; c<gen->channels; c++) {
+        render_noise(gen, c, &out[c][offset+m], len);
+      }
+    }
+
+    m += len;
+  }
+}
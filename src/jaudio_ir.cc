@@ -0,0 +1,463 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <complex>
+#include <thread>
+#include <vector>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Swept-sine Impulse Response Measurement
+ *
+ * Deconvolution of exponential sweep recordings using the (Farina) inverse filter,
+ * that is, the time-reversed sweep with an amplitude envelope that compensates for
+ * the pink spectrum of the sweep. The linear impulse response then starts at frame
+ * sweep_frames-1 of the convolution and the k:th order harmonic distortion response
+ * L*ln(k) seconds earlier, where L = T/ln(f2/f1).
+ *
+ * The convolution is linear in the recording, so it is split at the end of the sweep.
+ * The first sweep_frames frames are deconvolved (with FFTs) while the tail is still
+ * recording. A tail frame only reaches the linear response through the first
+ * ir_frames taps of the inverse filter, and never reaches the harmonic responses, so
+ * when the recording ends only a convolution with those taps remains. It is computed
+ * directly unless it exceeds IR_DIRECT_TAIL_MACS, in which case FFTs are used.
+ *
+ *********************************************************************************************/
+
+#define IR_DIRECT_TAIL_MACS (1 << 20)  // Largest (ir_frames x tail frames) direct tail convolution.
+
+// The number of frames the k:th harmonic response precedes the linear response.
+static size_t ir_harmonic_offset(const jaudio_ir_t *ir, size_t k)
+{
+  double L = ((double) ir->sweep_frames / ir->fs) / log(ir->f2_hz / ir->f1_hz);
+
+  return (size_t) round(L * log((double) k) * ir->fs);
+}
+
+/***
+ *
+ * ir_sweep_generator
+ *
+ * Fills in a generator struct with the sweep used by the measurement (followed by
+ * tail_frames of silence) so that the inverse filter is computed from exactly the
+ * same signal that is played.
+ *
+ ***/
+
+void ir_sweep_generator(const jaudio_ir_t *ir, jaudio_generator_t *gen)
+{
+  memset(gen, 0x0, sizeof(jaudio_generator_t));
+
+  gen->type = JAUDIO_GEN_EXP_SWEEP;
+  gen->amplitude = ir->amplitude;
+  gen->f1_hz = ir->f1_hz;
+  gen->f2_hz = ir->f2_hz;
+  gen->sweep_frames = ir->sweep_frames;
+}
+
+/***
+ *
+ * ir_prepare
+ *
+ * Computes the spectrum of the inverse filter for deconvolving record_frames long
+ * recordings. This can be done while the sweep is playing.
+ *
+ ***/
+
+int ir_prepare(jaudio_ir_t *ir, size_t record_frames)
+{
+  size_t Ns = ir->sweep_frames;
+
+  ir->plan = nullptr;
+  ir->inv_spectrum = nullptr;
+  ir->inv_head = nullptr;
+  ir->tail_fft_frames = 0;
+  ir->tail_plan = nullptr;
+  ir->tail_spectrum = nullptr;
+  ir->record_frames = record_frames;
+  ir->fft_frames = fft_next_pow2(record_frames + Ns - 1);
+
+  //
+  // Render the sweep.
+  //
+
+  jaudio_generator_t gen;
+  ir_sweep_generator(ir, &gen);
+
+  if (generator_setup(&gen, ir->fs, 1) < 0) {
+    return -1;
+  }
+
+  float *sweep = (float*) malloc(Ns * sizeof(float));
+  if (!sweep) {
+    generator_free(&gen);
+    std::cerr << "Sweep memory allocation failed!" << std::endl;
+    return -1;
+  }
+
+  generator_render(&gen, &sweep, 0, 0, Ns);
+  generator_free(&gen);
+
+  //
+  // The inverse filter: the time-reversed sweep with a -6 dB/octave envelope.
+  //
+
+  ir->plan = fft_create_plan(ir->fft_frames);
+  ir->inv_spectrum = (std::complex<double>*) calloc(ir->fft_frames, sizeof(std::complex<double>));
+  ir->inv_head = (double*) calloc(ir->ir_frames, sizeof(double));
+
+  if (!ir->plan || !ir->inv_spectrum || !ir->inv_head) {
+    free(sweep);
+    ir_free(ir);
+    std::cerr << "Inverse filter memory allocation failed!" << std::endl;
+    return -1;
+  }
+
+  double L = ((double) Ns / ir->fs) / log(ir->f2_hz / ir->f1_hz);
+
+  for (size_t n=0; n<Ns; n++) {
+    double t = (double) n / ir->fs;
+    ir->inv_spectrum[n] = (double) sweep[Ns-1-n] * exp(-t / L);
+  }
+
+  //
+  // Normalize so that sweep * inverse filter has unit gain at the
+  // (geometric) center frequency of the sweep.
+  //
+
+  double w0 = 2.0 * M_PI * sqrt(ir->f1_hz * ir->f2_hz) / ir->fs;
+  std::complex<double> S0 = 0.0, I0 = 0.0;
+
+  for (size_t n=0; n<Ns; n++) {
+    std::complex<double> e = std::polar(1.0, -w0 * (double) n);
+    S0 += (double) sweep[n] * e;
+    I0 += ir->inv_spectrum[n] * e;
+  }
+
+  free(sweep);
+
+  double gain = std::abs(S0 * I0);
+  if (gain > 0.0) {
+    for (size_t n=0; n<Ns; n++) {
+      ir->inv_spectrum[n] /= gain;
+    }
+  }
+
+  // The taps that the tail of the recording is convolved with.
+  for (size_t n=0; n<ir->ir_frames && n<Ns; n++) {
+    ir->inv_head[n] = ir->inv_spectrum[n].real();
+  }
+
+  // Only the first ir_frames-1 tail frames reach the linear response (through the taps 0 to ir_frames-2).
+  size_t tail_taps = (record_frames > Ns) ? record_frames - Ns : 0;
+  if (tail_taps > ir->ir_frames - 1) {
+    tail_taps = ir->ir_frames - 1;
+  }
+
+  if (ir->ir_frames * tail_taps > IR_DIRECT_TAIL_MACS) {
+
+    ir->tail_fft_frames = fft_next_pow2(tail_taps + ir->ir_frames);
+    ir->tail_plan = fft_create_plan(ir->tail_fft_frames);
+    ir->tail_spectrum = (std::complex<double>*) calloc(ir->tail_fft_frames, sizeof(std::complex<double>));
+
+    if (!ir->tail_plan || !ir->tail_spectrum) {
+      ir_free(ir);
+      std::cerr << "Inverse filter memory allocation failed!" << std::endl;
+      return -1;
+    }
+
+    for (size_t n=0; n<ir->ir_frames-1; n++) {
+      ir->tail_spectrum[n] = ir->inv_head[n];
+    }
+
+    fft_execute(ir->tail_plan, ir->tail_spectrum, false);
+  }
+
+  fft_execute(ir->plan, ir->inv_spectrum, false);
+
+  return 0;
+}
+
+void ir_free(jaudio_ir_t *ir)
+{
+  if (ir->plan) {
+    fft_destroy_plan(ir->plan);
+    ir->plan = nullptr;
+  }
+
+  if (ir->inv_spectrum) {
+    free(ir->inv_spectrum);
+    ir->inv_spectrum = nullptr;
+  }
+
+  if (ir->inv_head) {
+    free(ir->inv_head);
+    ir->inv_head = nullptr;
+  }
+
+  if (ir->tail_plan) {
+    fft_destroy_plan(ir->tail_plan);
+    ir->tail_plan = nullptr;
+  }
+
+  if (ir->tail_spectrum) {
+    free(ir->tail_spectrum);
+    ir->tail_spectrum = nullptr;
+  }
+}
+
+// Deconvolve the sweep part of the channels first_ch, first_ch+stride, ...
+static void ir_deconvolve_channels(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                                   double *h, double *hd, size_t first_ch, size_t stride)
+{
+  size_t N = ir->fft_frames;
+  size_t lin_pos = ir->sweep_frames - 1;
+
+  std::complex<double> *X = (std::complex<double>*) malloc(N * sizeof(std::complex<double>));
+  if (!X) {
+    std::cerr << "Deconvolution memory allocation failed!" << std::endl;
+    return;
+  }
+
+  for (size_t c=first_ch; c<channels; c+=stride) {
+
+    const float *y = &Y[c*ir->record_frames];
+
+    for (size_t n=0; n<ir->sweep_frames; n++) {
+      X[n] = (double) y[n];
+    }
+    for (size_t n=ir->sweep_frames; n<N; n++) {
+      X[n] = 0.0;
+    }
+
+    fft_execute(ir->plan, X, false);
+
+    for (size_t n=0; n<N; n++) {
+      X[n] *= ir->inv_spectrum[n];
+    }
+
+    fft_execute(ir->plan, X, true);
+
+    //
+    // The linear impulse response.
+    //
+
+    for (size_t n=0; n<ir->ir_frames; n++) {
+      size_t i = lin_pos + n;
+      h[n + c*ir->ir_frames] = (i < N) ? X[i].real() : 0.0;
+    }
+
+    //
+    // The harmonic distortion responses (2nd order and up). Each slice ends
+    // where the response of the next lower order starts.
+    //
+
+    for (size_t k=2; k<=ir->num_harmonics && hd; k++) {
+
+      size_t offset = ir_harmonic_offset(ir, k);
+      size_t spacing = offset - ir_harmonic_offset(ir, k-1);
+      double *dest = &hd[(c + (k-2)*channels) * ir->ir_frames];
+
+      for (size_t n=0; n<ir->ir_frames; n++) {
+        dest[n] = 0.0;
+        if (n < spacing && offset <= lin_pos) {
+          dest[n] = X[lin_pos - offset + n].real();
+        }
+      }
+    }
+  }
+
+  free(X);
+}
+
+// Add the contribution of the tail to the linear responses of the channels first_ch, first_ch+stride, ...
+static void ir_tail_channels(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                             double *h, size_t first_ch, size_t stride)
+{
+  size_t tail_frames = ir->record_frames - ir->sweep_frames;
+
+  for (size_t c=first_ch; c<channels; c+=stride) {
+
+    const float *y = &Y[c*ir->record_frames + ir->sweep_frames];
+    double *dest = &h[c*ir->ir_frames];
+
+    // Response frame n gets tail frame m through inverse filter tap n-1-m.
+    for (size_t n=1; n<ir->ir_frames; n++) {
+
+      size_t len = (n < tail_frames) ? n : tail_frames;
+      const double *g = &ir->inv_head[n-1];
+      double acc = 0.0;
+
+      for (size_t m=0; m<len; m++) {
+        acc += (double) y[m] * g[-(ptrdiff_t) m];
+      }
+
+      dest[n] += acc;
+    }
+  }
+}
+
+// As ir_tail_channels but with FFTs (for long responses and tails).
+static void ir_tail_channels_fft(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                                 double *h, size_t first_ch, size_t stride)
+{
+  size_t N = ir->tail_fft_frames;
+  size_t tail_taps = ir->record_frames - ir->sweep_frames;
+  if (tail_taps > ir->ir_frames - 1) {
+    tail_taps = ir->ir_frames - 1;
+  }
+
+  std::complex<double> *X = (std::complex<double>*) malloc(N * sizeof(std::complex<double>));
+  if (!X) {
+    std::cerr << "Deconvolution memory allocation failed!" << std::endl;
+    return;
+  }
+
+  for (size_t c=first_ch; c<channels; c+=stride) {
+
+    const float *y = &Y[c*ir->record_frames + ir->sweep_frames];
+    double *dest = &h[c*ir->ir_frames];
+
+    for (size_t n=0; n<tail_taps; n++) {
+      X[n] = (double) y[n];
+    }
+    for (size_t n=tail_taps; n<N; n++) {
+      X[n] = 0.0;
+    }
+
+    fft_execute(ir->tail_plan, X, false);
+
+    for (size_t n=0; n<N; n++) {
+      X[n] *= ir->tail_spectrum[n];
+    }
+
+    fft_execute(ir->tail_plan, X, true);
+
+    // Response frame n gets convolution frame n-1.
+    for (size_t n=1; n<ir->ir_frames; n++) {
+      dest[n] += X[n-1].real();
+    }
+  }
+
+  free(X);
+}
+
+// Runs f(first_ch, stride) on num_threads threads (one or more channels per thread).
+template <typename F>
+static void ir_run_threads(size_t channels, size_t num_threads, F f)
+{
+  if (num_threads > channels) {
+    num_threads = channels;
+  }
+
+  if (num_threads <= 1) {
+    f(0, 1);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t t=0; t<num_threads; t++) {
+    threads.push_back(std::thread(f, t, num_threads));
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+/***
+ *
+ * ir_deconvolve_sweep
+ *
+ * Deconvolves the first sweep_frames frames of the recorded (record_frames x
+ * channels) data Y, which can be done while the tail is recorded. The harmonic
+ * responses are final but the linear responses need ir_deconvolve_tail.
+ *
+ ***/
+
+int ir_deconvolve_sweep(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                        double *h, double *hd, size_t num_threads)
+{
+  if (!ir->plan || !ir->inv_spectrum) {
+    return -1;
+  }
+
+  ir_run_threads(channels, num_threads, [=](size_t first_ch, size_t stride) {
+      ir_deconvolve_channels(ir, Y, channels, h, hd, first_ch, stride);
+    });
+
+  return 0;
+}
+
+/***
+ *
+ * ir_deconvolve_tail
+ *
+ * Adds the contribution of the recorded tail (the frames after sweep_frames)
+ * to the linear responses h computed by ir_deconvolve_sweep.
+ *
+ ***/
+
+int ir_deconvolve_tail(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                       double *h, size_t num_threads)
+{
+  if (!ir->inv_head) {
+    return -1;
+  }
+
+  ir_run_threads(channels, num_threads, [=](size_t first_ch, size_t stride) {
+      if (ir->tail_plan) {
+        ir_tail_channels_fft(ir, Y, channels, h, first_ch, stride);
+      } else {
+        ir_tail_channels(ir, Y, channels, h, first_ch, stride);
+      }
+    });
+
+  return 0;
+}
+
+/***
+ *
+ * ir_deconvolve
+ *
+ * Deconvolves the recorded (record_frames x channels) data Y. The linear impulse
+ * responses are returned in h (ir_frames x channels) and, if hd is not null, the
+ * harmonic responses of order 2 to num_harmonics in hd (ir_frames x channels x
+ * num_harmonics-1). The channels are distributed over num_threads threads.
+ *
+ ***/
+
+int ir_deconvolve(const jaudio_ir_t *ir, const float *Y, size_t channels,
+                  double *h, double *hd, size_t num_threads)
+{
+  if (ir_deconvolve_sweep(ir, Y, channels, h, hd, num_threads) < 0) {
+    return -1;
+  }
+
+  return ir_deconvolve_tail(ir, Y, channels, h, num_threads);
+}
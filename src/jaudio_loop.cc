@@ -0,0 +1,122 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <iostream>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Loop Points
+ *
+ * The play data is played from the start, the loop region [start,end) is played repeats
+ * times, and then the rest of the data is played. The timeline position is mapped to a
+ * position in the play data, and the number of frames until the next jump, so the play
+ * callbacks copy contiguous runs of the (single) stimulus period and jump back to the loop
+ * start sample-exactly (no crossfade).
+ *
+ *********************************************************************************************/
+
+/***
+ *
+ * loop_setup
+ *
+ * Checks and sets the loop points for play data with frames frames. Use
+ * start = 0, end = frames, and repeats = 1 for no looping.
+ *
+ ***/
+
+int loop_setup(jaudio_loop_t *lp, size_t frames, size_t start, size_t end, size_t repeats)
+{
+  if (start >= end || end > frames) {
+    std::cerr << "The loop must be a non-empty range of the " << frames << " play data frames!" << std::endl;
+    return -1;
+  }
+
+  lp->frames = frames;
+  lp->start = start;
+  lp->end = end;
+  lp->repeats = repeats;
+
+  return 0;
+}
+
+/***
+ *
+ * loop_get_frames
+ *
+ * The length of the timeline (SIZE_MAX if the loop is played until stopped).
+ *
+ ***/
+
+size_t loop_get_frames(const jaudio_loop_t *lp)
+{
+  if (lp->repeats == JAUDIO_LOOP_FOREVER) {
+    return SIZE_MAX;
+  }
+
+  return lp->frames + (lp->repeats - 1) * (lp->end - lp->start);
+}
+
+/***
+ *
+ * loop_position
+ *
+ * Maps the timeline position t to a position in the play data. The number
+ * of frames that can be copied from there before the next jump is returned
+ * in run.
+ *
+ ***/
+
+size_t loop_position(const jaudio_loop_t *lp, size_t t, size_t *run)
+{
+  size_t loop_frames = lp->end - lp->start;
+
+  // Before the first jump.
+  if (t < lp->end) {
+    *run = ((lp->repeats == 1) ? lp->frames : lp->end) - t;
+    return t;
+  }
+
+  // In the loop region (the last repetition runs on into the tail).
+  size_t loops_end = lp->end + (lp->repeats - 1) * loop_frames;
+  if (lp->repeats == JAUDIO_LOOP_FOREVER || t < loops_end) {
+
+    size_t pos = lp->start + (t - lp->end) % loop_frames;
+
+    if (lp->repeats != JAUDIO_LOOP_FOREVER && t + (lp->end - pos) == loops_end) {
+      *run = lp->frames - pos;
+    } else {
+      *run = lp->end - pos;
+    }
+
+    return pos;
+  }
+
+  // The tail after the loop.
+  size_t pos = lp->end + (t - loops_end);
+  *run = lp->frames - pos;
+
+  return pos;
+}
@@ -0,0 +1,198 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <atomic>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Level Metering
+ *
+ * The JACK callback meters each period right after it has been copied (while the
+ * samples are still in the cache) and then publishes the statistics to a snapshot
+ * that can be read from any thread. The snapshot is protected by a sequence counter
+ * (a seqlock): the callback never waits and a reader simply retries if it raced
+ * with an update.
+ *
+ *********************************************************************************************/
+
+// Per channel accumulators (only touched by the JACK thread).
+typedef struct {
+  float peak;
+  double sum_sq;
+  size_t clips;
+  size_t frames;
+  float period_peak;
+  double period_sum_sq;
+  size_t period_frames;
+} meter_acc_t;
+
+struct jaudio_meter {
+  size_t channels;
+  float clip_level;
+  meter_acc_t *acc;
+  jaudio_meter_stats_t *snapshot;
+  std::atomic<unsigned int> seq;
+};
+
+/***
+ *
+ * meter_create
+ *
+ * Allocates a meter for the given number of channels. Samples with
+ * a magnitude >= clip_level are counted as clipped.
+ *
+ ***/
+
+jaudio_meter_t* meter_create(size_t channels, float clip_level)
+{
+  jaudio_meter_t *meter = new jaudio_meter_t;
+
+  meter->channels = channels;
+  meter->clip_level = clip_level;
+  meter->acc = (meter_acc_t*) calloc(channels, sizeof(meter_acc_t));
+  meter->snapshot = (jaudio_meter_stats_t*) calloc(channels, sizeof(jaudio_meter_stats_t));
+  meter->seq.store(0);
+
+  if (!meter->acc || !meter->snapshot) {
+    std::cerr << "Meter memory allocation failed!" << std::endl;
+    meter_destroy(meter);
+    return nullptr;
+  }
+
+  return meter;
+}
+
+void meter_destroy(jaudio_meter_t *meter)
+{
+  if (meter) {
+    free(meter->acc);
+    free(meter->snapshot);
+    delete meter;
+  }
+}
+
+/***
+ *
+ * meter_update
+ *
+ * Meters nframes samples of a channel. Called from the JACK callback.
+ *
+ ***/
+
+void meter_update(jaudio_meter_t *meter, size_t channel, const float *x, size_t nframes)
+{
+  meter_acc_t *acc = &meter->acc[channel];
+
+  // One pass over the period for the peak, the sum of squares, and the clip count.
+  float peak = 0.0f;
+  float sum_sq = 0.0f;
+  size_t clips = 0;
+  float clip_level = meter->clip_level;
+
+  for (size_t m=0; m<nframes; m++) {
+    float a = fabsf(x[m]);
+    peak = (a > peak) ? a : peak;
+    sum_sq += x[m] * x[m];
+    clips += (a >= clip_level);
+  }
+
+  if (peak > acc->period_peak) {
+    acc->period_peak = peak;
+  }
+
+  acc->period_sum_sq += (double) sum_sq;
+  acc->period_frames += nframes;
+  acc->clips += clips;
+}
+
+/***
+ *
+ * meter_publish
+ *
+ * Ends a period: folds the period statistics into the totals and
+ * updates the snapshot. Called from the JACK callback.
+ *
+ ***/
+
+void meter_publish(jaudio_meter_t *meter)
+{
+  unsigned int seq = meter->seq.load(std::memory_order_relaxed);
+
+  meter->seq.store(seq + 1, std::memory_order_relaxed); // Odd: update in progress.
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (size_t n=0; n<meter->channels; n++) {
+
+    meter_acc_t *acc = &meter->acc[n];
+    jaudio_meter_stats_t *s = &meter->snapshot[n];
+
+    if (acc->period_frames == 0) {
+      continue;
+    }
+
+    if (acc->period_peak > acc->peak) {
+      acc->peak = acc->period_peak;
+    }
+    acc->sum_sq += acc->period_sum_sq;
+    acc->frames += acc->period_frames;
+
+    s->peak = acc->peak;
+    s->rms = (float) sqrt(acc->sum_sq / (double) acc->frames);
+    s->period_peak = acc->period_peak;
+    s->period_rms = (float) sqrt(acc->period_sum_sq / (double) acc->period_frames);
+    s->clips = acc->clips;
+    s->frames = acc->frames;
+
+    acc->period_peak = 0.0f;
+    acc->period_sum_sq = 0.0;
+    acc->period_frames = 0;
+  }
+
+  meter->seq.store(seq + 2, std::memory_order_release); // Even: snapshot consistent.
+}
+
+/***
+ *
+ * meter_snapshot
+ *
+ * Copies the latest published statistics (one struct per channel)
+ * into stats. Can be called from any (non real-time) thread.
+ *
+ ***/
+
+void meter_snapshot(const jaudio_meter_t *meter, jaudio_meter_stats_t *stats)
+{
+  unsigned int seq0, seq1;
+
+  do {
+    seq0 = meter->seq.load(std::memory_order_acquire);
+    memcpy(stats, meter->snapshot, meter->channels * sizeof(jaudio_meter_stats_t));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    seq1 = meter->seq.load(std::memory_order_relaxed);
+  } while ((seq0 & 1) || seq0 != seq1);
+}
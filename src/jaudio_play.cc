@@ -34,14 +34,40 @@
 // Globals.
 //
 
-volatile bool play_running;
+static volatile bool play_running;
 
-size_t play_frames;
-size_t frames_played;
+static size_t play_frames;    // The length of the timeline (the play data with the loops).
+static size_t frames_played;
+static size_t play_data_frames; // The length of the play data.
 
-jack_client_t *play_client;
-jack_port_t **output_ports;
-size_t n_output_ports;
+static jack_client_t *play_client;
+static jack_port_t **output_ports;
+static size_t n_output_ports;
+
+static bool play_use_freewheel;
+static volatile bool play_freewheeling;
+
+static jaudio_generator_t *play_generator = nullptr;
+static jaudio_resampler_t *play_resampler = nullptr;
+static jaudio_events_t *play_events = nullptr;
+static jack_default_audio_sample_t **play_out = nullptr; // Per period output port buffers.
+
+// Routing (sources -> ports) gain matrix.
+static const double *play_route_gains = nullptr;
+static size_t play_route_sources = 0;
+static jaudio_router_t *play_router = nullptr;
+
+// Loop points.
+static size_t play_loop_start = 0;
+static size_t play_loop_end = 0;
+static size_t play_loop_repeats = 1;
+static jaudio_loop_t play_loop;
+
+// Xruns (only reported; the play data continues where it was).
+static jaudio_xrun_log_t *play_xruns = nullptr;
+
+// The time the client was activated (until the first played period).
+static double play_t_started = 0.0;
 
 /***
  *
@@ -71,10 +97,43 @@ void play_clear_running_flag(void)
 // This is called whenever the sample rate changes.
 int play_srate(jack_nframes_t nframes, void *arg)
 {
-  //printf("The sample rate is now %lu/sec.\n", (long unsigned int) nframes);
+  // Resampled data would be played at the wrong speed so stop.
+  if (play_resampler && (double) nframes != resampler_get_output_rate(play_resampler)) {
+    std::cerr << "The JACK sample rate changed to " << nframes << " [Hz] - playback stopped!" << std::endl;
+    play_clear_running_flag();
+  }
+
   return 0;
 }
 
+// This is called whenever JACK (or a client) misses a deadline.
+static int play_xrun(void *arg)
+{
+  if (play_xruns) {
+    xrun_log_notify(play_xruns);
+  }
+
+  return 0;
+}
+
+// Logs the frames JACK never played since the previous period (and the time of the first period).
+static void play_period_start(jack_nframes_t nframes)
+{
+  if (play_t_started > 0.0) {
+    profile_add(JAUDIO_PHASE_FIRST_PERIOD, play_t_started);
+    play_t_started = 0.0;
+  }
+
+  size_t lost_frames = xrun_log_lost_frames(play_xruns, jack_last_frame_time(play_client),
+                                            nframes, play_freewheeling);
+
+  if (lost_frames > 0 && frames_played < play_frames) {
+    xrun_log_add(play_xruns, frames_played, lost_frames);
+  }
+
+  return;
+}
+
 void play_jerror(const char *desc)
 {
   std::cerr << "JACK error: '" << desc << "'" << std::endl;
@@ -90,6 +149,28 @@ void play_jack_shutdown(void *arg)
   return;
 }
 
+// This is called whenever the JACK server enters or leaves freewheel mode.
+void play_freewheel(int starting, void *arg)
+{
+  play_freewheeling = (starting != 0);
+
+  return;
+}
+
+/***
+ *
+ * play_is_freewheeling
+ *
+ * True when the JACK server is running the process cycles
+ * as fast as possible (not in sync with the sound card).
+ *
+ ***/
+
+bool play_is_freewheeling(void)
+{
+  return play_freewheeling;
+}
+
 
 /********************************************************************************************
  *
@@ -97,6 +178,45 @@ void play_jack_shutdown(void *arg)
  *
  *********************************************************************************************/
 
+/***
+ *
+ * play_set_routing
+ *
+ * Play a frames x sources matrix through a ports x sources (column major)
+ * gain matrix: port p plays the sum of all sources s scaled by gains(p,s).
+ * Only used for FLOAT_AUDIO and DOUBLE_AUDIO data. The gains must be valid
+ * until play_init returns. Must be called before play_init.
+ *
+ ***/
+
+void play_set_routing(const double *gains, size_t sources)
+{
+  play_route_gains = gains;
+  play_route_sources = sources;
+
+  return;
+}
+
+/***
+ *
+ * play_set_loop
+ *
+ * Play the frames [start,end) of the play data repeats times (or until
+ * stopped if repeats is JAUDIO_LOOP_FOREVER) before the rest of the data
+ * is played. end = 0 is the end of the data. Only used for FLOAT_AUDIO,
+ * DOUBLE_AUDIO, and EVENT_AUDIO data. Must be called before play_init.
+ *
+ ***/
+
+void play_set_loop(size_t start, size_t end, size_t repeats)
+{
+  play_loop_start = start;
+  play_loop_end = end;
+  play_loop_repeats = repeats;
+
+  return;
+}
+
 /***
  *
  * play_finished
@@ -132,6 +252,8 @@ int play_process_f(jack_nframes_t nframes, void *arg)
   // The number of available frames.
   frames_to_write = (size_t) nframes;
 
+  play_period_start(nframes);
+
   if((play_frames - frames_played) > 0) {
 
     if (frames_to_write >  (play_frames - frames_played) ) {
@@ -197,6 +319,8 @@ int play_process_d(jack_nframes_t nframes, void *arg)
   // The number of available frames.
   frames_to_write = (size_t) nframes;
 
+  play_period_start(nframes);
+
   if((play_frames - frames_played) > 0) {
 
     if (frames_to_write >  (play_frames - frames_played) ) {
@@ -248,6 +372,275 @@ int play_process_d(jack_nframes_t nframes, void *arg)
   return 0;
 }
 
+// Generated play data (no input matrix).
+
+int play_process_g(jack_nframes_t nframes, void *arg)
+{
+  size_t frames_to_write, n;
+  jaudio_generator_t *gen = (jaudio_generator_t*) arg;
+
+  // The number of available frames.
+  frames_to_write = (size_t) nframes;
+
+  play_period_start(nframes);
+
+  if (frames_played < play_frames) {
+    if (frames_to_write > (play_frames - frames_played) ) {
+      frames_to_write = play_frames - frames_played;
+    }
+  }
+
+  // Grab all output buffers since the generator renders all channels at once.
+  for (n=0; n<n_output_ports; n++) {
+
+    play_out[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(output_ports[n], nframes);
+
+    if (play_out[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  if (frames_played >= play_frames || !play_running) {
+
+    for (n=0; n<n_output_ports; n++) {
+      std::memset(play_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes); // Just fill with silence.
+    }
+
+  } else {
+
+    // Synthesize directly into the JACK buffers.
+    generator_render(gen, play_out, frames_played, 0, frames_to_write);
+
+    // Fill the end with silence.
+    if ( frames_to_write < nframes ) {
+      for (n=0; n<n_output_ports; n++) {
+        std::memset(&play_out[n][frames_to_write], 0x0,
+                    sizeof (jack_default_audio_sample_t) * (nframes - frames_to_write));
+      }
+    }
+  }
+
+  if (frames_played < play_frames) {
+    frames_played += frames_to_write;
+  }
+
+  return 0;
+}
+
+// Resampled play data (the play buffer is a jaudio_resampler_t).
+
+int play_process_r(jack_nframes_t nframes, void *arg)
+{
+  size_t frames_to_write, n;
+  jaudio_resampler_t *rs = (jaudio_resampler_t*) arg;
+
+  // The number of available frames.
+  frames_to_write = (size_t) nframes;
+
+  play_period_start(nframes);
+
+  if (frames_played < play_frames) {
+    if (frames_to_write > (play_frames - frames_played) ) {
+      frames_to_write = play_frames - frames_played;
+    }
+  }
+
+  for (n=0; n<n_output_ports; n++) {
+
+    play_out[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(output_ports[n], nframes);
+
+    if (play_out[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  if (frames_played >= play_frames || !play_running) {
+
+    for (n=0; n<n_output_ports; n++) {
+      std::memset(play_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes); // Just fill with silence.
+    }
+
+  } else {
+
+    // The worker thread converts the data ahead of us.
+    resampler_read(rs, play_out, 0, frames_to_write);
+
+    // Fill the end with silence.
+    if ( frames_to_write < nframes ) {
+      for (n=0; n<n_output_ports; n++) {
+        std::memset(&play_out[n][frames_to_write], 0x0,
+                    sizeof (jack_default_audio_sample_t) * (nframes - frames_to_write));
+      }
+    }
+  }
+
+  if (frames_played < play_frames) {
+    frames_played += frames_to_write;
+  }
+
+  return 0;
+}
+
+// Event-list play data (the play buffer is a jaudio_events_t).
+
+int play_process_e(jack_nframes_t nframes, void *arg)
+{
+  size_t frames_to_write, n;
+  jaudio_events_t *ev = (jaudio_events_t*) arg;
+
+  // The number of available frames.
+  frames_to_write = (size_t) nframes;
+
+  play_period_start(nframes);
+
+  if (frames_played < play_frames) {
+    if (frames_to_write > (play_frames - frames_played) ) {
+      frames_to_write = play_frames - frames_played;
+    }
+  }
+
+  for (n=0; n<n_output_ports; n++) {
+
+    play_out[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(output_ports[n], nframes);
+
+    if (play_out[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  if (frames_played >= play_frames || !play_running) {
+
+    for (n=0; n<n_output_ports; n++) {
+      std::memset(play_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes); // Just fill with silence.
+    }
+
+  } else {
+
+    // Only the sounding events are rendered (the rest is silence). The event
+    // list restarts at the loop start when the loop jumps back.
+    size_t m = 0;
+    while (m < frames_to_write) {
+
+      size_t run;
+      size_t pos = loop_position(&play_loop, frames_played + m, &run);
+      if (run > frames_to_write - m) {
+        run = frames_to_write - m;
+      }
+
+      events_render(ev, play_out, pos, m, run);
+      m += run;
+    }
+
+    // Fill the end with silence.
+    if ( frames_to_write < nframes ) {
+      for (n=0; n<n_output_ports; n++) {
+        std::memset(&play_out[n][frames_to_write], 0x0,
+                    sizeof (jack_default_audio_sample_t) * (nframes - frames_to_write));
+      }
+    }
+  }
+
+  if (frames_played < play_frames) {
+    frames_played += frames_to_write;
+  }
+
+  return 0;
+}
+
+// Routed and/or looped play data (the sources are mixed to the ports).
+
+template <typename T>
+static int play_process_looped(jack_nframes_t nframes, const T *buffer)
+{
+  size_t frames_to_write, n;
+
+  // The number of available frames.
+  frames_to_write = (size_t) nframes;
+
+  play_period_start(nframes);
+
+  if (frames_played < play_frames) {
+    if (frames_to_write > (play_frames - frames_played) ) {
+      frames_to_write = play_frames - frames_played;
+    }
+  }
+
+  for (n=0; n<n_output_ports; n++) {
+
+    play_out[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(output_ports[n], nframes);
+
+    if (play_out[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  if (frames_played >= play_frames || !play_running) {
+
+    for (n=0; n<n_output_ports; n++) {
+      std::memset(play_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes); // Just fill with silence.
+    }
+
+  } else {
+
+    // Copy (or mix) directly into the JACK buffers in runs that end where the loop jumps back.
+    size_t m = 0;
+    while (m < frames_to_write) {
+
+      size_t run;
+      size_t pos = loop_position(&play_loop, frames_played + m, &run);
+      if (run > frames_to_write - m) {
+        run = frames_to_write - m;
+      }
+
+      if (play_router) {
+        router_mix_play(play_router, buffer, play_data_frames, pos, play_out, m, run);
+      } else {
+        for (n=0; n<n_output_ports; n++) {
+          const T *src = &buffer[pos + n*play_data_frames];
+          jack_default_audio_sample_t *out = &play_out[n][m];
+          for (size_t k=0; k<run; k++) {
+            out[k] = (jack_default_audio_sample_t) src[k];
+          }
+        }
+      }
+
+      m += run;
+    }
+
+    // Fill the end with silence.
+    if ( frames_to_write < nframes ) {
+      for (n=0; n<n_output_ports; n++) {
+        std::memset(&play_out[n][frames_to_write], 0x0,
+                    sizeof (jack_default_audio_sample_t) * (nframes - frames_to_write));
+      }
+    }
+  }
+
+  if (frames_played < play_frames) {
+    frames_played += frames_to_write;
+  }
+
+  return 0;
+}
+
+int play_process_mf(jack_nframes_t nframes, void *arg)
+{
+  return play_process_looped<float>(nframes, (const float*) arg);
+}
+
+int play_process_md(jack_nframes_t nframes, void *arg)
+{
+  return play_process_looped<double>(nframes, (const double*) arg);
+}
+
 /***
  *
  * play_init
@@ -257,20 +650,44 @@ int play_process_d(jack_nframes_t nframes, void *arg)
  ***/
 
 int play_init(void* buffer, size_t frames, size_t channels,
-              char **port_names, const char *client_name, int format)
+              char **port_names, const char *client_name, int format,
+              bool freewheel)
 {
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
   size_t n;
   char port_name[255];
 
-  // The number of channels (columns) in the buffer matrix.
+  // The number of channels (columns) in the buffer matrix (or
+  // the number of ports the sources are routed to).
   n_output_ports = channels;
 
-  // The total number of frames to play.
-  play_frames = frames;
+  // The number of frames in the play data and the total number of
+  // frames to play (longer when the data is looped).
+  play_data_frames = frames;
+
+  bool looped = (play_loop_repeats != 1);
+  if (looped && format != FLOAT_AUDIO && format != DOUBLE_AUDIO && format != EVENT_AUDIO) {
+    std::cerr << "Only matrix and event-list play data can be looped!" << std::endl;
+    return -1;
+  }
+
+  if (looped) {
+    if (loop_setup(&play_loop, frames, play_loop_start, (play_loop_end > 0) ? play_loop_end : frames,
+                   play_loop_repeats) < 0) {
+      return -1;
+    }
+  } else {
+    loop_setup(&play_loop, frames, 0, frames, 1);
+  }
+
+  play_frames = loop_get_frames(&play_loop);
 
   // Reset play counter.
   frames_played = 0;
 
+  play_use_freewheel = freewheel;
+  play_freewheeling = false;
+
   // Tell the JACK server to call jerror() whenever it
   // experiences an error.  Notice that this callback is
   // global to this process, not specific to each client.
@@ -280,6 +697,7 @@ int play_init(void* buffer, size_t frames, size_t channels,
   jack_set_error_function(play_jerror);
 
   // Try to become a client of the JACK server.
+  double t_open = profile_now();
   jack_status_t status;
   if ((play_client = jack_client_open(client_name,
                                       JackNullOption,&status)) == 0) {
@@ -288,45 +706,130 @@ int play_init(void* buffer, size_t frames, size_t channels,
     return -1;
   }
 
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
+  play_xruns = xrun_log_create();
+
+  // Mix the sources to the ports, and/or loop the data, in the callback.
+  bool routed = play_route_gains && (format == FLOAT_AUDIO || format == DOUBLE_AUDIO);
+
+  if (routed || (looped && format != EVENT_AUDIO)) {
+
+    play_router = routed ? router_create(play_route_gains, n_output_ports, play_route_sources, 0) : nullptr;
+    play_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    if ((routed && !play_router) || !play_out) {
+      play_close();
+      return -1;
+    }
+  }
+
   // Tell the JACK server to call the `play_process()' whenever
   // there is work to be done.
   if (format == FLOAT_AUDIO) {
-    jack_set_process_callback(play_client, play_process_f, buffer);
+    jack_set_process_callback(play_client, (routed || looped) ? play_process_mf : play_process_f, buffer);
   }
 
   if (format == DOUBLE_AUDIO) {
-    jack_set_process_callback(play_client, play_process_d, buffer);
+    jack_set_process_callback(play_client, (routed || looped) ? play_process_md : play_process_d, buffer);
+  }
+
+  if (format == GENERATOR_AUDIO) {
+
+    play_generator = (jaudio_generator_t*) buffer;
+
+    if (generator_setup(play_generator, (double) jack_get_sample_rate(play_client), n_output_ports) < 0) {
+      play_generator = nullptr; // Not set up (and owned by the caller).
+      play_close();
+      return -1;
+    }
+
+    play_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(play_client, play_process_g, buffer);
+  }
+
+  if (format == RESAMPLED_AUDIO) {
+
+    play_resampler = (jaudio_resampler_t*) buffer;
+
+    if ((double) jack_get_sample_rate(play_client) != resampler_get_output_rate(play_resampler)) {
+      std::cerr << "The play data was resampled to " << resampler_get_output_rate(play_resampler)
+                << " [Hz] but the JACK sample rate is " << jack_get_sample_rate(play_client) << " [Hz]!" << std::endl;
+      play_close();
+      return -1;
+    }
+
+    play_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(play_client, play_process_r, buffer);
+  }
+
+  if (format == EVENT_AUDIO) {
+
+    play_events = (jaudio_events_t*) buffer;
+
+    play_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(play_client, play_process_e, buffer);
   }
 
   // Tell the JACK server to call `srate()' whenever
   // the sample rate of the system changes.
   jack_set_sample_rate_callback(play_client, play_srate, 0);
 
+  // Tell the JACK server to call `play_xrun()' whenever
+  // a deadline is missed.
+  jack_set_xrun_callback(play_client, play_xrun, 0);
+
   // Tell the JACK server to call `jack_shutdown()' if
   // it ever shuts down, either entirely, or if it
   // just decides to stop calling us.
   jack_on_shutdown(play_client, play_jack_shutdown, 0);
 
+  // Tell the JACK server to call `play_freewheel()' when
+  // freewheel mode is entered or left.
+  jack_set_freewheel_callback(play_client, play_freewheel, 0);
+
   output_ports = (jack_port_t**) malloc(n_output_ports * sizeof(jack_port_t*));
 
+  double t_register = profile_now();
   for (n=0; n<n_output_ports; n++) {
     sprintf(port_name,"output_%d", (int) n+1); // Port numbers start at 1.
     output_ports[n] = jack_port_register(play_client, port_name,
                                          JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
   }
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
 
   // Tell the JACK server that we are ready to roll.
+  double t_activate = profile_now();
+  play_t_started = t_activate; // The first period is timed from here.
   if (jack_activate(play_client)) {
     std::cerr << "Cannot activate jack client!" << std::endl;
+    play_close();
+    return -1;
+  }
+
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
+  // Connect to the output ports (all are checked before any is connected).
+  if (ports_connect(play_client, output_ports, port_names, n_output_ports, false) < 0) {
+    play_close();
     return -1;
   }
 
-  // Connect to the output ports.
   for (n=0; n<n_output_ports; n++) {
-    if (jack_connect(play_client, jack_port_name(output_ports[n]), port_names[n])) {
-      std::cerr << "Cannot connect to the client output port: '" <<  port_names[n] << "'" << std::endl;
-      play_close();
-      return -1;
+    if (freewheel && jaudio_port_is_physical(play_client, port_names[n])) {
+      std::cerr << "Warning: '" << port_names[n]
+                << "' is a hardware port which is not serviced in freewheel mode!" << std::endl;
+    }
+  }
+
+  // Run the server as fast as possible for the duration of the playback.
+  if (freewheel) {
+    if (jack_set_freewheel(play_client, 1)) {
+      std::cerr << "Failed to enter freewheel mode!" << std::endl;
+      play_use_freewheel = false;
     }
   }
 
@@ -344,23 +847,72 @@ int play_init(void* buffer, size_t frames, size_t channels,
 
 int play_close(void)
 {
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
   size_t n;
   int err;
-  // Unregister all ports for the play client.
-  for (n=0; n<n_output_ports; n++) {
-    err = jack_port_unregister(play_client, output_ports[n]);
+
+  // Nothing to release if the client is already closed (play_close may be called twice).
+  if (play_client) {
+
+    // Leave freewheel mode before we remove our ports.
+    if (play_use_freewheel) {
+      jack_set_freewheel(play_client, 0);
+    }
+
+    // Unregister all ports for the play client.
+    for (n=0; output_ports && n<n_output_ports; n++) {
+      if (output_ports[n] && jack_port_unregister(play_client, output_ports[n])) {
+        std::cerr << "Failed to unregister an output port!" << std::endl;
+      }
+    }
+
+    // Close the client.
+    err = jack_client_close(play_client);
     if (err) {
-      std::cerr << "Failed to unregister an output port!" << std::endl;
+      std::cerr << "jack_client_close failed!" << std::endl;
     }
+
+    play_client = nullptr;
   }
+  play_use_freewheel = false;
 
-  // Close the client.
-  err = jack_client_close(play_client);
-  if (err) {
-    std::cerr << "jack_client_close failed!" << std::endl;
-      }
+  if (output_ports) {
+    free(output_ports);
+    output_ports = nullptr;
+  }
+
+  if (play_generator) {
+    generator_free(play_generator);
+    play_generator = nullptr;
+  }
+
+  // The resampler and the event list are owned (and destroyed) by the caller.
+  play_resampler = nullptr;
+  play_events = nullptr;
+
+  if (play_router) {
+    router_destroy(play_router);
+    play_router = nullptr;
+  }
+  play_route_gains = nullptr;
+  play_route_sources = 0;
+
+  play_loop_start = 0;
+  play_loop_end = 0;
+  play_loop_repeats = 1;
 
-  free(output_ports);
+  if (play_out) {
+    free(play_out);
+    play_out = nullptr;
+  }
+
+  play_t_started = 0.0;
+
+  if (play_xruns) {
+    xrun_log_report(play_xruns);
+    xrun_log_destroy(play_xruns);
+    play_xruns = nullptr;
+  }
 
   return 0;
 }
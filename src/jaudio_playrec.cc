@@ -34,22 +34,85 @@
 // Globals.
 //
 
-volatile bool playrec_running;
-
-int total_playrec_frames;
-int frames_played;
-int frames_recorded;
-bool is_first_jack_period;
-size_t num_skip_periods;
-size_t skip_periods_counter;
-
-jack_client_t *playrec_client;
-
-jack_port_t **input_ports;
-size_t n_input_ports;
-
-jack_port_t **output_ports;
-size_t n_output_ports;
+static volatile bool playrec_running;
+
+static size_t total_playrec_frames;
+static size_t frames_played;
+static size_t frames_recorded;
+static size_t stimulus_frames;       // The length of the stimulus (one repetition, including the loops).
+static size_t playrec_data_frames;   // The length of the play data.
+static bool is_first_jack_period;
+static size_t skip_frames_left;      // Frames left to skip before recording.
+
+static jack_client_t *playrec_client;
+
+static jack_port_t **input_ports;
+static size_t n_input_ports;
+static size_t n_record_channels; // The recorded channels (= n_input_ports unless routed).
+
+static jack_port_t **output_ports;
+static size_t n_output_ports;
+
+// The play and record buffer adresses passed to the process callback.
+static void *playrec_buffers[2];
+
+static bool playrec_use_freewheel;
+static volatile bool playrec_freewheeling;
+
+// Synchronous averaging.
+static size_t playrec_num_averages = 1;
+static bool playrec_use_variance = false;
+static double *avg_sum = nullptr;
+static double *avg_sum_sq = nullptr;
+
+// Level metering.
+static bool playrec_use_meter = false;
+static float playrec_clip_level = JAUDIO_METER_CLIP_LEVEL;
+static jaudio_meter_t *playrec_meter = nullptr;
+
+// Decimation.
+static const size_t *playrec_decimation_factors = nullptr;
+static jaudio_decimation_t *playrec_decimation = nullptr;
+
+static jaudio_generator_t *playrec_generator = nullptr;
+static jaudio_resampler_t *playrec_resampler = nullptr;
+static jaudio_convolver_t *playrec_convolver = nullptr;
+static jaudio_events_t *playrec_events = nullptr;
+static jack_default_audio_sample_t **playrec_out = nullptr; // Per period output port buffers.
+
+// Routing (sources -> play ports and record ports -> channels) gain matrices.
+static const double *playrec_play_route_gains = nullptr;
+static size_t playrec_play_route_sources = 0;
+static jaudio_router_t *playrec_play_router = nullptr;
+static const double *playrec_record_route_gains = nullptr;
+static size_t playrec_record_route_channels = 0;
+static jaudio_router_t *playrec_record_router = nullptr;
+static jack_default_audio_sample_t **playrec_in = nullptr; // Per period input port buffers.
+
+// Direct monitoring (record ports -> play ports in the same cycle).
+static const double *playrec_monitor_gains = nullptr;
+static bool playrec_monitor_gated = true;
+static jaudio_router_t *playrec_monitor = nullptr;
+static jack_default_audio_sample_t **playrec_monitor_in = nullptr;
+static float playrec_monitor_level = 0.0f; // The current monitor gain (ramped when the gate opens or closes).
+
+// Loop points.
+static size_t playrec_loop_start = 0;
+static size_t playrec_loop_end = 0;
+static size_t playrec_loop_repeats = 1;
+static jaudio_loop_t playrec_loop;
+
+// Buffer-size and sample-rate change points.
+static jaudio_change_log_t *playrec_changes = nullptr;
+
+// The time the client was activated (until the first recorded frame, after the skipped periods).
+static double playrec_t_started = 0.0;
+
+// Xruns (lost periods are played and recorded as gaps unless playrec_xrun_fill is false).
+static bool playrec_xrun_fill = true;
+static jaudio_xrun_log_t *playrec_xruns = nullptr;
+static jack_default_audio_sample_t *playrec_zeros = nullptr; // One (largest) period of zeros.
+static size_t playrec_zeros_frames = 0;
 
 /***
  *
@@ -79,7 +142,36 @@ void playrec_clear_running_flag(void)
 // This is called whenever the sample rate changes.
 int playrec_srate(jack_nframes_t nframes, void *arg)
 {
-  //printf("The sample rate is now %lu/sec.\n", (long unsigned int) nframes);
+  // Resampled data would be played at the wrong speed so stop.
+  if (playrec_resampler && (double) nframes != resampler_get_output_rate(playrec_resampler)) {
+    std::cerr << "The JACK sample rate changed to " << nframes << " [Hz] - playback stopped!" << std::endl;
+    playrec_clear_running_flag();
+  }
+
+  if (playrec_changes) {
+    change_log_set_sample_rate(playrec_changes, nframes);
+  }
+
+  return 0;
+}
+
+// This is called whenever the period size changes (the change is logged by the process callback).
+static int playrec_bufsize(jack_nframes_t nframes, void *arg)
+{
+  if (playrec_changes && change_log_set_buffer_size(playrec_changes, nframes) < 0) {
+    playrec_clear_running_flag(); // Stop since the period doesn't fit the scratch buffers.
+  }
+
+  return 0;
+}
+
+// This is called whenever JACK (or a client) misses a deadline.
+static int playrec_xrun(void *arg)
+{
+  if (playrec_xruns) {
+    xrun_log_notify(playrec_xruns);
+  }
+
   return 0;
 }
 
@@ -98,26 +190,419 @@ void playrec_jack_shutdown(void *arg)
   return;
 }
 
+// This is called whenever the JACK server enters or leaves freewheel mode.
+void playrec_freewheel(int starting, void *arg)
+{
+  playrec_freewheeling = (starting != 0);
+
+  return;
+}
+
+/***
+ *
+ * playrec_is_freewheeling
+ *
+ * True when the JACK server is running the process cycles
+ * as fast as possible (not in sync with the sound card).
+ *
+ ***/
+
+bool playrec_is_freewheeling(void)
+{
+  return playrec_freewheeling;
+}
+
 
 bool playrec_finished(void)
 {
-  return ((total_playrec_frames - frames_recorded) <= 0);
+  return (frames_recorded >= total_playrec_frames);
 }
 
-// Single precision play data.
+// The number of frames recorded so far (frames before it are final).
+size_t playrec_get_frames_recorded(void)
+{
+  return frames_recorded;
+}
 
-int playrec_process_f(jack_nframes_t nframes, void *arg)
+// The sample rate of the JACK server (valid after playrec_init).
+jack_nframes_t playrec_get_sample_rate(void)
+{
+  return jack_get_sample_rate(playrec_client);
+}
+
+/***
+ *
+ * playrec_set_averaging
+ *
+ * Loop the stimulus num_averages times and accumulate the recorded
+ * periods, aligned to the stimulus, instead of storing every
+ * repetition. Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_averaging(size_t num_averages, bool compute_variance)
+{
+  playrec_num_averages = (num_averages > 0) ? num_averages : 1;
+  playrec_use_variance = compute_variance;
+
+  return;
+}
+
+/***
+ *
+ * playrec_set_meter
+ *
+ * Enable per-channel level metering (peak, RMS, and clip counts) of
+ * the recorded data. Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_meter(bool enable, float clip_level)
+{
+  playrec_use_meter = enable;
+  playrec_clip_level = clip_level;
+
+  return;
+}
+
+/***
+ *
+ * playrec_get_meter
+ *
+ * Copies the latest meter statistics (one struct per channel) to stats.
+ * Can be called while playing and recording. Returns -1 if metering is
+ * not enabled.
+ *
+ ***/
+
+int playrec_get_meter(jaudio_meter_stats_t *stats)
+{
+  if (!playrec_meter) {
+    return -1;
+  }
+
+  meter_snapshot(playrec_meter, stats);
+
+  return 0;
+}
+
+/***
+ *
+ * playrec_get_period_changes
+ *
+ * Copies the buffer-size and sample-rate changes during the capture
+ * (changes must have room for JAUDIO_MAX_PERIOD_CHANGES entries) and
+ * returns their number. Must be called before playrec_close.
+ *
+ ***/
+
+size_t playrec_get_period_changes(jaudio_period_change_t *changes)
+{
+  return playrec_changes ? change_log_get(playrec_changes, changes) : 0;
+}
+
+/***
+ *
+ * playrec_set_xrun_fill
+ *
+ * If fill is true (the default) the frames lost in an xrun are skipped in
+ * the play data and recorded as zeros so that both stay time-true (and
+ * aligned). Otherwise play and record just continue where they were and
+ * the gaps are only logged. Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_xrun_fill(bool fill)
+{
+  playrec_xrun_fill = fill;
+
+  return;
+}
+
+/***
+ *
+ * playrec_get_xruns
+ *
+ * Copies the gaps (recorded frame, lost frames) during the capture (xruns
+ * must have room for JAUDIO_MAX_XRUNS entries) and returns their number.
+ * Must be called before playrec_close.
+ *
+ ***/
+
+size_t playrec_get_xruns(jaudio_xrun_t *xruns)
+{
+  return playrec_xruns ? xrun_log_get(playrec_xruns, xruns) : 0;
+}
+
+/***
+ *
+ * playrec_set_decimation
+ *
+ * Anti-alias filter and downsample recorded channel n by factors[n]
+ * (1 = keep the full rate). The channels are then stored after each
+ * other in the record buffer, each decimation_output_frames() long.
+ * Not used in averaging mode. The factors must be valid until
+ * playrec_close. Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_decimation(const size_t *factors)
+{
+  playrec_decimation_factors = factors;
+
+  return;
+}
+
+/***
+ *
+ * playrec_set_play_routing
+ *
+ * Play a frames x sources matrix through a ports x sources (column major)
+ * gain matrix: port p plays the sum of all sources s scaled by gains(p,s).
+ * Only used for FLOAT_AUDIO and DOUBLE_AUDIO data. The gains must be valid
+ * until playrec_init returns. Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_play_routing(const double *gains, size_t sources)
+{
+  playrec_play_route_gains = gains;
+  playrec_play_route_sources = sources;
+
+  return;
+}
+
+/***
+ *
+ * playrec_set_record_routing
+ *
+ * Record channels x ports (column major) mixes of the input ports: channel c
+ * is the sum of all ports p scaled by gains(c,p). The record buffer then holds
+ * channels columns and averaging, metering, and decimation work on the mixed
+ * channels. The gains must be valid until playrec_init returns. Must be called
+ * before playrec_init.
+ *
+ ***/
+
+void playrec_set_record_routing(const double *gains, size_t channels)
+{
+  playrec_record_route_gains = gains;
+  playrec_record_route_channels = channels;
+
+  return;
+}
+
+/***
+ *
+ * playrec_set_monitor
+ *
+ * Mix the input ports into the output ports, in the same JACK cycle, through
+ * a play ports x record ports (column major) gain matrix: output port p gets
+ * the sum of all input ports r scaled by gains(p,r) added to the play data. If
+ * gated, the monitor is muted except while recording (after the skipped periods
+ * and until all frames are recorded). The gain is ramped over one period when
+ * the gate opens or closes. The gains must be valid until playrec_init returns.
+ * Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_monitor(const double *gains, bool gated)
+{
+  playrec_monitor_gains = gains;
+  playrec_monitor_gated = gated;
+
+  return;
+}
+
+/***
+ *
+ * playrec_set_loop
+ *
+ * Play the frames [start,end) of the play data repeats times before the
+ * rest of the data is played. end = 0 is the end of the data. The stimulus
+ * (which is repeated when averaging) and the recording are then longer than
+ * the play data, see loop_get_frames. Only used for FLOAT_AUDIO, DOUBLE_AUDIO,
+ * and EVENT_AUDIO data. Must be called before playrec_init.
+ *
+ ***/
+
+void playrec_set_loop(size_t start, size_t end, size_t repeats)
+{
+  playrec_loop_start = start;
+  playrec_loop_end = end;
+  playrec_loop_repeats = repeats;
+
+  return;
+}
+
+/***
+ *
+ * playrec_get_average
+ *
+ * Computes the (coherent) average, and optionally the variance, of the
+ * recorded repetitions. The output buffers are frames x channels (column
+ * major) matrices. If the recording was interrupted only the completed
+ * part of each repetition is averaged.
+ *
+ ***/
+
+int playrec_get_average(float *average, float *variance)
+{
+  if (avg_sum == nullptr) {
+    return -1; // Not in averaging mode.
+  }
+
+  if (stimulus_frames == 0) {
+    return 0;
+  }
+
+  size_t full_reps = frames_recorded / stimulus_frames;
+  size_t partial_frames = frames_recorded % stimulus_frames;
+
+  for (size_t n=0; n<n_record_channels; n++) {
+    for (size_t m=0; m<stimulus_frames; m++) {
+
+      size_t i = m + n*stimulus_frames;
+      double count = (double) (full_reps + ((m < partial_frames) ? 1 : 0));
+
+      if (count < 1.0) {
+        average[i] = 0.0f;
+        if (variance) {
+          variance[i] = 0.0f;
+        }
+        continue;
+      }
+
+      double mean = avg_sum[i] / count;
+      average[i] = (float) mean;
+
+      if (variance) {
+        if (avg_sum_sq && count > 1.0) {
+          // Unbiased estimate from the sum and the sum of squares.
+          double var = (avg_sum_sq[i] - count*mean*mean) / (count - 1.0);
+          variance[i] = (float) ((var > 0.0) ? var : 0.0);
+        } else {
+          variance[i] = 0.0f;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Adds the monitored inputs to the (already written) output port buffers.
+static int playrec_monitor_process(jack_nframes_t nframes)
+{
+  bool recording = playrec_running && frames_recorded < total_playrec_frames &&
+    skip_frames_left == 0;
+
+  float target = (!playrec_monitor_gated || recording) ? 1.0f : 0.0f;
+  if (target == 0.0f && playrec_monitor_level == 0.0f) {
+    return 0; // Muted.
+  }
+
+  for (size_t n=0; n<n_input_ports; n++) {
+
+    playrec_monitor_in[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(input_ports[n], nframes);
+
+    if (playrec_monitor_in[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  jack_default_audio_sample_t **mixed = router_mix(playrec_monitor, playrec_monitor_in, (size_t) nframes);
+  if (mixed == nullptr) {
+    std::cerr << "The JACK period is larger than the monitor buffers!" << std::endl;
+    return -1;
+  }
+
+  float level = playrec_monitor_level;
+  float step = (target - level) / (float) nframes;
+
+  for (size_t n=0; n<n_output_ports; n++) {
+
+    jack_default_audio_sample_t *out = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(output_ports[n], nframes);
+
+    if (out == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+
+    const jack_default_audio_sample_t *x = mixed[n];
+    if (step == 0.0f) {
+      for (size_t k=0; k<nframes; k++) {
+        out[k] += level * x[k];
+      }
+    } else {
+      for (size_t k=0; k<nframes; k++) {
+        out[k] += (level + step * (float) (k+1)) * x[k];
+      }
+    }
+  }
+
+  playrec_monitor_level = target;
+
+  return 0;
+}
+
+/***
+ *
+ * playrec_process
+ *
+ * The duplex callback function. The stimulus is played num_averages
+ * times (once unless in averaging mode) so the play position is taken
+ * modulo the stimulus length, and then mapped to the play data through
+ * the loop points.
+ *
+ ***/
+
+// Records zeros in place of the frames lost in an xrun (nothing is added to the averages).
+static void playrec_fill_gap(float *input_fbuffer, size_t frames)
+{
+  if (frames > total_playrec_frames - frames_recorded) {
+    frames = total_playrec_frames - frames_recorded;
+  }
+
+  if (playrec_decimation) {
+
+    for (size_t m=0; m<frames; m+=playrec_zeros_frames) {
+
+      size_t chunk = (frames - m < playrec_zeros_frames) ? frames - m : playrec_zeros_frames;
+
+      for (size_t n=0; n<n_record_channels; n++) {
+        decimation_process(playrec_decimation, n, playrec_zeros, chunk, input_fbuffer);
+      }
+    }
+
+  } else if (avg_sum == nullptr) {
+
+    for (size_t n=0; n<n_record_channels; n++) {
+      std::memset(&input_fbuffer[frames_recorded + n*total_playrec_frames], 0x0, frames * sizeof(float));
+    }
+  }
+
+  frames_recorded += frames;
+
+  if (playrec_decimation && frames_recorded >= total_playrec_frames) {
+    decimation_finish(playrec_decimation, input_fbuffer);
+  }
+
+  return;
+}
+
+template <typename T>
+static int playrec_process(jack_nframes_t nframes, const T *output_buffer, float *input_fbuffer)
 {
-  float  **iobuffers = nullptr;
-  float  *output_fbuffer = nullptr;
-  float  *input_fbuffer = nullptr;
   jack_default_audio_sample_t *out = nullptr;
   jack_default_audio_sample_t *in = nullptr;
 
-  // Get the adresses of the input and output buffers.
-  iobuffers = (float**) arg;
-  output_fbuffer = iobuffers[0];
-  input_fbuffer = iobuffers[1];
+  // The frames JACK never delivered since the previous period (checked every period).
+  size_t lost_frames = xrun_log_lost_frames(playrec_xruns, jack_last_frame_time(playrec_client),
+                                            nframes, playrec_freewheeling);
 
   // First JACK period is just silence so skip it.
   if (is_first_jack_period) {
@@ -125,22 +610,120 @@ int playrec_process_f(jack_nframes_t nframes, void *arg)
     return 0;
   }
 
+  // Keep play and record time-true (and aligned) by skipping the lost frames in the
+  // play data and recording zeros in their place (after the periods that are skipped).
+  size_t play_lost_frames = 0;
+  if (lost_frames > 0 && playrec_running && frames_recorded < total_playrec_frames) {
+
+    // The frames lost in the skipped periods are not missing in the recording.
+    size_t skip = (skip_frames_left < lost_frames) ? skip_frames_left : lost_frames;
+
+    if (lost_frames > skip) {
+      xrun_log_add(playrec_xruns, frames_recorded, lost_frames - skip);
+    }
+
+    if (playrec_xrun_fill) {
+
+      skip_frames_left -= skip;
+      playrec_fill_gap(input_fbuffer, lost_frames - skip);
+
+      if (frames_played < total_playrec_frames) {
+        play_lost_frames = (lost_frames < total_playrec_frames - frames_played) ?
+          lost_frames : total_playrec_frames - frames_played;
+        frames_played += play_lost_frames;
+      }
+    }
+  }
+
   //
   // Play
   //
 
   // The number of available frames write.
-  int frames_to_write = (int) nframes;
+  size_t frames_to_write = (size_t) nframes;
 
-  if((total_playrec_frames - frames_played) > 0) {
-
-    if (frames_to_write >  (total_playrec_frames - frames_played) ) {
+  if (frames_played < total_playrec_frames) {
+    if (frames_to_write > (total_playrec_frames - frames_played) ) {
       frames_to_write = total_playrec_frames - frames_played;
     }
   }
 
+  bool rendered = (playrec_generator || playrec_resampler || playrec_convolver ||
+                   playrec_play_router || playrec_events);
+
+  if (rendered) {
+
+    // Grab all output buffers since the generator (resampler, convolver, router,
+    // event list) renders all channels at once.
+    for (size_t n=0; n<n_output_ports; n++) {
+
+      playrec_out[n] = (jack_default_audio_sample_t *)
+        jack_port_get_buffer(output_ports[n], nframes);
+
+      if (playrec_out[n] == nullptr) {
+        std::cerr << "jack_port_get_buffer failed!" << std::endl;
+        return -1;
+      }
+
+      if (frames_played >= total_playrec_frames || !playrec_running) {
+        std::memset(playrec_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes);
+      } else if ( frames_to_write < nframes ) {
+        std::memset(&playrec_out[n][frames_to_write], 0x0,
+                    sizeof (jack_default_audio_sample_t) * (nframes - frames_to_write));
+      }
+    }
+
+    // The resampler and the convolver are streams so the lost frames are rendered (into the
+    // output buffers, which are overwritten below) and discarded.
+    if ((playrec_resampler || playrec_convolver) && play_lost_frames > 0 && playrec_running) {
+
+      for (size_t m=0; m<play_lost_frames; m+=nframes) {
+
+        size_t len = (play_lost_frames - m < nframes) ? play_lost_frames - m : nframes;
+
+        if (playrec_resampler) {
+          resampler_read(playrec_resampler, playrec_out, 0, len);
+        } else {
+          convolver_read(playrec_convolver, playrec_out, 0, len);
+        }
+      }
+
+      for (size_t n=0; n<n_output_ports; n++) {
+        std::memset(playrec_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes);
+      }
+    }
+
+    if (frames_played < total_playrec_frames && playrec_running) {
+
+      // Synthesize directly into the JACK buffers (restarting at each repetition).
+      size_t m = 0;
+      while (m < frames_to_write) {
+
+        size_t len;
+        size_t pos = loop_position(&playrec_loop, (frames_played + m) % stimulus_frames, &len);
+        if (len > frames_to_write - m) {
+          len = frames_to_write - m;
+        }
+
+        if (playrec_generator) {
+          generator_render(playrec_generator, playrec_out, pos, m, len);
+        } else if (playrec_resampler) {
+          resampler_read(playrec_resampler, playrec_out, m, len);
+        } else if (playrec_play_router) {
+          router_mix_play(playrec_play_router, output_buffer, playrec_data_frames, pos, playrec_out, m, len);
+        } else if (playrec_events) {
+          events_render(playrec_events, playrec_out, pos, m, len);
+        } else {
+          convolver_read(playrec_convolver, playrec_out, m, len);
+        }
+
+        m += len;
+      }
+    }
+  }
+
   // Loop over all ouput ports.
-  for (size_t n=0; n<n_output_ports; n++) {
+  for (size_t n=0; n<n_output_ports && !rendered; n++) {
 
     // Grab the n:th output buffer.
     out = (jack_default_audio_sample_t *)
@@ -159,16 +742,29 @@ int playrec_process_f(jack_nframes_t nframes, void *arg)
 
       if (playrec_running) {
 
-        for (size_t m=0; m< (size_t) frames_to_write; m++) {
-          out[(jack_nframes_t) m] = (jack_default_audio_sample_t)
-            output_fbuffer[m+frames_played + n*total_playrec_frames];
+        const T *src = &output_buffer[n*playrec_data_frames];
+
+        // Copy in segments that end where the stimulus wraps around (or the loop jumps back).
+        size_t m = 0;
+        while (m < frames_to_write) {
+
+          size_t len;
+          size_t pos = loop_position(&playrec_loop, (frames_played + m) % stimulus_frames, &len);
+          if (len > frames_to_write - m) {
+            len = frames_to_write - m;
+          }
+
+          for (size_t k=0; k<len; k++) {
+            out[m+k] = (jack_default_audio_sample_t) src[pos+k];
+          }
+
+          m += len;
         }
 
         // Fill the end with silence to avoid playing random buffer data.
-        if ( frames_to_write < (int) nframes ) {
-          for (size_t m=frames_to_write; m<nframes; m++) {
-            out[(jack_nframes_t) m] = (jack_default_audio_sample_t) 0.0; // Silence.
-          }
+        if ( frames_to_write < nframes ) {
+          std::memset(&out[frames_to_write], 0x0,
+                      sizeof (jack_default_audio_sample_t) * (nframes - frames_to_write));
         }
 
       } // running
@@ -180,176 +776,207 @@ int playrec_process_f(jack_nframes_t nframes, void *arg)
     frames_played += frames_to_write;
   }
 
+  //
+  // Direct monitoring (before the record checks below which return early in skipped periods).
+  //
+
+  if (playrec_monitor) {
+    if (playrec_monitor_process(nframes) < 0) {
+      return -1;
+    }
+  }
+
   //
   // Record (single precision)
   //
 
+  // The skipped periods are counted in frames (at the period size the capture started
+  // with) so that the play/record alignment holds if the period size changes.
+  size_t skip = (skip_frames_left < (size_t) nframes) ? skip_frames_left : (size_t) nframes;
+
   // The number of available frames in the JACK buffer.
-  int frames_to_read = (int) nframes;
+  size_t frames_to_read = (size_t) nframes - skip;
 
-  if ((total_playrec_frames - frames_recorded) > 0 && playrec_running) {
+  if (frames_recorded < total_playrec_frames && playrec_running) {
 
     // Check if the number of frames in JACK buffer is larger than what
     // we have left to read.
-    if (frames_to_read >  (total_playrec_frames - frames_recorded) ) {
+    if (frames_to_read > (total_playrec_frames - frames_recorded) ) {
       frames_to_read = total_playrec_frames - frames_recorded;
     }
 
-  } else {
-    frames_recorded = total_playrec_frames;
-    return 0;
-  }
-
-  if (num_skip_periods > 0) {
-    if (skip_periods_counter < num_skip_periods) {
-      skip_periods_counter++;
-      return 0;
-    }
-  }
-
-  // Loop over all input ports.
-  for (size_t n=0; n< (size_t) n_input_ports; n++) {
-
-    // Grab the n:th input buffer.
-    in = (jack_default_audio_sample_t *)
-      jack_port_get_buffer(input_ports[n], nframes);
-
-    if (in == nullptr) {
-      std::cerr << "jack_port_get_buffer failed!" << std::endl;
-      return -1;
-    }
-
-    // If the port was not closed fast enough after we were done recording
-    // then skip extra new frames.
-    if (frames_recorded < total_playrec_frames) {
+  } else {
+    frames_recorded = total_playrec_frames;
+    return 0;
+  }
 
-      if (playrec_running) {
+  skip_frames_left -= skip;
+  if (frames_to_read == 0) {
+    return 0;
+  }
 
-        for (size_t m=0; m< (size_t) frames_to_read; m++) {
-          input_fbuffer[m+frames_recorded + n*total_playrec_frames] = (float) in[(jack_nframes_t) m];
-        }
+  if (playrec_t_started > 0.0) {
+    profile_add(JAUDIO_PHASE_FIRST_PERIOD, playrec_t_started);
+    playrec_t_started = 0.0;
+  }
 
-      } // running
+  change_log_update(playrec_changes, frames_recorded, nframes);
 
-    }
-  } // < n_input_ports
+  // Mix the input ports to the recorded channels.
+  jack_default_audio_sample_t **mixed = nullptr;
+  if (playrec_record_router) {
 
-  frames_recorded += frames_to_read;
+    for (size_t n=0; n<n_input_ports; n++) {
 
-  return 0;
-}
+      playrec_in[n] = (jack_default_audio_sample_t *)
+        jack_port_get_buffer(input_ports[n], nframes);
 
-// Double precision play data (converted to float).
+      if (playrec_in[n] == nullptr) {
+        std::cerr << "jack_port_get_buffer failed!" << std::endl;
+        return -1;
+      }
 
-int playrec_process_d(jack_nframes_t nframes, void *arg)
-{
-  void  **iobuffers = nullptr;
-  double  *output_dbuffer = nullptr;
-  float  *input_fbuffer = nullptr; // JACK uses floats internally.
-  jack_default_audio_sample_t *out = nullptr;
-  jack_default_audio_sample_t *in = nullptr;
+      playrec_in[n] += skip;
+    }
 
-  // Get the adresses of the input and output buffers.
-  iobuffers = (void**) arg;
-  output_dbuffer = (double*) iobuffers[0];
-  input_fbuffer = (float*) iobuffers[1];
+    mixed = router_mix(playrec_record_router, playrec_in, frames_to_read);
+    if (mixed == nullptr) {
+      std::cerr << "The JACK period is larger than the routing buffers!" << std::endl;
+      return -1;
+    }
+  }
 
-  //
-  // Play
-  //
+  // Loop over all (recorded) channels.
+  for (size_t n=0; n<n_record_channels; n++) {
 
-  // The number of available frames write.
-  int frames_to_write = (int) nframes;
+    // Grab the n:th input buffer.
+    if (mixed) {
+      in = mixed[n];
+    } else {
+      in = (jack_default_audio_sample_t *)
+        jack_port_get_buffer(input_ports[n], nframes);
 
-  if((total_playrec_frames - frames_played) > 0) {
+      if (in == nullptr) {
+        std::cerr << "jack_port_get_buffer failed!" << std::endl;
+        return -1;
+      }
 
-    if (frames_to_write >  (total_playrec_frames - frames_played) ) {
-      frames_to_write = total_playrec_frames - frames_played;
+      in += skip;
     }
-  }
 
-  // Loop over all ouput ports.
-  for (size_t n=0; n< (size_t) n_output_ports; n++) {
+    if (playrec_decimation) {
 
-    // Grab the n:th output buffer.
-    out = (jack_default_audio_sample_t *)
-      jack_port_get_buffer(output_ports[n], nframes);
+      decimation_process(playrec_decimation, n, in, frames_to_read, input_fbuffer);
 
-    if (out == nullptr) {
-      std::cerr << "jack_port_get_buffer failed!" << std::endl;
-      return -1;
-    }
+    } else if (avg_sum == nullptr) {
+
+      float *dest = &input_fbuffer[frames_recorded + n*total_playrec_frames];
+      for (size_t m=0; m<frames_to_read; m++) {
+        dest[m] = (float) in[m];
+      }
 
-    // If the port was not closed fast enough after we were done playing
-    // all frames then just fill jack's output buffers with silence.
-    if (frames_played >= total_playrec_frames) {
-      std::memset(out, 0x0, sizeof (jack_default_audio_sample_t) * nframes); // Just fill with silence.
     } else {
 
-      if (playrec_running) {
+      // Accumulate the period into the sum buffer(s) which are aligned to the stimulus.
+      size_t m = 0;
+      size_t pos = frames_recorded % stimulus_frames;
+      while (m < frames_to_read) {
 
-        for (size_t m=0; m< (size_t)frames_to_write; m++) {
-          out[(jack_nframes_t) m] = (jack_default_audio_sample_t) // double -> float conversion
-            output_dbuffer[m+frames_played + n*total_playrec_frames];
+        size_t len = stimulus_frames - pos;
+        if (len > frames_to_read - m) {
+          len = frames_to_read - m;
         }
 
-        // Fill the end with silence to avoid playing random buffer data.
-        if ( frames_to_write < (int) nframes ) {
-          for (size_t m=frames_to_write; m < (size_t) nframes; m++) {
-            out[(jack_nframes_t) m] = (jack_default_audio_sample_t) 0.0; // Silence.
+        double *sum = &avg_sum[pos + n*stimulus_frames];
+        const jack_default_audio_sample_t *x = &in[m];
+        for (size_t k=0; k<len; k++) {
+          sum[k] += (double) x[k];
+        }
+
+        if (avg_sum_sq) {
+          double *sum_sq = &avg_sum_sq[pos + n*stimulus_frames];
+          for (size_t k=0; k<len; k++) {
+            sum_sq[k] += (double) x[k] * (double) x[k];
           }
         }
 
-      } // running
+        m += len;
+        pos = 0;
+      }
     }
 
-  } // < n_output_ports
+    if (playrec_meter) {
+      meter_update(playrec_meter, n, in, frames_to_read);
+    }
 
-  if (frames_played < total_playrec_frames) {
-    frames_played += frames_to_write;
-  }
+  } // < n_record_channels
 
-  //
-  // Record (single precision)
-  //
+  if (playrec_meter) {
+    meter_publish(playrec_meter);
+  }
 
-  // The number of available frames.
-  int frames_to_read = (int) nframes;
+  frames_recorded += frames_to_read;
 
-  if (frames_to_read >  (total_playrec_frames - frames_recorded) ) {
-    frames_to_read = total_playrec_frames - frames_recorded;
+  // Flush the decimation filters after the last period.
+  if (playrec_decimation && frames_recorded >= total_playrec_frames) {
+    decimation_finish(playrec_decimation, input_fbuffer);
   }
 
-  // Loop over all input ports.
-  for (size_t n=0; n<n_input_ports; n++) {
+  return 0;
+}
 
-    // Grab the n:th input buffer.
-    in = (jack_default_audio_sample_t *)
-      jack_port_get_buffer(input_ports[n], nframes);
+// Single precision play data.
 
-    if (in == nullptr) {
-      std::cerr << "jack_port_get_buffer failed!" << std::endl;
-      return -1;
-    }
+int playrec_process_f(jack_nframes_t nframes, void *arg)
+{
+  void **iobuffers = (void**) arg;
 
-    // If the port was not closed fast enough after we were done recording
-    // then skip extra new frames.
-    if (frames_recorded < total_playrec_frames) {
+  return playrec_process<float>(nframes, (float*) iobuffers[0], (float*) iobuffers[1]);
+}
 
-      if (playrec_running) {
+// Double precision play data (converted to float).
 
-        for (size_t m=0; m< (size_t) frames_to_read; m++) {
-          input_fbuffer[m+frames_recorded + n*total_playrec_frames] = (float) in[(jack_nframes_t) m];
-        }
+int playrec_process_d(jack_nframes_t nframes, void *arg)
+{
+  void **iobuffers = (void**) arg;
 
-      } // running
+  return playrec_process<double>(nframes, (double*) iobuffers[0], (float*) iobuffers[1]);
+}
 
-    }
-  } // < n_input_ports
+// Generated play data (the play buffer is a jaudio_generator_t).
 
-  frames_recorded += frames_to_read;
+int playrec_process_g(jack_nframes_t nframes, void *arg)
+{
+  void **iobuffers = (void**) arg;
 
-  return 0;
+  return playrec_process<float>(nframes, nullptr, (float*) iobuffers[1]);
+}
+
+// Resampled play data (the play buffer is a jaudio_resampler_t).
+
+int playrec_process_r(jack_nframes_t nframes, void *arg)
+{
+  void **iobuffers = (void**) arg;
+
+  return playrec_process<float>(nframes, nullptr, (float*) iobuffers[1]);
+}
+
+// Filtered play data (the play buffer is a jaudio_convolver_t).
+
+int playrec_process_c(jack_nframes_t nframes, void *arg)
+{
+  void **iobuffers = (void**) arg;
+
+  return playrec_process<float>(nframes, nullptr, (float*) iobuffers[1]);
+}
+
+// Event-list play data (the play buffer is a jaudio_events_t).
+
+int playrec_process_e(jack_nframes_t nframes, void *arg)
+{
+  void **iobuffers = (void**) arg;
+
+  return playrec_process<float>(nframes, nullptr, (float*) iobuffers[1]);
 }
 
 /***
@@ -364,23 +991,91 @@ int playrec_init(void* play_buffer, int play_format,
                  size_t play_channels, char **play_port_names,
                  void* record_buffer, size_t record_channels, char **record_port_names,
                  size_t frames,
-                 const char *client_name, size_t num_skip_buffers)
+                 const char *client_name, size_t num_skip_buffers,
+                 bool freewheel)
 {
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
   char port_name[255];
 
   n_output_ports = play_channels;
   n_input_ports = record_channels;
+  n_record_channels = playrec_record_route_gains ? playrec_record_route_channels : record_channels;
+
+  // The length of the play data and of the stimulus (longer when the data is looped).
+  playrec_data_frames = frames;
+
+  if (playrec_loop_repeats != 1) {
+
+    if (play_format != FLOAT_AUDIO && play_format != DOUBLE_AUDIO && play_format != EVENT_AUDIO) {
+      std::cerr << "Only matrix and event-list play data can be looped!" << std::endl;
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+
+    if (playrec_loop_repeats == JAUDIO_LOOP_FOREVER) {
+      std::cerr << "The loop must be played a finite number of times when recording!" << std::endl;
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+
+    if (loop_setup(&playrec_loop, frames, playrec_loop_start, (playrec_loop_end > 0) ? playrec_loop_end : frames,
+                   playrec_loop_repeats) < 0) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+
+  } else {
+    loop_setup(&playrec_loop, frames, 0, frames, 1);
+  }
+
+  // The total number of frames to play and record (the stimulus
+  // is repeated when averaging).
+  stimulus_frames = loop_get_frames(&playrec_loop);
+  total_playrec_frames = stimulus_frames * playrec_num_averages;
 
-  // The total number of frames to play and record.
-  total_playrec_frames = frames;
+  // Allocate and clear the sum buffers used for averaging.
+  if (playrec_num_averages > 1) {
 
-  num_skip_periods = num_skip_buffers;
-  skip_periods_counter = 0; // Reset period counter.
+    avg_sum = (double*) calloc(stimulus_frames * n_record_channels, sizeof(double));
+    if (!avg_sum) {
+      std::cerr << "Averaging buffer memory allocation failed!" << std::endl;
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+
+    if (playrec_use_variance) {
+      avg_sum_sq = (double*) calloc(stimulus_frames * n_record_channels, sizeof(double));
+      if (!avg_sum_sq) {
+        std::cerr << "Averaging buffer memory allocation failed!" << std::endl;
+        playrec_close(0, nullptr, 0, nullptr);
+        return -1;
+      }
+    }
+  }
+
+  if (playrec_decimation_factors && playrec_num_averages == 1) {
+    playrec_decimation = decimation_create(playrec_decimation_factors, n_record_channels, stimulus_frames);
+    if (!playrec_decimation) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+  }
+
+  if (playrec_use_meter) {
+    playrec_meter = meter_create(n_record_channels, playrec_clip_level);
+    if (!playrec_meter) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+  }
 
   // Reset play/record counters.
   frames_played = 0;
   frames_recorded = 0;
 
+  playrec_use_freewheel = freewheel;
+  playrec_freewheeling = false;
+
   // Mark that we have not called our process callback before
   // so than we can disregard the frames in the first JACK period
   // which always seems to be silence (zero valued samples).
@@ -395,40 +1090,165 @@ int playrec_init(void* play_buffer, int play_format,
   jack_set_error_function(playrec_jerror);
 
   // Try to become a client of the JACK server.
+  double t_open = profile_now();
   jack_status_t status;
   if ((playrec_client = jack_client_open(client_name,
                                         JackNullOption,&status)) == 0) {
     print_jack_status(status);
     std::cerr << "Failed to open JACK client: '" << client_name << "'" << std::endl;
+    playrec_close(0, nullptr, 0, nullptr);
     return -1;
   }
 
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
+  // Skip num_skip_buffers periods (at the current period size) before recording.
+  skip_frames_left = num_skip_buffers * (size_t) jack_get_buffer_size(playrec_client);
+
+  // The per-period buffers are preallocated for the largest period so that
+  // nothing is reallocated if the period size changes while recording.
+  size_t max_period_frames = jaudio_max_period_frames(playrec_client);
+  playrec_changes = change_log_create(playrec_client, max_period_frames);
+  playrec_xruns = xrun_log_create();
+
+  if (playrec_xrun_fill) {
+    playrec_zeros_frames = max_period_frames;
+    playrec_zeros = (jack_default_audio_sample_t*) calloc(playrec_zeros_frames, sizeof(jack_default_audio_sample_t));
+
+    if (!playrec_zeros) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+  }
+
+  // Mix the sources to the play ports in the callback.
+  if (playrec_play_route_gains && (play_format == FLOAT_AUDIO || play_format == DOUBLE_AUDIO)) {
+
+    playrec_play_router = router_create(playrec_play_route_gains, n_output_ports, playrec_play_route_sources, 0);
+    playrec_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    if (!playrec_play_router || !playrec_out) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+  }
+
+  // Mix buffers for one JACK period.
+  if (playrec_record_route_gains) {
+
+    playrec_record_router = router_create(playrec_record_route_gains, n_record_channels, n_input_ports,
+                                          max_period_frames);
+    playrec_in = (jack_default_audio_sample_t**) calloc(n_input_ports, sizeof(jack_default_audio_sample_t*));
+
+    if (!playrec_record_router || !playrec_in) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+  }
+
+  // Monitor mix buffers for one JACK period.
+  if (playrec_monitor_gains) {
+
+    playrec_monitor = router_create(playrec_monitor_gains, n_output_ports, n_input_ports,
+                                    max_period_frames);
+    playrec_monitor_in = (jack_default_audio_sample_t**) calloc(n_input_ports, sizeof(jack_default_audio_sample_t*));
+    playrec_monitor_level = 0.0f;
+
+    if (!playrec_monitor || !playrec_monitor_in) {
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+  }
+
   // Tell the JACK server to call the `record_process()' whenever
-  // there is work to be done.
-  void *buffer_array[2];
-  buffer_array[0] = play_buffer;
-  buffer_array[1] = record_buffer;
+  // there is work to be done. N.B., the buffer array must outlive
+  // this function since the callback keeps using it.
+  playrec_buffers[0] = play_buffer;
+  playrec_buffers[1] = record_buffer;
   if (play_format == DOUBLE_AUDIO) {
-    jack_set_process_callback(playrec_client, playrec_process_d, buffer_array);
+    jack_set_process_callback(playrec_client, playrec_process_d, playrec_buffers);
   }
 
   if (play_format == FLOAT_AUDIO) {
-    jack_set_process_callback(playrec_client, playrec_process_f, buffer_array);
+    jack_set_process_callback(playrec_client, playrec_process_f, playrec_buffers);
+  }
+
+  if (play_format == GENERATOR_AUDIO) {
+
+    playrec_generator = (jaudio_generator_t*) play_buffer;
+
+    if (generator_setup(playrec_generator, (double) jack_get_sample_rate(playrec_client), n_output_ports) < 0) {
+      playrec_generator = nullptr; // Not set up (and owned by the caller).
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+
+    playrec_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(playrec_client, playrec_process_g, playrec_buffers);
+  }
+
+  if (play_format == RESAMPLED_AUDIO) {
+
+    playrec_resampler = (jaudio_resampler_t*) play_buffer;
+
+    if ((double) jack_get_sample_rate(playrec_client) != resampler_get_output_rate(playrec_resampler)) {
+      std::cerr << "The play data was resampled to " << resampler_get_output_rate(playrec_resampler)
+                << " [Hz] but the JACK sample rate is " << jack_get_sample_rate(playrec_client) << " [Hz]!" << std::endl;
+      playrec_close(0, nullptr, 0, nullptr);
+      return -1;
+    }
+
+    playrec_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(playrec_client, playrec_process_r, playrec_buffers);
+  }
+
+  if (play_format == CONVOLVED_AUDIO) {
+
+    playrec_convolver = (jaudio_convolver_t*) play_buffer;
+
+    playrec_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(playrec_client, playrec_process_c, playrec_buffers);
+  }
+
+  if (play_format == EVENT_AUDIO) {
+
+    playrec_events = (jaudio_events_t*) play_buffer;
+
+    playrec_out = (jack_default_audio_sample_t**) malloc(n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+    jack_set_process_callback(playrec_client, playrec_process_e, playrec_buffers);
   }
 
   // Tell the JACK server to call `srate()' whenever
   // the sample rate of the system changes.
   jack_set_sample_rate_callback(playrec_client, playrec_srate, 0);
 
+  // Tell the JACK server to call `playrec_bufsize()' whenever
+  // the period size changes.
+  jack_set_buffer_size_callback(playrec_client, playrec_bufsize, 0);
+
+  // Tell the JACK server to call `playrec_xrun()' whenever
+  // a deadline is missed.
+  jack_set_xrun_callback(playrec_client, playrec_xrun, 0);
+
   // Tell the JACK server to call `jack_shutdown()' if
   // it ever shuts down, either entirely, or if it
   // just decides to stop calling us.
   jack_on_shutdown(playrec_client, playrec_jack_shutdown, 0);
 
+  // Tell the JACK server to call `playrec_freewheel()' when
+  // freewheel mode is entered or left.
+  jack_set_freewheel_callback(playrec_client, playrec_freewheel, 0);
+
   //
   // Register ports
   //
 
+  double t_register = profile_now();
+
   // Input ports
 
   input_ports = (jack_port_t**) malloc(n_input_ports * sizeof(jack_port_t*));
@@ -449,32 +1269,54 @@ int playrec_init(void* play_buffer, int play_format,
                                         JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
   }
 
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
+
   //
   // Tell the JACK server that we are ready to roll.
   //
 
+  double t_activate = profile_now();
+  playrec_t_started = t_activate; // The first period is timed from here.
   if (jack_activate(playrec_client)) {
     std::cerr << "Cannot activate jack client!" << std::endl;
+    playrec_close(0, nullptr, 0, nullptr);
     return -1;
   }
 
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
   //
   // Connect the ports
   //
 
-  // Connect to the input ports.
-  for (size_t n=0; n<n_input_ports; n++) {
-    if (jack_connect(playrec_client, record_port_names[n], jack_port_name(input_ports[n]))) {
-      std::cerr << "Cannot connect to the client output port: '" <<  record_port_names[n] << "'" << std::endl;
-      return -1;
-    }
+  // Connect to the input and the output ports.
+  if (ports_connect(playrec_client, input_ports, record_port_names, n_input_ports, true) < 0 ||
+      ports_connect(playrec_client, output_ports, play_port_names, n_output_ports, false) < 0) {
+    // Closing the client also drops the connections made so far.
+    playrec_close(0, nullptr, 0, nullptr);
+    return -1;
   }
 
-  // Connect to the output ports.
-  for (size_t n=0; n<n_output_ports; n++) {
-    if (jack_connect(playrec_client, jack_port_name(output_ports[n]), play_port_names[n])) {
-      std::cerr << "Cannot connect to the client output port: '" <<  play_port_names[n] << "'" << std::endl;
-      return -1;
+  if (freewheel) {
+
+    for (size_t n=0; n<n_input_ports; n++) {
+      if (jaudio_port_is_physical(playrec_client, record_port_names[n])) {
+        std::cerr << "Warning: '" << record_port_names[n]
+                  << "' is a hardware port which is not serviced in freewheel mode!" << std::endl;
+      }
+    }
+
+    for (size_t n=0; n<n_output_ports; n++) {
+      if (jaudio_port_is_physical(playrec_client, play_port_names[n])) {
+        std::cerr << "Warning: '" << play_port_names[n]
+                  << "' is a hardware port which is not serviced in freewheel mode!" << std::endl;
+      }
+    }
+
+    // Run the server as fast as possible for the duration of the job.
+    if (jack_set_freewheel(playrec_client, 1)) {
+      std::cerr << "Failed to enter freewheel mode!" << std::endl;
+      playrec_use_freewheel = false;
     }
   }
 
@@ -494,56 +1336,74 @@ int playrec_close(size_t play_channels,
                   size_t record_channels,
                   char **record_port_names)
 {
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
   int err;
 
-  //
-  //  Record ports
-  //
+  // Nothing to release if the client is already closed (playrec_close may be called twice).
+  if (playrec_client) {
 
-  // Disconnect to the input ports.
-  for (size_t n=0; n<n_input_ports; n++) {
-    if (jack_disconnect(playrec_client, record_port_names[n], jack_port_name(input_ports[n]))) {
-      std::cerr << "Cannot connect to the client output port: '" <<  record_port_names[n] << "'" << std::endl;
-      return -1;
+    // Leave freewheel mode before we disconnect.
+    if (playrec_use_freewheel) {
+      jack_set_freewheel(playrec_client, 0);
     }
-  }
 
-  // Unregister all input ports.
-  for (size_t n=0; n<n_input_ports; n++) {
-    err = jack_port_unregister(playrec_client, input_ports[n]);
-    if (err) {
-      std::cerr << "Failed to unregister an input port!" << std::endl;
+    //
+    //  Record ports
+    //
+
+    // Disconnect from, and unregister, the input ports (the ports may not
+    // have been connected if the init failed so only warn).
+    for (size_t n=0; input_ports && n<n_input_ports; n++) {
+
+      if (!input_ports[n]) {
+        continue;
+      }
+
+      if (record_port_names &&
+          jack_disconnect(playrec_client, record_port_names[n], jack_port_name(input_ports[n]))) {
+        std::cerr << "Cannot disconnect the client output port: '" <<  record_port_names[n] << "'" << std::endl;
+      }
+
+      err = jack_port_unregister(playrec_client, input_ports[n]);
+      if (err) {
+        std::cerr << "Failed to unregister an input port!" << std::endl;
+      }
     }
-  }
 
-  //
-  //  Play ports
-  //
+    //
+    //  Play ports
+    //
 
-  // Disconnect to the output ports.
-  for (size_t n=0; n<n_output_ports; n++) {
-    if (jack_disconnect(playrec_client, jack_port_name(output_ports[n]), play_port_names[n])) {
-      std::cerr << "Cannot connect to the client output port: '" <<  play_port_names[n] << "'" << std::endl;
-      return -1;
+    // Disconnect from, and unregister, the output ports.
+    for (size_t n=0; output_ports && n<n_output_ports; n++) {
+
+      if (!output_ports[n]) {
+        continue;
+      }
+
+      if (play_port_names &&
+          jack_disconnect(playrec_client, jack_port_name(output_ports[n]), play_port_names[n])) {
+        std::cerr << "Cannot disconnect the client input port: '" <<  play_port_names[n] << "'" << std::endl;
+      }
+
+      err = jack_port_unregister(playrec_client, output_ports[n]);
+      if (err) {
+        std::cerr << "Failed to unregister an output port!" << std::endl;
+      }
     }
-  }
 
-  // Unregister all output ports.
-  for (size_t n=0; n<n_output_ports; n++) {
-    err = jack_port_unregister(playrec_client, output_ports[n]);
+    //
+    // Close the playrec client.
+    //
+
+    err = jack_client_close(playrec_client);
     if (err) {
-      std::cerr << "Failed to unregister an output port!" << std::endl;
+      std::cerr << "jack_client_close failed!" << std::endl;
     }
-  }
-
-  //
-  // Close the playrec client.
-  //
 
-  err = jack_client_close(playrec_client);
-  if (err) {
-    std::cerr << "jack_client_close failed!" << std::endl;
+    playrec_client = nullptr;
   }
+  playrec_use_freewheel = false;
 
   //
   // Free buffers.
@@ -551,15 +1411,113 @@ int playrec_close(size_t play_channels,
 
   if (input_ports) {
     free(input_ports);
-  } else {
-    std::cerr << "Failed free input_ports memory!" << std::endl;
+    input_ports = nullptr;
   }
 
   if (output_ports) {
     free(output_ports);
-  } else {
-    std::cerr << "Failed free output_ports memory!" << std::endl;
+    output_ports = nullptr;
+  }
+
+  if (avg_sum) {
+    free(avg_sum);
+    avg_sum = nullptr;
+  }
+
+  if (avg_sum_sq) {
+    free(avg_sum_sq);
+    avg_sum_sq = nullptr;
+  }
+
+  // Back to a single repetition (also when the init failed).
+  playrec_num_averages = 1;
+  playrec_use_variance = false;
+  stimulus_frames = 0;
+  total_playrec_frames = 0;
+
+  if (playrec_generator) {
+    generator_free(playrec_generator);
+    playrec_generator = nullptr;
+  }
+
+  // The resampler, convolver, and event list are owned (and destroyed) by the caller.
+  playrec_resampler = nullptr;
+  playrec_convolver = nullptr;
+  playrec_events = nullptr;
+
+  if (playrec_out) {
+    free(playrec_out);
+    playrec_out = nullptr;
+  }
+
+  if (playrec_meter) {
+    meter_destroy(playrec_meter);
+    playrec_meter = nullptr;
+  }
+
+  if (playrec_decimation) {
+    decimation_destroy(playrec_decimation);
+    playrec_decimation = nullptr;
+  }
+  playrec_decimation_factors = nullptr;
+
+  if (playrec_play_router) {
+    router_destroy(playrec_play_router);
+    playrec_play_router = nullptr;
+  }
+  playrec_play_route_gains = nullptr;
+  playrec_play_route_sources = 0;
+
+  if (playrec_record_router) {
+    router_destroy(playrec_record_router);
+    playrec_record_router = nullptr;
+  }
+
+  if (playrec_in) {
+    free(playrec_in);
+    playrec_in = nullptr;
+  }
+  playrec_record_route_gains = nullptr;
+  playrec_record_route_channels = 0;
+
+  if (playrec_monitor) {
+    router_destroy(playrec_monitor);
+    playrec_monitor = nullptr;
+  }
+
+  if (playrec_monitor_in) {
+    free(playrec_monitor_in);
+    playrec_monitor_in = nullptr;
+  }
+  playrec_monitor_gains = nullptr;
+  playrec_monitor_gated = true;
+
+  playrec_loop_start = 0;
+  playrec_loop_end = 0;
+  playrec_loop_repeats = 1;
+
+  if (playrec_changes) {
+    change_log_destroy(playrec_changes);
+    playrec_changes = nullptr;
+  }
+
+  playrec_t_started = 0.0;
+
+  if (playrec_xruns) {
+    xrun_log_destroy(playrec_xruns);
+    playrec_xruns = nullptr;
+  }
+
+  if (playrec_zeros) {
+    free(playrec_zeros);
+    playrec_zeros = nullptr;
   }
+  playrec_zeros_frames = 0;
+  playrec_xrun_fill = true;
+
+  // Back to plain (non-metered) play and record.
+  playrec_use_meter = false;
+  playrec_clip_level = JAUDIO_METER_CLIP_LEVEL;
 
   return 0;
 }
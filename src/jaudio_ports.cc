@@ -0,0 +1,434 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <regex.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Port Selection
+ *
+ * Port arguments may be patterns which are expanded to the matching ports of the server:
+ *
+ *   system:capture_*        Glob patterns (*, ?, [a-z], [!a-z]).
+ *   system:capture_[1-64]   A bracket with a decimal range matches a whole number in the range.
+ *   /system:capture_(1|3)/  Patterns between slashes are (whole name) POSIX extended regexes.
+ *
+ * The matches of a pattern are in natural order (capture_2 before capture_10). All patterns
+ * are resolved against one jack_get_ports listing, and the names are stored back to back
+ * in one buffer. ports_connect checks all names against one listing before connecting
+ * anything, so that a misspelled port is reported before the graph is changed.
+ *
+ *********************************************************************************************/
+
+static bool is_regex(const char *name)
+{
+  size_t len = strlen(name);
+
+  return len >= 2 && name[0] == '/' && name[len-1] == '/';
+}
+
+bool ports_is_pattern(const char *name)
+{
+  return is_regex(name) || strpbrk(name, "*?[") != nullptr;
+}
+
+bool ports_has_patterns(const char * const *names, size_t num_names)
+{
+  for (size_t n=0; n<num_names; n++) {
+    if (ports_is_pattern(names[n])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/***
+ *
+ * ports_open_client
+ *
+ * Opens a (never activated) client for listing the server's ports before
+ * an engine client exists, or returns nullptr if the server can't be
+ * reached. Close it with jack_client_close.
+ *
+ ***/
+
+jack_client_t* ports_open_client(const char *client_name)
+{
+  jack_status_t status;
+  jack_client_t *client = jack_client_open(client_name, JackNoStartServer, &status);
+
+  if (client == nullptr) {
+    print_jack_status(status);
+    std::cerr << "Failed to open JACK client: '" << client_name << "'!" << std::endl;
+  }
+
+  return client;
+}
+
+// Parses a decimal range bracket body ("1-64"). Returns false for other brackets.
+static bool parse_range(const char *p, const char *end, unsigned long *lo, unsigned long *hi)
+{
+  const char *dash = (const char*) memchr(p, '-', end - p);
+
+  if (!dash || dash == p || dash + 1 == end) {
+    return false;
+  }
+
+  for (const char *q=p; q<end; q++) {
+    if (q != dash && (*q < '0' || *q > '9')) {
+      return false;
+    }
+  }
+
+  *lo = strtoul(p, nullptr, 10);
+  *hi = strtoul(dash + 1, nullptr, 10);
+
+  return true;
+}
+
+// Matches the character c against the bracket body [p, end).
+static bool match_class(const char *p, const char *end, char c)
+{
+  bool negate = false;
+
+  if (p < end && (*p == '!' || *p == '^')) {
+    negate = true;
+    p++;
+  }
+
+  bool match = false;
+  while (p < end) {
+    if (p + 2 < end && p[1] == '-') {
+      match = match || (c >= p[0] && c <= p[2]);
+      p += 3;
+    } else {
+      match = match || (c == *p);
+      p++;
+    }
+  }
+
+  return match != negate;
+}
+
+static bool glob_match(const char *p, const char *s)
+{
+  while (*p) {
+
+    switch (*p) {
+
+    case '*':
+      // Try all tails (a run of stars is one star).
+      while (*p == '*') {
+        p++;
+      }
+      for (;; s++) {
+        if (glob_match(p, s)) {
+          return true;
+        }
+        if (!*s) {
+          return false;
+        }
+      }
+
+    case '?':
+      if (!*s) {
+        return false;
+      }
+      p++;
+      s++;
+      break;
+
+    case '[': {
+      const char *end = strchr(p + 1, ']');
+      if (!end) {
+        // Not a bracket: match '[' literally.
+        if (*s != '[') {
+          return false;
+        }
+        p++;
+        s++;
+        break;
+      }
+
+      unsigned long lo, hi;
+      if (parse_range(p + 1, end, &lo, &hi)) {
+        // The whole number at s must be in [lo, hi].
+        const char *q = s;
+        while (*q >= '0' && *q <= '9') {
+          q++;
+        }
+        if (q == s) {
+          return false;
+        }
+        unsigned long v = strtoul(s, nullptr, 10);
+        if (v < lo || v > hi) {
+          return false;
+        }
+        s = q;
+      } else {
+        if (!*s || !match_class(p + 1, end, *s)) {
+          return false;
+        }
+        s++;
+      }
+      p = end + 1;
+      break;
+    }
+
+    case '\\':
+      if (p[1]) {
+        p++;
+      }
+      [[fallthrough]]; // Match the escaped character.
+
+    default:
+      if (*p != *s) {
+        return false;
+      }
+      p++;
+      s++;
+    }
+  }
+
+  return *s == '\0';
+}
+
+// Natural order: runs of digits are compared by value.
+static bool natural_less(const char *a, const char *b)
+{
+  while (*a && *b) {
+
+    if (*a >= '0' && *a <= '9' && *b >= '0' && *b <= '9') {
+
+      char *ea, *eb;
+      unsigned long va = strtoul(a, &ea, 10);
+      unsigned long vb = strtoul(b, &eb, 10);
+
+      if (va != vb) {
+        return va < vb;
+      }
+
+      a = ea;
+      b = eb;
+
+    } else {
+
+      if (*a != *b) {
+        return *a < *b;
+      }
+
+      a++;
+      b++;
+    }
+  }
+
+  return *a == '\0' && *b != '\0';
+}
+
+static void port_list_append(jaudio_port_list_t *list, const char *name)
+{
+  list->buffer.insert(list->buffer.end(), name, name + strlen(name) + 1);
+  list->num++;
+}
+
+// Points names into buffer (after all names have been appended).
+static void port_list_finish(jaudio_port_list_t *list)
+{
+  list->names.resize(list->num);
+
+  char *p = list->buffer.data();
+  for (size_t n=0; n<list->num; n++) {
+    list->names[n] = p;
+    p += strlen(p) + 1;
+  }
+}
+
+/***
+ *
+ * port_list_resolve
+ *
+ * Expands the port names and patterns to a list of port names. Ports are
+ * only looked up if there are patterns, in which case the caller's open
+ * client lists the ports with the given flags (JackPortIsOutput for capture
+ * and JackPortIsInput for playback ports), and plain names are validated
+ * against the same listing. The client may be nullptr if there are no
+ * patterns (see ports_has_patterns). Returns -1 if a name is not a port
+ * or if a pattern matches no port.
+ *
+ ***/
+
+int port_list_resolve(jaudio_port_list_t *list, const char * const *names, size_t num_names,
+                      unsigned long flags, jack_client_t *client)
+{
+  list->buffer.clear();
+  list->names.clear();
+  list->num = 0;
+
+  if (!ports_has_patterns(names, num_names)) {
+    for (size_t n=0; n<num_names; n++) {
+      port_list_append(list, names[n]);
+    }
+    port_list_finish(list);
+    return 0;
+  }
+
+  if (client == nullptr) {
+    std::cerr << "A JACK client is needed to resolve port patterns!" << std::endl;
+    return -1;
+  }
+
+  const char **ports = jack_get_ports(client, nullptr, JACK_DEFAULT_AUDIO_TYPE, flags);
+
+  std::vector<const char*> all;
+  for (size_t n=0; ports && ports[n]; n++) {
+    all.push_back(ports[n]);
+  }
+  std::sort(all.begin(), all.end(), natural_less);
+
+  int err = 0;
+  for (size_t n=0; n<num_names && !err; n++) {
+
+    size_t num_before = list->num;
+
+    if (is_regex(names[n])) {
+
+      std::string re = "^(" + std::string(names[n] + 1, strlen(names[n]) - 2) + ")$";
+      regex_t regex;
+
+      if (regcomp(&regex, re.c_str(), REG_EXTENDED | REG_NOSUB)) {
+        std::cerr << "Invalid port regex: '" << names[n] << "'!" << std::endl;
+        err = -1;
+        break;
+      }
+
+      for (const char *port : all) {
+        if (regexec(&regex, port, 0, nullptr, 0) == 0) {
+          port_list_append(list, port);
+        }
+      }
+
+      regfree(&regex);
+
+    } else {
+
+      for (const char *port : all) {
+        if (glob_match(names[n], port)) {
+          port_list_append(list, port);
+        }
+      }
+
+      // Aliases aren't in the listing but are accepted by jack_connect.
+      if (list->num == num_before && !ports_is_pattern(names[n]) &&
+          jack_port_by_name(client, names[n]) != nullptr) {
+        port_list_append(list, names[n]);
+      }
+    }
+
+    if (list->num == num_before) {
+      if (ports_is_pattern(names[n])) {
+        std::cerr << "No " << ((flags & JackPortIsInput) ? "input" : "output")
+                  << " ports match: '" << names[n] << "'!" << std::endl;
+      } else {
+        std::cerr << "Unknown " << ((flags & JackPortIsInput) ? "input" : "output")
+                  << " port: '" << names[n] << "'!" << std::endl;
+      }
+      err = -1;
+    }
+  }
+
+  if (ports) {
+    jack_free(ports);
+  }
+
+  port_list_finish(list);
+
+  return err;
+}
+
+/***
+ *
+ * ports_connect
+ *
+ * Connects the client's ports to the named ports: port_names[n] ->
+ * ports[n] for capture, and ports[n] -> port_names[n] otherwise. All
+ * names are checked against one listing of the server's ports first, and
+ * nothing is connected if any of them is missing. Returns -1 on errors.
+ *
+ ***/
+
+int ports_connect(jack_client_t *client, jack_port_t **ports, char **port_names, size_t num_ports,
+                  bool capture)
+{
+  unsigned long flags = capture ? JackPortIsOutput : JackPortIsInput;
+  const char **server_ports = jack_get_ports(client, nullptr, nullptr, flags);
+
+  std::vector<const char*> all;
+  for (size_t n=0; server_ports && server_ports[n]; n++) {
+    all.push_back(server_ports[n]);
+  }
+
+  auto less = [](const char *a, const char *b) { return strcmp(a, b) < 0; };
+  std::sort(all.begin(), all.end(), less);
+
+  int err = 0;
+  for (size_t n=0; n<num_ports; n++) {
+    // Aliases aren't in the listing but are accepted by jack_connect.
+    if (!std::binary_search(all.begin(), all.end(), (const char*) port_names[n], less) &&
+        jack_port_by_name(client, port_names[n]) == nullptr) {
+      std::cerr << "Cannot connect to the client " << (capture ? "output" : "input")
+                << " port: '" << port_names[n] << "' (no such port)" << std::endl;
+      err = -1;
+    }
+  }
+
+  if (server_ports) {
+    jack_free(server_ports);
+  }
+
+  for (size_t n=0; n<num_ports && !err; n++) {
+
+    double t_connect = profile_now();
+
+    int ret = capture ?
+      jack_connect(client, port_names[n], jack_port_name(ports[n])) :
+      jack_connect(client, jack_port_name(ports[n]), port_names[n]);
+
+    profile_add(JAUDIO_PHASE_CONNECT, t_connect);
+
+    if (ret) {
+      std::cerr << "Cannot connect to the client " << (capture ? "output" : "input")
+                << " port: '" << port_names[n] << "'" << std::endl;
+      err = -1;
+    }
+  }
+
+  return err;
+}
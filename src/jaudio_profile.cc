@@ -0,0 +1,139 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <string.h>
+#include <time.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Setup-phase Profiling
+ *
+ * Times the phases of a job outside the audio transfer: opening the client, registering
+ * and connecting the ports, activating, waiting for the first period, waiting for the job
+ * to finish, and closing. The engines add the phases of the current call, and the same
+ * times are summed over all calls since the module was loaded. Nothing is timed unless
+ * profiling is enabled. The first-period phase is added by the process thread, so the
+ * profile should only be read when the job is done. The profile is process-wide and not
+ * locked, so profiled jobs must not run concurrently.
+ *
+ *********************************************************************************************/
+
+static bool profile_enabled = false;
+static jaudio_profile_t profile_call;  // The current (or last) call.
+static jaudio_profile_t profile_total; // All calls since the module was loaded.
+
+static const char *profile_phase_names[JAUDIO_NUM_PHASES] = {
+  "init",
+  "open",
+  "register",
+  "activate",
+  "connect",
+  "first_period",
+  "wait",
+  "close"
+};
+
+void profile_enable(bool enable)
+{
+  profile_enabled = enable;
+
+  return;
+}
+
+bool profile_is_enabled(void)
+{
+  return profile_enabled;
+}
+
+// Starts profiling a new call.
+void profile_begin_call(void)
+{
+  if (!profile_enabled) {
+    return;
+  }
+
+  memset(&profile_call, 0, sizeof(jaudio_profile_t));
+  profile_call.calls = 1;
+  profile_total.calls++;
+
+  return;
+}
+
+// Monotonic time [s] (0 when profiling is disabled).
+double profile_now(void)
+{
+  if (!profile_enabled) {
+    return 0.0;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+/***
+ *
+ * profile_add
+ *
+ * Adds the time since start (from profile_now) to phase. A phase may be
+ * added several times per call (one connect per port, for example).
+ *
+ ***/
+
+void profile_add(jaudio_phase_t phase, double start)
+{
+  if (!profile_enabled || start <= 0.0) {
+    return;
+  }
+
+  double seconds = profile_now() - start;
+
+  profile_call.seconds[phase] += seconds;
+  profile_call.count[phase]++;
+
+  profile_total.seconds[phase] += seconds;
+  profile_total.count[phase]++;
+
+  return;
+}
+
+// Copies the profile of the current (or last) call and the totals (either may be nullptr).
+void profile_get(jaudio_profile_t *call, jaudio_profile_t *total)
+{
+  if (call) {
+    *call = profile_call;
+  }
+
+  if (total) {
+    *total = profile_total;
+  }
+
+  return;
+}
+
+const char* profile_phase_name(jaudio_phase_t phase)
+{
+  return profile_phase_names[phase];
+}
@@ -0,0 +1,451 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <atomic>
+
+#include <jack/ringbuffer.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Play Queue
+ *
+ * A play client that stays open between calls so that buffers can be enqueued while it
+ * plays. Enqueued buffers are copied (as frames x channels float matrices) and their
+ * descriptors are passed to the JACK callback through a lock-free ring buffer. The callback
+ * plays the buffers back to back, moving on to the next descriptor within a period, and
+ * passes the played descriptors back through a second ring buffer so that the buffers are
+ * freed by the caller and not in the JACK thread. At most max_buffers buffers are held by
+ * the queue at any time.
+ *
+ *********************************************************************************************/
+
+typedef struct {
+  float *data;    // frames x channels (column major).
+  size_t frames;
+} queue_buffer_t;
+
+struct jaudio_queue {
+  jack_client_t *client;
+  jack_port_t **ports;
+  size_t channels;
+  jack_default_audio_sample_t **out;
+
+  size_t max_buffers;
+  size_t num_buffers;             // Enqueued and not yet freed (caller only).
+  jack_ringbuffer_t *pending;     // Enqueued descriptors (caller -> JACK thread).
+  jack_ringbuffer_t *played;      // Played descriptors (JACK thread -> caller).
+
+  queue_buffer_t current;         // The buffer being played (JACK thread only).
+  bool has_current;
+  size_t pos;                     // Play position in the current buffer.
+
+  std::atomic<size_t> frames_enqueued;
+  std::atomic<size_t> frames_played;
+  std::atomic<size_t> underruns;
+  jaudio_xrun_log_t *xruns;       // Only reported; the queue continues where it was.
+  std::atomic<bool> started;      // Set by the first enqueue.
+  std::atomic<bool> closing;      // No more buffers will be enqueued.
+  std::atomic<bool> running;
+};
+
+// Starts playing the next enqueued buffer. Returns false if the queue is empty.
+static bool queue_next(jaudio_queue_t *q)
+{
+  if (jack_ringbuffer_read_space(q->pending) < sizeof(queue_buffer_t)) {
+    return false;
+  }
+
+  jack_ringbuffer_read(q->pending, (char*) &q->current, sizeof(queue_buffer_t));
+  q->has_current = true;
+  q->pos = 0;
+
+  return true;
+}
+
+/***
+ *
+ * queue_process
+ *
+ * The JACK callback. Plays the enqueued buffers back to back and fills
+ * the rest of the period with silence when the queue runs dry.
+ *
+ ***/
+
+static int queue_process(jack_nframes_t nframes, void *arg)
+{
+  jaudio_queue_t *q = (jaudio_queue_t*) arg;
+
+  size_t lost_frames = xrun_log_lost_frames(q->xruns, jack_last_frame_time(q->client), nframes, false);
+  if (lost_frames > 0 && q->started && q->running) {
+    xrun_log_add(q->xruns, q->frames_played, lost_frames);
+  }
+
+  for (size_t c=0; c<q->channels; c++) {
+
+    q->out[c] = (jack_default_audio_sample_t *) jack_port_get_buffer(q->ports[c], nframes);
+
+    if (q->out[c] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  size_t m = 0;
+  while (m < nframes && q->running) {
+
+    if (!q->has_current && !queue_next(q)) {
+      break;
+    }
+
+    size_t len = q->current.frames - q->pos;
+    if (len > nframes - m) {
+      len = nframes - m;
+    }
+
+    for (size_t c=0; c<q->channels; c++) {
+      memcpy(&q->out[c][m], &q->current.data[c*q->current.frames + q->pos],
+             len * sizeof(jack_default_audio_sample_t));
+    }
+
+    m += len;
+    q->pos += len;
+
+    // Hand the played buffer back to be freed.
+    if (q->pos == q->current.frames) {
+      jack_ringbuffer_write(q->played, (const char*) &q->current, sizeof(queue_buffer_t));
+      q->has_current = false;
+    }
+  }
+
+  if (m < nframes) {
+
+    for (size_t c=0; c<q->channels; c++) {
+      memset(&q->out[c][m], 0x0, (nframes - m) * sizeof(jack_default_audio_sample_t));
+    }
+
+    // Running dry before the queue is closed means that the buffers were enqueued too late.
+    if (q->started && !q->closing && q->running) {
+      q->underruns++;
+    }
+  }
+
+  q->frames_played += m;
+
+  return 0;
+}
+
+// This is called whenever JACK (or a client) misses a deadline.
+static int queue_xrun(void *arg)
+{
+  jaudio_queue_t *q = (jaudio_queue_t*) arg;
+
+  xrun_log_notify(q->xruns);
+
+  return 0;
+}
+
+static void queue_jack_shutdown(void *arg)
+{
+  jaudio_queue_t *q = (jaudio_queue_t*) arg;
+
+  q->running = false; // Stop if JACK shuts down.
+
+  return;
+}
+
+// Frees the buffers that the JACK callback is done with.
+static void queue_reclaim(jaudio_queue_t *q)
+{
+  queue_buffer_t buf;
+
+  while (jack_ringbuffer_read_space(q->played) >= sizeof(queue_buffer_t)) {
+    jack_ringbuffer_read(q->played, (char*) &buf, sizeof(queue_buffer_t));
+    free(buf.data);
+    q->num_buffers--;
+  }
+
+  return;
+}
+
+/***
+ *
+ * queue_open
+ *
+ * Opens a play client with channels ports, connects them to port_names,
+ * and starts the (initially silent) playback. At most max_buffers
+ * enqueued buffers are held by the queue.
+ *
+ ***/
+
+jaudio_queue_t* queue_open(size_t channels, char **port_names, const char *client_name, size_t max_buffers)
+{
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
+  char port_name[255];
+
+  if (channels == 0 || max_buffers == 0) {
+    std::cerr << "The play queue must have at least one channel and one buffer!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_queue_t *q = new jaudio_queue_t;
+
+  q->client = nullptr;
+  q->channels = channels;
+  q->max_buffers = max_buffers;
+  q->num_buffers = 0;
+  q->has_current = false;
+  q->pos = 0;
+  q->frames_enqueued = 0;
+  q->frames_played = 0;
+  q->underruns = 0;
+  q->xruns = xrun_log_create();
+  q->started = false;
+  q->closing = false;
+  q->running = true;
+
+  q->ports = (jack_port_t**) calloc(channels, sizeof(jack_port_t*));
+  q->out = (jack_default_audio_sample_t**) calloc(channels, sizeof(jack_default_audio_sample_t*));
+
+  // One spare slot since a ring buffer holds one byte less than its size.
+  q->pending = jack_ringbuffer_create((max_buffers + 1) * sizeof(queue_buffer_t));
+  q->played = jack_ringbuffer_create((max_buffers + 1) * sizeof(queue_buffer_t));
+
+  if (!q->ports || !q->out || !q->pending || !q->played) {
+    std::cerr << "Play queue memory allocation failed!" << std::endl;
+    queue_close(q);
+    return nullptr;
+  }
+
+  // Keep the ring buffers in RAM since they are used from the JACK thread.
+  jack_ringbuffer_mlock(q->pending);
+  jack_ringbuffer_mlock(q->played);
+
+  double t_open = profile_now();
+  jack_status_t status;
+  if ((q->client = jack_client_open(client_name, JackNullOption, &status)) == 0) {
+    print_jack_status(status);
+    std::cerr << "Failed to open JACK client: '" << client_name << "'!" << std::endl;
+    queue_close(q);
+    return nullptr;
+  }
+
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
+  jack_set_process_callback(q->client, queue_process, q);
+  jack_set_xrun_callback(q->client, queue_xrun, q);
+  jack_on_shutdown(q->client, queue_jack_shutdown, q);
+
+  double t_register = profile_now();
+  for (size_t n=0; n<channels; n++) {
+    sprintf(port_name,"output_%d", (int) n+1); // Port numbers start at 1.
+    q->ports[n] = jack_port_register(q->client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  }
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
+
+  double t_activate = profile_now();
+  if (jack_activate(q->client)) {
+    std::cerr << "Cannot activate jack client!" << std::endl;
+    queue_close(q);
+    return nullptr;
+  }
+
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
+  if (ports_connect(q->client, q->ports, port_names, channels, false) < 0) {
+    queue_close(q);
+    return nullptr;
+  }
+
+  return q;
+}
+
+/***
+ *
+ * queue_enqueue
+ *
+ * Copies the frames x channels matrix buffer (FLOAT_AUDIO or DOUBLE_AUDIO)
+ * to the end of the queue. Returns 1 (and enqueues nothing) if the queue
+ * already holds max_buffers buffers, and -1 on errors.
+ *
+ ***/
+
+int queue_enqueue(jaudio_queue_t *q, const void *buffer, int format, size_t frames)
+{
+  if (!q->running) {
+    return -1;
+  }
+
+  if (frames == 0) {
+    return 0;
+  }
+
+  queue_reclaim(q);
+
+  if (q->num_buffers >= q->max_buffers) {
+    return 1;
+  }
+
+  queue_buffer_t buf;
+  buf.frames = frames;
+  buf.data = (float*) malloc(frames * q->channels * sizeof(float));
+
+  if (!buf.data) {
+    std::cerr << "Play queue memory allocation failed!" << std::endl;
+    return -1;
+  }
+
+  size_t n = frames * q->channels;
+  if (format == DOUBLE_AUDIO) {
+    const double *x = (const double*) buffer;
+    for (size_t k=0; k<n; k++) {
+      buf.data[k] = (float) x[k];
+    }
+  } else {
+    memcpy(buf.data, buffer, n * sizeof(float));
+  }
+
+  q->num_buffers++;
+  q->frames_enqueued += frames;
+  jack_ringbuffer_write(q->pending, (const char*) &buf, sizeof(queue_buffer_t));
+  q->started = true;
+
+  return 0;
+}
+
+size_t queue_channels(const jaudio_queue_t *q)
+{
+  return q->channels;
+}
+
+// The number of enqueued frames that have not been played yet.
+size_t queue_pending_frames(const jaudio_queue_t *q)
+{
+  return q->frames_enqueued - q->frames_played;
+}
+
+size_t queue_frames_played(const jaudio_queue_t *q)
+{
+  return q->frames_played;
+}
+
+size_t queue_underruns(const jaudio_queue_t *q)
+{
+  return q->underruns;
+}
+
+bool queue_is_running(const jaudio_queue_t *q)
+{
+  return q->running;
+}
+
+/***
+ *
+ * queue_finish
+ *
+ * Marks that no more buffers will be enqueued (so that the queue running
+ * dry isn't counted as an underrun). Returns true when all enqueued frames
+ * have been played.
+ *
+ ***/
+
+bool queue_finish(jaudio_queue_t *q)
+{
+  q->closing = true;
+
+  return (queue_pending_frames(q) == 0 || !q->running);
+}
+
+/***
+ *
+ * queue_close
+ *
+ * Stops the playback, closes the client, and frees the queue and all
+ * buffers still in it. Call queue_finish until it returns true first to
+ * play the queue to the end.
+ *
+ ***/
+
+void queue_close(jaudio_queue_t *q)
+{
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
+
+  if (!q) {
+    return;
+  }
+
+  q->running = false;
+
+  if (q->client) {
+
+    jack_deactivate(q->client);
+
+    for (size_t n=0; n<q->channels; n++) {
+      if (q->ports[n] && jack_port_unregister(q->client, q->ports[n])) {
+        std::cerr << "Failed to unregister an output port!" << std::endl;
+      }
+    }
+
+    if (jack_client_close(q->client)) {
+      std::cerr << "jack_client_close failed!" << std::endl;
+    }
+  }
+
+  // The JACK thread is stopped so all buffers can be freed.
+  if (q->pending && q->played) {
+
+    queue_reclaim(q);
+
+    if (q->has_current) {
+      free(q->current.data);
+    }
+
+    queue_buffer_t buf;
+    while (jack_ringbuffer_read_space(q->pending) >= sizeof(queue_buffer_t)) {
+      jack_ringbuffer_read(q->pending, (char*) &buf, sizeof(queue_buffer_t));
+      free(buf.data);
+    }
+  }
+
+  if (q->pending) {
+    jack_ringbuffer_free(q->pending);
+  }
+
+  if (q->played) {
+    jack_ringbuffer_free(q->played);
+  }
+
+  free(q->ports);
+  free(q->out);
+
+  xrun_log_report(q->xruns);
+  xrun_log_destroy(q->xruns);
+
+  delete q;
+
+  return;
+}
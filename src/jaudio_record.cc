@@ -27,6 +27,8 @@
 
 #include <iostream>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "jaudio.h"
 
@@ -34,17 +36,63 @@
 // Globals.
 //
 
-volatile bool record_running;
+static volatile bool record_running;
 
-int total_record_frames;
-int frames_recorded;
-bool is_first_jack_period;
+static int total_record_frames;
+static int frames_recorded;
+static bool is_first_jack_period;
 
-jack_client_t *record_client;
-jack_port_t **input_ports;
-size_t n_input_ports;
+static jack_client_t *record_client;
+static jack_port_t **input_ports;
+static size_t n_input_ports;
+static size_t n_record_channels; // The recorded channels (= n_input_ports unless routed).
 
-volatile bool got_data;
+static volatile bool got_data;
+
+static bool record_use_freewheel;
+static volatile bool record_freewheeling;
+
+// Level metering.
+static bool record_use_meter = false;
+static float record_clip_level = JAUDIO_METER_CLIP_LEVEL;
+static jaudio_meter_t *record_meter = nullptr;
+
+// Streaming STFT (only the spectral frames are stored).
+static const jaudio_stft_config_t *record_stft_cfg = nullptr;
+static jaudio_stft_t *record_stft = nullptr;
+static jack_default_audio_sample_t **record_in = nullptr; // Per period input port buffers.
+
+// Decimation.
+static const size_t *record_decimation_factors = nullptr;
+static jaudio_decimation_t *record_decimation = nullptr;
+
+// Beamforming.
+static const jaudio_beamform_config_t *record_beamform_cfg = nullptr;
+static float *record_beams = nullptr; // The beam buffer (nullptr = the record buffer).
+static jaudio_beamformer_t *record_beamformer = nullptr;
+
+// Routing (ports -> recorded channels) gain matrix.
+static const double *record_route_gains = nullptr;
+static size_t record_route_channels = 0;
+static jaudio_router_t *record_router = nullptr;
+static jack_default_audio_sample_t **record_ports = nullptr; // Per period input port buffers.
+
+// Shared-memory live tap.
+static const char *record_tap_name = nullptr;
+static size_t record_tap_frames = 0;
+static jaudio_tap_t *record_tap = nullptr;
+
+// Buffer-size and sample-rate change points.
+static jaudio_change_log_t *record_changes = nullptr;
+
+// The time the client was activated (until the first recorded frame).
+static double record_t_started = 0.0;
+
+// Xruns (lost periods are filled with zeros unless record_xrun_fill is false).
+static bool record_xrun_fill = true;
+static jaudio_xrun_log_t *record_xruns = nullptr;
+static jack_default_audio_sample_t *record_zeros = nullptr; // One (largest) period of zeros.
+static size_t record_zeros_frames = 0;
 
 /***
  *
@@ -74,7 +122,30 @@ void record_clear_running_flag(void)
 // This is called whenever the sample rate changes.
 int record_srate(jack_nframes_t nframes, void *arg)
 {
-  //printf("The sample rate is now %lu/sec.\n", (long unsigned int) nframes);
+  if (record_changes) {
+    change_log_set_sample_rate(record_changes, nframes);
+  }
+
+  return 0;
+}
+
+// This is called whenever the period size changes (the change is logged by the process callback).
+static int record_bufsize(jack_nframes_t nframes, void *arg)
+{
+  if (record_changes && change_log_set_buffer_size(record_changes, nframes) < 0) {
+    record_clear_running_flag(); // Stop since the period doesn't fit the scratch buffers.
+  }
+
+  return 0;
+}
+
+// This is called whenever JACK (or a client) misses a deadline.
+static int record_xrun(void *arg)
+{
+  if (record_xruns) {
+    xrun_log_notify(record_xruns);
+  }
+
   return 0;
 }
 
@@ -93,6 +164,54 @@ void record_jack_shutdown(void *arg)
   return;
 }
 
+// This is called whenever the JACK server enters or leaves freewheel mode.
+void record_freewheel(int starting, void *arg)
+{
+  record_freewheeling = (starting != 0);
+
+  return;
+}
+
+// Unregisters the input ports and closes the client (shared by record_close and t_record_close).
+static void record_release_client(void)
+{
+  if (record_client) {
+
+    for (size_t n=0; input_ports && n<n_input_ports; n++) {
+      if (input_ports[n] && jack_port_unregister(record_client, input_ports[n])) {
+        std::cerr << "Failed to unregister an input port!" << std::endl;
+      }
+    }
+
+    if (jack_client_close(record_client)) {
+      std::cerr << "jack_client_close failed!" << std::endl;
+    }
+
+    record_client = nullptr;
+  }
+
+  if (input_ports) {
+    free(input_ports);
+    input_ports = nullptr;
+  }
+
+  return;
+}
+
+/***
+ *
+ * record_is_freewheeling
+ *
+ * True when the JACK server is running the process cycles
+ * as fast as possible (not in sync with the sound card).
+ *
+ ***/
+
+bool record_is_freewheeling(void)
+{
+  return record_freewheeling;
+}
+
 /********************************************************************************************
  *
  * Audio Capturing
@@ -109,9 +228,266 @@ void record_jack_shutdown(void *arg)
 
 bool record_finished(void)
 {
+  // In STFT mode we are done when the worker has analyzed all data.
+  if (record_stft) {
+    return ((total_record_frames - frames_recorded) <= 0) && stft_done(record_stft);
+  }
+
+  // Likewise when beamforming.
+  if (record_beamformer) {
+    return ((total_record_frames - frames_recorded) <= 0) && beamform_done(record_beamformer);
+  }
+
   return ((total_record_frames - frames_recorded) <= 0);
 }
 
+// The sample rate of the JACK server (valid after record_init).
+jack_nframes_t record_get_sample_rate(void)
+{
+  return jack_get_sample_rate(record_client);
+}
+
+/***
+ *
+ * record_set_stft
+ *
+ * Capture short-time power spectra instead of the raw samples. The
+ * record buffer passed to record_init must then hold stft_num_features()
+ * x stft_num_frames() x channels values. The configuration must be valid
+ * until record_close. Must be called before record_init.
+ *
+ ***/
+
+void record_set_stft(const jaudio_stft_config_t *cfg)
+{
+  record_stft_cfg = cfg;
+
+  return;
+}
+
+/***
+ *
+ * record_set_decimation
+ *
+ * Anti-alias filter and downsample channel n by factors[n] (1 = keep the
+ * full rate). The channels are then stored after each other in the record
+ * buffer, each decimation_output_frames() long. The factors must be valid
+ * until record_close. Must be called before record_init.
+ *
+ ***/
+
+void record_set_decimation(const size_t *factors)
+{
+  record_decimation_factors = factors;
+
+  return;
+}
+
+/***
+ *
+ * record_set_beamform
+ *
+ * Compute cfg->num_beams delay-and-sum beams of the captured channels. The
+ * beams are written to beams, which must hold frames x num_beams values, and
+ * the raw channels to the record buffer as usual. If beams is nullptr only the
+ * beams are stored, in the record buffer. The configuration must be valid until
+ * record_close. Must be called before record_init.
+ *
+ ***/
+
+void record_set_beamform(const jaudio_beamform_config_t *cfg, float *beams)
+{
+  record_beamform_cfg = cfg;
+  record_beams = beams;
+
+  return;
+}
+
+// The number of times the beamformer worker could not keep up (data was dropped).
+size_t record_get_beamform_overruns(void)
+{
+  return record_beamformer ? beamform_overruns(record_beamformer) : 0;
+}
+
+// The number of frames the beamformer worker processed as zeros since they were dropped.
+size_t record_get_beamform_frames_dropped(void)
+{
+  return record_beamformer ? beamform_frames_dropped(record_beamformer) : 0;
+}
+
+// The number of times the STFT worker could not keep up (data was dropped).
+size_t record_get_stft_overruns(void)
+{
+  return record_stft ? stft_overruns(record_stft) : 0;
+}
+
+// The number of frames the STFT worker analyzed as zeros since they were dropped.
+size_t record_get_stft_frames_dropped(void)
+{
+  return record_stft ? stft_frames_dropped(record_stft) : 0;
+}
+
+/***
+ *
+ * record_get_period_changes
+ *
+ * Copies the buffer-size and sample-rate changes during the capture
+ * (changes must have room for JAUDIO_MAX_PERIOD_CHANGES entries) and
+ * returns their number. Must be called before record_close.
+ *
+ ***/
+
+size_t record_get_period_changes(jaudio_period_change_t *changes)
+{
+  return record_changes ? change_log_get(record_changes, changes) : 0;
+}
+
+/***
+ *
+ * record_set_xrun_fill
+ *
+ * If fill is true (the default) the frames lost in an xrun are recorded
+ * as zeros so that the sample indices stay time-true. Otherwise the gaps
+ * are skipped (and only logged). Must be called before record_init.
+ *
+ ***/
+
+void record_set_xrun_fill(bool fill)
+{
+  record_xrun_fill = fill;
+
+  return;
+}
+
+/***
+ *
+ * record_get_xruns
+ *
+ * Copies the gaps (recorded frame, lost frames) during the capture (xruns
+ * must have room for JAUDIO_MAX_XRUNS entries) and returns their number.
+ * Must be called before record_close.
+ *
+ ***/
+
+size_t record_get_xruns(jaudio_xrun_t *xruns)
+{
+  return record_xruns ? xrun_log_get(record_xruns, xruns) : 0;
+}
+
+/***
+ *
+ * record_set_routing
+ *
+ * Record channels x ports (column major) mixes of the input ports: channel c
+ * is the sum of all ports p scaled by gains(c,p). The record buffer then holds
+ * channels columns and metering, decimation, STFT, and beamforming all work on
+ * the mixed channels. The gains must be valid until record_init returns. Must
+ * be called before record_init.
+ *
+ ***/
+
+void record_set_routing(const double *gains, size_t channels)
+{
+  record_route_gains = gains;
+  record_route_channels = channels;
+
+  return;
+}
+
+/***
+ *
+ * record_set_tap
+ *
+ * Publish the recorded channels in the POSIX shared-memory object name
+ * (see tap_create) so that other processes can read the capture while it
+ * runs. The ring holds ring_frames frames per channel (one second if 0).
+ * The name must be valid until record_init returns. Must be called before
+ * record_init.
+ *
+ ***/
+
+void record_set_tap(const char *name, size_t ring_frames)
+{
+  record_tap_name = name;
+  record_tap_frames = ring_frames;
+
+  return;
+}
+
+/***
+ *
+ * record_set_meter
+ *
+ * Enable per-channel level metering (peak, RMS, and clip counts) of
+ * the recorded data. Must be called before record_init.
+ *
+ ***/
+
+void record_set_meter(bool enable, float clip_level)
+{
+  record_use_meter = enable;
+  record_clip_level = clip_level;
+
+  return;
+}
+
+/***
+ *
+ * record_get_meter
+ *
+ * Copies the latest meter statistics (one struct per channel) to stats.
+ * Can be called while recording. Returns -1 if metering is not enabled.
+ *
+ ***/
+
+int record_get_meter(jaudio_meter_stats_t *stats)
+{
+  if (!record_meter) {
+    return -1;
+  }
+
+  meter_snapshot(record_meter, stats);
+
+  return 0;
+}
+
+// Records zeros in place of the frames lost in an xrun.
+static void record_fill_gap(float *input_fbuffer, size_t frames)
+{
+  while (frames > 0) {
+
+    size_t chunk = (frames < record_zeros_frames) ? frames : record_zeros_frames;
+
+    for (size_t n=0; n<n_record_channels; n++) {
+
+      if (record_stft || record_beamformer) {
+        record_in[n] = record_zeros;
+      }
+
+      if (record_stft || (record_beamformer && !record_beams)) {
+        // Only the spectral frames (beams) are stored.
+      } else if (record_decimation) {
+        decimation_process(record_decimation, n, record_zeros, chunk, input_fbuffer);
+      } else {
+        memset(&input_fbuffer[frames_recorded + n*total_record_frames], 0, chunk * sizeof(float));
+      }
+    }
+
+    if (record_stft) {
+      stft_write(record_stft, record_in, chunk);
+    }
+
+    if (record_beamformer) {
+      beamform_write(record_beamformer, record_in, chunk);
+    }
+
+    frames_recorded += (int) chunk;
+    frames -= chunk;
+  }
+
+  return;
+}
+
 /***
  *
  * record_process
@@ -132,6 +508,10 @@ int record_process(jack_nframes_t nframes, void *arg)
   // The number of available frames in the JACK buffer.
   frames_to_read = (int) nframes;
 
+  // The frames JACK never delivered since the previous period (checked every period).
+  size_t lost_frames = xrun_log_lost_frames(record_xruns, jack_last_frame_time(record_client),
+                                            nframes, record_freewheeling);
+
   // First JACK period is just silence so skip it.
   if (is_first_jack_period) {
     is_first_jack_period = false;
@@ -148,29 +528,127 @@ int record_process(jack_nframes_t nframes, void *arg)
 
   } else {
     frames_recorded = total_record_frames;
+    if (record_stft) {
+      stft_finish(record_stft);
+    }
+    if (record_beamformer) {
+      beamform_finish(record_beamformer);
+    }
     return 0;
   }
 
-  // Loop over all ports.
-  for (size_t n=0; n<n_input_ports; n++) {
+  change_log_update(record_changes, (size_t) frames_recorded, nframes);
+
+  // Keep the recording time-true by recording zeros in place of the lost frames.
+  if (lost_frames > 0) {
+
+    xrun_log_add(record_xruns, (size_t) frames_recorded, lost_frames);
+
+    if (record_xrun_fill) {
+
+      size_t frames_left = (size_t) (total_record_frames - frames_recorded);
+      record_fill_gap(input_fbuffer, (lost_frames < frames_left) ? lost_frames : frames_left);
+
+      if (frames_to_read > (total_record_frames - frames_recorded)) {
+        frames_to_read = total_record_frames - frames_recorded;
+      }
+    }
+  }
+
+  if (record_t_started > 0.0) {
+    profile_add(JAUDIO_PHASE_FIRST_PERIOD, record_t_started);
+    record_t_started = 0.0;
+  }
+
+  // Mix the input ports to the recorded channels.
+  jack_default_audio_sample_t **mixed = nullptr;
+  if (record_router) {
+
+    for (size_t n=0; n<n_input_ports; n++) {
+
+      record_ports[n] = (jack_default_audio_sample_t *)
+        jack_port_get_buffer(input_ports[n], nframes);
+
+      if (record_ports[n] == nullptr) {
+        std::cerr << "jack_port_get_buffer failed!" << std::endl;
+        return -1;
+      }
+    }
+
+    mixed = router_mix(record_router, record_ports, (size_t) frames_to_read);
+    if (mixed == nullptr) {
+      std::cerr << "The JACK period is larger than the routing buffers!" << std::endl;
+      return -1;
+    }
+  }
+
+  // Loop over all (recorded) channels.
+  for (size_t n=0; n<n_record_channels; n++) {
 
     // Grab the n:th input buffer.
-    in = (jack_default_audio_sample_t *)
-      jack_port_get_buffer(input_ports[n], nframes);
+    if (mixed) {
+      in = mixed[n];
+    } else {
+      in = (jack_default_audio_sample_t *)
+        jack_port_get_buffer(input_ports[n], nframes);
+    }
 
     if (in == nullptr) {
       std::cerr << "jack_port_get_buffer failed!" << std::endl;
       return -1;
     }
 
-    for (size_t m=0; m< (size_t) frames_to_read; m++) {
-      input_fbuffer[m+frames_recorded + n*total_record_frames] = (float) in[(jack_nframes_t) m];
+    if (record_stft || record_beamformer || record_tap) {
+      record_in[n] = in; // Queued for the STFT or beamformer worker (or the tap) below.
+    }
+
+    if (record_stft || (record_beamformer && !record_beams)) {
+      // Only the spectral frames (beams) are stored.
+    } else if (record_decimation) {
+      decimation_process(record_decimation, n, in, (size_t) frames_to_read, input_fbuffer);
+    } else {
+      for (size_t m=0; m< (size_t) frames_to_read; m++) {
+        input_fbuffer[m+frames_recorded + n*total_record_frames] = (float) in[(jack_nframes_t) m];
+      }
+    }
+
+    if (record_meter) {
+      meter_update(record_meter, n, in, (size_t) frames_to_read);
     }
 
-  } //  n<n_input_ports;
+  } //  n<n_record_channels;
+
+  if (record_meter) {
+    meter_publish(record_meter);
+  }
+
+  if (record_stft) {
+    stft_write(record_stft, record_in, (size_t) frames_to_read);
+  }
+
+  if (record_beamformer) {
+    beamform_write(record_beamformer, record_in, (size_t) frames_to_read);
+  }
+
+  if (record_tap) {
+    tap_write(record_tap, record_in, (size_t) frames_to_read, jack_last_frame_time(record_client));
+  }
 
   frames_recorded += frames_to_read;
 
+  if (record_stft && frames_recorded >= total_record_frames) {
+    stft_finish(record_stft);
+  }
+
+  if (record_beamformer && frames_recorded >= total_record_frames) {
+    beamform_finish(record_beamformer);
+  }
+
+  // Flush the decimation filters after the last period.
+  if (record_decimation && frames_recorded >= total_record_frames) {
+    decimation_finish(record_decimation, input_fbuffer);
+  }
+
   return 0;
 }
 
@@ -183,12 +661,15 @@ int record_process(jack_nframes_t nframes, void *arg)
  ***/
 
 int record_init(void* buffer, size_t frames, size_t channels,
-                char **port_names, const char *client_name)
+                char **port_names, const char *client_name,
+                bool freewheel)
 {
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
   char port_name[255];
 
-  // The number of channels (columns) in the buffer matrix.
+  // The number of ports and the number of channels (columns) in the buffer matrix.
   n_input_ports = channels;
+  n_record_channels = record_route_gains ? record_route_channels : channels;
 
   // The total number of frames to record.
   total_record_frames = frames;
@@ -196,11 +677,42 @@ int record_init(void* buffer, size_t frames, size_t channels,
   // Reset record counter.
   frames_recorded = 0;
 
+  record_use_freewheel = freewheel;
+  record_freewheeling = false;
+
   // Mark that we have not called our process callback before
   // so than we can disregard the frames in the first JACK period
   // which always seems to be silence (zero valued samples).
   is_first_jack_period = true;
 
+  if (record_decimation_factors && !record_stft_cfg) {
+    record_decimation = decimation_create(record_decimation_factors, n_record_channels, frames);
+    if (!record_decimation) {
+      record_close();
+      return -1;
+    }
+  }
+
+  if (record_use_meter) {
+    record_meter = meter_create(n_record_channels, record_clip_level);
+    if (!record_meter) {
+      record_close();
+      return -1;
+    }
+  }
+
+  if (record_beamform_cfg && !record_stft_cfg) {
+
+    record_in = (jack_default_audio_sample_t**) calloc(n_record_channels, sizeof(jack_default_audio_sample_t*));
+    record_beamformer = beamform_create(record_beamform_cfg, n_record_channels, frames,
+                                        record_beams ? record_beams : (float*) buffer);
+
+    if (!record_in || !record_beamformer) {
+      record_close();
+      return -1;
+    }
+  }
+
   // Tell the JACK server to call jerror() whenever it
   // experiences an error.  Notice that this callback is
   // global to this process, not specific to each client.
@@ -210,14 +722,92 @@ int record_init(void* buffer, size_t frames, size_t channels,
   jack_set_error_function(record_jerror);
 
   // Try to become a client of the JACK server.
+  double t_open = profile_now();
   jack_status_t status;
   if ((record_client = jack_client_open(client_name,
                                         JackNullOption,&status)) == 0) {
     print_jack_status(status);
     std::cerr << "Failed to open JACK client: '" << client_name << "'" << std::endl;
+    record_close();
     return -1;
   }
 
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
+  // Start the STFT worker (it needs the sample rate for the band edges).
+  if (record_stft_cfg) {
+
+    record_in = (jack_default_audio_sample_t**) calloc(n_record_channels, sizeof(jack_default_audio_sample_t*));
+    record_stft = stft_create(record_stft_cfg, n_record_channels,
+                              (double) jack_get_sample_rate(record_client),
+                              frames, (float*) buffer);
+
+    if (!record_in || !record_stft) {
+      record_close();
+      return -1;
+    }
+  }
+
+  // The per-period buffers are preallocated for the largest period so that
+  // nothing is reallocated if the period size changes while recording.
+  size_t max_period_frames = jaudio_max_period_frames(record_client);
+  record_changes = change_log_create(record_client, max_period_frames);
+  record_xruns = xrun_log_create();
+
+  if (record_xrun_fill) {
+    record_zeros_frames = max_period_frames;
+    record_zeros = (jack_default_audio_sample_t*) calloc(record_zeros_frames, sizeof(jack_default_audio_sample_t));
+
+    if (!record_zeros) {
+      record_close();
+      return -1;
+    }
+  }
+
+  // Mix buffers for one JACK period.
+  if (record_route_gains) {
+
+    record_router = router_create(record_route_gains, n_record_channels, n_input_ports,
+                                  max_period_frames);
+    record_ports = (jack_default_audio_sample_t**) calloc(n_input_ports, sizeof(jack_default_audio_sample_t*));
+
+    if (!record_router || !record_ports) {
+      record_close();
+      return -1;
+    }
+  }
+
+  // Publish the capture in shared memory.
+  if (record_tap_name) {
+
+    double fs = (double) jack_get_sample_rate(record_client);
+    size_t ring_frames = (record_tap_frames > 0) ? record_tap_frames : (size_t) fs;
+
+    // At least two (of the largest) periods so that the latest period is always complete.
+    if (ring_frames < 2 * max_period_frames) {
+      ring_frames = 2 * max_period_frames;
+    }
+
+    // Name the channels after the ports unless they are mixed.
+    std::vector<std::string> names(n_record_channels);
+    std::vector<const char*> name_ptrs(n_record_channels);
+    for (size_t n=0; n<n_record_channels; n++) {
+      names[n] = record_router ? "mix_" + std::to_string(n+1) : std::string(port_names[n]);
+      name_ptrs[n] = names[n].c_str();
+    }
+
+    if (!record_in) {
+      record_in = (jack_default_audio_sample_t**) calloc(n_record_channels, sizeof(jack_default_audio_sample_t*));
+    }
+    record_tap = tap_create(record_tap_name, n_record_channels, ring_frames, max_period_frames,
+                            fs, name_ptrs.data());
+
+    if (!record_in || !record_tap) {
+      record_close();
+      return -1;
+    }
+  }
+
   // Tell the JACK server to call the `record_process()' whenever
   // there is work to be done.
   jack_set_process_callback(record_client, record_process, buffer);
@@ -226,31 +816,62 @@ int record_init(void* buffer, size_t frames, size_t channels,
   // the sample rate of the system changes.
   jack_set_sample_rate_callback(record_client, record_srate, 0);
 
+  // Tell the JACK server to call `record_bufsize()' whenever
+  // the period size changes.
+  jack_set_buffer_size_callback(record_client, record_bufsize, 0);
+
+  // Tell the JACK server to call `record_xrun()' whenever
+  // a deadline is missed.
+  jack_set_xrun_callback(record_client, record_xrun, 0);
+
   // Tell the JACK server to call `jack_shutdown()' if
   // it ever shuts down, either entirely, or if it
   // just decides to stop calling us.
   jack_on_shutdown(record_client, record_jack_shutdown, 0);
 
+  // Tell the JACK server to call `record_freewheel()' when
+  // freewheel mode is entered or left.
+  jack_set_freewheel_callback(record_client, record_freewheel, 0);
+
   input_ports = (jack_port_t**) malloc(n_input_ports * sizeof(jack_port_t*));
 
+  double t_register = profile_now();
   for (size_t n=0; n<n_input_ports; n++) {
     sprintf(port_name,"input_%d",(int) n+1); // Port numbers start at 1.
     input_ports[n] = jack_port_register(record_client, port_name,
                                         JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
   }
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
 
   // Tell the JACK server that we are ready to roll.
+  double t_activate = profile_now();
+  record_t_started = t_activate; // The first period is timed from here.
   if (jack_activate(record_client)) {
     std::cerr << "Cannot activate jack client!" << std::endl;
+    record_close();
+    return -1;
+  }
+
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
+  // Connect to the input ports (all are checked before any is connected).
+  if (ports_connect(record_client, input_ports, port_names, n_input_ports, true) < 0) {
+    record_close();
     return -1;
   }
 
-  // Connect to the input ports.
   for (size_t n=0; n<n_input_ports; n++) {
-    if (jack_connect(record_client, port_names[n], jack_port_name(input_ports[n]))) {
-      std::cerr << "Cannot connect to the client output port: '" <<  port_names[n] << "'" << std::endl;
-      record_close();
-      return -1;
+    if (freewheel && jaudio_port_is_physical(record_client, port_names[n])) {
+      std::cerr << "Warning: '" << port_names[n]
+                << "' is a hardware port which is not serviced in freewheel mode!" << std::endl;
+    }
+  }
+
+  // Run the server as fast as possible for the duration of the capture.
+  if (freewheel) {
+    if (jack_set_freewheel(record_client, 1)) {
+      std::cerr << "Failed to enter freewheel mode!" << std::endl;
+      record_use_freewheel = false;
     }
   }
 
@@ -268,27 +889,89 @@ int record_init(void* buffer, size_t frames, size_t channels,
 
 int record_close(void)
 {
-  int err = 0;
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
+  // Nothing to release if the client is already closed (record_close may be called twice).
+  if (record_client) {
 
-  // Unregister all ports for the record client.
-  for (size_t n=0; n<n_input_ports; n++) {
-    err = jack_port_unregister(record_client, input_ports[n]);
-    if (err) {
-      std::cerr << "Failed to unregister an input port!" << std::endl;
+    // Leave freewheel mode before we remove our ports.
+    if (record_use_freewheel) {
+      jack_set_freewheel(record_client, 0);
     }
+
+    record_release_client();
   }
+  record_use_freewheel = false;
 
-  // Close the client.
-  err = jack_client_close(record_client);
-  if (err) {
-    std::cerr << "jack_client_close failed!" << std::endl;
+  if (record_meter) {
+    meter_destroy(record_meter);
+    record_meter = nullptr;
   }
+  record_use_meter = false;
 
-  if (input_ports) {
-    free(input_ports);
-  } else {
-    std::cerr << "Failed free input_ports memory!" << std::endl;
+  // Wait for the STFT worker (it's already done unless we were interrupted).
+  if (record_stft) {
+    stft_destroy(record_stft);
+    record_stft = nullptr;
+  }
+
+  if (record_in) {
+    free(record_in);
+    record_in = nullptr;
+  }
+  record_stft_cfg = nullptr;
+
+  if (record_decimation) {
+    decimation_destroy(record_decimation);
+    record_decimation = nullptr;
+  }
+  record_decimation_factors = nullptr;
+
+  if (record_beamformer) {
+    beamform_destroy(record_beamformer);
+    record_beamformer = nullptr;
+  }
+  record_beamform_cfg = nullptr;
+  record_beams = nullptr;
+
+  if (record_router) {
+    router_destroy(record_router);
+    record_router = nullptr;
+  }
+
+  if (record_ports) {
+    free(record_ports);
+    record_ports = nullptr;
   }
+  record_route_gains = nullptr;
+  record_route_channels = 0;
+
+  if (record_tap) {
+    tap_destroy(record_tap);
+    record_tap = nullptr;
+  }
+  record_tap_name = nullptr;
+  record_tap_frames = 0;
+
+  if (record_changes) {
+    change_log_destroy(record_changes);
+    record_changes = nullptr;
+  }
+
+  if (record_xruns) {
+    xrun_log_destroy(record_xruns);
+    record_xruns = nullptr;
+  }
+
+  if (record_zeros) {
+    free(record_zeros);
+    record_zeros = nullptr;
+  }
+  record_zeros_frames = 0;
+  record_xrun_fill = true;
+
+  record_t_started = 0.0;
+
+  record_clip_level = JAUDIO_METER_CLIP_LEVEL;
 
   return 0;
 }
@@ -298,22 +981,29 @@ int record_close(void)
  *
  * Triggered Audio Capturing
  *
+ * The capture runs into a ring buffer until the trigger fires, and then for
+ * post_trigger_frames more frames. The trigger is either a single channel and level
+ * (the t_record_init arguments) or, with t_record_set_trigger, any number of channels
+ * with their own levels and a vote of how many of them must be above their levels.
+ *
  *********************************************************************************************/
 
 // Globals for the triggered audio caputring.
 
-float *triggerbuffer = NULL;
-size_t triggerport;
-float t_level = 1.0, trigger = 0.0;
-int    trigger_active;
-size_t trigger_position;
-size_t t_frames;
+static jaudio_trigger_t *record_trigger = nullptr;
+static int    trigger_active;
 
-bool ringbuffer_read_running;
-size_t ringbuffer_position;
-size_t post_t_frames_counter;
-size_t post_t_frames;
-int has_wrapped;
+// The multi-channel trigger (nullptr = the t_record_init trigger channel and level).
+static const size_t *t_trigger_channels = nullptr;
+static const double *t_trigger_levels = nullptr;
+static size_t t_trigger_num_channels = 0;
+static size_t t_trigger_votes = 1;
+
+static bool ringbuffer_read_running;
+static size_t ringbuffer_position;
+static size_t post_t_frames_counter;
+static size_t post_t_frames;
+static int has_wrapped;
 
 /***
  *
@@ -328,6 +1018,48 @@ bool t_record_finished(void)
   return !ringbuffer_read_running;
 }
 
+/***
+ *
+ * t_record_set_trigger
+ *
+ * Triggers on num_channels channels (0-based) instead of the single
+ * t_record_init trigger channel, each with its own (mean |x|) level. The
+ * capture is triggered when at least votes of the channels are above their
+ * levels (1 = any, num_channels = all). The arrays must be valid until
+ * t_record_init has returned. Must be called before t_record_init.
+ *
+ ***/
+
+void t_record_set_trigger(const size_t *channels, const double *levels, size_t num_channels,
+                          size_t votes)
+{
+  t_trigger_channels = channels;
+  t_trigger_levels = levels;
+  t_trigger_num_channels = num_channels;
+  t_trigger_votes = votes;
+
+  return;
+}
+
+/***
+ *
+ * t_record_get_trigger_envelopes
+ *
+ * Copies the envelope (mean |x| over the trigger window) of each trigger
+ * channel to envelopes (as they were when the capture was triggered) and
+ * returns the number of trigger channels. Must be called before t_record_close.
+ *
+ ***/
+
+size_t t_record_get_trigger_envelopes(float *envelopes)
+{
+  if (!record_trigger) {
+    return 0;
+  }
+
+  return trigger_get_envelopes(record_trigger, envelopes);
+}
+
 /***
  *
  * t_record_process
@@ -349,6 +1081,10 @@ int t_record_process(jack_nframes_t nframes, void *arg)
   // The number of available frames.
   frames_to_read = (int) nframes;
 
+  // The frames JACK never delivered since the previous period.
+  size_t lost_frames = xrun_log_lost_frames(record_xruns, jack_last_frame_time(record_client),
+                                            nframes, false);
+
   // First JACK period is just silence so skip it.
   if (is_first_jack_period) {
     is_first_jack_period = false;
@@ -357,6 +1093,40 @@ int t_record_process(jack_nframes_t nframes, void *arg)
 
   if ( record_running && ringbuffer_read_running) {
 
+    if (record_t_started > 0.0) {
+      profile_add(JAUDIO_PHASE_FIRST_PERIOD, record_t_started);
+      record_t_started = 0.0;
+    }
+
+    // Keep the ring buffer time-true by writing zeros in place of the lost frames
+    // (a gap longer than the ring buffer just clears it).
+    if (lost_frames > 0) {
+
+      xrun_log_add(record_xruns, ringbuffer_position, lost_frames);
+
+      size_t fill_frames = (lost_frames < (size_t) total_record_frames) ? lost_frames : total_record_frames;
+
+      for (size_t m=0; m<fill_frames; m++) {
+
+        if (ringbuffer_position >= (size_t) total_record_frames) {
+          ringbuffer_position = 0;
+          has_wrapped = true;
+        }
+
+        for (size_t n=0; n<n_input_ports; n++) {
+          input_fbuffer[ringbuffer_position + n*total_record_frames] = 0.0;
+        }
+
+        ringbuffer_position++;
+      }
+
+      if (trigger_active) {
+        post_t_frames_counter += lost_frames;
+      } else {
+        trigger_skip(record_trigger, lost_frames); // The trigger windows also see the zeros.
+      }
+    }
+
     // Loop over all JACK ports.
     for (size_t n=0; n<n_input_ports; n++) {
 
@@ -388,88 +1158,52 @@ int t_record_process(jack_nframes_t nframes, void *arg)
 
       }
 
-      //
-      // Update the trigger buffer
-      //
-
-      if (n == triggerport) {
-
-        if (!trigger_active) { // TODO: We may have a problem if frames_to_read >= t_frames!
-
-          // 1) "Forget" the old data which is now shifted out of the trigger buffer.
-          // We have got 'frames_to_read' new frames so forget the 'frames_to_read' oldest ones.
-
-          for (size_t m=0; m< (size_t) frames_to_read; m++) {
-
-            size_t m2 = (trigger_position + m) % t_frames;
-
-            trigger -= fabsf(triggerbuffer[m2]);
-          }
-
-          // 2) Add the new data to the trigger ring buffer.
-
-          for (size_t m=0; m< (size_t) frames_to_read; m++) {
-
-            size_t m2 = (trigger_position + m) % t_frames;
-
-            triggerbuffer[m2] = (float) in[(jack_nframes_t) m];
-          }
-
-          // 3) Update the trigger value.
-
-          size_t m2 = 0;
-          for (size_t m=0; m< (size_t) frames_to_read; m++) {
-
-            m2 = (trigger_position + m) % t_frames;
-
-            trigger += fabsf(triggerbuffer[m2]);
-          }
-
-          // 4) Set the new position in the trigger buffer.
-
-          trigger_position = m2 + 1;
+      // Update the trigger envelope (if a trigger channel) while the period is still in the cache.
+      if (!trigger_active) {
+        trigger_update(record_trigger, n, (const float*) in, (size_t) frames_to_read);
+      }
 
-          // Check if we are above the threshold.
-          if ( (trigger / (float) t_frames) > t_level) {
-            trigger_active = true;
+    } // for (n=0; n<n_input_ports; n++)
 
-            struct tm *the_time;
-            time_t curtime;
+    ringbuffer_position = local_rbuf_pos; // Update the global ringbuffer position index.
 
-            // Get the current time.
-            curtime = time(NULL);
+    if (!trigger_active) {
 
-            // Convert it to local time representation.
-            the_time = localtime(&curtime);
+      // Check if enough trigger channels are above their thresholds.
+      if (trigger_check(record_trigger, (size_t) frames_to_read)) {
+        trigger_active = true;
 
-            // This should work with Octave's diary command.
-            std::cout << "\n Got a trigger signal at: " << asctime (the_time) << "\n";
-            got_data = true;
-          }
+        struct tm *the_time;
+        time_t curtime;
 
-        } else { // We have already detected a signal so wait until we have got all the requested data.
-          post_t_frames_counter += frames_to_read; // Add the number of acquired frames.
-        }
+        // Get the current time.
+        curtime = time(NULL);
 
-        // We have got a trigger and the buffer has wrapped. Now wait for post_t_frames more
-        // data and then we're done acquiring data.
-        if (trigger_active && has_wrapped && (post_t_frames_counter >= post_t_frames)) {
-          ringbuffer_read_running = false; // Exit the read loop.
-        }
+        // Convert it to local time representation.
+        the_time = localtime(&curtime);
 
-        // We have got a trigger and the buffer has NOT wrapped. Now just wait until the buffer
-        // is full. This is to avoid saving a non-full buffer. If the buffer wraps while we
-        // are waiting for total_record_frames number of frames (= until the ringbuffer is full)
-        // then the condition above applies and we wait for post_t_frames number of frames instead.
-        if (trigger_active && !has_wrapped && (local_rbuf_pos >= total_record_frames)) {
-          ringbuffer_read_running = false; // Exit the read loop.
-        }
+        // This should work with Octave's diary command.
+        std::cout << "\n Got a trigger signal at: " << asctime (the_time) << "\n";
+        got_data = true;
+      }
 
-      } // if (n == triggerport)
+    } else { // We have already detected a signal so wait until we have got all the requested data.
+      post_t_frames_counter += frames_to_read; // Add the number of acquired frames.
+    }
 
-    } // for (n=0; n<n_input_ports; n++)
+    // We have got a trigger and the buffer has wrapped. Now wait for post_t_frames more
+    // data and then we're done acquiring data.
+    if (trigger_active && has_wrapped && (post_t_frames_counter >= post_t_frames)) {
+      ringbuffer_read_running = false; // Exit the read loop.
+    }
 
-    ringbuffer_position = local_rbuf_pos; // Update the global ringbuffer position index.
+    // We have got a trigger and the buffer has NOT wrapped. Now just wait until the buffer
+    // is full. This is to avoid saving a non-full buffer. If the buffer wraps while we
+    // are waiting for total_record_frames number of frames (= until the ringbuffer is full)
+    // then the condition above applies and we wait for post_t_frames number of frames instead.
+    if (trigger_active && !has_wrapped && (local_rbuf_pos >= total_record_frames)) {
+      ringbuffer_read_running = false; // Exit the read loop.
+    }
 
   } // if ( record_running && ringbuffer_read_running )
 
@@ -500,7 +1234,8 @@ bool got_a_trigger(void)
  * post_trigger_frames frames have been aquired after the input
  * signal average level is over the trigger_level. The average
  * signal level is computed from a (typically) smaller ring buffer
- * of trigger_frames length.
+ * of trigger_frames length. trigger_channel and trigger_level are
+ * not used if a multi-channel trigger is set (t_record_set_trigger).
  *
  * The audio data is read by the JACK callback function
  * t_record_process() above.
@@ -514,6 +1249,7 @@ int t_record_init(void* buffer, size_t frames, size_t channels,
                   size_t trigger_frames,
                   size_t post_trigger_frames)
 {
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
   char port_name[255];
 
   // Clear trigger indicator.
@@ -522,9 +1258,6 @@ int t_record_init(void* buffer, size_t frames, size_t channels,
   // The number of channels (columns) in the buffer matrix.
   n_input_ports = channels;
 
-  // Set the trigger level for the callback function.
-  t_level = (float) trigger_level;
-
   // The total number of frames to record.
   total_record_frames = frames;
 
@@ -541,30 +1274,28 @@ int t_record_init(void* buffer, size_t frames, size_t channels,
   // Initialze the ring buffer position.
   ringbuffer_position = 0;
 
-  // Allocate space and clear the trigger buffer.
-  triggerbuffer = (float*) malloc(trigger_frames*sizeof(float));
-  if (!triggerbuffer) {
-    std::cerr << "Trigger buffer memory allocation failed!" << std::endl;
-    return -1;
-  }
-  bzero(triggerbuffer, trigger_frames*sizeof(float));
-
-  t_frames = trigger_frames;
-
   // Reset the wrapped flag.
   has_wrapped = false;
 
-  // Initialize trigger parameters.
-  trigger = 0.0;	    // Clear the trigger value.
-  trigger_position = 0;	    // Start from the beginning of the buffer.
-  trigger_active = false;   // Clear the trigger status.
-  triggerport = trigger_channel; // The (global) trigger port for the JACK callback function.
+  // Clear the trigger status.
+  trigger_active = false;
 
-  if (triggerport < 0 || triggerport >= n_input_ports) {
-    std::cerr << "Trigger channel out-of-bounds!" << std::endl;
+  // The trigger channel(s) and level(s) (with cleared trigger windows).
+  if (t_trigger_num_channels > 0) {
+    record_trigger = trigger_create(n_input_ports, t_trigger_channels, t_trigger_levels,
+                                    t_trigger_num_channels, trigger_frames, t_trigger_votes);
+  } else {
+    record_trigger = trigger_create(n_input_ports, &trigger_channel, &trigger_level,
+                                    1, trigger_frames, 1);
+  }
+
+  if (!record_trigger) {
+    t_record_close();
     return -1;
   }
 
+  record_xruns = xrun_log_create();
+
   // Tell the JACK server to call jerror() whenever it
   // experiences an error.  Notice that this callback is
   // global to this process, not specific to each client.
@@ -574,14 +1305,18 @@ int t_record_init(void* buffer, size_t frames, size_t channels,
   jack_set_error_function (record_jerror);
 
   // Try to become a client of the JACK server.
+  double t_open = profile_now();
   jack_status_t status;
   if ((record_client = jack_client_open(client_name,
                                         JackNullOption,&status)) == 0) {
     print_jack_status(status);
     std::cerr << "Failed to open JACK client: '" << client_name << "'!" << std::endl;
+    t_record_close();
     return -1;
   }
 
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
   // Tell the JACK server to call the `record_process()' whenever
   // there is work to be done.
   jack_set_process_callback(record_client, t_record_process, buffer);
@@ -590,6 +1325,10 @@ int t_record_init(void* buffer, size_t frames, size_t channels,
   // the sample rate of the system changes.
   jack_set_sample_rate_callback(record_client, record_srate, 0);
 
+  // Tell the JACK server to call `record_xrun()' whenever
+  // a deadline is missed.
+  jack_set_xrun_callback(record_client, record_xrun, 0);
+
   // Tell the JACK server to call `jack_shutdown()' if
   // it ever shuts down, either entirely, or if it
   // just decides to stop calling us.
@@ -597,30 +1336,39 @@ int t_record_init(void* buffer, size_t frames, size_t channels,
 
   // Register the input ports.
   input_ports = (jack_port_t**) malloc(n_input_ports * sizeof(jack_port_t*));
+  double t_register = profile_now();
   for ( size_t n=0; n<n_input_ports; n++) {
     sprintf(port_name,"input_%d",(int) n+1); // Port numbers start at 1.
     input_ports[n] = jack_port_register(record_client, port_name,
                                         JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
   }
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
 
   // Tell the JACK server that we are ready to roll.
+  double t_activate = profile_now();
+  record_t_started = t_activate; // The first period is timed from here.
   if (jack_activate(record_client)) {
     std::cerr << "Cannot activate jack client!" << std::endl;
+    t_record_close();
     return -1;
   }
 
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
   // Connect to the input ports.
-  for (size_t n=0; n<n_input_ports; n++) {
-    if (jack_connect(record_client, port_names[n], jack_port_name(input_ports[n]))) {
-      std::cerr << "Cannot connect to the client output port '" << port_names[n] << "'!" << std::endl;
-      t_record_close();
-      return -1;
-    }
+  if (ports_connect(record_client, input_ports, port_names, n_input_ports, true) < 0) {
+    t_record_close();
+    return -1;
   }
 
   // This should work with Octave's diary command.
-  std::cout << "\n Audio capturing started. Listening to JACK port '" <<
-    port_names[trigger_channel]  << "' for a trigger signal.\n\n";
+  if (t_trigger_num_channels > 0) {
+    std::cout << "\n Audio capturing started. Listening to " << t_trigger_num_channels <<
+      " JACK ports for a trigger signal (" << t_trigger_votes << " must agree).\n\n";
+  } else {
+    std::cout << "\n Audio capturing started. Listening to JACK port '" <<
+      port_names[trigger_channel]  << "' for a trigger signal.\n\n";
+  }
 
   return 0;
 }
@@ -660,36 +1408,30 @@ size_t get_ringbuffer_position(void)
 
 int t_record_close(void)
 {
-  int err;
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
 
-   // Unregister all ports for the record client.
-  for (size_t n=0; n<n_input_ports; n++) {
-    err = jack_port_unregister(record_client, input_ports[n]);
-    if (err) {
-      std::cerr << "Failed to unregister an input port!" << std::endl;
-    }
-  }
-
-  // Close the client.
-  err = jack_client_close(record_client);
-  if (err) {
-    std::cerr << "jack_client_close failed!" << std::endl;
-  }
+  // Unregister the ports and close the client (if not already done).
+  record_release_client();
 
   //
   // Cleanup memory.
   //
 
-  if(input_ports) {
-    free(input_ports);
-  } else {
-    std::cerr << "Failed free input_ports memory!" << std::endl;
-  }
+  trigger_destroy(record_trigger);
+  record_trigger = nullptr;
 
-  if (triggerbuffer) {
-    free(triggerbuffer);
-  } else {
-    std::cerr << "Failed free triggerbuffer memory!" << std::endl;
+  // Back to the single channel trigger.
+  t_trigger_channels = nullptr;
+  t_trigger_levels = nullptr;
+  t_trigger_num_channels = 0;
+  t_trigger_votes = 1;
+
+  record_t_started = 0.0;
+
+  if (record_xruns) {
+    xrun_log_report(record_xruns);
+    xrun_log_destroy(record_xruns);
+    record_xruns = nullptr;
   }
 
   return 0;
@@ -0,0 +1,437 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <jack/ringbuffer.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Playback sample-rate conversion
+ *
+ * The play data is converted from its own sample rate to the JACK server rate by a
+ * Kaiser windowed-sinc polyphase filter. The rate ratio is reduced to L/M and output
+ * frame k is computed from the input frames around k*M/L using the coefficients of
+ * phase (k*M mod L). A worker thread converts the data in chunks into a lock-free
+ * ring buffer that is kept ahead of the JACK callback, so the full resampled matrix
+ * is never stored.
+ *
+ *********************************************************************************************/
+
+#define RESAMPLE_ZERO_CROSSINGS 16    // Sinc zero crossings on each side of the center tap.
+#define RESAMPLE_KAISER_BETA 8.0      // About 80 dB stopband attenuation.
+#define RESAMPLE_PASSBAND 0.9         // Cutoff relative to the lower Nyquist frequency.
+#define RESAMPLE_MAX_PHASES 4096      // Largest supported L in the L/M rate ratio.
+#define RESAMPLE_CHUNK_FRAMES 1024    // Output frames converted per worker iteration.
+#define RESAMPLE_SCRATCH_FRAMES 256   // De-interleaving chunk size in the JACK callback.
+
+struct jaudio_resampler {
+  const void *buffer;         // The frames x channels (column major) play data.
+  int format;                 // FLOAT_AUDIO or DOUBLE_AUDIO.
+  size_t frames;
+  size_t channels;
+  double fs_in;
+  double fs_out;
+
+  size_t L;                   // Interpolation factor (number of filter phases).
+  size_t M;                   // Decimation factor.
+  size_t half_taps;
+  size_t taps;                // Taps per phase (2*half_taps).
+  float *coeffs;              // L x taps coefficients.
+
+  size_t out_frames;          // Number of resampled frames.
+  size_t produced;            // Output frames converted so far (worker only).
+  float *chunk;               // Interleaved worker output.
+
+  jack_ringbuffer_t *ring;    // Interleaved resampled frames (worker -> JACK thread).
+  float *scratch;             // De-interleaving buffer used by the JACK callback.
+  size_t consumed;            // Frames read by the JACK callback.
+  std::atomic<size_t> underruns;
+
+  std::thread worker;
+  std::atomic<bool> stopping;
+};
+
+// Zeroth order modified Bessel function of the first kind.
+static double bessel_i0(double x)
+{
+  double sum = 1.0, term = 1.0;
+
+  for (int k=1; k<50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < 1e-12 * sum) {
+      break;
+    }
+  }
+
+  return sum;
+}
+
+static size_t gcd(size_t a, size_t b)
+{
+  while (b != 0) {
+    size_t t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+/***
+ *
+ * resampler_output_frames
+ *
+ * The number of frames when frames frames at the rate fs_in are
+ * converted to the rate fs_out.
+ *
+ ***/
+
+size_t resampler_output_frames(size_t frames, double fs_in, double fs_out)
+{
+  size_t r_in = (size_t) llround(fs_in);
+  size_t r_out = (size_t) llround(fs_out);
+
+  if (r_in == 0 || r_out == 0) {
+    return 0;
+  }
+
+  size_t g = gcd(r_in, r_out);
+  size_t L = r_out / g;
+  size_t M = r_in / g;
+
+  return (frames * L + M - 1) / M;
+}
+
+// Compute the L polyphase filters.
+static void resampler_make_filters(jaudio_resampler_t *rs)
+{
+  // Cutoff, normalized to the input Nyquist frequency, below the lower of the two rates.
+  double fc = RESAMPLE_PASSBAND * ((rs->L < rs->M) ? (double) rs->L / (double) rs->M : 1.0);
+  double i0_beta = bessel_i0(RESAMPLE_KAISER_BETA);
+  double half = (double) rs->half_taps;
+
+  for (size_t p=0; p<rs->L; p++) {
+
+    float *h = &rs->coeffs[p * rs->taps];
+    double frac = (double) p / (double) rs->L;
+    double sum = 0.0;
+
+    // Tap j multiplies input frame n - half_taps + 1 + j where n + frac is the output time.
+    for (size_t j=0; j<rs->taps; j++) {
+
+      double t = (double) j - half + 1.0 - frac;
+      double x = M_PI * fc * t;
+      double sinc = (fabs(x) < 1e-12) ? 1.0 : sin(x) / x;
+      double r = t / half;
+      double w = (fabs(r) < 1.0) ? bessel_i0(RESAMPLE_KAISER_BETA * sqrt(1.0 - r*r)) / i0_beta : 0.0;
+
+      h[j] = (float) (sinc * w);
+      sum += sinc * w;
+    }
+
+    // Unity DC gain for every phase.
+    for (size_t j=0; j<rs->taps; j++) {
+      h[j] = (float) (h[j] / sum);
+    }
+  }
+}
+
+// Output frame k of one channel (zero outside the input data).
+template <typename T>
+static float resampler_frame(const jaudio_resampler_t *rs, const T *x, size_t k)
+{
+  size_t pos = k * rs->M;
+  size_t n = pos / rs->L;
+  const float *h = &rs->coeffs[(pos % rs->L) * rs->taps];
+
+  // Index of the input frame multiplied by the first tap.
+  ptrdiff_t first = (ptrdiff_t) n - (ptrdiff_t) rs->half_taps + 1;
+  size_t j0 = 0, j1 = rs->taps;
+
+  if (first < 0) {
+    j0 = (size_t) -first;
+  }
+  if (first + (ptrdiff_t) rs->taps > (ptrdiff_t) rs->frames) {
+    ptrdiff_t end = (ptrdiff_t) rs->frames - first;
+    j1 = (end > 0) ? (size_t) end : 0;
+  }
+
+  double acc = 0.0;
+  for (size_t j=j0; j<j1; j++) {
+    acc += (double) h[j] * (double) x[first + (ptrdiff_t) j];
+  }
+
+  return (float) acc;
+}
+
+// Convert the next (at most) len frames into the interleaved chunk buffer.
+static size_t resampler_convert(jaudio_resampler_t *rs, size_t len)
+{
+  if (len > rs->out_frames - rs->produced) {
+    len = rs->out_frames - rs->produced;
+  }
+
+  for (size_t c=0; c<rs->channels; c++) {
+
+    if (rs->format == DOUBLE_AUDIO) {
+      const double *x = &((const double*) rs->buffer)[c * rs->frames];
+      for (size_t k=0; k<len; k++) {
+        rs->chunk[k*rs->channels + c] = resampler_frame<double>(rs, x, rs->produced + k);
+      }
+    } else {
+      const float *x = &((const float*) rs->buffer)[c * rs->frames];
+      for (size_t k=0; k<len; k++) {
+        rs->chunk[k*rs->channels + c] = resampler_frame<float>(rs, x, rs->produced + k);
+      }
+    }
+  }
+
+  rs->produced += len;
+
+  return len;
+}
+
+// Fill the ring buffer as far as possible. Returns false when all frames are converted.
+static bool resampler_fill(jaudio_resampler_t *rs)
+{
+  size_t frame_bytes = rs->channels * sizeof(float);
+
+  while (rs->produced < rs->out_frames) {
+
+    size_t space = jack_ringbuffer_write_space(rs->ring) / frame_bytes;
+    if (space < RESAMPLE_CHUNK_FRAMES && space < rs->out_frames - rs->produced) {
+      return true; // Full - wait for the JACK callback to consume some data.
+    }
+
+    size_t len = resampler_convert(rs, RESAMPLE_CHUNK_FRAMES);
+    jack_ringbuffer_write(rs->ring, (const char*) rs->chunk, len * frame_bytes);
+  }
+
+  return false;
+}
+
+/***
+ *
+ * The worker thread: keeps the ring buffer filled until all
+ * frames are converted or the resampler is destroyed.
+ *
+ ***/
+
+static void resampler_worker(jaudio_resampler_t *rs)
+{
+  while (!rs->stopping && resampler_fill(rs)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+/***
+ *
+ * resampler_create
+ *
+ * Creates a resampler that converts the frames x channels matrix buffer
+ * (FLOAT_AUDIO or DOUBLE_AUDIO) from the rate fs_in to fs_out. The ring
+ * buffer is filled before the function returns and a worker thread then
+ * keeps it filled. The buffer must outlive the resampler.
+ *
+ ***/
+
+jaudio_resampler_t* resampler_create(const void *buffer, int format, size_t frames, size_t channels,
+                                     double fs_in, double fs_out)
+{
+  size_t r_in = (size_t) llround(fs_in);
+  size_t r_out = (size_t) llround(fs_out);
+
+  if (r_in == 0 || r_out == 0) {
+    std::cerr << "The sample rates must be > 0!" << std::endl;
+    return nullptr;
+  }
+
+  if (format != FLOAT_AUDIO && format != DOUBLE_AUDIO) {
+    std::cerr << "Only matrix play data can be resampled!" << std::endl;
+    return nullptr;
+  }
+
+  size_t g = gcd(r_in, r_out);
+  if (r_out / g > RESAMPLE_MAX_PHASES) {
+    std::cerr << "Unsupported sample rate ratio " << r_out << "/" << r_in << "!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_resampler_t *rs = new jaudio_resampler_t;
+
+  rs->buffer = buffer;
+  rs->format = format;
+  rs->frames = frames;
+  rs->channels = channels;
+  rs->fs_in = fs_in;
+  rs->fs_out = fs_out;
+  rs->L = r_out / g;
+  rs->M = r_in / g;
+  rs->out_frames = resampler_output_frames(frames, fs_in, fs_out);
+  rs->produced = 0;
+  rs->consumed = 0;
+  rs->underruns = 0;
+  rs->stopping = false;
+
+  // The filter is stretched when downsampling so that it spans the same number of zero crossings.
+  double fc = RESAMPLE_PASSBAND * ((rs->L < rs->M) ? (double) rs->L / (double) rs->M : 1.0);
+  rs->half_taps = (size_t) ceil(RESAMPLE_ZERO_CROSSINGS / fc);
+  rs->taps = 2 * rs->half_taps;
+
+  rs->coeffs = (float*) malloc(rs->L * rs->taps * sizeof(float));
+  rs->chunk = (float*) malloc(RESAMPLE_CHUNK_FRAMES * channels * sizeof(float));
+  rs->scratch = (float*) malloc(RESAMPLE_SCRATCH_FRAMES * channels * sizeof(float));
+
+  // Room for half a second (and at least four chunks) of converted data.
+  size_t ring_frames = (size_t) (fs_out / 2.0);
+  if (ring_frames < 4*RESAMPLE_CHUNK_FRAMES) {
+    ring_frames = 4*RESAMPLE_CHUNK_FRAMES;
+  }
+  rs->ring = jack_ringbuffer_create(ring_frames * channels * sizeof(float));
+
+  if (!rs->coeffs || !rs->chunk || !rs->scratch || !rs->ring) {
+    std::cerr << "Resampler memory allocation failed!" << std::endl;
+    resampler_destroy(rs);
+    return nullptr;
+  }
+
+  // Keep the ring buffer in RAM since it is read from the JACK thread.
+  jack_ringbuffer_mlock(rs->ring);
+
+  resampler_make_filters(rs);
+
+  // Fill the ring buffer before the JACK callback starts reading.
+  if (resampler_fill(rs)) {
+    rs->worker = std::thread(resampler_worker, rs);
+  }
+
+  return rs;
+}
+
+size_t resampler_get_frames(const jaudio_resampler_t *rs)
+{
+  return rs->out_frames;
+}
+
+double resampler_get_output_rate(const jaudio_resampler_t *rs)
+{
+  return rs->fs_out;
+}
+
+/***
+ *
+ * resampler_read
+ *
+ * Writes the next nframes resampled frames to the per-channel buffers
+ * out, starting at offset. If the worker has fallen behind the missing
+ * frames are set to zero and counted as an underrun. Called from the
+ * JACK callback.
+ *
+ ***/
+
+size_t resampler_read(jaudio_resampler_t *rs, jack_default_audio_sample_t **out,
+                      size_t offset, size_t nframes)
+{
+  size_t frame_bytes = rs->channels * sizeof(float);
+  size_t m = 0;
+
+  while (m < nframes) {
+
+    size_t len = nframes - m;
+    if (len > RESAMPLE_SCRATCH_FRAMES) {
+      len = RESAMPLE_SCRATCH_FRAMES;
+    }
+
+    size_t available = jack_ringbuffer_read_space(rs->ring) / frame_bytes;
+    if (len > available) {
+      len = available;
+    }
+
+    if (len == 0) {
+      break;
+    }
+
+    jack_ringbuffer_read(rs->ring, (char*) rs->scratch, len * frame_bytes);
+
+    for (size_t c=0; c<rs->channels; c++) {
+      jack_default_audio_sample_t *y = &out[c][offset + m];
+      for (size_t k=0; k<len; k++) {
+        y[k] = rs->scratch[k*rs->channels + c];
+      }
+    }
+
+    m += len;
+  }
+
+  if (m < nframes) {
+
+    for (size_t c=0; c<rs->channels; c++) {
+      memset(&out[c][offset + m], 0x0, (nframes - m) * sizeof(jack_default_audio_sample_t));
+    }
+
+    // Running out of data before the end means that the worker can't keep up.
+    if (rs->consumed + m < rs->out_frames) {
+      rs->underruns++;
+    }
+  }
+
+  rs->consumed += m;
+
+  return m;
+}
+
+size_t resampler_underruns(const jaudio_resampler_t *rs)
+{
+  return rs->underruns;
+}
+
+void resampler_destroy(jaudio_resampler_t *rs)
+{
+  if (!rs) {
+    return;
+  }
+
+  if (rs->worker.joinable()) {
+    rs->stopping = true;
+    rs->worker.join();
+  }
+
+  if (rs->ring) {
+    jack_ringbuffer_free(rs->ring);
+  }
+
+  free(rs->coeffs);
+  free(rs->chunk);
+  free(rs->scratch);
+
+  delete rs;
+}
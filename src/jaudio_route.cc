@@ -0,0 +1,215 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Routing and Gain Matrices
+ *
+ * Output o of a router is the sum of all inputs i weighted by gains(o,i). Routing
+ * matrices are typically sparse (a source fed to a few ports, a few ports summed to a
+ * channel) so only the non-zero gains are stored, as a list of (input, gain) taps per
+ * output. The mix kernel is a scaled copy of the first tap followed by a scaled add
+ * for each of the other taps.
+ *
+ *********************************************************************************************/
+
+typedef struct {
+  size_t input;
+  float gain;
+} route_tap_t;
+
+struct jaudio_router {
+  size_t outputs;
+  size_t inputs;
+  size_t max_frames;                 // Capacity of the mix buffers.
+  size_t *first_tap;                 // outputs+1 offsets into taps.
+  route_tap_t *taps;
+  float *mix;                        // outputs x max_frames mix buffers.
+  jack_default_audio_sample_t **out; // Pointers into mix.
+};
+
+/***
+ *
+ * router_create
+ *
+ * Creates a router from the outputs x inputs (column major) gain matrix. If
+ * max_frames > 0 the router also holds mix buffers for router_mix of up to
+ * max_frames frames (the JACK buffer size).
+ *
+ ***/
+
+jaudio_router_t* router_create(const double *gains, size_t outputs, size_t inputs, size_t max_frames)
+{
+  if (outputs == 0 || inputs == 0) {
+    std::cerr << "The routing matrix must have at least one input and one output!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_router_t *rt = new jaudio_router_t;
+
+  rt->outputs = outputs;
+  rt->inputs = inputs;
+  rt->max_frames = max_frames;
+  rt->first_tap = (size_t*) calloc(outputs + 1, sizeof(size_t));
+  rt->taps = (route_tap_t*) calloc(outputs * inputs, sizeof(route_tap_t));
+  rt->mix = nullptr;
+  rt->out = nullptr;
+
+  if (max_frames > 0) {
+    rt->mix = (float*) calloc(outputs * max_frames, sizeof(float));
+    rt->out = (jack_default_audio_sample_t**) calloc(outputs, sizeof(jack_default_audio_sample_t*));
+  }
+
+  if (!rt->first_tap || !rt->taps || (max_frames > 0 && (!rt->mix || !rt->out))) {
+    std::cerr << "Router memory allocation failed!" << std::endl;
+    router_destroy(rt);
+    return nullptr;
+  }
+
+  size_t num_taps = 0;
+  for (size_t o=0; o<outputs; o++) {
+
+    rt->first_tap[o] = num_taps;
+
+    for (size_t i=0; i<inputs; i++) {
+      double g = gains[o + i*outputs];
+      if (g != 0.0) {
+        rt->taps[num_taps].input = i;
+        rt->taps[num_taps].gain = (float) g;
+        num_taps++;
+      }
+    }
+  }
+  rt->first_tap[outputs] = num_taps;
+
+  for (size_t o=0; o<rt->outputs && rt->out; o++) {
+    rt->out[o] = &rt->mix[o * max_frames];
+  }
+
+  return rt;
+}
+
+size_t router_outputs(const jaudio_router_t *rt)
+{
+  return rt->outputs;
+}
+
+size_t router_inputs(const jaudio_router_t *rt)
+{
+  return rt->inputs;
+}
+
+void router_destroy(jaudio_router_t *rt)
+{
+  if (rt) {
+    free(rt->first_tap);
+    free(rt->taps);
+    free(rt->mix);
+    free(rt->out);
+    delete rt;
+  }
+}
+
+// out = sum_i gains(o,i) * in_i, where in_i = &src[i*stride]. Outputs without taps are silent.
+template <typename T>
+static void router_mix_output(const jaudio_router_t *rt, size_t o, const T *src, size_t stride,
+                              const T * const *in, jack_default_audio_sample_t *out, size_t nframes)
+{
+  size_t t0 = rt->first_tap[o];
+  size_t t1 = rt->first_tap[o+1];
+
+  if (t0 == t1) {
+    memset(out, 0x0, nframes * sizeof(jack_default_audio_sample_t));
+    return;
+  }
+
+  for (size_t t=t0; t<t1; t++) {
+
+    const T *x = in ? in[rt->taps[t].input] : &src[rt->taps[t].input * stride];
+    float g = rt->taps[t].gain;
+
+    if (t == t0) {
+      for (size_t k=0; k<nframes; k++) {
+        out[k] = g * (float) x[k];
+      }
+    } else {
+      for (size_t k=0; k<nframes; k++) {
+        out[k] += g * (float) x[k];
+      }
+    }
+  }
+}
+
+/***
+ *
+ * router_mix
+ *
+ * Mixes nframes frames of the input (port) buffers into the router's mix
+ * buffers, which are returned. Returns nullptr if nframes is larger than
+ * the capacity of the mix buffers. Called from the JACK callback.
+ *
+ ***/
+
+jack_default_audio_sample_t** router_mix(jaudio_router_t *rt, jack_default_audio_sample_t **in, size_t nframes)
+{
+  if (nframes > rt->max_frames) {
+    return nullptr;
+  }
+
+  for (size_t o=0; o<rt->outputs; o++) {
+    router_mix_output<float>(rt, o, nullptr, 0, in, rt->out[o], nframes);
+  }
+
+  return rt->out;
+}
+
+/***
+ *
+ * router_mix_play
+ *
+ * Mixes nframes frames, starting at frame pos, of the frames x inputs play
+ * matrix buffer into the JACK output buffers out[o][offset...]. Called from
+ * the JACK callback.
+ *
+ ***/
+
+void router_mix_play(const jaudio_router_t *rt, const float *buffer, size_t frames, size_t pos,
+                     jack_default_audio_sample_t **out, size_t offset, size_t nframes)
+{
+  for (size_t o=0; o<rt->outputs; o++) {
+    router_mix_output<float>(rt, o, &buffer[pos], frames, nullptr, &out[o][offset], nframes);
+  }
+}
+
+void router_mix_play(const jaudio_router_t *rt, const double *buffer, size_t frames, size_t pos,
+                     jack_default_audio_sample_t **out, size_t offset, size_t nframes)
+{
+  for (size_t o=0; o<rt->outputs; o++) {
+    router_mix_output<double>(rt, o, &buffer[pos], frames, nullptr, &out[o][offset], nframes);
+  }
+}
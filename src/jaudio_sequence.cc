@@ -0,0 +1,682 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include "jaudio.h"
+
+//
+// Globals.
+//
+
+static volatile bool sequence_running;
+
+static jaudio_seq_job_t *seq_jobs;
+static size_t n_seq_jobs;
+
+static size_t total_sequence_frames; // The length of the whole job timeline.
+static size_t seq_frames_played;
+static size_t seq_frames_recorded;
+static size_t seq_play_job;          // The first job that is not yet fully played.
+static size_t seq_record_job;        // The first job that is not yet fully recorded.
+
+static bool seq_is_first_jack_period;
+static size_t seq_skip_frames_left;  // Frames left to skip before recording.
+
+static jack_client_t *sequence_client;
+
+static jack_port_t **seq_input_ports;
+static size_t seq_n_input_ports;
+static jack_default_audio_sample_t **seq_in;   // Per period input port buffers.
+
+static jack_port_t **seq_output_ports;
+static size_t seq_n_output_ports;
+static jack_default_audio_sample_t **seq_out;  // Per period output port buffers.
+
+static bool sequence_use_freewheel;
+
+// The time the client was activated (until the first recorded frame, after the skipped periods).
+static double seq_t_started = 0.0;
+
+// Xruns (the lost frames are skipped on the timeline and recorded as zeros).
+static jaudio_xrun_log_t *seq_xruns = nullptr;
+
+// Buffer-size and sample-rate change points.
+static jaudio_change_log_t *seq_changes = nullptr;
+
+/***
+ *
+ * Functions for CTRL-C support.
+ *
+ */
+
+bool sequence_is_running(void)
+{
+  return sequence_running;
+}
+
+void sequence_set_running_flag(void)
+{
+  sequence_running = true;
+
+  return;
+}
+
+void sequence_clear_running_flag(void)
+{
+  sequence_running = false;
+
+  return;
+}
+
+void sequence_jerror(const char *desc)
+{
+  std::cerr << "JACK error: '" << desc << "'" << std::endl;
+  sequence_clear_running_flag(); // Stop if we get a JACK error.
+
+  return;
+}
+
+// This is called whenever the sample rate changes.
+static int sequence_srate(jack_nframes_t nframes, void *arg)
+{
+  if (seq_changes) {
+    change_log_set_sample_rate(seq_changes, nframes);
+  }
+
+  return 0;
+}
+
+// This is called whenever the period size changes (the change is logged by the process callback).
+static int sequence_bufsize(jack_nframes_t nframes, void *arg)
+{
+  if (seq_changes && change_log_set_buffer_size(seq_changes, nframes) < 0) {
+    sequence_clear_running_flag();
+  }
+
+  return 0;
+}
+
+// This is called whenever JACK (or a client) misses a deadline.
+static int sequence_xrun(void *arg)
+{
+  if (seq_xruns) {
+    xrun_log_notify(seq_xruns);
+  }
+
+  return 0;
+}
+
+void sequence_jack_shutdown(void *arg)
+{
+  sequence_clear_running_flag(); // Stop if JACK shuts down..
+
+  return;
+}
+
+/********************************************************************************************
+ *
+ * Sequenced (back-to-back) Play and Record Jobs
+ *
+ *********************************************************************************************/
+
+/***
+ *
+ * sequence_finished
+ *
+ * To check if all jobs in the sequence have been played and recorded.
+ *
+ ***/
+
+bool sequence_finished(void)
+{
+  return (seq_frames_recorded >= total_sequence_frames);
+}
+
+/***
+ *
+ * sequence_current_job
+ *
+ * Returns the index of the job that currently is being recorded.
+ *
+ ***/
+
+size_t sequence_current_job(void)
+{
+  return seq_record_job;
+}
+
+/***
+ *
+ * sequence_get_period_changes
+ *
+ * Copies the buffer-size and sample-rate changes during the sequence
+ * (changes must have room for JAUDIO_MAX_PERIOD_CHANGES entries) and
+ * returns their number. Must be called before sequence_close.
+ *
+ ***/
+
+size_t sequence_get_period_changes(jaudio_period_change_t *changes)
+{
+  return seq_changes ? change_log_get(seq_changes, changes) : 0;
+}
+
+// The number of frames a job is active, that is, excluding the trailing gap.
+static inline size_t seq_job_active_frames(const jaudio_seq_job_t *job)
+{
+  return job->frames * job->repetitions;
+}
+
+// Write the stimulus of a job to the output ports for the timeline span [t0,t1).
+template <typename T>
+static void seq_play_span(const jaudio_seq_job_t *job, size_t t0, size_t t1, size_t period_start)
+{
+  const T *buffer = (const T*) job->play_buffer;
+
+  size_t t = t0;
+  while (t < t1) {
+
+    // Position in the stimulus (the stimulus is repeated job->repetitions times).
+    size_t m0 = (t - job->start_frame) % job->frames;
+    size_t len = job->frames - m0;
+    if (len > t1 - t) {
+      len = t1 - t;
+    }
+
+    for (size_t c=0; c<job->play_channels; c++) {
+
+      jack_default_audio_sample_t *out = seq_out[job->play_ports[c]] + (t - period_start);
+      const T *src = &buffer[m0 + c*job->frames];
+
+      for (size_t m=0; m<len; m++) {
+        out[m] += (jack_default_audio_sample_t) src[m];
+      }
+    }
+
+    t += len;
+  }
+}
+
+// Read the input ports to the record buffer of a job for the timeline span [t0,t1)
+// (period_start is recorded from frame in_offset of the port buffers).
+static void seq_record_span(jaudio_seq_job_t *job, size_t t0, size_t t1, size_t period_start,
+                            size_t in_offset)
+{
+  size_t record_frames = seq_job_active_frames(job);
+
+  for (size_t c=0; c<job->record_channels; c++) {
+
+    const jack_default_audio_sample_t *in = seq_in[job->record_ports[c]] + in_offset + (t0 - period_start);
+    float *dest = &job->record_buffer[(t0 - job->start_frame) + c*record_frames];
+
+    std::memcpy(dest, in, (t1 - t0) * sizeof(float));
+  }
+}
+
+// Record zeros to the jobs for the timeline span [t0,t1) (frames lost in an xrun).
+static void seq_record_gap(size_t t0, size_t t1)
+{
+  for (size_t k=seq_record_job; k<n_seq_jobs; k++) {
+
+    jaudio_seq_job_t *job = &seq_jobs[k];
+
+    if (job->start_frame >= t1) {
+      break;
+    }
+
+    size_t record_frames = seq_job_active_frames(job);
+    size_t s0 = std::max(t0, job->start_frame);
+    size_t s1 = std::min(t1, job->start_frame + record_frames);
+
+    for (size_t c=0; c<job->record_channels && s0<s1; c++) {
+      std::memset(&job->record_buffer[(s0 - job->start_frame) + c*record_frames], 0x0,
+                  (s1 - s0) * sizeof(float));
+    }
+
+    if (job->start_frame + record_frames + job->gap_frames <= t1) {
+      seq_record_job = k+1;
+    }
+  }
+}
+
+/***
+ *
+ * sequence_process
+ *
+ * The JACK callback function. The play and record positions are frame
+ * indices on the job timeline where each job occupies its active frames
+ * (frames x repetitions) followed by its gap. A period can hence span
+ * the end of one job and the beginning of the next one.
+ *
+ ***/
+
+int sequence_process(jack_nframes_t nframes, void *arg)
+{
+  // The frames JACK never delivered since the previous period (checked every period).
+  size_t lost_frames = xrun_log_lost_frames(seq_xruns, jack_last_frame_time(sequence_client),
+                                            nframes, sequence_use_freewheel);
+
+  // First JACK period is just silence so skip it.
+  if (seq_is_first_jack_period) {
+    seq_is_first_jack_period = false;
+    return 0;
+  }
+
+  // Grab all port buffers for this period.
+  for (size_t n=0; n<seq_n_output_ports; n++) {
+    seq_out[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(seq_output_ports[n], nframes);
+
+    if (seq_out[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+
+    // Silence unless a job plays on the port.
+    std::memset(seq_out[n], 0x0, sizeof (jack_default_audio_sample_t) * nframes);
+  }
+
+  for (size_t n=0; n<seq_n_input_ports; n++) {
+    seq_in[n] = (jack_default_audio_sample_t *)
+      jack_port_get_buffer(seq_input_ports[n], nframes);
+
+    if (seq_in[n] == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+  }
+
+  if (!sequence_running) {
+    return 0;
+  }
+
+  // Keep the timeline time-true: skip the lost frames of the jobs that were playing and
+  // record zeros in their place (once the skipped periods are over).
+  if (lost_frames > 0 && seq_frames_recorded < total_sequence_frames) {
+
+    seq_frames_played = std::min(seq_frames_played + lost_frames, total_sequence_frames);
+
+    // The frames lost in the skipped periods are not missing in the recording.
+    size_t skip = std::min(seq_skip_frames_left, lost_frames);
+    seq_skip_frames_left -= skip;
+
+    if (lost_frames > skip) {
+      xrun_log_add(seq_xruns, seq_frames_recorded, lost_frames - skip);
+
+      size_t t1 = std::min(seq_frames_recorded + lost_frames - skip, total_sequence_frames);
+      seq_record_gap(seq_frames_recorded, t1);
+      seq_frames_recorded = t1;
+    }
+  }
+
+  //
+  // Play
+  //
+
+  if (seq_frames_played < total_sequence_frames) {
+
+    size_t period_start = seq_frames_played;
+    size_t period_end = period_start + nframes;
+    if (period_end > total_sequence_frames) {
+      period_end = total_sequence_frames;
+    }
+
+    for (size_t k=seq_play_job; k<n_seq_jobs; k++) {
+
+      const jaudio_seq_job_t *job = &seq_jobs[k];
+
+      if (job->start_frame >= period_end) {
+        break; // This (and all following) jobs start in a later period.
+      }
+
+      size_t t0 = std::max(period_start, job->start_frame);
+      size_t t1 = std::min(period_end, job->start_frame + seq_job_active_frames(job));
+
+      if (t0 < t1) {
+        if (job->play_format == DOUBLE_AUDIO) {
+          seq_play_span<double>(job, t0, t1, period_start);
+        } else {
+          seq_play_span<float>(job, t0, t1, period_start);
+        }
+      }
+
+      // Done with this job including its gap?
+      if (job->start_frame + seq_job_active_frames(job) + job->gap_frames <= period_end) {
+        seq_play_job = k+1;
+      }
+    }
+
+    seq_frames_played = period_end;
+  }
+
+  //
+  // Record
+  //
+
+  // The skipped periods are counted in frames (at the period size the sequence started
+  // with) so that the play/record alignment holds if the period size changes.
+  size_t skip = std::min(seq_skip_frames_left, (size_t) nframes);
+  seq_skip_frames_left -= skip;
+
+  if (skip == (size_t) nframes) {
+    return 0;
+  }
+
+  if (seq_t_started > 0.0) {
+    profile_add(JAUDIO_PHASE_FIRST_PERIOD, seq_t_started);
+    seq_t_started = 0.0;
+  }
+
+  if (seq_frames_recorded < total_sequence_frames) {
+
+    change_log_update(seq_changes, seq_frames_recorded, nframes);
+
+    size_t period_start = seq_frames_recorded;
+    size_t period_end = period_start + (nframes - skip);
+    if (period_end > total_sequence_frames) {
+      period_end = total_sequence_frames;
+    }
+
+    for (size_t k=seq_record_job; k<n_seq_jobs; k++) {
+
+      jaudio_seq_job_t *job = &seq_jobs[k];
+
+      if (job->start_frame >= period_end) {
+        break;
+      }
+
+      size_t t0 = std::max(period_start, job->start_frame);
+      size_t t1 = std::min(period_end, job->start_frame + seq_job_active_frames(job));
+
+      if (t0 < t1) {
+        seq_record_span(job, t0, t1, period_start, skip);
+      }
+
+      if (job->start_frame + seq_job_active_frames(job) + job->gap_frames <= period_end) {
+        seq_record_job = k+1;
+      }
+    }
+
+    seq_frames_recorded = period_end;
+  }
+
+  return 0;
+}
+
+/***
+ *
+ * sequence_init
+ *
+ * Init the sequence client, connect the ports, and start playing and recording
+ * the list of jobs back-to-back. The play/record port indices of the jobs refer
+ * to the play_port_names and record_port_names lists.
+ *
+ ***/
+
+int sequence_init(jaudio_seq_job_t *jobs, size_t num_jobs,
+                  size_t play_channels, char **play_port_names,
+                  size_t record_channels, char **record_port_names,
+                  const char *client_name,
+                  size_t num_skip_buffers,
+                  bool freewheel)
+{
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
+  char port_name[255];
+
+  seq_jobs = jobs;
+  n_seq_jobs = num_jobs;
+
+  seq_n_output_ports = play_channels;
+  seq_n_input_ports = record_channels;
+
+  //
+  // Lay out the jobs on the timeline.
+  //
+
+  total_sequence_frames = 0;
+  for (size_t k=0; k<num_jobs; k++) {
+
+    for (size_t c=0; c<jobs[k].play_channels; c++) {
+      if (jobs[k].play_ports[c] >= play_channels) {
+        std::cerr << "Job " << k+1 << ": play port index out-of-bounds!" << std::endl;
+        return -1;
+      }
+    }
+
+    for (size_t c=0; c<jobs[k].record_channels; c++) {
+      if (jobs[k].record_ports[c] >= record_channels) {
+        std::cerr << "Job " << k+1 << ": record port index out-of-bounds!" << std::endl;
+        return -1;
+      }
+    }
+
+    jobs[k].start_frame = total_sequence_frames;
+    total_sequence_frames += seq_job_active_frames(&jobs[k]) + jobs[k].gap_frames;
+  }
+
+  // Reset play/record counters.
+  seq_frames_played = 0;
+  seq_frames_recorded = 0;
+  seq_play_job = 0;
+  seq_record_job = 0;
+
+  sequence_use_freewheel = freewheel;
+
+  // Mark that we have not called our process callback before
+  // so than we can disregard the frames in the first JACK period
+  // which always seems to be silence (zero valued samples).
+  seq_is_first_jack_period = true;
+
+  // Tell the JACK server to call jerror() whenever it
+  // experiences an error.  Notice that this callback is
+  // global to this process, not specific to each client.
+  //
+  // This is set here so that it can catch errors in the
+  // connection process.
+  jack_set_error_function(sequence_jerror);
+
+  // Try to become a client of the JACK server.
+  double t_open = profile_now();
+  jack_status_t status;
+  if ((sequence_client = jack_client_open(client_name,
+                                          JackNullOption,&status)) == 0) {
+    print_jack_status(status);
+    std::cerr << "Failed to open JACK client: '" << client_name << "'" << std::endl;
+    return -1;
+  }
+
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
+  // Skip num_skip_buffers periods (at the current period size) before recording.
+  seq_skip_frames_left = num_skip_buffers * (size_t) jack_get_buffer_size(sequence_client);
+
+  // The jobs are played and recorded straight from/to the port buffers, so
+  // any period size fits (nothing is preallocated per period).
+  seq_changes = change_log_create(sequence_client, SIZE_MAX);
+  seq_xruns = xrun_log_create();
+
+  // Tell the JACK server to call the `sequence_process()' whenever
+  // there is work to be done.
+  jack_set_process_callback(sequence_client, sequence_process, 0);
+
+  // Tell the JACK server to call `sequence_srate()' whenever
+  // the sample rate of the system changes.
+  jack_set_sample_rate_callback(sequence_client, sequence_srate, 0);
+
+  // Tell the JACK server to call `sequence_bufsize()' whenever
+  // the period size changes.
+  jack_set_buffer_size_callback(sequence_client, sequence_bufsize, 0);
+
+  // Tell the JACK server to call `sequence_xrun()' whenever
+  // a deadline is missed.
+  jack_set_xrun_callback(sequence_client, sequence_xrun, 0);
+
+  // Tell the JACK server to call `jack_shutdown()' if
+  // it ever shuts down, either entirely, or if it
+  // just decides to stop calling us.
+  jack_on_shutdown(sequence_client, sequence_jack_shutdown, 0);
+
+  //
+  // Register ports
+  //
+
+  double t_register = profile_now();
+
+  seq_input_ports = (jack_port_t**) malloc(seq_n_input_ports * sizeof(jack_port_t*));
+  seq_in = (jack_default_audio_sample_t**) malloc(seq_n_input_ports * sizeof(jack_default_audio_sample_t*));
+
+  for (size_t n=0; n<seq_n_input_ports; n++) {
+    sprintf(port_name,"input_%d",(int) n+1); // Port numbers start at 1.
+    seq_input_ports[n] = jack_port_register(sequence_client, port_name,
+                                            JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  }
+
+  seq_output_ports = (jack_port_t**) malloc(seq_n_output_ports * sizeof(jack_port_t*));
+  seq_out = (jack_default_audio_sample_t**) malloc(seq_n_output_ports * sizeof(jack_default_audio_sample_t*));
+
+  for (size_t n=0; n<seq_n_output_ports; n++) {
+    sprintf(port_name,"output_%d", (int) n+1); // Port numbers start at 1.
+    seq_output_ports[n] = jack_port_register(sequence_client, port_name,
+                                             JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  }
+
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
+
+  //
+  // Tell the JACK server that we are ready to roll.
+  //
+
+  double t_activate = profile_now();
+  seq_t_started = t_activate; // The first period is timed from here.
+  if (jack_activate(sequence_client)) {
+    std::cerr << "Cannot activate jack client!" << std::endl;
+    sequence_close();
+    return -1;
+  }
+
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
+  //
+  // Connect the ports
+  //
+
+  if (ports_connect(sequence_client, seq_input_ports, record_port_names, seq_n_input_ports, true) < 0 ||
+      ports_connect(sequence_client, seq_output_ports, play_port_names, seq_n_output_ports, false) < 0) {
+    sequence_close(); // Stop the callback before the caller frees the jobs.
+    return -1;
+  }
+
+  // Run the server as fast as possible for the duration of the sequence.
+  if (freewheel) {
+    if (jack_set_freewheel(sequence_client, 1)) {
+      std::cerr << "Failed to enter freewheel mode!" << std::endl;
+      sequence_use_freewheel = false;
+    }
+  }
+
+  return 0;
+}
+
+/***
+ *
+ * sequence_close
+ *
+ * Close the JACK client and free port memory. The ports are
+ * disconnected when the client closes.
+ *
+ ***/
+
+int sequence_close(void)
+{
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
+  int err;
+
+  // Nothing to release if the client is already closed (sequence_close may be called twice).
+  if (sequence_client) {
+
+    if (sequence_use_freewheel) {
+      jack_set_freewheel(sequence_client, 0);
+    }
+
+    // Stop the process callback before the ports (and the caller's job data) go away.
+    jack_deactivate(sequence_client);
+
+    // Unregister all ports.
+    for (size_t n=0; seq_input_ports && n<seq_n_input_ports; n++) {
+      if (seq_input_ports[n] && jack_port_unregister(sequence_client, seq_input_ports[n])) {
+        std::cerr << "Failed to unregister an input port!" << std::endl;
+      }
+    }
+
+    for (size_t n=0; seq_output_ports && n<seq_n_output_ports; n++) {
+      if (seq_output_ports[n] && jack_port_unregister(sequence_client, seq_output_ports[n])) {
+        std::cerr << "Failed to unregister an output port!" << std::endl;
+      }
+    }
+
+    // Close the client.
+    err = jack_client_close(sequence_client);
+    if (err) {
+      std::cerr << "jack_client_close failed!" << std::endl;
+    }
+
+    sequence_client = nullptr;
+  }
+  sequence_use_freewheel = false;
+
+  //
+  // Free buffers.
+  //
+
+  free(seq_input_ports);
+  free(seq_in);
+  free(seq_output_ports);
+  free(seq_out);
+
+  seq_input_ports = nullptr;
+  seq_in = nullptr;
+  seq_output_ports = nullptr;
+  seq_out = nullptr;
+
+  seq_t_started = 0.0;
+
+  if (seq_xruns) {
+    xrun_log_report(seq_xruns);
+    xrun_log_destroy(seq_xruns);
+    seq_xruns = nullptr;
+  }
+
+  if (seq_changes) {
+    change_log_destroy(seq_changes);
+    seq_changes = nullptr;
+  }
+
+  return 0;
+}
@@ -0,0 +1,501 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+#include <complex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <jack/ringbuffer.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Streaming STFT
+ *
+ * The JACK callback interleaves the captured periods into a lock-free ring buffer
+ * and a worker thread computes the short-time power spectra, optionally summed
+ * into frequency bands, as soon as a full hop is available. Only the spectral
+ * frames are stored so the analysis overlaps the capture. Frames that don't fit
+ * in the ring buffer (the worker can't keep up) are dropped and replaced by zeros
+ * as soon as there is room again, as the xrun gaps, so the spectral frames stay
+ * time-true.
+ *
+ *********************************************************************************************/
+
+#define STFT_SCRATCH_FRAMES 256 // Interleaving chunk size in the JACK callback.
+
+struct jaudio_stft {
+  jaudio_stft_config_t cfg;
+  size_t channels;
+  double fs;
+
+  size_t num_features;
+  size_t num_frames;          // Number of spectral frames that will be produced.
+  float *features;            // num_features x num_frames x channels output.
+
+  float *window;              // Window coefficients.
+  double scale;               // Power spectrum normalization (1 / sum of the squared window).
+  size_t *band_first;         // First bin in each band.
+  size_t *band_last;          // Last bin (+1) in each band.
+
+  jaudio_fft_plan_t *plan;
+
+  jack_ringbuffer_t *ring;    // Interleaved samples (JACK thread -> worker).
+  float *scratch;             // Interleaving buffer used by the JACK callback.
+  std::atomic<size_t> overruns;
+  std::atomic<size_t> gap_frames;     // Dropped frames not yet replaced by zeros.
+  std::atomic<size_t> frames_dropped; // Total dropped frames.
+
+  std::thread worker;
+  std::atomic<bool> finishing;
+  std::atomic<size_t> frames_done;
+};
+
+/***
+ *
+ * stft_num_features, stft_num_frames
+ *
+ * The size of the output for a given configuration and capture length.
+ *
+ ***/
+
+size_t stft_num_features(const jaudio_stft_config_t *cfg)
+{
+  return (cfg->num_bands > 0) ? cfg->num_bands : cfg->window_frames/2 + 1;
+}
+
+size_t stft_num_frames(const jaudio_stft_config_t *cfg, size_t frames)
+{
+  if (frames < cfg->window_frames || cfg->hop_frames == 0) {
+    return 0;
+  }
+
+  return 1 + (frames - cfg->window_frames) / cfg->hop_frames;
+}
+
+static void stft_make_window(jaudio_stft_t *stft)
+{
+  size_t N = stft->cfg.window_frames;
+
+  for (size_t n=0; n<N; n++) {
+
+    double x = 2.0 * M_PI * (double) n / (double) N; // Periodic windows.
+
+    switch (stft->cfg.window_type) {
+
+    case JAUDIO_WIN_RECT:
+      stft->window[n] = 1.0f;
+      break;
+
+    case JAUDIO_WIN_HAMMING:
+      stft->window[n] = (float) (0.54 - 0.46 * cos(x));
+      break;
+
+    case JAUDIO_WIN_CUSTOM:
+      stft->window[n] = stft->cfg.window_coeffs[n];
+      break;
+
+    default: // JAUDIO_WIN_HANN
+      stft->window[n] = (float) (0.5 - 0.5 * cos(x));
+    }
+  }
+
+  // Scale so that the power spectrum is independent of the window.
+  double wsum = 0.0;
+  for (size_t n=0; n<N; n++) {
+    wsum += (double) stft->window[n] * (double) stft->window[n];
+  }
+  stft->scale = (wsum > 0.0) ? 1.0 / wsum : 1.0;
+}
+
+// Process one full window for all channels.
+static void stft_frame(jaudio_stft_t *stft, float **hist, std::complex<double> *X,
+                       double *power, size_t frame)
+{
+  size_t N = stft->cfg.window_frames;
+  size_t num_bins = N/2 + 1;
+  double scale = stft->scale;
+
+  for (size_t c=0; c<stft->channels; c++) {
+
+    for (size_t n=0; n<N; n++) {
+      X[n] = (double) (hist[c][n] * stft->window[n]);
+    }
+
+    fft_execute(stft->plan, X, false);
+
+    for (size_t k=0; k<num_bins; k++) {
+      power[k] = std::norm(X[k]) * scale;
+    }
+
+    float *dest = &stft->features[stft->num_features * (frame + stft->num_frames*c)];
+
+    for (size_t f=0; f<stft->num_features; f++) {
+
+      double p = 0.0;
+      if (stft->cfg.num_bands > 0) {
+        for (size_t k=stft->band_first[f]; k<stft->band_last[f]; k++) {
+          p += power[k];
+        }
+      } else {
+        p = power[f];
+      }
+
+      if (stft->cfg.db) {
+        p = 10.0 * log10(p + 1e-20);
+      }
+
+      dest[f] = (float) p;
+    }
+  }
+}
+
+/***
+ *
+ * The worker thread: de-interleaves the ring buffer data into a per-channel
+ * history of one window and computes a spectral frame every hop.
+ *
+ ***/
+
+static void stft_worker(jaudio_stft_t *stft)
+{
+  size_t N = stft->cfg.window_frames;
+  size_t hop = stft->cfg.hop_frames;
+  size_t frame_bytes = stft->channels * sizeof(float);
+
+  float **hist = (float**) calloc(stft->channels, sizeof(float*));
+  float *chunk = (float*) malloc(N * frame_bytes);
+  std::complex<double> *X = (std::complex<double>*) malloc(N * sizeof(std::complex<double>));
+  double *power = (double*) malloc((N/2 + 1) * sizeof(double));
+
+  bool ok = (hist && chunk && X && power);
+  for (size_t c=0; ok && c<stft->channels; c++) {
+    hist[c] = (float*) calloc(N, sizeof(float));
+    ok = (hist[c] != nullptr);
+  }
+
+  if (!ok) {
+    std::cerr << "STFT worker memory allocation failed!" << std::endl;
+    stft->frames_done = stft->num_frames; // Don't let the caller wait for us.
+  }
+
+  size_t fill = 0;   // Number of valid frames in the history.
+  size_t frame = 0;
+
+  while (ok && frame < stft->num_frames) {
+
+    // The number of frames needed to complete the next window.
+    size_t needed = N - fill;
+    size_t available = jack_ringbuffer_read_space(stft->ring) / frame_bytes;
+
+    size_t len;
+
+    if (available > 0) {
+
+      len = (available < needed) ? available : needed;
+      jack_ringbuffer_read(stft->ring, (char*) chunk, len * frame_bytes);
+
+      for (size_t c=0; c<stft->channels; c++) {
+        float *h = &hist[c][fill];
+        for (size_t m=0; m<len; m++) {
+          h[m] = chunk[m*stft->channels + c];
+        }
+      }
+
+    } else if (stft->finishing && stft->gap_frames > 0) {
+
+      // Frames dropped at the end of the capture were never replaced (no more writes).
+      len = (stft->gap_frames < needed) ? stft->gap_frames.load() : needed;
+      for (size_t c=0; c<stft->channels; c++) {
+        memset(&hist[c][fill], 0x0, len * sizeof(float));
+      }
+      stft->gap_frames -= len;
+
+    } else if (stft->finishing) {
+      break; // No more data will arrive.
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    fill += len;
+
+    if (fill == N) {
+
+      stft_frame(stft, hist, X, power, frame);
+      frame++;
+      stft->frames_done = frame;
+
+      // Slide the window one hop.
+      if (hop < N) {
+        for (size_t c=0; c<stft->channels; c++) {
+          memmove(hist[c], &hist[c][hop], (N - hop) * sizeof(float));
+        }
+        fill = N - hop;
+      } else {
+        fill = 0;
+        // Skip the frames between the windows when hop > window.
+        size_t skip = hop - N;
+        while (skip > 0 && !(stft->finishing && jack_ringbuffer_read_space(stft->ring) == 0)) {
+          size_t a = jack_ringbuffer_read_space(stft->ring) / frame_bytes;
+          size_t s = (a < skip) ? a : skip;
+          jack_ringbuffer_read_advance(stft->ring, s * frame_bytes);
+          skip -= s;
+          if (s == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        }
+
+        // The final dropped frames count as skipped too.
+        if (stft->finishing && skip > 0) {
+          size_t s = (stft->gap_frames < skip) ? stft->gap_frames.load() : skip;
+          stft->gap_frames -= s;
+        }
+      }
+    }
+  }
+
+  stft->frames_done = stft->num_frames;
+
+  if (hist) {
+    for (size_t c=0; c<stft->channels; c++) {
+      free(hist[c]);
+    }
+    free(hist);
+  }
+  free(chunk);
+  free(X);
+  free(power);
+}
+
+/***
+ *
+ * stft_create
+ *
+ * Creates an STFT analyzer, for frames long captures with the given
+ * number of channels, and starts the worker thread. The spectral frames
+ * are written to the features buffer which must hold stft_num_features()
+ * x stft_num_frames() x channels values.
+ *
+ ***/
+
+jaudio_stft_t* stft_create(const jaudio_stft_config_t *cfg, size_t channels, double fs,
+                           size_t frames, float *features)
+{
+  if (cfg->window_frames < 2 || (cfg->window_frames & (cfg->window_frames-1)) != 0) {
+    std::cerr << "The STFT window length must be a power of two!" << std::endl;
+    return nullptr;
+  }
+
+  if (cfg->hop_frames == 0) {
+    std::cerr << "The STFT hop size must be > 0!" << std::endl;
+    return nullptr;
+  }
+
+  if (cfg->window_type == JAUDIO_WIN_CUSTOM && !cfg->window_coeffs) {
+    std::cerr << "No STFT window coefficients given!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_stft_t *stft = new jaudio_stft_t;
+
+  stft->cfg = *cfg;
+  stft->channels = channels;
+  stft->fs = fs;
+  stft->num_features = stft_num_features(cfg);
+  stft->num_frames = stft_num_frames(cfg, frames);
+  stft->features = features;
+  stft->overruns = 0;
+  stft->gap_frames = 0;
+  stft->frames_dropped = 0;
+  stft->finishing = false;
+  stft->frames_done = 0;
+
+  size_t N = cfg->window_frames;
+
+  stft->window = (float*) malloc(N * sizeof(float));
+  stft->band_first = (size_t*) calloc(stft->num_features, sizeof(size_t));
+  stft->band_last = (size_t*) calloc(stft->num_features, sizeof(size_t));
+  stft->scratch = (float*) malloc(STFT_SCRATCH_FRAMES * channels * sizeof(float));
+  stft->plan = fft_create_plan(N);
+
+  // Room for half a second (and at least four windows) of data.
+  size_t ring_frames = (size_t) (fs / 2.0);
+  if (ring_frames < 4*N) {
+    ring_frames = 4*N;
+  }
+  stft->ring = jack_ringbuffer_create(ring_frames * channels * sizeof(float));
+
+  if (!stft->window || !stft->band_first || !stft->band_last || !stft->scratch ||
+      !stft->plan || !stft->ring) {
+    std::cerr << "STFT memory allocation failed!" << std::endl;
+    stft_destroy(stft);
+    return nullptr;
+  }
+
+  // Keep the ring buffer in RAM since it is written from the JACK thread.
+  jack_ringbuffer_mlock(stft->ring);
+
+  stft_make_window(stft);
+
+  // Map the band edges to FFT bins (a bin belongs to the band its center frequency is in).
+  if (cfg->num_bands > 0) {
+    double df = fs / (double) N;
+    for (size_t b=0; b<cfg->num_bands; b++) {
+
+      double lo = ceil(cfg->band_edges_hz[b] / df);
+      double hi = ceil(cfg->band_edges_hz[b+1] / df);
+
+      lo = (lo < 0.0) ? 0.0 : lo;
+      hi = (hi > (double) (N/2 + 1)) ? (double) (N/2 + 1) : hi;
+
+      stft->band_first[b] = (size_t) lo;
+      stft->band_last[b] = (hi > lo) ? (size_t) hi : (size_t) lo;
+    }
+  }
+
+  stft->worker = std::thread(stft_worker, stft);
+
+  return stft;
+}
+
+/***
+ *
+ * stft_write
+ *
+ * Queues nframes frames from the per-channel buffers in for analysis.
+ * Called from the JACK callback.
+ *
+ ***/
+
+void stft_write(jaudio_stft_t *stft, jack_default_audio_sample_t **in, size_t nframes)
+{
+  size_t frame_bytes = stft->channels * sizeof(float);
+  size_t m = 0;
+
+  // The worker owns the remaining gap after stft_finish.
+  if (stft->finishing) {
+    return;
+  }
+
+  // First replace the frames dropped in earlier periods with zeros.
+  while (stft->gap_frames > 0) {
+
+    size_t len = (stft->gap_frames < STFT_SCRATCH_FRAMES) ? stft->gap_frames.load() : STFT_SCRATCH_FRAMES;
+
+    if (jack_ringbuffer_write_space(stft->ring) < len * frame_bytes) {
+      break;
+    }
+
+    memset(stft->scratch, 0x0, len * frame_bytes);
+    jack_ringbuffer_write(stft->ring, (const char*) stft->scratch, len * frame_bytes);
+    stft->gap_frames -= len;
+  }
+
+  while (m < nframes) {
+
+    size_t len = nframes - m;
+    if (len > STFT_SCRATCH_FRAMES) {
+      len = STFT_SCRATCH_FRAMES;
+    }
+
+    // The worker can't keep up - drop the rest of the period (and zero it later).
+    if (stft->gap_frames > 0 || jack_ringbuffer_write_space(stft->ring) < len * frame_bytes) {
+      stft->overruns++;
+      stft->gap_frames += nframes - m;
+      stft->frames_dropped += nframes - m;
+      return;
+    }
+
+    for (size_t c=0; c<stft->channels; c++) {
+      const float *x = &in[c][m];
+      for (size_t k=0; k<len; k++) {
+        stft->scratch[k*stft->channels + c] = x[k];
+      }
+    }
+
+    jack_ringbuffer_write(stft->ring, (const char*) stft->scratch, len * frame_bytes);
+
+    m += len;
+  }
+}
+
+/***
+ *
+ * stft_finish
+ *
+ * Tells the worker that no more data will be written. The worker
+ * processes the queued data and then exits.
+ *
+ ***/
+
+void stft_finish(jaudio_stft_t *stft)
+{
+  stft->finishing = true;
+}
+
+// True when all spectral frames have been computed.
+bool stft_done(const jaudio_stft_t *stft)
+{
+  return (stft->frames_done >= stft->num_frames);
+}
+
+size_t stft_overruns(const jaudio_stft_t *stft)
+{
+  return stft->overruns;
+}
+
+// The number of frames that were dropped (and analyzed as zeros).
+size_t stft_frames_dropped(const jaudio_stft_t *stft)
+{
+  return stft->frames_dropped;
+}
+
+void stft_destroy(jaudio_stft_t *stft)
+{
+  if (!stft) {
+    return;
+  }
+
+  if (stft->worker.joinable()) {
+    stft->finishing = true;
+    stft->worker.join();
+  }
+
+  if (stft->ring) {
+    jack_ringbuffer_free(stft->ring);
+  }
+
+  fft_destroy_plan(stft->plan);
+  free(stft->window);
+  free(stft->band_first);
+  free(stft->band_last);
+  free(stft->scratch);
+
+  delete stft;
+}
@@ -0,0 +1,384 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <atomic>
+
+#include <jack/ringbuffer.h>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Capture Stream
+ *
+ * The record counterpart of the play queue: a record client that captures until it is
+ * closed, for recordings that are too long to fit in memory. The JACK callback interleaves
+ * each period into a lock-free ring buffer which the caller drains with stream_read (to
+ * disk, typically). The callback never waits; if the caller falls so far behind that a
+ * period doesn't fit in the ring the period is dropped and counted. Frames lost in xruns
+ * are written as zeros (if they fit) so that the stream stays time-true.
+ *
+ *********************************************************************************************/
+
+struct jaudio_stream {
+  jack_client_t *client;
+  jack_port_t **ports;
+  size_t channels;
+  jack_nframes_t fs;
+
+  jack_ringbuffer_t *ring;       // Interleaved frames (JACK thread -> caller).
+
+  std::atomic<size_t> frames_captured;
+  std::atomic<size_t> frames_dropped;
+  std::atomic<size_t> frames_lost;
+
+  jaudio_xrun_log_t *xruns;
+  std::atomic<bool> running;
+};
+
+// Appends (at most) frames silent frames to the ring buffer. Returns the number appended.
+static size_t stream_write_zeros(jaudio_stream_t *s, size_t frames)
+{
+  size_t frame_bytes = s->channels * sizeof(float);
+  size_t space = jack_ringbuffer_write_space(s->ring) / frame_bytes;
+
+  if (frames > space) {
+    frames = space;
+  }
+
+  jack_ringbuffer_data_t vec[2];
+  jack_ringbuffer_get_write_vector(s->ring, vec);
+
+  size_t bytes = frames * frame_bytes;
+  size_t n0 = (bytes < vec[0].len) ? bytes : vec[0].len;
+
+  memset(vec[0].buf, 0, n0);
+  memset(vec[1].buf, 0, bytes - n0);
+
+  jack_ringbuffer_write_advance(s->ring, bytes);
+
+  return frames;
+}
+
+/***
+ *
+ * stream_process
+ *
+ * The JACK callback. Appends the period, interleaved, to the ring buffer.
+ *
+ ***/
+
+static int stream_process(jack_nframes_t nframes, void *arg)
+{
+  jaudio_stream_t *s = (jaudio_stream_t*) arg;
+
+  // The frames JACK never delivered since the previous period.
+  size_t lost_frames = xrun_log_lost_frames(s->xruns, jack_last_frame_time(s->client), nframes, false);
+
+  if (!s->running) {
+    return 0;
+  }
+
+  if (lost_frames > 0) {
+
+    xrun_log_add(s->xruns, s->frames_captured, lost_frames);
+    s->frames_lost += lost_frames;
+
+    size_t filled = stream_write_zeros(s, lost_frames);
+    s->frames_captured += filled;
+    s->frames_dropped += lost_frames - filled;
+  }
+
+  size_t frame_bytes = s->channels * sizeof(float);
+
+  if (jack_ringbuffer_write_space(s->ring) < nframes * frame_bytes) {
+    s->frames_dropped += nframes;
+    return 0;
+  }
+
+  jack_ringbuffer_data_t vec[2];
+  jack_ringbuffer_get_write_vector(s->ring, vec);
+
+  // The ring size is a power of two so a sample (but maybe not a frame) is never split
+  // between the two parts of the write vector.
+  size_t n0 = vec[0].len / sizeof(float);
+  float *dst0 = (float*) vec[0].buf;
+  float *dst1 = (float*) vec[1].buf;
+
+  for (size_t c=0; c<s->channels; c++) {
+
+    jack_default_audio_sample_t *in =
+      (jack_default_audio_sample_t *) jack_port_get_buffer(s->ports[c], nframes);
+
+    if (in == nullptr) {
+      std::cerr << "jack_port_get_buffer failed!" << std::endl;
+      return -1;
+    }
+
+    for (size_t k=0; k<nframes; k++) {
+      size_t i = k*s->channels + c;
+      if (i < n0) {
+        dst0[i] = in[k];
+      } else {
+        dst1[i - n0] = in[k];
+      }
+    }
+  }
+
+  jack_ringbuffer_write_advance(s->ring, nframes * frame_bytes);
+  s->frames_captured += nframes;
+
+  return 0;
+}
+
+// This is called whenever JACK (or a client) misses a deadline.
+static int stream_xrun(void *arg)
+{
+  jaudio_stream_t *s = (jaudio_stream_t*) arg;
+
+  xrun_log_notify(s->xruns);
+
+  return 0;
+}
+
+static void stream_jack_shutdown(void *arg)
+{
+  jaudio_stream_t *s = (jaudio_stream_t*) arg;
+
+  s->running = false; // Stop if JACK shuts down.
+
+  return;
+}
+
+/***
+ *
+ * stream_open
+ *
+ * Opens a record client with channels ports, connects port_names to them,
+ * and starts capturing into a ring buffer of ring_frames frames (0 = four
+ * seconds at the server's sample rate).
+ *
+ ***/
+
+jaudio_stream_t* stream_open(size_t channels, char **port_names, const char *client_name, size_t ring_frames)
+{
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_INIT);
+  char port_name[255];
+
+  if (channels == 0) {
+    std::cerr << "The capture stream must have at least one channel!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_stream_t *s = new jaudio_stream_t;
+
+  s->client = nullptr;
+  s->channels = channels;
+  s->fs = 0;
+  s->ring = nullptr;
+  s->frames_captured = 0;
+  s->frames_dropped = 0;
+  s->frames_lost = 0;
+  s->xruns = xrun_log_create();
+  s->running = false;
+
+  s->ports = (jack_port_t**) calloc(channels, sizeof(jack_port_t*));
+
+  if (!s->ports) {
+    std::cerr << "Capture stream memory allocation failed!" << std::endl;
+    stream_close(s);
+    return nullptr;
+  }
+
+  double t_open = profile_now();
+  jack_status_t status;
+  if ((s->client = jack_client_open(client_name, JackNullOption, &status)) == 0) {
+    print_jack_status(status);
+    std::cerr << "Failed to open JACK client: '" << client_name << "'!" << std::endl;
+    stream_close(s);
+    return nullptr;
+  }
+
+  profile_add(JAUDIO_PHASE_OPEN, t_open);
+
+  s->fs = jack_get_sample_rate(s->client);
+
+  if (ring_frames == 0) {
+    ring_frames = 4 * (size_t) s->fs;
+  }
+
+  // At least two of the largest periods (the period size may change while capturing).
+  size_t buffer_frames = jaudio_max_period_frames(s->client);
+  if (ring_frames < 2 * buffer_frames) {
+    ring_frames = 2 * buffer_frames;
+  }
+
+  // One spare frame since a ring buffer holds one byte less than its size.
+  s->ring = jack_ringbuffer_create((ring_frames + 1) * channels * sizeof(float));
+
+  if (!s->ring) {
+    std::cerr << "Capture stream memory allocation failed!" << std::endl;
+    stream_close(s);
+    return nullptr;
+  }
+
+  // Keep the ring buffer in RAM since it is used from the JACK thread.
+  jack_ringbuffer_mlock(s->ring);
+
+  jack_set_process_callback(s->client, stream_process, s);
+  jack_set_xrun_callback(s->client, stream_xrun, s);
+  jack_on_shutdown(s->client, stream_jack_shutdown, s);
+
+  double t_register = profile_now();
+  for (size_t n=0; n<channels; n++) {
+    sprintf(port_name,"input_%d", (int) n+1); // Port numbers start at 1.
+    s->ports[n] = jack_port_register(s->client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  }
+  profile_add(JAUDIO_PHASE_REGISTER, t_register);
+
+  double t_activate = profile_now();
+  if (jack_activate(s->client)) {
+    std::cerr << "Cannot activate jack client!" << std::endl;
+    stream_close(s);
+    return nullptr;
+  }
+
+  profile_add(JAUDIO_PHASE_ACTIVATE, t_activate);
+
+  if (ports_connect(s->client, s->ports, port_names, channels, true) < 0) {
+    stream_close(s);
+    return nullptr;
+  }
+
+  // Start capturing when all ports are connected.
+  s->running = true;
+
+  return s;
+}
+
+/***
+ *
+ * stream_read
+ *
+ * Moves up to max_frames captured frames (interleaved) to buffer and
+ * returns the number of frames read. Does not wait for data.
+ *
+ ***/
+
+size_t stream_read(jaudio_stream_t *s, float *buffer, size_t max_frames)
+{
+  size_t frame_bytes = s->channels * sizeof(float);
+  size_t frames = jack_ringbuffer_read_space(s->ring) / frame_bytes;
+
+  if (frames > max_frames) {
+    frames = max_frames;
+  }
+
+  if (frames > 0) {
+    jack_ringbuffer_read(s->ring, (char*) buffer, frames * frame_bytes);
+  }
+
+  return frames;
+}
+
+size_t stream_channels(const jaudio_stream_t *s)
+{
+  return s->channels;
+}
+
+jack_nframes_t stream_sample_rate(const jaudio_stream_t *s)
+{
+  return s->fs;
+}
+
+size_t stream_frames_captured(const jaudio_stream_t *s)
+{
+  return s->frames_captured;
+}
+
+// The number of frames dropped since the ring buffer was full.
+size_t stream_frames_dropped(const jaudio_stream_t *s)
+{
+  return s->frames_dropped;
+}
+
+// The number of frames lost in xruns (written as zeros unless the ring buffer was full).
+size_t stream_frames_lost(const jaudio_stream_t *s)
+{
+  return s->frames_lost;
+}
+
+bool stream_is_running(const jaudio_stream_t *s)
+{
+  return s->running;
+}
+
+/***
+ *
+ * stream_close
+ *
+ * Stops the capture, closes the client, and frees the stream. Frames
+ * that have not been read are discarded.
+ *
+ ***/
+
+void stream_close(jaudio_stream_t *s)
+{
+  jaudio_profile_scope_t profile_scope(JAUDIO_PHASE_CLOSE);
+
+  if (!s) {
+    return;
+  }
+
+  s->running = false;
+
+  if (s->client) {
+
+    jack_deactivate(s->client);
+
+    for (size_t n=0; n<s->channels; n++) {
+      if (s->ports[n] && jack_port_unregister(s->client, s->ports[n])) {
+        std::cerr << "Failed to unregister an input port!" << std::endl;
+      }
+    }
+
+    if (jack_client_close(s->client)) {
+      std::cerr << "jack_client_close failed!" << std::endl;
+    }
+  }
+
+  if (s->ring) {
+    jack_ringbuffer_free(s->ring);
+  }
+
+  xrun_log_destroy(s->xruns);
+
+  free(s->ports);
+
+  delete s;
+
+  return;
+}
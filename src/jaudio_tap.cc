@@ -0,0 +1,216 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <iostream>
+#include <atomic>
+#include <string>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Shared-memory Live Tap
+ *
+ * The recorded periods are published in a named POSIX shared-memory object so that other
+ * processes on the host can follow the capture without opening JACK clients of their own.
+ * The object starts with a jaudio_tap_header_t followed by the channel names and a planar
+ * ring of ring_frames frames per channel. The writer copies a period into the ring and then
+ * advances write_count (release ordered), so up to max_period frames past write_count, i.e.,
+ * the oldest max_period frames of the ring, may be in the middle of being overwritten. A
+ * reader loads write_count, copies the frames it wants, and loads write_count again; the
+ * copied frames are valid if none of them is older than the second write_count minus
+ * ring_frames plus max_period (otherwise the writer has lapped it, or is about to).
+ *
+ *********************************************************************************************/
+
+struct jaudio_tap {
+  std::string name;
+  size_t bytes;
+  jaudio_tap_header_t *header;
+  float *data;
+};
+
+/***
+ *
+ * tap_create
+ *
+ * Creates (or replaces) the shared-memory object name, e.g., "/jrecord",
+ * with a ring of ring_frames frames for each of the channels. The
+ * writer writes at most max_period_frames frames per tap_write.
+ *
+ ***/
+
+jaudio_tap_t* tap_create(const char *name, size_t channels, size_t ring_frames, size_t max_period_frames,
+                         double fs, const char * const *channel_names)
+{
+  if (channels == 0 || ring_frames == 0) {
+    std::cerr << "The live tap must have at least one channel and one frame!" << std::endl;
+    return nullptr;
+  }
+
+  if (ring_frames <= max_period_frames) {
+    std::cerr << "The live tap ring must be longer than the JACK period!" << std::endl;
+    return nullptr;
+  }
+
+  // The data starts on a cache line after the header and the channel names.
+  size_t data_offset = sizeof(jaudio_tap_header_t) + channels * JAUDIO_TAP_NAME_SIZE;
+  data_offset = (data_offset + 63) & ~((size_t) 63);
+
+  size_t bytes = data_offset + channels * ring_frames * sizeof(float);
+
+  // Replace an old object with a new one rather than truncating it, since
+  // readers may still have the old one mapped.
+  shm_unlink(name);
+
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    perror("shm_open");
+    std::cerr << "Failed to create the shared-memory object '" << name << "'!" << std::endl;
+    return nullptr;
+  }
+
+  if (ftruncate(fd, (off_t) bytes) < 0) {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return nullptr;
+  }
+
+  void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    shm_unlink(name);
+    return nullptr;
+  }
+
+  // Keep the ring in RAM since it is written from the JACK thread.
+  mlock(mem, bytes);
+
+  jaudio_tap_t *tap = new jaudio_tap_t;
+
+  tap->name = name;
+  tap->bytes = bytes;
+  tap->header = (jaudio_tap_header_t*) mem;
+  tap->data = (float*) ((char*) mem + data_offset);
+
+  memset(mem, 0x0, bytes);
+
+  jaudio_tap_header_t *h = tap->header;
+  h->version = JAUDIO_TAP_VERSION;
+  h->channels = (uint32_t) channels;
+  h->sample_rate = (uint32_t) fs;
+  h->ring_frames = (uint64_t) ring_frames;
+  h->data_offset = (uint64_t) data_offset;
+  h->write_count = 0;
+  h->frame_time = 0;
+  h->active = 1;
+  h->max_period = (uint32_t) max_period_frames;
+
+  char *names = (char*) mem + sizeof(jaudio_tap_header_t);
+  for (size_t c=0; c<channels && channel_names; c++) {
+    strncpy(&names[c * JAUDIO_TAP_NAME_SIZE], channel_names[c], JAUDIO_TAP_NAME_SIZE - 1);
+  }
+
+  // Readers check the magic number last.
+  std::atomic_thread_fence(std::memory_order_release);
+  h->magic = JAUDIO_TAP_MAGIC;
+
+  return tap;
+}
+
+/***
+ *
+ * tap_write
+ *
+ * Appends nframes frames of the per-channel buffers in to the ring.
+ * frame_time is the JACK frame time of the first frame. Called from
+ * the JACK callback.
+ *
+ ***/
+
+void tap_write(jaudio_tap_t *tap, jack_default_audio_sample_t **in, size_t nframes, jack_nframes_t frame_time)
+{
+  jaudio_tap_header_t *h = tap->header;
+  size_t ring_frames = (size_t) h->ring_frames;
+  size_t pos = (size_t) (h->write_count % ring_frames);
+
+  // Only the last ring_frames frames can be kept.
+  size_t skip = (nframes > ring_frames) ? nframes - ring_frames : 0;
+  pos = (pos + skip) % ring_frames;
+
+  size_t m = skip;
+  while (m < nframes) {
+
+    size_t len = ring_frames - pos;
+    if (len > nframes - m) {
+      len = nframes - m;
+    }
+
+    for (size_t c=0; c<h->channels; c++) {
+      memcpy(&tap->data[c*ring_frames + pos], &in[c][m], len * sizeof(float));
+    }
+
+    m += len;
+    pos = (pos + len) % ring_frames;
+  }
+
+  // Publish the frames after they are written.
+  std::atomic_thread_fence(std::memory_order_release);
+  h->frame_time = (uint64_t) frame_time;
+  h->write_count = h->write_count + nframes;
+
+  return;
+}
+
+/***
+ *
+ * tap_destroy
+ *
+ * Marks the stream as ended and removes the shared-memory object
+ * (readers that have it mapped can still read the last frames).
+ *
+ ***/
+
+void tap_destroy(jaudio_tap_t *tap)
+{
+  if (!tap) {
+    return;
+  }
+
+  tap->header->active = 0;
+
+  munmap((void*) tap->header, tap->bytes);
+  shm_unlink(tap->name.c_str());
+
+  delete tap;
+
+  return;
+}
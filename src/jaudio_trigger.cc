@@ -0,0 +1,297 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <iostream>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Multi-channel Trigger Detection
+ *
+ * The envelope of a trigger channel is the mean |x| over a sliding window of the last
+ * window frames (the jtrecord criterion). Each channel keeps the |x| values of its window
+ * in a history ring, so a period only has to swap the new values in for the oldest ones
+ * and add the difference to the window sum: one pass over the period, while it is still
+ * in the cache after the copy. The rings share one write position. At the end of each
+ * period the channels whose envelopes exceed their own levels vote, and the trigger fires
+ * when at least votes channels agree (1 = any channel, channels = all of them).
+ *
+ *********************************************************************************************/
+
+#define TRIGGER_LANES 8 // The number of partial window sums in trigger_slide.
+
+struct jaudio_trigger {
+  size_t ports;          // The number of ports (update is called for each of them).
+  size_t channels;       // The number of trigger channels.
+  size_t votes;          // The number of channels that must be above their levels.
+  size_t window;         // The envelope window length [frames].
+  size_t pos;            // The (shared) write position in the history rings.
+  size_t *index;         // The trigger channel of each port (channels = not a trigger port).
+  float *history;        // channels x window |x| values.
+  double *sum;           // The sum of each history ring.
+  double *threshold;     // The level times window of each channel.
+};
+
+/***
+ *
+ * trigger_create
+ *
+ * Creates a trigger for num_channels of the ports (0-based port indices)
+ * with one mean |x| level per channel. The trigger fires when votes of
+ * the channels are above their levels.
+ *
+ ***/
+
+jaudio_trigger_t* trigger_create(size_t ports, const size_t *channels, const double *levels,
+                                 size_t num_channels, size_t window_frames, size_t votes)
+{
+  if (num_channels == 0 || window_frames == 0) {
+    std::cerr << "The trigger must have at least one channel and a window of at least one frame!" << std::endl;
+    return nullptr;
+  }
+
+  if (votes < 1 || votes > num_channels) {
+    std::cerr << "The number of trigger votes must be >= 1 and <= the number of trigger channels!" << std::endl;
+    return nullptr;
+  }
+
+  jaudio_trigger_t *trig = new jaudio_trigger_t;
+
+  trig->ports = ports;
+  trig->channels = num_channels;
+  trig->votes = votes;
+  trig->window = window_frames;
+  trig->pos = 0;
+  trig->index = (size_t*) malloc(ports * sizeof(size_t));
+  trig->history = (float*) calloc(num_channels * window_frames, sizeof(float));
+  trig->sum = (double*) calloc(num_channels, sizeof(double));
+  trig->threshold = (double*) calloc(num_channels, sizeof(double));
+
+  if (!trig->index || !trig->history || !trig->sum || !trig->threshold) {
+    std::cerr << "Trigger memory allocation failed!" << std::endl;
+    trigger_destroy(trig);
+    return nullptr;
+  }
+
+  for (size_t n=0; n<ports; n++) {
+    trig->index[n] = num_channels;
+  }
+
+  for (size_t k=0; k<num_channels; k++) {
+
+    if (channels[k] >= ports || trig->index[channels[k]] != num_channels) {
+      std::cerr << "Trigger channel out-of-bounds (or given twice)!" << std::endl;
+      trigger_destroy(trig);
+      return nullptr;
+    }
+
+    if (levels[k] < 0.0) {
+      std::cerr << "The trigger levels must be >= 0!" << std::endl;
+      trigger_destroy(trig);
+      return nullptr;
+    }
+
+    trig->index[channels[k]] = k;
+    trig->threshold[k] = levels[k] * (double) window_frames;
+  }
+
+  return trig;
+}
+
+void trigger_destroy(jaudio_trigger_t *trig)
+{
+  if (trig) {
+    free(trig->index);
+    free(trig->history);
+    free(trig->sum);
+    free(trig->threshold);
+    delete trig;
+  }
+}
+
+// Replaces the n oldest history values h with |x| and returns the change of the window sum.
+static float trigger_slide(float *h, const float *x, size_t n)
+{
+  float acc[TRIGGER_LANES] = {0.0f};
+  size_t m = 0;
+
+  // Blocks of TRIGGER_LANES frames with one partial sum per lane (the block of x
+  // is read before h is written since the two could overlap as far as we know).
+  for (; m + TRIGGER_LANES <= n; m += TRIGGER_LANES) {
+
+    float a[TRIGGER_LANES];
+
+    for (size_t j=0; j<TRIGGER_LANES; j++) {
+      a[j] = fabsf(x[m+j]);
+    }
+
+    for (size_t j=0; j<TRIGGER_LANES; j++) {
+      acc[j] += a[j] - h[m+j];
+      h[m+j] = a[j];
+    }
+  }
+
+  float delta = 0.0f;
+  for (; m<n; m++) {
+    float a = fabsf(x[m]);
+    delta += a - h[m];
+    h[m] = a;
+  }
+
+  for (size_t j=0; j<TRIGGER_LANES; j++) {
+    delta += acc[j];
+  }
+
+  return delta;
+}
+
+/***
+ *
+ * trigger_update
+ *
+ * Slides the envelope window of port over the nframes new samples x
+ * (ports that aren't trigger channels are ignored). Called from the JACK
+ * callback for each port, and followed by trigger_check once per period.
+ *
+ ***/
+
+void trigger_update(jaudio_trigger_t *trig, size_t port, const float *x, size_t nframes)
+{
+  size_t k = trig->index[port];
+
+  if (k == trig->channels) {
+    return;
+  }
+
+  // Only the last window frames of a long period are in the window at its end.
+  size_t n = (nframes < trig->window) ? nframes : trig->window;
+  x += nframes - n;
+
+  float *h = trig->history + k * trig->window;
+  size_t n0 = trig->window - trig->pos;
+
+  if (n0 > n) {
+    n0 = n;
+  }
+
+  double delta = (double) trigger_slide(h + trig->pos, x, n0);
+  delta += (double) trigger_slide(h, x + n0, n - n0);
+
+  trig->sum[k] += delta;
+
+  // The window sum is never negative (but rounding could make it slightly so).
+  if (trig->sum[k] < 0.0) {
+    trig->sum[k] = 0.0;
+  }
+}
+
+// Zeros the n history values h and returns their sum.
+static double trigger_clear(float *h, size_t n)
+{
+  double removed = 0.0;
+
+  for (size_t m=0; m<n; m++) {
+    removed += (double) h[m];
+    h[m] = 0.0f;
+  }
+
+  return removed;
+}
+
+/***
+ *
+ * trigger_skip
+ *
+ * Slides the envelope windows of all trigger channels over nframes frames
+ * of silence (the frames lost in an xrun), so that the windows stay aligned
+ * with the zero-filled ring buffer. Zeros can't raise an envelope so no
+ * trigger_check is needed. Called from the JACK callback.
+ *
+ ***/
+
+void trigger_skip(jaudio_trigger_t *trig, size_t nframes)
+{
+  size_t n = (nframes < trig->window) ? nframes : trig->window;
+  size_t n0 = trig->window - trig->pos;
+
+  if (n0 > n) {
+    n0 = n;
+  }
+
+  for (size_t k=0; k<trig->channels; k++) {
+
+    float *h = trig->history + k * trig->window;
+
+    trig->sum[k] -= trigger_clear(h + trig->pos, n0) + trigger_clear(h, n - n0);
+
+    if (trig->sum[k] < 0.0) {
+      trig->sum[k] = 0.0;
+    }
+  }
+
+  trig->pos = (trig->pos + n) % trig->window;
+}
+
+/***
+ *
+ * trigger_check
+ *
+ * Ends a period of nframes frames (all trigger channels must have been
+ * updated) and returns true if at least votes channels are above their
+ * levels. Called from the JACK callback.
+ *
+ ***/
+
+bool trigger_check(jaudio_trigger_t *trig, size_t nframes)
+{
+  size_t n = (nframes < trig->window) ? nframes : trig->window;
+  trig->pos = (trig->pos + n) % trig->window;
+
+  size_t above = 0;
+  for (size_t k=0; k<trig->channels; k++) {
+    above += (trig->sum[k] > trig->threshold[k]);
+  }
+
+  return above >= trig->votes;
+}
+
+/***
+ *
+ * trigger_get_envelopes
+ *
+ * Copies the current envelope (mean |x| over the window) of each trigger
+ * channel to envelopes and returns the number of trigger channels.
+ *
+ ***/
+
+size_t trigger_get_envelopes(const jaudio_trigger_t *trig, float *envelopes)
+{
+  for (size_t k=0; k<trig->channels; k++) {
+    envelopes[k] = (float) (trig->sum[k] / (double) trig->window);
+  }
+
+  return trig->channels;
+}
@@ -0,0 +1,180 @@
+/***
+ *
+ * Copyright (C) 2023 Fredrik Lingvall
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with the program; see the file COPYING.  If not, write to the
+ *   Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301, USA.
+ *
+ ***/
+
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <atomic>
+
+#include "jaudio.h"
+
+/********************************************************************************************
+ *
+ * Xrun Detection
+ *
+ * JACK skips process cycles when a client (or the server) can't keep up. The xrun callback
+ * tells that it happened but not how much was lost, so the process callback also compares
+ * each period's frame time with where the previous period ended: the difference is the
+ * number of frames that were never delivered. The engines fill (or skip and mark) that span
+ * so that sample indices stay time-true, and log (frame, lost frames) pairs in a fixed,
+ * preallocated log that is read after the run.
+ *
+ *********************************************************************************************/
+
+struct jaudio_xrun_log {
+  bool started;                         // False until the first period has been seen.
+  jack_nframes_t next_frame_time;       // The frame time the next period should start at.
+
+  jaudio_xrun_t xruns[JAUDIO_MAX_XRUNS];
+  std::atomic<size_t> num_xruns;
+  size_t dropped;
+  std::atomic<size_t> total_lost;       // All lost frames (also of the xruns that were not logged).
+
+  std::atomic<size_t> num_reported;     // Xruns reported by the JACK xrun callback.
+};
+
+jaudio_xrun_log_t* xrun_log_create(void)
+{
+  jaudio_xrun_log_t *log = new jaudio_xrun_log_t;
+
+  log->started = false;
+  log->next_frame_time = 0;
+  log->num_xruns.store(0);
+  log->dropped = 0;
+  log->total_lost.store(0);
+  log->num_reported.store(0);
+
+  return log;
+}
+
+void xrun_log_destroy(jaudio_xrun_log_t *log)
+{
+  delete log;
+}
+
+// Called from the JACK xrun callback.
+void xrun_log_notify(jaudio_xrun_log_t *log)
+{
+  log->num_reported++;
+}
+
+/***
+ *
+ * xrun_log_lost_frames
+ *
+ * Called by the process callback at the start of every period with
+ * the period's frame time (jack_last_frame_time). Returns the number of
+ * frames lost since the previous period. Pass freewheeling = true while
+ * the server is freewheeling (there is no real time to lose then).
+ *
+ ***/
+
+size_t xrun_log_lost_frames(jaudio_xrun_log_t *log, jack_nframes_t frame_time, jack_nframes_t nframes,
+                            bool freewheeling)
+{
+  // The frame time wraps around so compare the (signed) difference.
+  int32_t lost = (int32_t) (frame_time - log->next_frame_time);
+
+  bool check = log->started && !freewheeling;
+
+  log->started = true;
+  log->next_frame_time = frame_time + nframes;
+
+  return (check && lost > 0) ? (size_t) lost : 0;
+}
+
+/***
+ *
+ * xrun_log_add
+ *
+ * Logs lost_frames frames lost at frame (of the recording). Never
+ * allocates; xruns beyond JAUDIO_MAX_XRUNS are only counted.
+ *
+ ***/
+
+void xrun_log_add(jaudio_xrun_log_t *log, size_t frame, size_t lost_frames)
+{
+  size_t n = log->num_xruns.load(std::memory_order_relaxed);
+
+  log->total_lost += lost_frames;
+
+  if (n == JAUDIO_MAX_XRUNS) {
+    log->dropped++;
+    return;
+  }
+
+  log->xruns[n].frame = frame;
+  log->xruns[n].lost_frames = lost_frames;
+
+  log->num_xruns.store(n + 1, std::memory_order_release);
+}
+
+/***
+ *
+ * xrun_log_get
+ *
+ * Copies the logged gaps to xruns (which must have room for
+ * JAUDIO_MAX_XRUNS entries) and returns their number.
+ *
+ ***/
+
+size_t xrun_log_get(const jaudio_xrun_log_t *log, jaudio_xrun_t *xruns)
+{
+  size_t n = log->num_xruns.load(std::memory_order_acquire);
+
+  memcpy(xruns, log->xruns, n * sizeof(jaudio_xrun_t));
+
+  if (log->dropped > 0) {
+    std::cerr << "Warning: " << log->dropped << " xruns were not logged!" << std::endl;
+  }
+
+  return n;
+}
+
+// The number of xruns reported by JACK.
+size_t xrun_log_reported(const jaudio_xrun_log_t *log)
+{
+  return log->num_reported;
+}
+
+/***
+ *
+ * xrun_log_report
+ *
+ * Prints a warning if there were xruns. For the engines that don't
+ * return the gaps with the data.
+ *
+ ***/
+
+void xrun_log_report(const jaudio_xrun_log_t *log)
+{
+  size_t num_xruns = log->num_xruns.load() + log->dropped;
+  size_t num_reported = log->num_reported.load();
+
+  if (num_xruns == 0 && num_reported == 0) {
+    return;
+  }
+
+  std::cerr << "Warning: JACK reported " << num_reported << " xruns and "
+            << log->total_lost.load() << " frames were lost in " << num_xruns << " gaps!" << std::endl;
+}